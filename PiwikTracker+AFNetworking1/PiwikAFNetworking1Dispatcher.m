@@ -7,6 +7,7 @@
 //
 
 #import "PiwikAFNetworking1Dispatcher.h"
+#import "PiwikLogging.h"
 
 
 static NSUInteger const PiwikHTTPRequestTimeout = 5;
@@ -64,16 +65,23 @@ static NSUInteger const PiwikHTTPRequestTimeout = 5;
   //NSLog(@"Request headers %@", [request allHTTPHeaderFields]);
   //NSLog(@"Request body %@", [[NSString alloc] initWithData:request.HTTPBody encoding:NSUTF8StringEncoding]);
   
+  PiwikSignpostDeclareID(signpostID)
+  PiwikSignpostBegin(signpostID, "Request", "%{public}@", request.HTTPMethod)
+  
   AFHTTPRequestOperation *operation = [self HTTPRequestOperationWithRequest:request
     success:^(AFHTTPRequestOperation *operation, id responseObject) {
                                                                                  
       //NSLog(@"Successfully sent stats to Piwik server");
+      PiwikSignpostEnd(signpostID, "Request", "success")
       successBlock();
       
     } failure:^(AFHTTPRequestOperation *operation, NSError *error) {
       
       //NSLog(@"Failed to send stats to Piwik server with reason : %@", error);
-      failureBlock([self shouldAbortdispatchForNetworkError:error]);
+      // Only a client error is a rejected request, other requests may still be accepted
+      PiwikSignpostEnd(signpostID, "Request", "failure")
+      NSInteger statusCode = operation.response.statusCode;
+      failureBlock(statusCode >= 400 && statusCode < 500 && ![self shouldAbortdispatchForNetworkError:error]);
       
     }];
   
@@ -14,6 +14,21 @@
 
 @property (nonatomic, strong) NSString *userAgent;
 
+/**
+ The timeout in seconds used for requests. Default 5 seconds.
+ */
+@property (nonatomic) NSTimeInterval requestTimeout;
+
+/**
+ Compress bulk request bodies with gzip. Default NO.
+ */
+@property (nonatomic) BOOL compressBulkRequests;
+
+/**
+ Bulk request bodies smaller than the threshold in bytes are not compressed. Default 1024 bytes.
+ */
+@property (nonatomic) NSUInteger compressionThreshold;
+
 - (instancetype)initWithPiwikURL:(NSURL*)piwikURL;
 
 @end
@@ -8,14 +8,27 @@
 
 #import "PiwikAFNetworking2Dispatcher.h"
 #import "AFNetworking.h"
+#import "PiwikGzip.h"
+#import "PiwikBulkRequestResult.h"
+#import "PiwikLogging.h"
 
 @interface PiwikAFNetworking2Dispatcher ()
 
 @property (nonatomic, readonly) NSString *piwikPath;
 
+// One serializer per request type, created once and never changed, requests in flight may still use them
+@property (nonatomic, readonly) AFHTTPRequestSerializer *singleEventRequestSerializer;
+@property (nonatomic, readonly) AFJSONRequestSerializer *bulkEventRequestSerializer;
+@property (nonatomic, readonly) AFHTTPRequestSerializer *bulkRequestBodySerializer;
+@property (nonatomic, readonly) AFImageResponseSerializer *singleEventResponseSerializer;
+@property (nonatomic, readonly) AFJSONResponseSerializer *bulkEventResponseSerializer;
+
 @end
 
 
+static NSTimeInterval const PiwikHTTPRequestTimeout = 5;
+
+
 @implementation PiwikAFNetworking2Dispatcher
 
 - (instancetype)initWithPiwikURL:(NSURL*)piwikURL {
@@ -25,6 +38,18 @@
   if (self) {
     // Since the path below starts with a / the base URL will be truncated
     _piwikPath = piwikURL.path;
+    _requestTimeout = PiwikHTTPRequestTimeout;
+    _compressBulkRequests = NO;
+    _compressionThreshold = PiwikDefaultCompressionThreshold;
+    
+    _singleEventRequestSerializer = [AFHTTPRequestSerializer serializer];
+    _bulkEventRequestSerializer = [AFJSONRequestSerializer serializerWithWritingOptions:kNilOptions];
+    _bulkRequestBodySerializer = [AFHTTPRequestSerializer serializer];
+    _singleEventResponseSerializer = [AFImageResponseSerializer serializer];
+    _bulkEventResponseSerializer = [AFJSONResponseSerializer serializer];
+    
+    // The shared manager only hands over the raw response, it is validated by the serializer of the request type
+    self.responseSerializer = [AFHTTPResponseSerializer serializer];
   }
   return self;
 }
@@ -33,19 +58,23 @@
                               success:(void (^)())successBlock
                               failure:(void (^)(BOOL shouldContinue))failureBlock {
   
-  self.requestSerializer = [AFHTTPRequestSerializer serializer];
-  self.responseSerializer = [AFImageResponseSerializer serializer];
-  
-  if (self.userAgent) {
-    [self.requestSerializer setValue:self.userAgent forHTTPHeaderField:@"User-Agent"];
+  NSMutableURLRequest *request = [self requestWithSerializer:self.singleEventRequestSerializer method:@"GET" parameters:parameters];
+  if (!request) {
+    failureBlock(YES);
+    return;
   }
   
-  [self GET:self.piwikPath parameters:parameters success:^(NSURLSessionDataTask *task, id responseObject) {
+  PiwikSignpostDeclareID(signpostID)
+  PiwikSignpostBegin(signpostID, "Request", "GET")
+  
+  [self sendRequest:request responseSerializer:self.singleEventResponseSerializer success:^(id responseObject) {
     //NSLog(@"Successfully sent stats to Piwik server");
+    PiwikSignpostEnd(signpostID, "Request", "success")
     successBlock();
-  } failure:^(NSURLSessionDataTask *task, NSError *error) {
+  } failure:^(BOOL shouldContinue) {
     //NSLog(@"Failed to send stats to Piwik server with reason : %@", error);
-    failureBlock([self shouldAbortdispatchForNetworkError:error]);
+    PiwikSignpostEnd(signpostID, "Request", "failure")
+    failureBlock(shouldContinue);
   }];
   
 }
@@ -54,38 +83,126 @@
                       success:(void (^)())successBlock
                       failure:(void (^)(BOOL shouldContinue))failureBlock {
   
-  self.requestSerializer = [AFJSONRequestSerializer serializerWithWritingOptions:kNilOptions];
-  self.responseSerializer = [AFJSONResponseSerializer serializer];
-
-  if (self.userAgent) {
-    [self.requestSerializer setValue:self.userAgent forHTTPHeaderField:@"User-Agent"];
+  NSMutableURLRequest *request = [self requestWithSerializer:self.bulkEventRequestSerializer method:@"POST" parameters:parameters];
+  if (!request) {
+    failureBlock(YES);
+    return;
   }
   
-  [self POST:self.piwikPath parameters:parameters success:^(NSURLSessionDataTask *task, id responseObject) {
+  [self sendBulkRequest:request compress:self.compressBulkRequests responseSerializer:self.bulkEventResponseSerializer success:^(id responseObject) {
     //NSLog(@"Successfully sent stats to Piwik server");
     successBlock();
-  } failure:^(NSURLSessionDataTask *task, NSError *error) {
-    //NSLog(@"Failed to send stats to Piwik server with reason : %@", error);
-    failureBlock([self shouldAbortdispatchForNetworkError:error]);    
+  } failure:failureBlock];
+  
+}
+
+// The body is written by the tracker, only the headers are set by the request serializer
+// The raw response is parsed into a bulk request result, the HTTP response serializer still fails on error status codes
+- (void)sendBulkEventWithRequestBody:(NSData*)requestBody
+                             success:(void (^)(PiwikBulkRequestResult *result))successBlock
+                             failure:(void (^)(BOOL shouldContinue))failureBlock {
+  
+  NSMutableURLRequest *request = [self requestWithSerializer:self.bulkRequestBodySerializer method:@"POST" parameters:nil];
+  if (!request) {
+    failureBlock(YES);
+    return;
+  }
+  
+  [request setValue:@"application/json" forHTTPHeaderField:@"Content-Type"];
+  request.HTTPBody = requestBody;
+  
+  [self sendBulkRequest:request compress:self.compressBulkRequests responseSerializer:self.responseSerializer success:^(id responseObject) {
+    successBlock([responseObject isKindOfClass:[NSData class]] ? [PiwikBulkRequestResult resultWithResponseData:responseObject] : nil);
+  } failure:failureBlock];
+  
+}
+
+
+// The timeout and the user agent may change between requests, they are set on the request instead of the shared serializer
+- (NSMutableURLRequest*)requestWithSerializer:(AFHTTPRequestSerializer*)requestSerializer method:(NSString*)method parameters:(NSDictionary*)parameters {
+  
+  NSError *error;
+  NSMutableURLRequest *request = [requestSerializer requestWithMethod:method URLString:[self piwikURLString] parameters:parameters error:&error];
+  
+  request.timeoutInterval = self.requestTimeout;
+  if (self.userAgent) {
+    [request setValue:self.userAgent forHTTPHeaderField:@"User-Agent"];
+  }
+  
+  return request;
+}
+
+
+// Build the request manually, AFNetworking will not compress the body
+- (void)sendBulkRequest:(NSMutableURLRequest*)request
+               compress:(BOOL)compress
+     responseSerializer:(AFHTTPResponseSerializer*)responseSerializer
+                success:(void (^)(id responseObject))successBlock
+                failure:(void (^)(BOOL shouldContinue))failureBlock {
+  
+  if (compress && request.HTTPBody.length >= self.compressionThreshold) {
+    NSData *compressedBody = [PiwikGzip gzipData:request.HTTPBody];
+    if (compressedBody) {
+      request.HTTPBody = compressedBody;
+      [request setValue:@"gzip" forHTTPHeaderField:@"Content-Encoding"];
+    }
+  }
+  
+  PiwikSignpostDeclareID(signpostID)
+  PiwikSignpostBegin(signpostID, "Request", "POST %lu bytes", (unsigned long)request.HTTPBody.length)
+  
+  [self sendRequest:request responseSerializer:responseSerializer success:^(id responseObject) {
+    PiwikSignpostEnd(signpostID, "Request", "success")
+    successBlock(responseObject);
+  } failure:^(BOOL shouldContinue) {
+    PiwikSignpostEnd(signpostID, "Request", "failure")
+    failureBlock(shouldContinue);
+  }];
+  
+}
+
+
+- (void)sendRequest:(NSURLRequest*)request
+ responseSerializer:(AFHTTPResponseSerializer*)responseSerializer
+            success:(void (^)(id responseObject))successBlock
+            failure:(void (^)(BOOL shouldContinue))failureBlock {
+  
+  NSURLSessionDataTask *task = [self dataTaskWithRequest:request completionHandler:^(NSURLResponse *response, id responseObject, NSError *error) {
+    
+    // Check the content type expected for the request type, the status code is already checked by the shared serializer
+    if (!error && responseSerializer != self.responseSerializer) {
+      [responseSerializer validateResponse:(NSHTTPURLResponse*)response data:responseObject error:&error];
+    }
+    
+    if (!error) {
+      successBlock(responseObject);
+    } else {
+      failureBlock([self shouldContinueDispatchAfterResponse:response]);
+    }
+    
   }];
   
+  [task resume];
+  
 }
 
-// Should the dispatch be aborted and pending events rescheduled
-- (BOOL)shouldAbortdispatchForNetworkError:(NSError*)error {
+
+- (NSString*)piwikURLString {
+  return [[NSURL URLWithString:self.piwikPath relativeToURL:self.baseURL] absoluteString];
+}
+
+
+// A client error is a rejected request and other requests may be accepted
+// Abort on server errors and when the request never reached the server, e.g. no connection or an unknown host
+- (BOOL)shouldContinueDispatchAfterResponse:(NSURLResponse*)response {
   
-  if (error.code == NSURLErrorBadURL ||
-      error.code == NSURLErrorUnsupportedURL ||
-      error.code == NSURLErrorCannotFindHost ||
-      error.code == NSURLErrorCannotConnectToHost ||
-      error.code == NSURLErrorDNSLookupFailed) {
-    return YES;
-  } else {
+  if (![response isKindOfClass:[NSHTTPURLResponse class]]) {
     return NO;
   }
   
+  NSInteger statusCode = [(NSHTTPURLResponse*)response statusCode];
+  return statusCode >= 400 && statusCode < 500;
 }
 
 
-
 @end
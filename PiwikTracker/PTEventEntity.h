@@ -14,5 +14,7 @@
 
 @property (nonatomic, retain) NSDate * date;
 @property (nonatomic, retain) NSData * piwikRequestParameters;
+@property (nonatomic, retain) NSNumber * encoding;
+@property (nonatomic, retain) NSNumber * priority;
 
 @end
@@ -13,6 +13,8 @@
 
 @dynamic date;
 @dynamic piwikRequestParameters;
+@dynamic encoding;
+@dynamic priority;
 
 
 - (void)awakeFromInsert {
@@ -0,0 +1,18 @@
+//
+//  PTParameterSetEntity.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import <CoreData/CoreData.h>
+
+
+@interface PTParameterSetEntity : NSManagedObject
+
+@property (nonatomic, retain) NSNumber * identifier;
+@property (nonatomic, retain) NSData * parameters;
+
+@end
@@ -0,0 +1,17 @@
+//
+//  PTParameterSetEntity.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PTParameterSetEntity.h"
+
+
+@implementation PTParameterSetEntity
+
+@dynamic identifier;
+@dynamic parameters;
+
+@end
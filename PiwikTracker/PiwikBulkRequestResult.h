@@ -0,0 +1,51 @@
+//
+//  PiwikBulkRequestResult.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ The result of a bulk request, parsed from the Piwik server response, e.g. {"status":"success","tracked":19,"invalid":1}.
+
+ Newer servers also include "invalid_indices", the positions of the invalid requests in the request body.
+ */
+@interface PiwikBulkRequestResult : NSObject
+
+/**
+ Parse a bulk request response.
+
+ @param data The response body.
+ @return The result, or nil if the body is not a bulk request response, e.g. from an older server or a proxy.
+ */
++ (instancetype)resultWithResponseData:(NSData*)data;
+
+- (instancetype)initWithNumberOfTrackedEvents:(NSUInteger)numberOfTrackedEvents numberOfInvalidEvents:(NSUInteger)numberOfInvalidEvents invalidIndexes:(NSIndexSet*)invalidIndexes;
+
+/**
+ The number of requests tracked by the server.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfTrackedEvents;
+
+/**
+ The number of requests the server rejected as invalid, they will never be tracked.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfInvalidEvents;
+
+/**
+ The positions of the invalid requests in the request body, nil if not reported by the server.
+ */
+@property (nonatomic, readonly, strong) NSIndexSet *invalidIndexes;
+
+/**
+ YES if the server processed every request in the body, tracked or invalid.
+
+ @param numberOfEvents The number of requests in the body.
+ */
+- (BOOL)isCompleteForNumberOfEvents:(NSUInteger)numberOfEvents;
+
+@end
@@ -0,0 +1,76 @@
+//
+//  PiwikBulkRequestResult.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikBulkRequestResult.h"
+
+
+static NSString * const PiwikBulkResponseTrackedKey = @"tracked";
+static NSString * const PiwikBulkResponseInvalidKey = @"invalid";
+static NSString * const PiwikBulkResponseInvalidIndicesKey = @"invalid_indices";
+
+
+@implementation PiwikBulkRequestResult
+
+
++ (instancetype)resultWithResponseData:(NSData*)data {
+  
+  if (data.length == 0) {
+    return nil;
+  }
+  
+  id JSONObject = [NSJSONSerialization JSONObjectWithData:data options:0 error:nil];
+  if (![JSONObject isKindOfClass:[NSDictionary class]]) {
+    return nil;
+  }
+  
+  NSNumber *tracked = JSONObject[PiwikBulkResponseTrackedKey];
+  NSNumber *invalid = JSONObject[PiwikBulkResponseInvalidKey];
+  if (![tracked isKindOfClass:[NSNumber class]]) {
+    return nil;
+  }
+  
+  NSIndexSet *invalidIndexes;
+  NSArray *invalidIndices = JSONObject[PiwikBulkResponseInvalidIndicesKey];
+  if ([invalidIndices isKindOfClass:[NSArray class]]) {
+    NSMutableIndexSet *indexes = [NSMutableIndexSet indexSet];
+    for (NSNumber *index in invalidIndices) {
+      if ([index isKindOfClass:[NSNumber class]] && [index integerValue] >= 0) {
+        [indexes addIndex:[index unsignedIntegerValue]];
+      }
+    }
+    invalidIndexes = indexes;
+  }
+  
+  return [[self alloc] initWithNumberOfTrackedEvents:[tracked unsignedIntegerValue]
+                               numberOfInvalidEvents:[invalid isKindOfClass:[NSNumber class]] ? [invalid unsignedIntegerValue] : 0
+                                      invalidIndexes:invalidIndexes];
+}
+
+
+- (instancetype)initWithNumberOfTrackedEvents:(NSUInteger)numberOfTrackedEvents numberOfInvalidEvents:(NSUInteger)numberOfInvalidEvents invalidIndexes:(NSIndexSet*)invalidIndexes {
+  self = [super init];
+  if (self) {
+    _numberOfTrackedEvents = numberOfTrackedEvents;
+    _numberOfInvalidEvents = numberOfInvalidEvents;
+    _invalidIndexes = [invalidIndexes copy];
+  }
+  return self;
+}
+
+
+- (BOOL)isCompleteForNumberOfEvents:(NSUInteger)numberOfEvents {
+  return self.numberOfTrackedEvents + self.numberOfInvalidEvents >= numberOfEvents;
+}
+
+
+- (NSString*)description {
+  return [NSString stringWithFormat:@"<%@ tracked %lu invalid %lu>", NSStringFromClass([self class]), (unsigned long)self.numberOfTrackedEvents, (unsigned long)self.numberOfInvalidEvents];
+}
+
+
+@end
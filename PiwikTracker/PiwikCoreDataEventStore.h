@@ -0,0 +1,28 @@
+//
+//  PiwikCoreDataEventStore.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "PiwikEventStore.h"
+
+
+/**
+ An event store backed by a Core Data SQLite store in the application documents directory.
+
+ This is the default store. The Core Data stack is set up when the store is first used.
+ */
+@interface PiwikCoreDataEventStore : NSObject <PiwikEventStore>
+
+@property (nonatomic) NSUInteger maximumNumberOfEvents;
+
+@property (nonatomic) PiwikEventOverflowPolicy overflowPolicy;
+
+@property (readonly) NSUInteger numberOfEvents;
+
+@property (readonly) NSUInteger numberOfDroppedEvents;
+
+@end
@@ -0,0 +1,712 @@
+//
+//  PiwikCoreDataEventStore.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikCoreDataEventStore.h"
+#import <CoreData/CoreData.h>
+
+#import "PTEventEntity.h"
+#import "PTParameterSetEntity.h"
+#import "PiwikEventEncoder.h"
+#import "PiwikEventParameters.h"
+#import "PiwikEventQueueBudget.h"
+#import "PiwikLogging.h"
+
+
+// Most fetches read one request worth of events
+static NSUInteger const PiwikCoreDataFetchBatchSize = 50;
+
+
+@interface PiwikCoreDataEventStore ()
+
+@property (nonatomic, readonly, strong) NSManagedObjectContext *managedObjectContext;
+@property (nonatomic, readonly, strong) NSManagedObjectModel *managedObjectModel;
+@property (nonatomic, readonly, strong) NSPersistentStoreCoordinator *persistentStoreCoordinator;
+
+// Parameter sets in the store, only accessed on the managed object context queue
+@property (nonatomic, strong) NSMutableSet *storedParameterSetIDs;
+@property (nonatomic, strong) NSMutableDictionary *parameterSetCache;
+
+// Counted once per priority and then updated on insert and delete, only written on the managed object context queue
+@property (nonatomic) BOOL isNumberOfEventsLoaded;
+@property (nonatomic, readonly, strong) PiwikEventQueueBudget *budget;
+@property (readwrite) NSUInteger numberOfDroppedEvents;
+
+// The date of the last stored event, only accessed on the managed object context queue
+@property (nonatomic, strong) NSDate *lastEventDate;
+
+@end
+
+
+@implementation PiwikCoreDataEventStore
+
+@synthesize managedObjectContext = _managedObjectContext;
+@synthesize managedObjectModel = _managedObjectModel;
+@synthesize persistentStoreCoordinator = _persistentStoreCoordinator;
+
+
+- (instancetype)init {
+  self = [super init];
+  if (self) {
+    _budget = [[PiwikEventQueueBudget alloc] init];
+  }
+  return self;
+}
+
+
+#pragma mark - PiwikEventStore
+
+- (NSUInteger)maximumNumberOfEvents {
+  return self.budget.maximumNumberOfEvents;
+}
+
+
+- (void)setMaximumNumberOfEvents:(NSUInteger)maximumNumberOfEvents {
+  self.budget.maximumNumberOfEvents = maximumNumberOfEvents;
+}
+
+
+- (PiwikEventOverflowPolicy)overflowPolicy {
+  return self.budget.overflowPolicy;
+}
+
+
+- (void)setOverflowPolicy:(PiwikEventOverflowPolicy)overflowPolicy {
+  self.budget.overflowPolicy = overflowPolicy;
+}
+
+
+- (void)setMaximumNumberOfEvents:(NSUInteger)maximumNumberOfEvents forPriority:(PiwikEventPriority)priority {
+  [self.budget setMaximumNumberOfEvents:maximumNumberOfEvents forPriority:priority];
+}
+
+
+- (NSUInteger)numberOfEvents {
+  return self.budget.numberOfEvents;
+}
+
+
+- (NSUInteger)numberOfEventsWithPriority:(PiwikEventPriority)priority {
+  return [self.budget numberOfEventsWithPriority:priority];
+}
+
+
+- (void)storeEvents:(NSArray*)events parameterSets:(NSDictionary*)parameterSets completionBlock:(void (^)(void))completionBlock {
+  [self storeEvents:events priority:PiwikEventPriorityNormal parameterSets:parameterSets completionBlock:completionBlock];
+}
+
+
+- (void)storeEvents:(NSArray*)events priority:(PiwikEventPriority)priority parameterSets:(NSDictionary*)parameterSets completionBlock:(void (^)(void))completionBlock {
+  
+  [self.managedObjectContext performBlock:^{
+    
+    PiwikSignpostDeclareID(signpostID)
+    PiwikSignpostBegin(signpostID, "Persist", "%lu events", (unsigned long)events.count)
+    
+    NSError *error;
+    
+    [self loadNumberOfEventsIfNeeded];
+    
+    // Check if we reached the limit of the number of queued events, in total and in the lane
+    NSUInteger numberOfEventsToDelete[PiwikNumberOfEventPriorities];
+    NSUInteger numberOfEventsToStore = [self.budget numberOfEventsToStore:events.count withPriority:priority numberOfEventsToDelete:numberOfEventsToDelete];
+    
+    NSUInteger numberOfDeletedEvents = 0;
+    for (NSUInteger lane = 0; lane < PiwikNumberOfEventPriorities; lane++) {
+      if (numberOfEventsToDelete[lane] > 0) {
+        numberOfDeletedEvents += [self deleteOldestEvents:numberOfEventsToDelete[lane] withPriority:lane];
+      }
+    }
+    
+    if (numberOfEventsToStore > 0) {
+      
+      [self storeParameterSets:parameterSets];
+      
+      // Create new event entities and save them all at once
+      // Events are fetched sorted by date, make sure every event is stored after the events before it,
+      // including events of an earlier batch dated ahead of the clock
+      NSDate *date = [NSDate date];
+      if (self.lastEventDate && [date timeIntervalSinceDate:self.lastEventDate] < 0.001) {
+        date = [self.lastEventDate dateByAddingTimeInterval:0.001];
+      }
+      NSUInteger firstEvent = events.count - numberOfEventsToStore;
+      for (NSUInteger i = 0; i < numberOfEventsToStore; i++) {
+        PTEventEntity *eventEntity = [NSEntityDescription insertNewObjectForEntityForName:@"PTEventEntity" inManagedObjectContext:self.managedObjectContext];
+        eventEntity.date = [date dateByAddingTimeInterval:i * 0.001];
+        eventEntity.piwikRequestParameters = events[firstEvent + i];
+        eventEntity.encoding = @(PiwikEventEncodingCompact);
+        eventEntity.priority = @(priority);
+      }
+      self.lastEventDate = [date dateByAddingTimeInterval:(numberOfEventsToStore - 1) * 0.001];
+      
+      [self.budget addNumberOfEvents:numberOfEventsToStore withPriority:priority];
+      
+    }
+    
+    if (numberOfEventsToStore > 0 || numberOfDeletedEvents > 0) {
+      [self.managedObjectContext save:&error];
+    }
+    
+    NSUInteger numberOfDroppedEvents = events.count - numberOfEventsToStore + numberOfDeletedEvents;
+    if (numberOfDroppedEvents > 0) {
+      self.numberOfDroppedEvents += numberOfDroppedEvents;
+      PiwikLog(@"Tracker reach maximum number of queued events, %lu events dropped", (unsigned long)numberOfDroppedEvents);
+    }
+    
+    PiwikSignpostEnd(signpostID, "Persist")
+    
+    if (completionBlock) {
+      completionBlock();
+    }
+    
+  }];
+  
+}
+
+
+// Must be called on the managed object context queue
+- (void)loadNumberOfEventsIfNeeded {
+  
+  if (!self.isNumberOfEventsLoaded) {
+    NSFetchRequest *fetchRequest = [NSFetchRequest fetchRequestWithEntityName:@"PTEventEntity"];
+    NSError *error;
+    NSUInteger count = [self.managedObjectContext countForFetchRequest:fetchRequest error:&error];
+    count = count != NSNotFound ? count : 0;
+    
+    // Only goals and transactions are high priority, the second count is cheap using the priority index
+    fetchRequest.predicate = [NSPredicate predicateWithFormat:@"priority >= %@", @(PiwikEventPriorityHigh)];
+    NSUInteger highPriorityCount = count > 0 ? [self.managedObjectContext countForFetchRequest:fetchRequest error:&error] : 0;
+    highPriorityCount = highPriorityCount != NSNotFound ? MIN(highPriorityCount, count) : 0;
+    
+    [self.budget setNumberOfEvents:count - highPriorityCount withPriority:PiwikEventPriorityNormal];
+    [self.budget setNumberOfEvents:highPriorityCount withPriority:PiwikEventPriorityHigh];
+    self.isNumberOfEventsLoaded = YES;
+  }
+  
+}
+
+
+// Must be called on the managed object context queue
+// Delete the oldest events with the priority using a single fetch, the context is saved by the caller
+- (NSUInteger)deleteOldestEvents:(NSUInteger)numberOfEvents withPriority:(PiwikEventPriority)priority {
+  
+  NSFetchRequest *fetchRequest = [NSFetchRequest fetchRequestWithEntityName:@"PTEventEntity"];
+  fetchRequest.predicate = [NSPredicate predicateWithFormat:priority == PiwikEventPriorityNormal ? @"priority < %@" : @"priority >= %@", @(PiwikEventPriorityHigh)];
+  fetchRequest.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"date" ascending:YES]];
+  fetchRequest.fetchLimit = numberOfEvents;
+  fetchRequest.resultType = NSManagedObjectIDResultType;
+  
+  NSError *error;
+  NSArray *entityIDs = [self.managedObjectContext executeFetchRequest:fetchRequest error:&error];
+  NSUInteger numberOfDeletedEvents = [self deleteEventEntitiesWithIDs:entityIDs];
+  
+  [self.budget removeNumberOfEvents:numberOfDeletedEvents withPriority:priority];
+  
+  return numberOfDeletedEvents;
+}
+
+
+// Must be called on the managed object context queue
+// Only the object ids are fetched using the date index, the context is saved by the caller
+- (NSUInteger)deleteEventsStoredBeforeDate:(NSDate*)date withPriority:(PiwikEventPriority)priority {
+  
+  NSFetchRequest *fetchRequest = [NSFetchRequest fetchRequestWithEntityName:@"PTEventEntity"];
+  fetchRequest.predicate = [NSPredicate predicateWithFormat:priority == PiwikEventPriorityNormal ? @"date < %@ AND priority < %@" : @"date < %@ AND priority >= %@", date, @(PiwikEventPriorityHigh)];
+  fetchRequest.resultType = NSManagedObjectIDResultType;
+  
+  NSError *error;
+  NSArray *entityIDs = [self.managedObjectContext executeFetchRequest:fetchRequest error:&error];
+  NSUInteger numberOfDeletedEvents = [self deleteEventEntitiesWithIDs:entityIDs];
+  
+  [self.budget removeNumberOfEvents:numberOfDeletedEvents withPriority:priority];
+  
+  return numberOfDeletedEvents;
+}
+
+
+// Must be called on the managed object context queue
+// Use a batch delete executed directly by the store if available (iOS 9, OS X 10.11), the context must still be saved by the caller
+- (NSUInteger)deleteEventEntitiesWithIDs:(NSArray*)entityIDs {
+  
+  if (entityIDs.count == 0) {
+    return 0;
+  }
+  
+  if (NSClassFromString(@"NSBatchDeleteRequest")) {
+    NSBatchDeleteRequest *batchDeleteRequest = [[NSBatchDeleteRequest alloc] initWithObjectIDs:entityIDs];
+    batchDeleteRequest.resultType = NSBatchDeleteResultTypeCount;
+    
+    NSError *error;
+    NSBatchDeleteResult *result = (NSBatchDeleteResult*)[self.managedObjectContext executeRequest:batchDeleteRequest error:&error];
+    if (result) {
+      return [result.result unsignedIntegerValue];
+    }
+    
+    PiwikLog(@"Batch delete failed, deleting events one by one: %@", error);
+  }
+  
+  NSUInteger numberOfDeletedEvents = 0;
+  for (NSManagedObjectID *entityID in entityIDs) {
+    NSManagedObject *event = [self.managedObjectContext existingObjectWithID:entityID error:nil];
+    if (event && !event.isDeleted) {
+      [self.managedObjectContext deleteObject:event];
+      numberOfDeletedEvents++;
+    }
+  }
+  
+  return numberOfDeletedEvents;
+}
+
+
+// Must be called on the managed object context queue
+- (void)storeParameterSets:(NSDictionary*)parameterSets {
+  
+  if (!self.storedParameterSetIDs) {
+    // Load the identifiers of the sets already in the store
+    NSFetchRequest *fetchRequest = [NSFetchRequest fetchRequestWithEntityName:@"PTParameterSetEntity"];
+    fetchRequest.resultType = NSDictionaryResultType;
+    fetchRequest.propertiesToFetch = @[@"identifier"];
+    
+    NSError *error;
+    NSArray *results = [self.managedObjectContext executeFetchRequest:fetchRequest error:&error];
+    self.storedParameterSetIDs = [NSMutableSet setWithArray:[results valueForKey:@"identifier"]];
+  }
+  
+  [parameterSets enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+    if (![self.storedParameterSetIDs containsObject:key]) {
+      PTParameterSetEntity *parameterSetEntity = [NSEntityDescription insertNewObjectForEntityForName:@"PTParameterSetEntity" inManagedObjectContext:self.managedObjectContext];
+      parameterSetEntity.identifier = key;
+      parameterSetEntity.parameters = obj;
+      [self.storedParameterSetIDs addObject:key];
+    }
+  }];
+  
+}
+
+
+// Must be called on the managed object context queue
+- (NSDictionary*)parameterSetWithIdentifier:(NSNumber*)identifier {
+  
+  if (!self.parameterSetCache) {
+    self.parameterSetCache = [NSMutableDictionary dictionary];
+  }
+  
+  NSDictionary *parameters = self.parameterSetCache[identifier];
+  if (!parameters) {
+    
+    NSFetchRequest *fetchRequest = [NSFetchRequest fetchRequestWithEntityName:@"PTParameterSetEntity"];
+    fetchRequest.predicate = [NSPredicate predicateWithFormat:@"identifier == %@", identifier];
+    fetchRequest.fetchLimit = 1;
+    
+    NSError *error;
+    PTParameterSetEntity *parameterSetEntity = [[self.managedObjectContext executeFetchRequest:fetchRequest error:&error] firstObject];
+    
+    parameters = [PiwikEventEncoder parametersWithData:parameterSetEntity.parameters parameterSetIDs:NULL];
+    if (parameters) {
+      self.parameterSetCache[identifier] = parameters;
+    }
+    
+  }
+  
+  return parameters;
+}
+
+
+// Must be called on the managed object context queue
+- (NSDictionary*)parametersWithData:(NSData*)data encoding:(PiwikEventEncoding)encoding {
+  
+  if (encoding == PiwikEventEncodingKeyedArchive) {
+    // Stored by a previous version
+    return (NSDictionary*)[NSKeyedUnarchiver unarchiveObjectWithData:data];
+  }
+  
+  NSArray *parameterSetIDs;
+  NSDictionary *eventParameters = [PiwikEventEncoder parametersWithData:data parameterSetIDs:&parameterSetIDs];
+  if (!eventParameters) {
+    return nil;
+  }
+  
+  // The parameter sets are merged when the request is created
+  NSMutableArray *parameterSets = [NSMutableArray arrayWithCapacity:parameterSetIDs.count];
+  for (NSNumber *parameterSetID in parameterSetIDs) {
+    NSDictionary *parameterSet = [self parameterSetWithIdentifier:parameterSetID];
+    if (!parameterSet) {
+      return nil;
+    }
+    [parameterSets addObject:parameterSet];
+  }
+  
+  return [[PiwikEventParameters alloc] initWithParameters:eventParameters parameterSets:parameterSets parameterSetIDs:parameterSetIDs];
+}
+
+
+- (void)eventsFromStore:(NSUInteger)numberOfEvents excludingEventIDs:(NSSet*)excludedEventIDs completionBlock:(void (^)(NSArray *eventIDs, NSArray *events, BOOL hasMore))completionBlock {
+  [self eventsFromStore:numberOfEvents minimumPriority:PiwikEventPriorityNormal excludingEventIDs:excludedEventIDs completionBlock:completionBlock];
+}
+
+
+- (void)eventsFromStore:(NSUInteger)numberOfEvents minimumPriority:(PiwikEventPriority)minimumPriority excludingEventIDs:(NSSet*)excludedEventIDs completionBlock:(void (^)(NSArray *eventIDs, NSArray *events, BOOL hasMore))completionBlock {
+  
+  [self.managedObjectContext performBlock:^{
+    
+    PiwikSignpostDeclareID(signpostID)
+    PiwikSignpostBegin(signpostID, "Fetch")
+    
+    [self loadNumberOfEventsIfNeeded];
+    
+    NSFetchRequest *fetchRequest = [NSFetchRequest fetchRequestWithEntityName:@"PTEventEntity"];
+    
+    // Oldest first
+    NSSortDescriptor *sortDescriptor = [NSSortDescriptor sortDescriptorWithKey:@"date" ascending:YES];
+    fetchRequest.sortDescriptors = @[sortDescriptor];
+
+    fetchRequest.fetchLimit = numberOfEvents + 1;
+    
+    NSMutableArray *predicates = [NSMutableArray arrayWithCapacity:2];
+    if (minimumPriority > PiwikEventPriorityNormal) {
+      [predicates addObject:[NSPredicate predicateWithFormat:@"priority >= %@", @(minimumPriority)]];
+    }
+    if (excludedEventIDs.count > 0) {
+      [predicates addObject:[NSPredicate predicateWithFormat:@"NOT (self IN %@)", excludedEventIDs]];
+    }
+    if (predicates.count > 0) {
+      fetchRequest.predicate = [NSCompoundPredicate andPredicateWithSubpredicates:predicates];
+    }
+    
+    // Read the raw attribute values, there is no need to create and register managed objects
+    NSExpressionDescription *objectIDDescription = [[NSExpressionDescription alloc] init];
+    objectIDDescription.name = @"objectID";
+    objectIDDescription.expression = [NSExpression expressionForEvaluatedObject];
+    objectIDDescription.expressionResultType = NSObjectIDAttributeType;
+    
+    fetchRequest.resultType = NSDictionaryResultType;
+    fetchRequest.propertiesToFetch = @[objectIDDescription, @"encoding", @"priority", @"piwikRequestParameters"];
+    fetchRequest.fetchBatchSize = PiwikCoreDataFetchBatchSize;
+    
+    NSError *error;
+    NSArray *eventRecords = [self.managedObjectContext executeFetchRequest:fetchRequest error:&error];
+    
+    NSUInteger returnCount = eventRecords.count == fetchRequest.fetchLimit ? numberOfEvents : eventRecords.count;
+    
+    NSMutableArray *events = [NSMutableArray arrayWithCapacity:returnCount];
+    NSMutableArray *entityIDs = [NSMutableArray arrayWithCapacity:returnCount];
+    
+    if (eventRecords && eventRecords.count > 0) {
+      
+      __block BOOL hasCorruptEvents = NO;
+      
+      [eventRecords enumerateObjectsAtIndexes:[NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, returnCount)] options:0
+        usingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
+          
+          NSDictionary *eventRecord = (NSDictionary*)obj;
+          NSDictionary *parameters = [self parametersWithData:eventRecord[@"piwikRequestParameters"]
+                                                     encoding:[eventRecord[@"encoding"] shortValue]];
+          
+          if (parameters) {
+            [events addObject:parameters];
+            [entityIDs addObject:eventRecord[@"objectID"]];
+          } else {
+            // Can not be decoded, remove it or it will block the queue
+            PiwikLog(@"Remove event that could not be decoded");
+            NSManagedObject *eventEntity = [self.managedObjectContext existingObjectWithID:eventRecord[@"objectID"] error:nil];
+            if (eventEntity) {
+              [self.managedObjectContext deleteObject:eventEntity];
+              hasCorruptEvents = YES;
+              [self.budget removeNumberOfEvents:1 withPriority:[eventRecord[@"priority"] unsignedIntegerValue]];
+            }
+          }
+          
+      }];
+      
+      if (hasCorruptEvents) {
+        [self.managedObjectContext save:&error];
+      }
+      
+      PiwikSignpostEnd(signpostID, "Fetch", "%lu events", (unsigned long)events.count)
+      completionBlock(entityIDs, events, eventRecords.count == fetchRequest.fetchLimit ? YES : NO);
+      
+    } else {
+      // No more pending events
+      PiwikSignpostEnd(signpostID, "Fetch", "empty")
+      completionBlock(nil, nil, NO);
+    }
+    
+  }];
+    
+}
+
+
+- (void)deleteEventsWithIDs:(NSArray*)entityIDs {
+
+  [self.managedObjectContext performBlock:^{
+    
+    NSError *error;
+    
+    [self loadNumberOfEventsIfNeeded];
+    
+    // Most deletes are normal priority events, only count the high priority events if there are any
+    NSUInteger highPriorityCount = 0;
+    if ([self.budget numberOfEventsWithPriority:PiwikEventPriorityHigh] > 0 && entityIDs.count > 0) {
+      NSFetchRequest *fetchRequest = [NSFetchRequest fetchRequestWithEntityName:@"PTEventEntity"];
+      fetchRequest.predicate = [NSPredicate predicateWithFormat:@"(self IN %@) AND priority >= %@", entityIDs, @(PiwikEventPriorityHigh)];
+      highPriorityCount = [self.managedObjectContext countForFetchRequest:fetchRequest error:&error];
+      highPriorityCount = highPriorityCount != NSNotFound ? highPriorityCount : 0;
+    }
+    
+    NSUInteger numberOfDeletedEvents = [self deleteEventEntitiesWithIDs:entityIDs];
+    NSUInteger numberOfDeletedHighPriorityEvents = MIN(highPriorityCount, numberOfDeletedEvents);
+    [self.budget removeNumberOfEvents:numberOfDeletedHighPriorityEvents withPriority:PiwikEventPriorityHigh];
+    [self.budget removeNumberOfEvents:numberOfDeletedEvents - numberOfDeletedHighPriorityEvents withPriority:PiwikEventPriorityNormal];
+    
+    // Parameter sets are no longer referenced once the queue is empty
+    if (self.numberOfEvents == 0) {
+      [self deleteAllParameterSets];
+    }
+    
+    [self.managedObjectContext save:&error];
+    
+  }];
+  
+}
+
+
+- (void)deleteEventsStoredBeforeDate:(NSDate*)date completionBlock:(void (^)(NSUInteger numberOfDeletedEvents))completionBlock {
+  
+  [self.managedObjectContext performBlock:^{
+    
+    NSError *error;
+    
+    [self loadNumberOfEventsIfNeeded];
+    
+    NSUInteger numberOfDeletedEvents = 0;
+    for (NSUInteger lane = 0; lane < PiwikNumberOfEventPriorities; lane++) {
+      if ([self.budget numberOfEventsWithPriority:lane] > 0) {
+        numberOfDeletedEvents += [self deleteEventsStoredBeforeDate:date withPriority:lane];
+      }
+    }
+    
+    if (numberOfDeletedEvents > 0) {
+      // Parameter sets are no longer referenced once the queue is empty
+      if (self.numberOfEvents == 0) {
+        [self deleteAllParameterSets];
+      }
+      
+      [self.managedObjectContext save:&error];
+    }
+    
+    if (completionBlock) {
+      completionBlock(numberOfDeletedEvents);
+    }
+    
+  }];
+  
+}
+
+
+- (void)deleteAllStoredEvents {
+  
+  [self.managedObjectContext performBlock:^{
+    
+    NSError *error;
+    
+    [self deleteAllEntitiesWithName:@"PTEventEntity"];
+    
+    [self.budget removeAllEvents];
+    self.isNumberOfEventsLoaded = YES;
+    
+    [self deleteAllParameterSets];
+    
+    [self.managedObjectContext save:&error];
+    
+  }];
+  
+}
+
+
+- (void)waitUntilAllOperationsAreFinished {
+  [self.managedObjectContext performBlockAndWait:^{}];
+}
+
+
+- (void)openWithCompletionBlock:(void (^)(void))completionBlock {
+  
+  // Creating the context adds the persistent store and runs any migration on the calling thread
+  dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+    [self.managedObjectContext performBlock:^{
+      [self loadNumberOfEventsIfNeeded];
+      
+      if (completionBlock) {
+        completionBlock();
+      }
+    }];
+  });
+  
+}
+
+
+- (NSArray*)archivableEventIDs:(NSArray*)eventIDs {
+  
+  NSMutableArray *archivableEventIDs = [NSMutableArray arrayWithCapacity:eventIDs.count];
+  for (NSManagedObjectID *eventID in eventIDs) {
+    [archivableEventIDs addObject:[[eventID URIRepresentation] absoluteString]];
+  }
+  
+  return archivableEventIDs;
+}
+
+
+- (NSArray*)eventIDsFromArchivableEventIDs:(NSArray*)archivableEventIDs {
+  
+  NSMutableArray *eventIDs = [NSMutableArray arrayWithCapacity:archivableEventIDs.count];
+  
+  [self.managedObjectContext performBlockAndWait:^{
+    for (NSString *archivableEventID in archivableEventIDs) {
+      NSManagedObjectID *eventID = [self.persistentStoreCoordinator managedObjectIDForURIRepresentation:[NSURL URLWithString:archivableEventID]];
+      if (eventID) {
+        [eventIDs addObject:eventID];
+      }
+    }
+  }];
+  
+  return eventIDs;
+}
+
+
+// Must be called on the managed object context queue
+// The tracker will pass the parameter sets in use with the next event and they will be stored again
+- (void)deleteAllParameterSets {
+  
+  [self deleteAllEntitiesWithName:@"PTParameterSetEntity"];
+  
+  [self.storedParameterSetIDs removeAllObjects];
+  [self.parameterSetCache removeAllObjects];
+}
+
+
+// Must be called on the managed object context queue
+- (void)deleteAllEntitiesWithName:(NSString*)entityName {
+  
+  NSFetchRequest *fetchRequest = [NSFetchRequest fetchRequestWithEntityName:entityName];
+  NSError *error;
+  
+  if (NSClassFromString(@"NSBatchDeleteRequest")) {
+    // Registered objects are not updated by a batch delete, the store never keep references to managed objects
+    NSBatchDeleteRequest *batchDeleteRequest = [[NSBatchDeleteRequest alloc] initWithFetchRequest:fetchRequest];
+    if ([self.managedObjectContext executeRequest:batchDeleteRequest error:&error]) {
+      return;
+    }
+    
+    PiwikLog(@"Batch delete failed, deleting %@ one by one: %@", entityName, error);
+  }
+  
+  // Only fetch the object ids, not the attribute values
+  fetchRequest.includesPropertyValues = NO;
+  NSArray *entities = [self.managedObjectContext executeFetchRequest:fetchRequest error:&error];
+  for (NSManagedObject *entity in entities) {
+    [self.managedObjectContext deleteObject:entity];
+  }
+  
+}
+
+
+#pragma mark - Core Data stack
+
+// May be called from any thread, the store may be opened in the background while the tracker is used
+- (NSManagedObjectContext*)managedObjectContext {
+  
+  @synchronized(self) {
+    if (_managedObjectContext) {
+      return _managedObjectContext;
+    }
+    
+    NSPersistentStoreCoordinator *coordinator = [self persistentStoreCoordinator];
+    if (coordinator) {
+      _managedObjectContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+      [_managedObjectContext setPersistentStoreCoordinator:coordinator];
+    }
+    
+    return _managedObjectContext;
+  }
+}
+
+
+- (NSManagedObjectModel*)managedObjectModel {
+  
+  if (_managedObjectModel) {
+    return _managedObjectModel;
+  }
+  
+  NSURL *modelURL = [[NSBundle bundleForClass:[self class]] URLForResource:@"piwiktracker" withExtension:@"momd"];
+  _managedObjectModel = [[NSManagedObjectModel alloc] initWithContentsOfURL:modelURL];
+  
+  return _managedObjectModel;
+}
+
+
+- (NSPersistentStoreCoordinator*)persistentStoreCoordinator {
+  
+  if (_persistentStoreCoordinator) {
+    return _persistentStoreCoordinator;
+  }
+  
+  NSURL *storeURL = [[self applicationDocumentsDirectory] URLByAppendingPathComponent:@"piwiktracker"];
+  
+  // Support lightweigt data migration
+  NSDictionary *options = @{
+                            NSMigratePersistentStoresAutomaticallyOption: @(YES),
+                            NSInferMappingModelAutomaticallyOption: @(YES)
+                           };
+  
+  NSError *error = nil;
+  _persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:[self managedObjectModel]];
+  if (![_persistentStoreCoordinator addPersistentStoreWithType:NSSQLiteStoreType
+                                                 configuration:nil
+                                                           URL:storeURL
+                                                       options:options
+                                                         error:&error]) {
+    
+    BOOL isMigrationError = [error code] == NSPersistentStoreIncompatibleVersionHashError || [error code] == NSMigrationMissingSourceModelError;
+    
+    if ([[error domain] isEqualToString:NSCocoaErrorDomain] && isMigrationError) {
+      
+      PiwikLog(@"Remove incompatible model version: %@", [storeURL lastPathComponent]);
+      
+      // Could not open the database, remove it and try again
+      [[NSFileManager defaultManager] removeItemAtURL:storeURL error:nil];
+      
+      
+      // Try one more time to create the store
+      [_persistentStoreCoordinator addPersistentStoreWithType:NSSQLiteStoreType
+                                                configuration:nil
+                                                          URL:storeURL
+                                                      options:nil
+                                                        error:&error];
+      
+      if (_persistentStoreCoordinator) {
+        // If we successfully added a store, remove the error that was initially created
+        PiwikLog(@"Recovered from migration error");
+        error = nil;
+      } else {
+        // Not possible to recover of workaround
+        PiwikLog(@"Unresolved error when setting up code data stack %@, %@", error, [error userInfo]);
+        abort();
+      }
+      
+    }
+    
+  }
+  
+  return _persistentStoreCoordinator;
+}
+
+
+- (NSURL*)applicationDocumentsDirectory {
+  return [[[NSFileManager defaultManager] URLsForDirectory:NSDocumentDirectory inDomains:NSUserDomainMask] lastObject];
+}
+
+
+@end
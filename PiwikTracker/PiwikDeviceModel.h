@@ -0,0 +1,44 @@
+//
+//  PiwikDeviceModel.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ The name of a device model, e.g. "iPhone 6s" for the machine identifier "iPhone8,1".
+
+ Known models are looked up in a sorted table built into the SDK. Models released after the SDK can be named without a new release by adding a PiwikDeviceModels.plist file to the app bundle, a dictionary with machine identifiers as keys and names as values. Names in the file replace the names in the table.
+ Unknown models are named by their machine identifier.
+ */
+@interface PiwikDeviceModel : NSObject
+
+/**
+ The name of the device the app is running on, looked up once per process. May be called from any thread.
+ */
++ (NSString*)currentModelName;
+
+/**
+ The machine identifier of the device the app is running on, e.g. "iPhone8,1".
+ */
++ (NSString*)currentMachineIdentifier;
+
+/**
+ The name of a device model.
+
+ @param machineIdentifier The machine identifier, e.g. "iPhone8,1".
+ @param modelNames Names replacing the built in table, keyed by machine identifier. May be nil.
+ @return The name of the model, or the machine identifier if the model is unknown.
+ */
++ (NSString*)nameForMachineIdentifier:(NSString*)machineIdentifier modelNames:(NSDictionary*)modelNames;
+
+/**
+ The names in the PiwikDeviceModels.plist file in the main bundle, nil if there is no file.
+ */
++ (NSDictionary*)bundledModelNames;
+
+@end
@@ -0,0 +1,157 @@
+//
+//  PiwikDeviceModel.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikDeviceModel.h"
+#include <sys/sysctl.h>
+
+
+static NSString * const PiwikDeviceModelsResourceName = @"PiwikDeviceModels";
+
+
+typedef struct {
+  const char *machineIdentifier;
+  const char *name;
+} PiwikDeviceModelEntry;
+
+// https://gist.github.com/Jaybles/1323251
+// https://www.theiphonewiki.com/wiki/Models
+// Must be sorted by strcmp of the machine identifier, the table is searched with bsearch
+static PiwikDeviceModelEntry const PiwikDeviceModelTable[] = {
+  {"i386",      "Simulator"},
+  {"iPad1,1",   "iPad"},
+  {"iPad2,1",   "iPad 2 (WiFi)"},
+  {"iPad2,2",   "iPad 2 (GSM)"},
+  {"iPad2,3",   "iPad 2 (CDMA)"},
+  {"iPad2,4",   "iPad 2 (WiFi)"},
+  {"iPad2,5",   "iPad Mini (WiFi)"},
+  {"iPad2,6",   "iPad Mini (GSM)"},
+  {"iPad2,7",   "iPad Mini (GSM+CDMA)"},
+  {"iPad3,1",   "iPad 3 (WiFi)"},
+  {"iPad3,2",   "iPad 3 (GSM+CDMA)"},
+  {"iPad3,3",   "iPad 3 (GSM)"},
+  {"iPad3,4",   "iPad 4 (WiFi)"},
+  {"iPad3,5",   "iPad 4 (GSM)"},
+  {"iPad3,6",   "iPad 4 (GSM+CDMA)"},
+  {"iPad4,1",   "iPad Air (WiFi)"},
+  {"iPad4,2",   "iPad Air (Cellular)"},
+  {"iPad4,3",   "iPad Air"},
+  {"iPad4,4",   "iPad Mini 2 (WiFi)"},
+  {"iPad4,5",   "iPad Mini 2 (Cellular)"},
+  {"iPad4,6",   "iPad Mini 2 (Rev)"},
+  {"iPad4,7",   "iPad Mini 3 (WiFi)"},
+  {"iPad4,8",   "iPad Mini 3 (A1600)"},
+  {"iPad4,9",   "iPad Mini 3 (A1601)"},
+  {"iPad5,1",   "iPad Mini 4 (WiFi)"},
+  {"iPad5,2",   "iPad Mini 4 (LTE)"},
+  {"iPad5,3",   "iPad Air 2 (WiFi)"},
+  {"iPad5,4",   "iPad Air 2 (Cellular)"},
+  {"iPad6,3",   "iPad Pro 9.7 (WiFi)"},
+  {"iPad6,4",   "iPad Pro 9.7 (Cellular)"},
+  {"iPad6,7",   "iPad Pro"},
+  {"iPad6,8",   "iPad Pro"},
+  {"iPhone1,1", "iPhone 1G"},
+  {"iPhone1,2", "iPhone 3G"},
+  {"iPhone2,1", "iPhone 3GS"},
+  {"iPhone3,1", "iPhone 4"},
+  {"iPhone3,2", "iPhone 4"},
+  {"iPhone3,3", "Verizon iPhone 4"},
+  {"iPhone4,1", "iPhone 4S"},
+  {"iPhone5,1", "iPhone 5 (GSM)"},
+  {"iPhone5,2", "iPhone 5 (GSM+CDMA)"},
+  {"iPhone5,3", "iPhone 5c (GSM)"},
+  {"iPhone5,4", "iPhone 5c (Global)"},
+  {"iPhone6,1", "iPhone 5s (GSM)"},
+  {"iPhone6,2", "iPhone 5s (Global)"},
+  {"iPhone7,1", "iPhone 6 Plus"},
+  {"iPhone7,2", "iPhone 6"},
+  {"iPhone8,1", "iPhone 6s"},
+  {"iPhone8,2", "iPhone 6s Plus"},
+  {"iPhone8,4", "iPhone SE"},
+  {"iPhone9,1", "iPhone 7"},
+  {"iPhone9,2", "iPhone 7 Plus"},
+  {"iPhone9,3", "iPhone 7"},
+  {"iPhone9,4", "iPhone 7 Plus"},
+  {"iPod1,1",   "iPod Touch 1G"},
+  {"iPod2,1",   "iPod Touch 2G"},
+  {"iPod3,1",   "iPod Touch 3G"},
+  {"iPod4,1",   "iPod Touch 4G"},
+  {"iPod5,1",   "iPod Touch 5G"},
+  {"iPod7,1",   "iPod Touch 6G"},
+  {"x86_64",    "Simulator"},
+};
+
+
+static int PiwikCompareDeviceModelEntries(const void *key, const void *entry) {
+  return strcmp(((const PiwikDeviceModelEntry*)key)->machineIdentifier, ((const PiwikDeviceModelEntry*)entry)->machineIdentifier);
+}
+
+
+@implementation PiwikDeviceModel
+
+
++ (NSString*)currentModelName {
+  
+  static NSString *modelName;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    modelName = [self nameForMachineIdentifier:[self currentMachineIdentifier] modelNames:[self bundledModelNames]];
+  });
+  
+  return modelName;
+}
+
+
++ (NSString*)currentMachineIdentifier {
+  
+  size_t size = 0;
+  if (sysctlbyname("hw.machine", NULL, &size, NULL, 0) != 0 || size == 0) {
+    return @"";
+  }
+  
+  char *machine = malloc(size * sizeof(char));
+  NSString *machineIdentifier = @"";
+  if (sysctlbyname("hw.machine", machine, &size, NULL, 0) == 0) {
+    machineIdentifier = [NSString stringWithUTF8String:machine];
+  }
+  free(machine);
+  
+  return machineIdentifier;
+}
+
+
++ (NSString*)nameForMachineIdentifier:(NSString*)machineIdentifier modelNames:(NSDictionary*)modelNames {
+  
+  NSString *name = modelNames[machineIdentifier];
+  if ([name isKindOfClass:[NSString class]]) {
+    return name;
+  }
+  
+  PiwikDeviceModelEntry key = {.machineIdentifier = [machineIdentifier UTF8String]};
+  const PiwikDeviceModelEntry *entry = bsearch(&key,
+                                               PiwikDeviceModelTable,
+                                               sizeof(PiwikDeviceModelTable) / sizeof(PiwikDeviceModelEntry),
+                                               sizeof(PiwikDeviceModelEntry),
+                                               PiwikCompareDeviceModelEntries);
+  
+  return entry ? @(entry->name) : machineIdentifier;
+}
+
+
++ (NSDictionary*)bundledModelNames {
+  
+  NSURL *URL = [[NSBundle mainBundle] URLForResource:PiwikDeviceModelsResourceName withExtension:@"plist"];
+  if (!URL) {
+    return nil;
+  }
+  
+  NSDictionary *modelNames = [NSDictionary dictionaryWithContentsOfURL:URL];
+  return [modelNames isKindOfClass:[NSDictionary class]] ? modelNames : nil;
+}
+
+
+@end
@@ -0,0 +1,116 @@
+//
+//  PiwikDispatchController.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "PiwikReachability.h"
+
+
+/**
+ A snapshot of the measured network performance and the dispatch settings currently used for a network class.
+ */
+@interface PiwikDispatchStatistics : NSObject <NSCopying>
+
+/**
+ The network class the statistics apply to.
+ */
+@property (nonatomic, readonly) PiwikNetworkClass networkClass;
+
+/**
+ The number of events currently sent in each request.
+ */
+@property (nonatomic, readonly) NSUInteger eventsPerRequest;
+
+/**
+ The request timeout currently used, in seconds.
+ */
+@property (nonatomic, readonly) NSTimeInterval requestTimeout;
+
+/**
+ Smoothed round trip time of successful requests, in seconds. 0 until the first request has succeeded.
+ */
+@property (nonatomic, readonly) NSTimeInterval roundTripTime;
+
+/**
+ Smoothed throughput of successful requests, in bytes per second. 0 until the first request has succeeded.
+ */
+@property (nonatomic, readonly) double throughput;
+
+/**
+ The number of requests sent.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfRequests;
+
+/**
+ The number of failed requests.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfFailures;
+
+@end
+
+
+/**
+ Adapt the number of events per request and the request timeout to the measured network performance.
+ 
+ The controller use additive increase and multiplicative decrease. For each network class the batch size grow by one event after each request that completes in less than half the timeout, and is halved after each failure. The timeout follow the smoothed round trip time and variation (as for TCP retransmission timeouts) and is doubled after each failure. Both are kept within the configured bounds.
+ 
+ The controller is not thread safe.
+ */
+@interface PiwikDispatchController : NSObject
+
+/**
+ Create a controller.
+ 
+ @param maximumEventsPerRequest The upper bound and initial number of events per request.
+ @param minimumRequestTimeout The lower bound and initial request timeout.
+ @param maximumRequestTimeout The upper bound of the request timeout.
+ */
+- (instancetype)initWithMaximumEventsPerRequest:(NSUInteger)maximumEventsPerRequest
+                          minimumRequestTimeout:(NSTimeInterval)minimumRequestTimeout
+                          maximumRequestTimeout:(NSTimeInterval)maximumRequestTimeout;
+
+@property (nonatomic) NSUInteger maximumEventsPerRequest;
+@property (nonatomic) NSTimeInterval minimumRequestTimeout;
+@property (nonatomic) NSTimeInterval maximumRequestTimeout;
+
+/**
+ The number of events per request to use on a network class.
+ */
+- (NSUInteger)eventsPerRequestForNetworkClass:(PiwikNetworkClass)networkClass;
+
+/**
+ The request timeout to use on a network class.
+ */
+- (NSTimeInterval)requestTimeoutForNetworkClass:(PiwikNetworkClass)networkClass;
+
+/**
+ Record a successful request.
+ 
+ @param numberOfEvents The number of events in the request.
+ @param payloadSize The approximate size of the request in bytes.
+ @param roundTripTime The time from sending the request until the response was received.
+ @param networkClass The network class when the request was sent.
+ */
+- (void)requestDidSucceedWithNumberOfEvents:(NSUInteger)numberOfEvents
+                                payloadSize:(NSUInteger)payloadSize
+                              roundTripTime:(NSTimeInterval)roundTripTime
+                               networkClass:(PiwikNetworkClass)networkClass;
+
+/**
+ Record a failed request.
+ 
+ @param numberOfEvents The number of events in the request.
+ @param networkClass The network class when the request was sent.
+ */
+- (void)requestDidFailWithNumberOfEvents:(NSUInteger)numberOfEvents networkClass:(PiwikNetworkClass)networkClass;
+
+/**
+ A snapshot of the statistics for a network class.
+ */
+- (PiwikDispatchStatistics*)statisticsForNetworkClass:(PiwikNetworkClass)networkClass;
+
+@end
@@ -0,0 +1,164 @@
+//
+//  PiwikDispatchController.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikDispatchController.h"
+
+
+// Smoothing factors for round trip time, variation and throughput, same as RFC 6298
+static double const PiwikRoundTripTimeGain = 0.125;
+static double const PiwikRoundTripTimeVariationGain = 0.25;
+static double const PiwikThroughputGain = 0.125;
+
+
+@interface PiwikDispatchStatistics ()
+
+@property (nonatomic) PiwikNetworkClass networkClass;
+@property (nonatomic) NSUInteger eventsPerRequest;
+@property (nonatomic) NSTimeInterval requestTimeout;
+@property (nonatomic) NSTimeInterval roundTripTime;
+@property (nonatomic) NSTimeInterval roundTripTimeVariation;
+@property (nonatomic) double throughput;
+@property (nonatomic) NSUInteger numberOfRequests;
+@property (nonatomic) NSUInteger numberOfFailures;
+
+@end
+
+
+@implementation PiwikDispatchStatistics
+
+
+- (id)copyWithZone:(NSZone*)zone {
+  
+  PiwikDispatchStatistics *statistics = [[[self class] allocWithZone:zone] init];
+  statistics.networkClass = self.networkClass;
+  statistics.eventsPerRequest = self.eventsPerRequest;
+  statistics.requestTimeout = self.requestTimeout;
+  statistics.roundTripTime = self.roundTripTime;
+  statistics.roundTripTimeVariation = self.roundTripTimeVariation;
+  statistics.throughput = self.throughput;
+  statistics.numberOfRequests = self.numberOfRequests;
+  statistics.numberOfFailures = self.numberOfFailures;
+  
+  return statistics;
+}
+
+
+- (NSString*)description {
+  return [NSString stringWithFormat:@"<%@: networkClass=%lu eventsPerRequest=%lu requestTimeout=%.1fs roundTripTime=%.3fs throughput=%.0fB/s requests=%lu failures=%lu>",
+          NSStringFromClass([self class]), (unsigned long)self.networkClass, (unsigned long)self.eventsPerRequest, self.requestTimeout,
+          self.roundTripTime, self.throughput, (unsigned long)self.numberOfRequests, (unsigned long)self.numberOfFailures];
+}
+
+
+@end
+
+
+@interface PiwikDispatchController ()
+
+// Statistics by network class
+@property (nonatomic, strong) NSMutableDictionary *statistics;
+
+@end
+
+
+@implementation PiwikDispatchController
+
+
+- (instancetype)initWithMaximumEventsPerRequest:(NSUInteger)maximumEventsPerRequest
+                          minimumRequestTimeout:(NSTimeInterval)minimumRequestTimeout
+                          maximumRequestTimeout:(NSTimeInterval)maximumRequestTimeout {
+  
+  if (self = [super init]) {
+    _maximumEventsPerRequest = MAX(maximumEventsPerRequest, 1);
+    _minimumRequestTimeout = minimumRequestTimeout;
+    _maximumRequestTimeout = MAX(maximumRequestTimeout, minimumRequestTimeout);
+    _statistics = [NSMutableDictionary dictionary];
+  }
+  
+  return self;
+}
+
+
+- (PiwikDispatchStatistics*)mutableStatisticsForNetworkClass:(PiwikNetworkClass)networkClass {
+  
+  PiwikDispatchStatistics *statistics = self.statistics[@(networkClass)];
+  if (!statistics) {
+    statistics = [[PiwikDispatchStatistics alloc] init];
+    statistics.networkClass = networkClass;
+    statistics.eventsPerRequest = self.maximumEventsPerRequest;
+    statistics.requestTimeout = self.minimumRequestTimeout;
+    self.statistics[@(networkClass)] = statistics;
+  }
+  
+  // The bounds may have changed since last request
+  statistics.eventsPerRequest = MAX(MIN(statistics.eventsPerRequest, self.maximumEventsPerRequest), 1);
+  statistics.requestTimeout = MAX(MIN(statistics.requestTimeout, self.maximumRequestTimeout), self.minimumRequestTimeout);
+  
+  return statistics;
+}
+
+
+- (NSUInteger)eventsPerRequestForNetworkClass:(PiwikNetworkClass)networkClass {
+  return [self mutableStatisticsForNetworkClass:networkClass].eventsPerRequest;
+}
+
+
+- (NSTimeInterval)requestTimeoutForNetworkClass:(PiwikNetworkClass)networkClass {
+  return [self mutableStatisticsForNetworkClass:networkClass].requestTimeout;
+}
+
+
+- (void)requestDidSucceedWithNumberOfEvents:(NSUInteger)numberOfEvents
+                                payloadSize:(NSUInteger)payloadSize
+                              roundTripTime:(NSTimeInterval)roundTripTime
+                               networkClass:(PiwikNetworkClass)networkClass {
+  
+  PiwikDispatchStatistics *statistics = [self mutableStatisticsForNetworkClass:networkClass];
+  statistics.numberOfRequests++;
+  
+  roundTripTime = MAX(roundTripTime, 0.001);
+  
+  if (statistics.roundTripTime == 0) {
+    statistics.roundTripTime = roundTripTime;
+    statistics.roundTripTimeVariation = roundTripTime / 2;
+    statistics.throughput = payloadSize / roundTripTime;
+  } else {
+    statistics.roundTripTimeVariation = (1 - PiwikRoundTripTimeVariationGain) * statistics.roundTripTimeVariation +
+      PiwikRoundTripTimeVariationGain * fabs(statistics.roundTripTime - roundTripTime);
+    statistics.roundTripTime = (1 - PiwikRoundTripTimeGain) * statistics.roundTripTime + PiwikRoundTripTimeGain * roundTripTime;
+    statistics.throughput = (1 - PiwikThroughputGain) * statistics.throughput + PiwikThroughputGain * (payloadSize / roundTripTime);
+  }
+  
+  // Additive increase, unless the request was close to timing out or did not use the full batch
+  if (roundTripTime < statistics.requestTimeout / 2 && numberOfEvents >= statistics.eventsPerRequest) {
+    statistics.eventsPerRequest = MIN(statistics.eventsPerRequest + 1, self.maximumEventsPerRequest);
+  }
+  
+  NSTimeInterval requestTimeout = statistics.roundTripTime + 4 * statistics.roundTripTimeVariation;
+  statistics.requestTimeout = MAX(MIN(requestTimeout, self.maximumRequestTimeout), self.minimumRequestTimeout);
+}
+
+
+- (void)requestDidFailWithNumberOfEvents:(NSUInteger)numberOfEvents networkClass:(PiwikNetworkClass)networkClass {
+  
+  PiwikDispatchStatistics *statistics = [self mutableStatisticsForNetworkClass:networkClass];
+  statistics.numberOfRequests++;
+  statistics.numberOfFailures++;
+  
+  // Multiplicative decrease, based on the size of the failed request since several requests may be in flight
+  statistics.eventsPerRequest = MAX(MIN(statistics.eventsPerRequest, numberOfEvents) / 2, 1);
+  statistics.requestTimeout = MIN(statistics.requestTimeout * 2, self.maximumRequestTimeout);
+}
+
+
+- (PiwikDispatchStatistics*)statisticsForNetworkClass:(PiwikNetworkClass)networkClass {
+  return [[self mutableStatisticsForNetworkClass:networkClass] copy];
+}
+
+
+@end
@@ -0,0 +1,67 @@
+//
+//  PiwikDispatchScheduler.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "PiwikReachability.h"
+
+
+/**
+ Schedule timed dispatches on a GCD timer source, replacing a timer on the main run loop.
+
+ The scheduler is aware of the network and the power state:
+ 1) No dispatch is started while the Internet is unreachable, the dispatch runs shortly after the network is back.
+ 2) After failed dispatches the interval is backed off exponentially, with jitter so devices losing the server at the same time do not retry together.
+ 3) The timer is given a leeway so the system can coalesce the wake up with other timers and network activity.
+ 4) Optionally dispatches are postponed in Low Power Mode and on cellular networks.
+
+ All methods may be called from any thread. The dispatch block is run on the queue given when the scheduler is created.
+ */
+@interface PiwikDispatchScheduler : NSObject
+
+/**
+ Create a scheduler.
+
+ @param queue The serial queue the timer and the dispatch block run on.
+ @param reachability Used to pause the scheduler while the Internet is unreachable.
+ @param dispatchBlock Run when it is time to dispatch.
+ */
+- (instancetype)initWithQueue:(dispatch_queue_t)queue reachability:(PiwikReachability*)reachability dispatchBlock:(void (^)(void))dispatchBlock;
+
+/**
+ Postpone dispatches in Low Power Mode and on cellular networks by a multiple of the interval. Default NO.
+ */
+@property (nonatomic) BOOL postponeDispatchOnExpensiveNetworks;
+
+/**
+ YES if the Internet was reachable at the last change of the network.
+ */
+@property (readonly) BOOL isNetworkReachable;
+
+/**
+ The number of dispatches in a row that failed, used to back off the interval.
+ */
+@property (readonly) NSUInteger numberOfConsecutiveFailures;
+
+/**
+ Run the dispatch block after the interval, replacing any scheduled dispatch.
+
+ @param interval The interval in seconds before backoff and postponing, must be > 0.
+ */
+- (void)scheduleDispatchWithInterval:(NSTimeInterval)interval;
+
+/**
+ Cancel the scheduled dispatch.
+ */
+- (void)cancel;
+
+/**
+ Report the result of a dispatch, a failure will back off the next interval.
+ */
+- (void)dispatchDidFinishWithSuccess:(BOOL)success;
+
+@end
@@ -0,0 +1,201 @@
+//
+//  PiwikDispatchScheduler.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikDispatchScheduler.h"
+
+
+// Let the system delay the timer by this fraction of the interval to coalesce wake ups
+static double const PiwikSchedulerLeewayFactor = 0.1;
+
+// Give a new network connection some time to settle before dispatching
+static NSTimeInterval const PiwikSchedulerReachabilityDelay = 2;
+
+static NSTimeInterval const PiwikSchedulerMaximumBackoffInterval = 30 * 60;
+static NSUInteger const PiwikSchedulerMaximumBackoffExponent = 10;
+
+static double const PiwikSchedulerLowPowerIntervalFactor = 4;
+static double const PiwikSchedulerCellularIntervalFactor = 2;
+
+
+@interface PiwikDispatchScheduler ()
+
+// Only accessed on the scheduler queue
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, strong) dispatch_source_t timer;
+@property (nonatomic, copy) void (^dispatchBlock)(void);
+@property (nonatomic, strong) PiwikReachability *reachability;
+@property (nonatomic) BOOL isWaitingForNetwork;
+
+@property (readwrite) BOOL isNetworkReachable;
+@property (readwrite) NSUInteger numberOfConsecutiveFailures;
+@property (nonatomic) PiwikNetworkClass networkClass;
+
+@end
+
+
+@implementation PiwikDispatchScheduler
+
+
+- (instancetype)initWithQueue:(dispatch_queue_t)queue reachability:(PiwikReachability*)reachability dispatchBlock:(void (^)(void))dispatchBlock {
+
+  if (self = [super init]) {
+    _queue = queue;
+    _reachability = reachability;
+    _dispatchBlock = [dispatchBlock copy];
+    _isNetworkReachable = [reachability isReachable];
+    _networkClass = [reachability networkClass];
+    _postponeDispatchOnExpensiveNetworks = NO;
+
+    __weak typeof(self)weakSelf = self;
+    [reachability startMonitoringOnQueue:queue changeBlock:^(BOOL isReachable, PiwikNetworkClass networkClass) {
+      [weakSelf networkDidChangeWithReachability:isReachable networkClass:networkClass];
+    }];
+  }
+
+  return self;
+}
+
+
+- (void)dealloc {
+  [_reachability stopMonitoring];
+  if (_timer) {
+    dispatch_source_cancel(_timer);
+  }
+}
+
+
+- (void)scheduleDispatchWithInterval:(NSTimeInterval)interval {
+
+  dispatch_async(self.queue, ^{
+    self.isWaitingForNetwork = NO;
+    [self startTimerWithDelay:[self delayForInterval:interval]];
+  });
+
+}
+
+
+- (void)cancel {
+
+  dispatch_async(self.queue, ^{
+    self.isWaitingForNetwork = NO;
+    [self cancelTimer];
+  });
+
+}
+
+
+- (void)dispatchDidFinishWithSuccess:(BOOL)success {
+
+  dispatch_async(self.queue, ^{
+    self.numberOfConsecutiveFailures = success ? 0 : self.numberOfConsecutiveFailures + 1;
+  });
+
+}
+
+
+#pragma mark Timer
+
+// Must be called on the scheduler queue
+- (NSTimeInterval)delayForInterval:(NSTimeInterval)interval {
+
+  NSTimeInterval delay = interval;
+
+  if (self.postponeDispatchOnExpensiveNetworks) {
+    if ([self isLowPowerModeEnabled]) {
+      delay *= PiwikSchedulerLowPowerIntervalFactor;
+    } else if (self.networkClass == PiwikNetworkClassCellular) {
+      delay *= PiwikSchedulerCellularIntervalFactor;
+    }
+  }
+
+  if (self.numberOfConsecutiveFailures > 0) {
+    NSUInteger exponent = MIN(self.numberOfConsecutiveFailures, PiwikSchedulerMaximumBackoffExponent);
+    NSTimeInterval backoff = MIN(interval * (1 << exponent), PiwikSchedulerMaximumBackoffInterval);
+    // Random delay within the upper half of the backoff
+    backoff *= 0.5 + 0.5 * arc4random_uniform(1001) / 1000.0;
+    delay = MAX(delay, backoff);
+  }
+
+  return delay;
+}
+
+
+// Low Power Mode is available from iOS 9
+- (BOOL)isLowPowerModeEnabled {
+#if TARGET_OS_IPHONE
+  NSProcessInfo *processInfo = [NSProcessInfo processInfo];
+  return [processInfo respondsToSelector:@selector(isLowPowerModeEnabled)] && processInfo.lowPowerModeEnabled;
+#else
+  return NO;
+#endif
+}
+
+
+// Must be called on the scheduler queue
+- (void)startTimerWithDelay:(NSTimeInterval)delay {
+
+  [self cancelTimer];
+
+  self.timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, self.queue);
+
+  __weak typeof(self)weakSelf = self;
+  dispatch_source_set_event_handler(self.timer, ^{
+    [weakSelf timerDidFire];
+  });
+
+  // One-shot, the next dispatch is scheduled when the dispatch has finished
+  dispatch_source_set_timer(self.timer,
+                            dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)),
+                            DISPATCH_TIME_FOREVER,
+                            (uint64_t)(delay * PiwikSchedulerLeewayFactor * NSEC_PER_SEC));
+  dispatch_resume(self.timer);
+
+}
+
+
+// Must be called on the scheduler queue
+- (void)cancelTimer {
+
+  if (self.timer) {
+    dispatch_source_cancel(self.timer);
+    self.timer = nil;
+  }
+
+}
+
+
+// Must be called on the scheduler queue
+- (void)timerDidFire {
+
+  [self cancelTimer];
+
+  if (!self.isNetworkReachable) {
+    // Paused, resumed when the network is reachable again
+    self.isWaitingForNetwork = YES;
+    return;
+  }
+
+  self.dispatchBlock();
+}
+
+
+// Must be called on the scheduler queue
+- (void)networkDidChangeWithReachability:(BOOL)isReachable networkClass:(PiwikNetworkClass)networkClass {
+
+  self.isNetworkReachable = isReachable;
+  self.networkClass = networkClass;
+
+  if (isReachable && self.isWaitingForNetwork) {
+    self.isWaitingForNetwork = NO;
+    [self startTimerWithDelay:PiwikSchedulerReachabilityDelay];
+  }
+
+}
+
+
+@end
@@ -6,6 +6,8 @@
 //  Copyright (c) 2014 Mattias Levin. All rights reserved.
 //
 
+@class PiwikBulkRequestResult;
+
 
 /**
  The dispatcher is responsible for performing the actual network request to the Piwik server.
@@ -27,7 +29,7 @@
 
  @param parameters Event parameters. These parameters should be added to the path as a URL encoded query string
  @param successBlock Run the block if the dispatch to the Piwik server is successful.
- @param failure Run this block if the dispatch to the Piwik server fails. Provide a YES to indicate if the SDK should attempt to send any pending event or NO if pending events should be saved until next dispatch. E.g. there is no use trying to send pending events if there is no network connection. 
+ @param failure Run this block if the dispatch to the Piwik server fails. Provide a YES to indicate if the SDK should attempt to send any pending event or NO if pending events should be saved until next dispatch. E.g. there is no use trying to send pending events if there is no network connection, the host can not be reached or the server failed. Only provide YES if the server rejected the request, the events are then counted as rejected. 
  */
 - (void)sendSingleEventWithParameters:(NSDictionary*)parameters
                               success:(void (^)())successBlock
@@ -40,7 +42,7 @@
  
  @param parameters Event parameters. These parameters should be JSON encoded and added to the request body.
  @param successBlock Run the block if the dispatch to the Piwik server is successful.
- @param failure Run this block if the dispatch to the Piwik server fails. Provide a YES to indicate if the SDK should attempt to send any pending event or NO if pending events should be saved until next dispatch. E.g. there is no use trying to send pending events if there is no network connection.
+ @param failure Run this block if the dispatch to the Piwik server fails. Provide a YES to indicate if the SDK should attempt to send any pending event or NO if pending events should be saved until next dispatch. E.g. there is no use trying to send pending events if there is no network connection, the host can not be reached or the server failed. Only provide YES if the server rejected the request, the events are then counted as rejected.
  */
 - (void)sendBulkEventWithParameters:(NSDictionary*)parameters
                             success:(void (^)())successBlock
@@ -49,6 +51,20 @@
 
 @optional
 
+/**
+ *  Send a bulk of tracking events with a request body written by the tracker.
+ *
+ *  Dispatchers implementing this method receive bulk requests this way instead of through `sendBulkEventWithParameters:success:failure:`. The tracker writes the body directly from the stored events into one buffer. It never builds the query strings or a JSON object first.
+ *  The response should be parsed with `PiwikBulkRequestResult`. Only the events the server did not accept are then retried, and events it rejected as invalid are dropped.
+ *
+ *  @param requestBody The UTF-8 encoded JSON body, {"requests":["?...","?..."]}. Send it as the body of a POST request.
+ *  @param successBlock Run the block if the server responded with a success status code, with the parsed result or nil if the response was not a bulk request response.
+ *  @param failureBlock Run this block if the dispatch to the Piwik server fails, see `sendBulkEventWithParameters:success:failure:`. A request rejected by the server should continue.
+ */
+- (void)sendBulkEventWithRequestBody:(NSData*)requestBody
+                             success:(void (^)(PiwikBulkRequestResult *result))successBlock
+                             failure:(void (^)(BOOL shouldContinue))failureBlock;
+
 /**
  *  Set a custom user agent the dispatchers will use for requests.
  *
@@ -56,5 +72,63 @@
  */
 - (void)setUserAgent:(NSString*)userAgent;
 
+/**
+ *  Set the timeout the dispatcher will use for requests.
+ *
+ *  The tracker will adjust the timeout to the measured network performance if adaptive dispatch is enabled.
+ *
+ *  @param requestTimeout The timeout in seconds.
+ */
+- (void)setRequestTimeout:(NSTimeInterval)requestTimeout;
+
+/**
+ *  Compress bulk request bodies with gzip and send them with `Content-Encoding: gzip`.
+ *
+ *  Dispatchers implementing this method support compressed request bodies. Small bodies should be sent uncompressed, see `PiwikDefaultCompressionThreshold`.
+ *  The Piwik server, or a proxy in front of it, must accept gzip encoded request bodies.
+ *
+ *  @param compressBulkRequests YES to compress bulk request bodies.
+ */
+- (void)setCompressBulkRequests:(BOOL)compressBulkRequests;
+
+/**
+ *  Enable background uploads using a background NSURLSession with the given identifier.
+ *
+ *  Dispatchers implementing the background upload methods let the tracker hand over queued events to the system when the app is sent to the background. The system will send them even if the app is suspended or terminated.
+ *  The dispatcher must create the session directly to receive the result of uploads started by a previous launch of the app.
+ *
+ *  @param backgroundSessionIdentifier The background session identifier.
+ */
+- (void)setBackgroundSessionIdentifier:(NSString*)backgroundSessionIdentifier;
+
+/**
+ *  Set the block to run when a background upload has finished.
+ *
+ *  Results of uploads finished before the block is set, e.g. while the app was not running, must be kept and reported when the block is set.
+ *
+ *  @param completionBlock Run with the request identifier passed to `sendBackgroundBulkEventWithParameters:requestIdentifier:` and YES if the server accepted the request. May be run on any queue.
+ */
+- (void)setBackgroundRequestCompletionBlock:(void (^)(NSString *requestIdentifier, BOOL success))completionBlock;
+
+/**
+ *  Upload a bulk request using the background session.
+ *
+ *  The request is written in the same format as `sendBulkEventWithParameters:success:failure:`.
+ *  The upload must finish or fail within 24 hours, the tracker will send the events again after that.
+ *
+ *  @param parameters Event parameters. These parameters should be JSON encoded and added to the request body.
+ *  @param requestIdentifier Identifier reported to the background request completion block when the upload has finished.
+ */
+- (void)sendBackgroundBulkEventWithParameters:(NSDictionary*)parameters requestIdentifier:(NSString*)requestIdentifier;
+
+/**
+ *  Pass on the events of a background session from the app delegate.
+ *
+ *  @param identifier The background session identifier.
+ *  @param completionHandler The completion handler to run when all events have been delivered.
+ *  @return YES if the session belongs to the dispatcher.
+ */
+- (BOOL)handleEventsForBackgroundURLSession:(NSString*)identifier completionHandler:(void (^)(void))completionHandler;
+
 
 @end
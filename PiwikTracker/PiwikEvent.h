@@ -0,0 +1,54 @@
+//
+//  PiwikEvent.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ A reusable event for call sites tracking many events, e.g. a game loop or a media player.
+
+ Set the fields and send the event with `sendEvent:`. The tracker captures the field values when the event is sent, the event can be changed and sent again right away. No dictionaries, arrays or numbers are created by the caller. The event parameters are built on the tracker queue when `processEventsInBackground` is enabled, otherwise on the calling thread.
+
+    PiwikEvent *event = [[PiwikEvent alloc] initWithCategory:@"Player" action:@"Progress"];
+    event.value = position;
+    [[PiwikTracker sharedInstance] sendEvent:event];
+
+ An event is not thread safe, use one event on each thread.
+ */
+@interface PiwikEvent : NSObject
+
+- (instancetype)initWithCategory:(NSString*)category action:(NSString*)action;
+
+/**
+ The category of the event.
+ */
+@property (nonatomic, copy) NSString *category;
+
+/**
+ The name of the action, e.g Play, Pause, Download.
+ */
+@property (nonatomic, copy) NSString *action;
+
+/**
+ Event name, e.g. song name, file name. Optional.
+ */
+@property (nonatomic, copy) NSString *name;
+
+/**
+ A numeric value. Only sent if hasValue is YES, set automatically when the value is set.
+ */
+@property (nonatomic) double value;
+
+@property (nonatomic) BOOL hasValue;
+
+/**
+ Clear the name and the value, keep the category and action.
+ */
+- (void)reset;
+
+@end
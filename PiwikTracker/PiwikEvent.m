@@ -0,0 +1,38 @@
+//
+//  PiwikEvent.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikEvent.h"
+
+
+@implementation PiwikEvent
+
+
+- (instancetype)initWithCategory:(NSString*)category action:(NSString*)action {
+  self = [super init];
+  if (self) {
+    _category = [category copy];
+    _action = [action copy];
+  }
+  return self;
+}
+
+
+- (void)setValue:(double)value {
+  _value = value;
+  _hasValue = YES;
+}
+
+
+- (void)reset {
+  self.name = nil;
+  _value = 0;
+  _hasValue = NO;
+}
+
+
+@end
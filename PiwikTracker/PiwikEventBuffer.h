@@ -0,0 +1,52 @@
+//
+//  PiwikEventBuffer.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ A fixed capacity FIFO ring buffer holding events in memory until they are written to the store.
+
+ The buffer is not thread safe and must only be accessed from the tracker queue.
+ */
+@interface PiwikEventBuffer : NSObject
+
+/**
+ The maximum number of events the buffer can hold.
+ */
+@property (nonatomic, readonly) NSUInteger capacity;
+
+/**
+ The number of events currently in the buffer.
+ */
+@property (nonatomic, readonly) NSUInteger count;
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity;
+
+/**
+ Add an event to the end of the buffer.
+
+ @param event The event.
+ @return NO if the buffer is full and the event was not added.
+ */
+- (BOOL)addEvent:(id)event;
+
+/**
+ Remove events from the beginning of the buffer.
+
+ @param numberOfEvents The maximum number of events to remove.
+ @return The removed events, oldest first.
+ */
+- (NSArray*)drainEvents:(NSUInteger)numberOfEvents;
+
+/**
+ Remove all events without returning them.
+ */
+- (void)removeAllEvents;
+
+@end
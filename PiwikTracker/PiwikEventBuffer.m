@@ -0,0 +1,81 @@
+//
+//  PiwikEventBuffer.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikEventBuffer.h"
+
+
+@interface PiwikEventBuffer ()
+
+@property (nonatomic, strong) NSMutableArray *slots;
+@property (nonatomic) NSUInteger head;
+@property (nonatomic, readwrite) NSUInteger count;
+
+@end
+
+
+@implementation PiwikEventBuffer
+
+
+- (instancetype)initWithCapacity:(NSUInteger)capacity {
+  self = [super init];
+  if (self) {
+    _capacity = capacity;
+
+    // Preallocate all slots, events replace the placeholders
+    _slots = [NSMutableArray arrayWithCapacity:capacity];
+    for (NSUInteger i = 0; i < capacity; i++) {
+      [_slots addObject:[NSNull null]];
+    }
+  }
+  return self;
+}
+
+
+- (BOOL)addEvent:(id)event {
+
+  if (self.count >= self.capacity) {
+    return NO;
+  }
+
+  NSUInteger tail = (self.head + self.count) % self.capacity;
+  [self.slots replaceObjectAtIndex:tail withObject:event];
+  self.count++;
+
+  return YES;
+}
+
+
+- (NSArray*)drainEvents:(NSUInteger)numberOfEvents {
+
+  NSUInteger drainCount = MIN(numberOfEvents, self.count);
+  NSMutableArray *events = [NSMutableArray arrayWithCapacity:drainCount];
+
+  for (NSUInteger i = 0; i < drainCount; i++) {
+    [events addObject:self.slots[self.head]];
+    [self.slots replaceObjectAtIndex:self.head withObject:[NSNull null]];
+    self.head = (self.head + 1) % self.capacity;
+  }
+
+  self.count -= drainCount;
+
+  return events;
+}
+
+
+- (void)removeAllEvents {
+
+  for (NSUInteger i = 0; i < self.count; i++) {
+    [self.slots replaceObjectAtIndex:(self.head + i) % self.capacity withObject:[NSNull null]];
+  }
+
+  self.head = 0;
+  self.count = 0;
+}
+
+
+@end
@@ -0,0 +1,63 @@
+//
+//  PiwikEventCoalescer.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ Merge identical screen views and content impressions tracked within a short interval into one event.
+
+ The first event is queued and identical events tracked within the interval after it are dropped. Only screen views and content impressions are coalesced, all other events are always queued.
+
+ The coalescer is not thread safe and must only be accessed from the tracker queue.
+ */
+@interface PiwikEventCoalescer : NSObject
+
+/**
+ The interval in seconds identical events are merged within. 0 disables coalescing (default).
+ */
+@property (nonatomic) NSTimeInterval interval;
+
+/**
+ The number of events dropped since the coalescer was created.
+ */
+@property (readonly) NSUInteger numberOfCoalescedEvents;
+
+/**
+ The key identifying identical events, nil if the event is never coalesced.
+
+ Screen views are identified by the action name and url, content impressions by the content name, piece and target.
+
+ @param parameters The event parameters as tracked, before any per request or session parameters have been added.
+ */
++ (NSString*)coalescingKeyForParameters:(NSDictionary*)parameters;
+
+/**
+ The key identifying identical stored events when rolling them up, nil if the event is never rolled up.
+
+ Only screen views and content impressions are rolled up. The key holds every parameter of the event except the ones that differ between identical events, the time, the random number and the event identifier. Events of different sites and visitors are never identical.
+
+ @param event The event parameters as read from the store, including the session and static parameters.
+ */
++ (NSString*)rollupKeyForStoredEvent:(NSDictionary*)event;
+
+/**
+ Check if an identical event was queued within the interval. If not the event is remembered and should be queued.
+
+ @param parameters The event parameters as tracked.
+ @param timestamp The time the event was tracked.
+ @return YES if the event should be dropped.
+ */
+- (BOOL)shouldCoalesceEventWithParameters:(NSDictionary*)parameters timestamp:(NSDate*)timestamp;
+
+/**
+ Forget all remembered events, e.g. when a new session start.
+ */
+- (void)removeAllEvents;
+
+@end
@@ -0,0 +1,142 @@
+//
+//  PiwikEventCoalescer.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikEventCoalescer.h"
+#import "PiwikParameters.h"
+
+
+// Expired keys are removed when this many events are remembered
+static NSUInteger const PiwikCoalescerMaximumNumberOfKeys = 256;
+
+// Unit separator, does not appear in screen or content names
+static NSString * const PiwikCoalescerKeySeparator = @"\x1F";
+
+
+@interface PiwikEventCoalescer ()
+
+// The time each remembered event was queued, keyed by coalescing key
+@property (nonatomic, strong) NSMutableDictionary *queuedTimes;
+
+@property (readwrite) NSUInteger numberOfCoalescedEvents;
+
+@end
+
+
+@implementation PiwikEventCoalescer
+
+
+- (instancetype)init {
+  self = [super init];
+  if (self) {
+    _interval = 0;
+    _queuedTimes = [NSMutableDictionary dictionary];
+  }
+  return self;
+}
+
+
++ (NSString*)coalescingKeyForParameters:(NSDictionary*)parameters {
+  
+  // Screen views only hold the action name and the url
+  if (parameters.count == 2 && parameters[PiwikParameterActionName] && parameters[PiwikParameterURL]) {
+    return [@[@"view", parameters[PiwikParameterActionName], parameters[PiwikParameterURL]] componentsJoinedByString:PiwikCoalescerKeySeparator];
+  }
+  
+  // Content impressions, but not interactions
+  if (parameters[PiwikParameterContentName] && !parameters[PiwikParameterContentInteraction]) {
+    NSMutableArray *components = [NSMutableArray arrayWithObjects:@"impression", parameters[PiwikParameterContentName], nil];
+    [components addObject:parameters[PiwikParameterContentPiece] ?: @""];
+    [components addObject:parameters[PiwikParameterContentTarget] ?: @""];
+    return [components componentsJoinedByString:PiwikCoalescerKeySeparator];
+  }
+  
+  return nil;
+}
+
+
++ (NSString*)rollupKeyForStoredEvent:(NSDictionary*)event {
+  
+  // Only screen views have an action name
+  BOOL isScreenView = event[PiwikParameterActionName] != nil;
+  BOOL isContentImpression = event[PiwikParameterContentName] && !event[PiwikParameterContentInteraction];
+  if (!isScreenView && !isContentImpression) {
+    return nil;
+  }
+  
+  static NSSet *excludedKeys;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    excludedKeys = [NSSet setWithObjects:PiwikParameterRandomNumber, PiwikParameterEventIdentifier, PiwikParameterDateAndTime,
+                    PiwikParameterHours, PiwikParameterMinutes, PiwikParameterSeconds, PiwikParameterRollupCount, nil];
+  });
+  
+  // Sorted, the order of the parameters in the store is not defined
+  NSArray *keys = [[event allKeys] sortedArrayUsingSelector:@selector(compare:)];
+  NSMutableArray *components = [NSMutableArray arrayWithCapacity:keys.count * 2];
+  for (NSString *key in keys) {
+    if (![excludedKeys containsObject:key]) {
+      [components addObject:key];
+      [components addObject:[event[key] description]];
+    }
+  }
+  
+  return [components componentsJoinedByString:PiwikCoalescerKeySeparator];
+}
+
+
+- (BOOL)shouldCoalesceEventWithParameters:(NSDictionary*)parameters timestamp:(NSDate*)timestamp {
+  
+  if (self.interval <= 0) {
+    return NO;
+  }
+  
+  NSString *key = [PiwikEventCoalescer coalescingKeyForParameters:parameters];
+  if (!key) {
+    return NO;
+  }
+  
+  NSTimeInterval time = [timestamp timeIntervalSinceReferenceDate];
+  NSNumber *queuedTime = self.queuedTimes[key];
+  
+  if (queuedTime && time - [queuedTime doubleValue] < self.interval) {
+    // One event per interval, the interval is not extended by dropped events
+    self.numberOfCoalescedEvents++;
+    return YES;
+  }
+  
+  if (self.queuedTimes.count >= PiwikCoalescerMaximumNumberOfKeys) {
+    [self removeExpiredKeysAtTime:time];
+  }
+  
+  self.queuedTimes[key] = @(time);
+  
+  return NO;
+}
+
+
+- (void)removeExpiredKeysAtTime:(NSTimeInterval)time {
+  
+  NSSet *expiredKeys = [self.queuedTimes keysOfEntriesPassingTest:^BOOL(id key, NSNumber *queuedTime, BOOL *stop) {
+    return time - [queuedTime doubleValue] >= self.interval;
+  }];
+  [self.queuedTimes removeObjectsForKeys:[expiredKeys allObjects]];
+  
+  if (self.queuedTimes.count >= PiwikCoalescerMaximumNumberOfKeys) {
+    // Many distinct events within the interval, start over rather than growing
+    [self.queuedTimes removeAllObjects];
+  }
+  
+}
+
+
+- (void)removeAllEvents {
+  [self.queuedTimes removeAllObjects];
+}
+
+
+@end
@@ -0,0 +1,68 @@
+//
+//  PiwikEventEncoder.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ The encoding used for a stored event.
+ */
+typedef NS_ENUM(int16_t, PiwikEventEncoding) {
+  // NSKeyedArchiver plist of the full parameter dictionary, used by store versions 1 and 2
+  PiwikEventEncodingKeyedArchive = 0,
+  // Compact binary encoding produced by PiwikEventEncoder
+  PiwikEventEncodingCompact = 1
+};
+
+
+/**
+ Encode and decode events and parameter sets in a compact and versioned binary format.
+
+ Known Piwik parameter names are replaced by small key ids, integers (including strings holding an integer, e.g. h, m, s and r) are written as varints and strings repeated within the same record are only written once.
+
+ Parameters shared by many events, e.g. the static and session parameters, are encoded once as a parameter set. Events reference the parameter sets by their identifier instead of repeating the parameters.
+ */
+@interface PiwikEventEncoder : NSObject
+
+/**
+ Encode the parameters of a single event.
+
+ @param parameters The event parameters.
+ @param parameterSetIDs Identifiers (NSNumber) of the parameter sets merged into the event when it is decoded. Later sets will replace values of earlier sets.
+ @return The encoded event.
+ */
++ (NSData*)dataWithParameters:(NSDictionary*)parameters parameterSetIDs:(NSArray*)parameterSetIDs;
+
+/**
+ Encode a parameter set.
+
+ Parameters are written in a stable order so that equal sets always produce the same data and identifier.
+
+ @param parameters The shared parameters.
+ @return The encoded parameter set.
+ */
++ (NSData*)dataWithParameterSet:(NSDictionary*)parameters;
+
+/**
+ An identifier for an encoded parameter set, derived from its content.
+
+ @param parameterSet The encoded parameter set.
+ @return The identifier.
+ */
++ (NSNumber*)identifierForParameterSet:(NSData*)parameterSet;
+
+/**
+ Decode an event or a parameter set.
+
+ @param data The encoded event or parameter set.
+ @param parameterSetIDs On return the identifiers of the parameter sets referenced by the event. Pass NULL if not needed.
+ @return The decoded parameters, or nil if the data could not be decoded.
+ */
++ (NSDictionary*)parametersWithData:(NSData*)data parameterSetIDs:(NSArray**)parameterSetIDs;
+
+@end
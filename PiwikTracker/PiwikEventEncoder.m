@@ -0,0 +1,437 @@
+//
+//  PiwikEventEncoder.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikEventEncoder.h"
+#import "PiwikParameters.h"
+
+
+// Format version, written as the first byte of each record
+static uint8_t const PiwikEventEncoderVersion = 1;
+
+// Value types
+typedef NS_ENUM(uint8_t, PiwikEncodedValueType) {
+  PiwikEncodedValueTypeString = 0,
+  PiwikEncodedValueTypeStringReference = 1,
+  PiwikEncodedValueTypeIntegerString = 2,
+  PiwikEncodedValueTypeInteger = 3,
+  PiwikEncodedValueTypeDouble = 4,
+  PiwikEncodedValueTypeArchivedObject = 5
+};
+
+// Key id 0 is followed by the key name, strings with more digits will not fit in a 64 bit integer
+static uint64_t const PiwikEncodedKeyInline = 0;
+static size_t const PiwikMaximumIntegerStringLength = 18;
+
+
+#pragma mark - Key table
+
+// The position in the table is the key id (starting at 1) written to disk
+// Never reorder or remove keys, only append new keys at the end
+static NSArray* PiwikEncodedKeys(void) {
+  static NSArray *keys;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    keys = @[PiwikParameterSiteID,
+             PiwikParameterRecord,
+             PiwikParameterAPIVersion,
+             PiwikParameterScreenReseloution,
+             PiwikParameterHours,
+             PiwikParameterMinutes,
+             PiwikParameterSeconds,
+             PiwikParameterDateAndTime,
+             PiwikParameterActionName,
+             PiwikParameterURL,
+             PiwikParameterVisitorID,
+             PiwikParameterUserID,
+             PiwikParameterVisitScopeCustomVariables,
+             PiwikParameterScreenScopeCustomVariables,
+             PiwikParameterRandomNumber,
+             PiwikParameterFirstVisitTimestamp,
+             PiwikParameterPreviousVisitTimestamp,
+             PiwikParameterTotalNumberOfVisits,
+             PiwikParameterGoalID,
+             PiwikParameterRevenue,
+             PiwikParameterSessionStart,
+             PiwikParameterLanguage,
+             PiwikParameterLatitude,
+             PiwikParameterLongitude,
+             PiwikParameterSearchKeyword,
+             PiwikParameterSearchCategory,
+             PiwikParameterSearchNumberOfHits,
+             PiwikParameterLink,
+             PiwikParameterDownload,
+             PiwikParameterSendImage,
+             PiwikParameterTransactionIdentifier,
+             PiwikParameterTransactionSubTotal,
+             PiwikParameterTransactionTax,
+             PiwikParameterTransactionShipping,
+             PiwikParameterTransactionDiscount,
+             PiwikParameterTransactionItems,
+             PiwikParameterReferrer,
+             PiwikParameterCampaignName,
+             PiwikParameterCampaignKeyword,
+             PiwikParameterEventCategory,
+             PiwikParameterEventAction,
+             PiwikParameterEventName,
+             PiwikParameterEventValue,
+             PiwikParameterContentName,
+             PiwikParameterContentPiece,
+             PiwikParameterContentTarget,
+             PiwikParameterContentInteraction,
+             PiwikParameterEventIdentifier];
+  });
+  return keys;
+}
+
+
+static NSDictionary* PiwikEncodedKeyIDs(void) {
+  static NSDictionary *keyIDs;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    NSArray *keys = PiwikEncodedKeys();
+    NSMutableDictionary *mutableKeyIDs = [NSMutableDictionary dictionaryWithCapacity:keys.count];
+    [keys enumerateObjectsUsingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
+      mutableKeyIDs[obj] = @(idx + 1);
+    }];
+    keyIDs = [mutableKeyIDs copy];
+  });
+  return keyIDs;
+}
+
+
+#pragma mark - Primitives
+
+static inline void PiwikAppendVarint(NSMutableData *data, uint64_t value) {
+  uint8_t buffer[10];
+  size_t length = 0;
+  do {
+    uint8_t byte = value & 0x7F;
+    value >>= 7;
+    buffer[length++] = value ? (byte | 0x80) : byte;
+  } while (value);
+  [data appendBytes:buffer length:length];
+}
+
+
+static inline BOOL PiwikReadVarint(const uint8_t *bytes, NSUInteger length, NSUInteger *offset, uint64_t *value) {
+  uint64_t result = 0;
+  for (unsigned shift = 0; shift < 64 && *offset < length; shift += 7) {
+    uint8_t byte = bytes[(*offset)++];
+    result |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return YES;
+    }
+  }
+  return NO;
+}
+
+
+static inline uint64_t PiwikZigZagEncode(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+
+static inline int64_t PiwikZigZagDecode(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+
+static inline void PiwikAppendString(NSMutableData *data, const char *string, size_t length) {
+  PiwikAppendVarint(data, length);
+  [data appendBytes:string length:length];
+}
+
+
+// YES if the string is the canonical decimal representation of an integer, i.e. it will be identical when decoded
+static BOOL PiwikParseIntegerString(const char *string, size_t length, int64_t *value) {
+
+  if (length == 0 || length > PiwikMaximumIntegerStringLength) {
+    return NO;
+  }
+
+  size_t index = 0;
+  BOOL isNegative = string[0] == '-';
+  if (isNegative) {
+    index++;
+  }
+
+  size_t numberOfDigits = length - index;
+  if (numberOfDigits == 0 || (string[index] == '0' && (numberOfDigits > 1 || isNegative))) {
+    // Leading zeros and -0 would not survive the round trip
+    return NO;
+  }
+
+  int64_t result = 0;
+  for (; index < length; index++) {
+    char c = string[index];
+    if (c < '0' || c > '9') {
+      return NO;
+    }
+    result = result * 10 + (c - '0');
+  }
+
+  *value = isNegative ? -result : result;
+  return YES;
+}
+
+
+#pragma mark - Encoder
+
+@implementation PiwikEventEncoder
+
+
++ (NSData*)dataWithParameters:(NSDictionary*)parameters parameterSetIDs:(NSArray*)parameterSetIDs {
+  return [self dataWithParameters:parameters keys:[parameters allKeys] parameterSetIDs:parameterSetIDs];
+}
+
+
++ (NSData*)dataWithParameterSet:(NSDictionary*)parameters {
+  NSArray *sortedKeys = [[parameters allKeys] sortedArrayUsingSelector:@selector(compare:)];
+  return [self dataWithParameters:parameters keys:sortedKeys parameterSetIDs:nil];
+}
+
+
++ (NSData*)dataWithParameters:(NSDictionary*)parameters keys:(NSArray*)keys parameterSetIDs:(NSArray*)parameterSetIDs {
+
+  NSDictionary *keyIDs = PiwikEncodedKeyIDs();
+  NSMutableDictionary *stringTable = [NSMutableDictionary dictionary];
+
+  NSMutableData *data = [NSMutableData dataWithCapacity:parameters.count * 8 + 16];
+  [data appendBytes:&PiwikEventEncoderVersion length:1];
+
+  PiwikAppendVarint(data, parameterSetIDs.count);
+  for (NSNumber *parameterSetID in parameterSetIDs) {
+    PiwikAppendVarint(data, [parameterSetID unsignedLongLongValue]);
+  }
+
+  PiwikAppendVarint(data, keys.count);
+
+  for (NSString *key in keys) {
+
+    // Key
+    NSNumber *keyID = keyIDs[key];
+    if (keyID) {
+      PiwikAppendVarint(data, [keyID unsignedLongLongValue]);
+    } else {
+      PiwikAppendVarint(data, PiwikEncodedKeyInline);
+      const char *keyString = [key UTF8String];
+      PiwikAppendString(data, keyString, strlen(keyString));
+    }
+
+    // Value
+    id value = parameters[key];
+
+    if ([value isKindOfClass:[NSString class]]) {
+
+      NSNumber *stringIndex = stringTable[value];
+      if (stringIndex) {
+        // Already written in this record
+        uint8_t type = PiwikEncodedValueTypeStringReference;
+        [data appendBytes:&type length:1];
+        PiwikAppendVarint(data, [stringIndex unsignedLongLongValue]);
+        continue;
+      }
+
+      const char *string = [value UTF8String];
+      size_t length = strlen(string);
+      int64_t integer;
+
+      if (PiwikParseIntegerString(string, length, &integer)) {
+        uint8_t type = PiwikEncodedValueTypeIntegerString;
+        [data appendBytes:&type length:1];
+        PiwikAppendVarint(data, PiwikZigZagEncode(integer));
+      } else {
+        uint8_t type = PiwikEncodedValueTypeString;
+        [data appendBytes:&type length:1];
+        PiwikAppendString(data, string, length);
+        stringTable[value] = @(stringTable.count);
+      }
+
+    } else if ([value isKindOfClass:[NSNumber class]]) {
+
+      if (CFNumberIsFloatType((__bridge CFNumberRef)value)) {
+        uint8_t type = PiwikEncodedValueTypeDouble;
+        [data appendBytes:&type length:1];
+        // Always big endian on disk
+        CFSwappedFloat64 swapped = CFConvertDoubleHostToSwapped([value doubleValue]);
+        [data appendBytes:&swapped.v length:sizeof(swapped.v)];
+      } else {
+        uint8_t type = PiwikEncodedValueTypeInteger;
+        [data appendBytes:&type length:1];
+        PiwikAppendVarint(data, PiwikZigZagEncode([value longLongValue]));
+      }
+
+    } else {
+
+      // Any other type is not expected but must not be lost
+      uint8_t type = PiwikEncodedValueTypeArchivedObject;
+      [data appendBytes:&type length:1];
+      NSData *archive = [NSKeyedArchiver archivedDataWithRootObject:value];
+      PiwikAppendVarint(data, archive.length);
+      [data appendData:archive];
+
+    }
+
+  }
+
+  return data;
+}
+
+
++ (NSNumber*)identifierForParameterSet:(NSData*)parameterSet {
+
+  // 64 bit FNV-1a, reduced to 63 bits to fit a signed integer in the store
+  const uint8_t *bytes = parameterSet.bytes;
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (NSUInteger i = 0; i < parameterSet.length; i++) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+
+  return @((int64_t)(hash & INT64_MAX));
+}
+
+
++ (NSDictionary*)parametersWithData:(NSData*)data parameterSetIDs:(NSArray**)parameterSetIDs {
+
+  const uint8_t *bytes = data.bytes;
+  NSUInteger length = data.length;
+  NSUInteger offset = 0;
+
+  if (length == 0 || bytes[offset++] != PiwikEventEncoderVersion) {
+    return nil;
+  }
+
+  uint64_t count;
+
+  // Parameter set references
+  if (!PiwikReadVarint(bytes, length, &offset, &count) || count > length) {
+    return nil;
+  }
+  NSMutableArray *setIDs = [NSMutableArray arrayWithCapacity:(NSUInteger)count];
+  for (uint64_t i = 0; i < count; i++) {
+    uint64_t setID;
+    if (!PiwikReadVarint(bytes, length, &offset, &setID)) {
+      return nil;
+    }
+    [setIDs addObject:@((int64_t)setID)];
+  }
+
+  // Parameters
+  if (!PiwikReadVarint(bytes, length, &offset, &count) || count > length) {
+    return nil;
+  }
+
+  NSArray *keys = PiwikEncodedKeys();
+  NSMutableArray *stringTable = [NSMutableArray array];
+  NSMutableDictionary *parameters = [NSMutableDictionary dictionaryWithCapacity:(NSUInteger)count];
+
+  for (uint64_t i = 0; i < count; i++) {
+
+    // Key
+    uint64_t keyID;
+    if (!PiwikReadVarint(bytes, length, &offset, &keyID)) {
+      return nil;
+    }
+
+    NSString *key;
+    if (keyID == PiwikEncodedKeyInline) {
+      uint64_t keyLength;
+      if (!PiwikReadVarint(bytes, length, &offset, &keyLength) || keyLength > length - offset) {
+        return nil;
+      }
+      key = [[NSString alloc] initWithBytes:bytes + offset length:(NSUInteger)keyLength encoding:NSUTF8StringEncoding];
+      offset += (NSUInteger)keyLength;
+    } else if (keyID <= keys.count) {
+      key = keys[(NSUInteger)keyID - 1];
+    }
+
+    if (!key || offset >= length) {
+      return nil;
+    }
+
+    // Value
+    id value;
+    uint8_t type = bytes[offset++];
+    uint64_t raw;
+
+    switch (type) {
+
+      case PiwikEncodedValueTypeString:
+        if (!PiwikReadVarint(bytes, length, &offset, &raw) || raw > length - offset) {
+          return nil;
+        }
+        value = [[NSString alloc] initWithBytes:bytes + offset length:(NSUInteger)raw encoding:NSUTF8StringEncoding];
+        offset += (NSUInteger)raw;
+        if (value) {
+          [stringTable addObject:value];
+        }
+        break;
+
+      case PiwikEncodedValueTypeStringReference:
+        if (!PiwikReadVarint(bytes, length, &offset, &raw) || raw >= stringTable.count) {
+          return nil;
+        }
+        value = stringTable[(NSUInteger)raw];
+        break;
+
+      case PiwikEncodedValueTypeIntegerString:
+        if (!PiwikReadVarint(bytes, length, &offset, &raw)) {
+          return nil;
+        }
+        value = [NSString stringWithFormat:@"%lld", (long long)PiwikZigZagDecode(raw)];
+        break;
+
+      case PiwikEncodedValueTypeInteger:
+        if (!PiwikReadVarint(bytes, length, &offset, &raw)) {
+          return nil;
+        }
+        value = @(PiwikZigZagDecode(raw));
+        break;
+
+      case PiwikEncodedValueTypeDouble: {
+        if (length - offset < sizeof(uint64_t)) {
+          return nil;
+        }
+        CFSwappedFloat64 swapped;
+        memcpy(&swapped.v, bytes + offset, sizeof(uint64_t));
+        offset += sizeof(uint64_t);
+        value = @(CFConvertDoubleSwappedToHost(swapped));
+        break;
+      }
+
+      case PiwikEncodedValueTypeArchivedObject:
+        if (!PiwikReadVarint(bytes, length, &offset, &raw) || raw > length - offset) {
+          return nil;
+        }
+        value = [NSKeyedUnarchiver unarchiveObjectWithData:[data subdataWithRange:NSMakeRange(offset, (NSUInteger)raw)]];
+        offset += (NSUInteger)raw;
+        break;
+
+      default:
+        // Unknown type, written by a newer version
+        return nil;
+    }
+
+    if (!value) {
+      return nil;
+    }
+
+    parameters[key] = value;
+  }
+
+  if (parameterSetIDs) {
+    *parameterSetIDs = setIDs;
+  }
+
+  return parameters;
+}
+
+
+@end
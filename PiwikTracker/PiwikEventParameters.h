@@ -0,0 +1,43 @@
+//
+//  PiwikEventParameters.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ The parameters of a stored event and the parameter sets it reference, e.g. the static and session parameters, returned by the event stores.
+
+ The event behave as an immutable dictionary holding all parameters, values in later parameter sets replace values of earlier sets and of the event. The parameters are only merged if the dictionary is enumerated. PiwikQuerySerializer write the event parameters and the cached parameter sets without merging them.
+ */
+@interface PiwikEventParameters : NSDictionary
+
+/**
+ Create event parameters.
+
+ @param parameters The parameters of the event itself.
+ @param parameterSets The parameter sets (NSDictionary) referenced by the event.
+ @param parameterSetIDs The identifiers of the parameter sets, in the same order.
+ */
+- (instancetype)initWithParameters:(NSDictionary*)parameters parameterSets:(NSArray*)parameterSets parameterSetIDs:(NSArray*)parameterSetIDs;
+
+/**
+ The parameters of the event itself.
+ */
+@property (nonatomic, readonly, strong) NSDictionary *parameters;
+
+/**
+ The parameter sets referenced by the event.
+ */
+@property (nonatomic, readonly, strong) NSArray *parameterSets;
+
+/**
+ The identifiers of the parameter sets. Equal identifiers always refer to equal parameter sets.
+ */
+@property (nonatomic, readonly, strong) NSArray *parameterSetIDs;
+
+@end
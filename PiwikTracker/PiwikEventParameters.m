@@ -0,0 +1,94 @@
+//
+//  PiwikEventParameters.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikEventParameters.h"
+
+
+@interface PiwikEventParameters ()
+
+// Created the first time the parameters are counted or enumerated
+@property (nonatomic, strong) NSDictionary *mergedParameters;
+
+@end
+
+
+@implementation PiwikEventParameters
+
+
+- (instancetype)initWithParameters:(NSDictionary*)parameters parameterSets:(NSArray*)parameterSets parameterSetIDs:(NSArray*)parameterSetIDs {
+  self = [super init];
+  if (self) {
+    _parameters = parameters;
+    _parameterSets = parameterSets;
+    _parameterSetIDs = parameterSetIDs;
+  }
+  return self;
+}
+
+
+- (NSDictionary*)mergedParameters {
+
+  @synchronized(self) {
+
+    if (!_mergedParameters) {
+      NSMutableDictionary *mergedParameters = [NSMutableDictionary dictionaryWithDictionary:self.parameters];
+      for (NSDictionary *parameterSet in self.parameterSets) {
+        [mergedParameters addEntriesFromDictionary:parameterSet];
+      }
+      _mergedParameters = mergedParameters;
+    }
+
+    return _mergedParameters;
+  }
+
+}
+
+
+#pragma mark NSDictionary primitive methods
+
+- (NSUInteger)count {
+  return self.mergedParameters.count;
+}
+
+
+// Look up values without merging the parameters
+- (id)objectForKey:(id)key {
+
+  for (NSDictionary *parameterSet in [self.parameterSets reverseObjectEnumerator]) {
+    id value = parameterSet[key];
+    if (value) {
+      return value;
+    }
+  }
+
+  return self.parameters[key];
+}
+
+
+- (NSEnumerator*)keyEnumerator {
+  return [self.mergedParameters keyEnumerator];
+}
+
+
+- (void)enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id obj, BOOL *stop))block {
+  [self.mergedParameters enumerateKeysAndObjectsUsingBlock:block];
+}
+
+
+- (void)enumerateKeysAndObjectsWithOptions:(NSEnumerationOptions)options usingBlock:(void (^)(id key, id obj, BOOL *stop))block {
+  [self.mergedParameters enumerateKeysAndObjectsWithOptions:options usingBlock:block];
+}
+
+
+- (id)copyWithZone:(NSZone*)zone {
+  // Immutable
+  return self;
+}
+
+
+@end
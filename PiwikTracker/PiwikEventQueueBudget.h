@@ -0,0 +1,59 @@
+//
+//  PiwikEventQueueBudget.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "PiwikEventStore.h"
+
+
+/**
+ Keep track of the number of stored events in each priority lane and decide which events to drop when the store is full.
+
+ All lanes share maximumNumberOfEvents and each lane may hold at most its own quota. Used by the event stores, the counters may be read from any thread.
+ */
+@interface PiwikEventQueueBudget : NSObject
+
+/**
+ The maximum number of events in all lanes.
+ */
+@property (nonatomic) NSUInteger maximumNumberOfEvents;
+
+@property (nonatomic) PiwikEventOverflowPolicy overflowPolicy;
+
+/**
+ The number of events in all lanes.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfEvents;
+
+/**
+ Set the maximum number of events in a lane. Default NSUIntegerMax, only limited by maximumNumberOfEvents.
+ */
+- (void)setMaximumNumberOfEvents:(NSUInteger)maximumNumberOfEvents forPriority:(PiwikEventPriority)priority;
+
+- (NSUInteger)numberOfEventsWithPriority:(PiwikEventPriority)priority;
+
+- (void)setNumberOfEvents:(NSUInteger)numberOfEvents withPriority:(PiwikEventPriority)priority;
+
+- (void)addNumberOfEvents:(NSUInteger)numberOfEvents withPriority:(PiwikEventPriority)priority;
+
+- (void)removeNumberOfEvents:(NSUInteger)numberOfEvents withPriority:(PiwikEventPriority)priority;
+
+- (void)removeAllEvents;
+
+/**
+ Decide how many new events to store and how many of the oldest stored events to delete to make room for them.
+
+ The counters are not updated.
+
+ @param numberOfEvents The number of new events.
+ @param priority The priority of the new events.
+ @param numberOfEventsToDelete On return the number of the oldest events to delete in each lane, indexed by priority. Must hold PiwikNumberOfEventPriorities values.
+ @return The number of new events to store. The newest events are kept if not all can be stored.
+ */
+- (NSUInteger)numberOfEventsToStore:(NSUInteger)numberOfEvents withPriority:(PiwikEventPriority)priority numberOfEventsToDelete:(NSUInteger*)numberOfEventsToDelete;
+
+@end
@@ -0,0 +1,135 @@
+//
+//  PiwikEventQueueBudget.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikEventQueueBudget.h"
+
+
+@implementation PiwikEventQueueBudget {
+  NSUInteger _numberOfEventsInLane[PiwikNumberOfEventPriorities];
+  NSUInteger _maximumNumberOfEventsInLane[PiwikNumberOfEventPriorities];
+}
+
+
+- (instancetype)init {
+  self = [super init];
+  if (self) {
+    _maximumNumberOfEvents = NSUIntegerMax;
+    for (NSUInteger i = 0; i < PiwikNumberOfEventPriorities; i++) {
+      _maximumNumberOfEventsInLane[i] = NSUIntegerMax;
+    }
+  }
+  return self;
+}
+
+
+- (NSUInteger)numberOfEvents {
+  @synchronized(self) {
+    NSUInteger numberOfEvents = 0;
+    for (NSUInteger i = 0; i < PiwikNumberOfEventPriorities; i++) {
+      numberOfEvents += _numberOfEventsInLane[i];
+    }
+    return numberOfEvents;
+  }
+}
+
+
+- (void)setMaximumNumberOfEvents:(NSUInteger)maximumNumberOfEvents forPriority:(PiwikEventPriority)priority {
+  @synchronized(self) {
+    _maximumNumberOfEventsInLane[MIN(priority, PiwikNumberOfEventPriorities - 1)] = maximumNumberOfEvents;
+  }
+}
+
+
+- (NSUInteger)numberOfEventsWithPriority:(PiwikEventPriority)priority {
+  @synchronized(self) {
+    return _numberOfEventsInLane[MIN(priority, PiwikNumberOfEventPriorities - 1)];
+  }
+}
+
+
+- (void)setNumberOfEvents:(NSUInteger)numberOfEvents withPriority:(PiwikEventPriority)priority {
+  @synchronized(self) {
+    _numberOfEventsInLane[MIN(priority, PiwikNumberOfEventPriorities - 1)] = numberOfEvents;
+  }
+}
+
+
+- (void)addNumberOfEvents:(NSUInteger)numberOfEvents withPriority:(PiwikEventPriority)priority {
+  @synchronized(self) {
+    _numberOfEventsInLane[MIN(priority, PiwikNumberOfEventPriorities - 1)] += numberOfEvents;
+  }
+}
+
+
+- (void)removeNumberOfEvents:(NSUInteger)numberOfEvents withPriority:(PiwikEventPriority)priority {
+  @synchronized(self) {
+    NSUInteger lane = MIN(priority, PiwikNumberOfEventPriorities - 1);
+    _numberOfEventsInLane[lane] -= MIN(numberOfEvents, _numberOfEventsInLane[lane]);
+  }
+}
+
+
+- (void)removeAllEvents {
+  @synchronized(self) {
+    for (NSUInteger i = 0; i < PiwikNumberOfEventPriorities; i++) {
+      _numberOfEventsInLane[i] = 0;
+    }
+  }
+}
+
+
+- (NSUInteger)numberOfEventsToStore:(NSUInteger)numberOfEvents withPriority:(PiwikEventPriority)priority numberOfEventsToDelete:(NSUInteger*)numberOfEventsToDelete {
+  @synchronized(self) {
+    NSUInteger lane = MIN(priority, PiwikNumberOfEventPriorities - 1);
+
+    NSUInteger remaining[PiwikNumberOfEventPriorities];
+    for (NSUInteger i = 0; i < PiwikNumberOfEventPriorities; i++) {
+      numberOfEventsToDelete[i] = 0;
+      remaining[i] = _numberOfEventsInLane[i];
+    }
+
+    // First the quota of the lane
+    NSUInteger laneMaximum = MIN(_maximumNumberOfEventsInLane[lane], self.maximumNumberOfEvents);
+    NSUInteger numberOfEventsToStore;
+    if (self.overflowPolicy == PiwikEventOverflowPolicyDropOldest) {
+      numberOfEventsToStore = MIN(numberOfEvents, laneMaximum);
+      if (remaining[lane] + numberOfEventsToStore > laneMaximum) {
+        numberOfEventsToDelete[lane] = MIN(remaining[lane] + numberOfEventsToStore - laneMaximum, remaining[lane]);
+        remaining[lane] -= numberOfEventsToDelete[lane];
+      }
+    } else {
+      numberOfEventsToStore = remaining[lane] < laneMaximum ? MIN(numberOfEvents, laneMaximum - remaining[lane]) : 0;
+    }
+
+    // Then the limit shared by all lanes
+    NSUInteger total = 0;
+    for (NSUInteger i = 0; i < PiwikNumberOfEventPriorities; i++) {
+      total += remaining[i];
+    }
+
+    NSUInteger excess = total + numberOfEventsToStore > self.maximumNumberOfEvents ? total + numberOfEventsToStore - self.maximumNumberOfEvents : 0;
+
+    if (excess > 0 && self.overflowPolicy == PiwikEventOverflowPolicyDropOldest) {
+      NSUInteger numberOfEventsToDeleteInLane = MIN(excess, remaining[lane]);
+      numberOfEventsToDelete[lane] += numberOfEventsToDeleteInLane;
+      excess -= numberOfEventsToDeleteInLane;
+    } else if (excess > 0 && self.overflowPolicy == PiwikEventOverflowPolicyDropLowestPriority) {
+      for (NSUInteger i = 0; i < lane && excess > 0; i++) {
+        NSUInteger numberOfEventsToDeleteInLane = MIN(excess, remaining[i]);
+        numberOfEventsToDelete[i] += numberOfEventsToDeleteInLane;
+        excess -= numberOfEventsToDeleteInLane;
+      }
+    }
+
+    // What is left could not be made room for
+    return numberOfEventsToStore - MIN(excess, numberOfEventsToStore);
+  }
+}
+
+
+@end
@@ -0,0 +1,182 @@
+//
+//  PiwikEventStore.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "PiwikEventParameters.h"
+
+
+/**
+ The priority of an event. Events are stored in one lane per priority and each lane is dispatched with its own schedule.
+ */
+typedef NS_ENUM(NSUInteger, PiwikEventPriority) {
+  // Screen views, events, content impressions etc. (default)
+  PiwikEventPriorityNormal = 0,
+  // Goals and transactions
+  PiwikEventPriorityHigh
+};
+
+static NSUInteger const PiwikNumberOfEventPriorities = 2;
+
+
+/**
+ What to do with new events when the store is full.
+ */
+typedef NS_ENUM(NSUInteger, PiwikEventOverflowPolicy) {
+  // New events are dropped (default)
+  PiwikEventOverflowPolicyDropNewest = 0,
+  // The oldest stored events with the same priority are deleted to make room for the new events
+  PiwikEventOverflowPolicyDropOldest,
+  // The oldest stored events with a lower priority are deleted to make room for the new events, otherwise new events are dropped
+  PiwikEventOverflowPolicyDropLowestPriority
+};
+
+
+/**
+ The event store persist tracked events until they have been successfully dispatched to the Piwik server.
+
+ The tracker use the store as a FIFO queue. Events are appended, the oldest events are read and sent to the server and on success they are deleted.
+
+ Two stores are included:
+ 1) PiwikCoreDataEventStore (default)
+ 2) PiwikJournalEventStore, an append-only memory mapped journal that does not need to set up Core Data
+
+ Developers can provide their own store by implementing this protocol.
+
+ Events are handed to the store as encoded data together with the encoded parameter sets they reference, see PiwikEventEncoder. Parameter sets are only passed to the store when they first appear and the sets currently in use are passed with every write. A store may remove all parameter sets once the store is empty.
+
+ All methods must be asynchronous and return immediately. Completion blocks may be run on any queue.
+ */
+@protocol PiwikEventStore <NSObject>
+
+/**
+ The maximum number of events kept in the store. Events stored after the limit has been reached are dropped.
+ */
+@property (nonatomic) NSUInteger maximumNumberOfEvents;
+
+/**
+ Append events to the store.
+
+ @param events Encoded events (NSData) in the order they were tracked.
+ @param parameterSets Encoded parameter sets (NSData) referenced by the events, keyed by their identifier.
+ @param completionBlock Run when the events have been written. May be nil.
+ */
+- (void)storeEvents:(NSArray*)events parameterSets:(NSDictionary*)parameterSets completionBlock:(void (^)(void))completionBlock;
+
+/**
+ Read the oldest events from the store.
+
+ The store must support several reads of disjoint ranges of events before the earlier events have been deleted.
+
+ Events are decoded and returned as PiwikEventParameters referencing their parameter sets, the parameters are merged when the request is created. Events that can not be decoded must be removed from the store.
+
+ @param numberOfEvents The maximum number of events to read.
+ @param excludedEventIDs Identifiers of events that must be skipped, e.g. events that are currently being sent. May be nil.
+ @param completionBlock Run with the identifiers of the events, to be passed to deleteEventsWithIDs:, the event parameters and YES if there are more events in the store. Identifiers and events are nil if the store is empty.
+ */
+- (void)eventsFromStore:(NSUInteger)numberOfEvents excludingEventIDs:(NSSet*)excludedEventIDs completionBlock:(void (^)(NSArray *eventIDs, NSArray *events, BOOL hasMore))completionBlock;
+
+/**
+ Delete events from the store.
+
+ @param eventIDs Event identifiers returned by eventsFromStore:excludingEventIDs:completionBlock:.
+ */
+- (void)deleteEventsWithIDs:(NSArray*)eventIDs;
+
+/**
+ Delete all events and parameter sets from the store.
+ */
+- (void)deleteAllStoredEvents;
+
+/**
+ Block until all pending store operations have finished, e.g. before the app is suspended.
+ */
+- (void)waitUntilAllOperationsAreFinished;
+
+
+@optional
+
+/**
+ Convert event identifiers to property list objects that remain valid after the app has been relaunched.
+
+ Required for background dispatch, where events sent by the system are deleted when the app is launched again.
+
+ @param eventIDs Event identifiers returned by eventsFromStore:excludingEventIDs:completionBlock:.
+ @return The archivable identifiers in the same order.
+ */
+- (NSArray*)archivableEventIDs:(NSArray*)eventIDs;
+
+/**
+ Convert archivable event identifiers back to event identifiers.
+
+ @param archivableEventIDs Identifiers returned by archivableEventIDs:.
+ @return The event identifiers. Identifiers that are no longer valid are left out.
+ */
+- (NSArray*)eventIDsFromArchivableEventIDs:(NSArray*)archivableEventIDs;
+
+/**
+ What to do with new events when the store hold maximumNumberOfEvents events. Default PiwikEventOverflowPolicyDropNewest.
+ */
+@property (nonatomic) PiwikEventOverflowPolicy overflowPolicy;
+
+/**
+ The number of events in the store, counted once when the store is opened and then kept up to date. May be read from any thread.
+ */
+@property (readonly) NSUInteger numberOfEvents;
+
+/**
+ The number of events dropped because the store was full, since the store was created. May be read from any thread.
+ */
+@property (readonly) NSUInteger numberOfDroppedEvents;
+
+/**
+ Open the store and count the stored events without blocking the calling thread, e.g. to keep a database migration off the launch path. Stores are otherwise opened by the first operation.
+
+ May be called from any thread, before any other method.
+
+ @param completionBlock Run on a background queue when the store is open.
+ */
+- (void)openWithCompletionBlock:(void (^)(void))completionBlock;
+
+/**
+ Append events with a priority to the store. storeEvents:parameterSets:completionBlock: store events with PiwikEventPriorityNormal.
+
+ Required for priority lanes, without it all events are stored and dispatched as normal priority events.
+ */
+- (void)storeEvents:(NSArray*)events priority:(PiwikEventPriority)priority parameterSets:(NSDictionary*)parameterSets completionBlock:(void (^)(void))completionBlock;
+
+/**
+ Read the oldest events with at least the given priority. eventsFromStore:excludingEventIDs:completionBlock: read events of all priorities.
+
+ @param numberOfEvents The maximum number of events to read.
+ @param minimumPriority The lowest priority of the events to read.
+ @param excludedEventIDs Identifiers of events that must be skipped. May be nil.
+ @param completionBlock Same as for eventsFromStore:excludingEventIDs:completionBlock:, hasMore only refer to events with at least the given priority.
+ */
+- (void)eventsFromStore:(NSUInteger)numberOfEvents minimumPriority:(PiwikEventPriority)minimumPriority excludingEventIDs:(NSSet*)excludedEventIDs completionBlock:(void (^)(NSArray *eventIDs, NSArray *events, BOOL hasMore))completionBlock;
+
+/**
+ The maximum number of events kept in the lane of the given priority. All lanes share maximumNumberOfEvents. Default no limit other than maximumNumberOfEvents.
+ */
+- (void)setMaximumNumberOfEvents:(NSUInteger)maximumNumberOfEvents forPriority:(PiwikEventPriority)priority;
+
+/**
+ The number of events in the lane of the given priority. May be read from any thread.
+ */
+- (NSUInteger)numberOfEventsWithPriority:(PiwikEventPriority)priority;
+
+/**
+ Delete the events stored before a date, in one range delete without reading the events.
+
+ Required for the tracker retention window. A store may keep some events stored shortly before the date, e.g. if it only tracks the time in larger ranges of events.
+
+ @param date Events stored before this date are deleted.
+ @param completionBlock Run with the number of deleted events. May be nil.
+ */
+- (void)deleteEventsStoredBeforeDate:(NSDate*)date completionBlock:(void (^)(NSUInteger numberOfDeletedEvents))completionBlock;
+
+@end
@@ -0,0 +1,31 @@
+//
+//  PiwikGzip.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ The default minimum size in bytes of a request body before it is compressed.
+ */
+extern NSUInteger const PiwikDefaultCompressionThreshold;
+
+
+/**
+ gzip compression of request bodies using the system zlib.
+ */
+@interface PiwikGzip : NSObject
+
+/**
+ Compress data in the gzip format.
+ 
+ @param data The data to compress.
+ @return The compressed data, or nil if the data could not be compressed.
+ */
++ (NSData*)gzipData:(NSData*)data;
+
+@end
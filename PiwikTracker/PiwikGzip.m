@@ -0,0 +1,52 @@
+//
+//  PiwikGzip.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikGzip.h"
+#include <zlib.h>
+
+
+NSUInteger const PiwikDefaultCompressionThreshold = 1024;
+
+// Window bits + 16 tell zlib to write a gzip header and trailer instead of a zlib wrapper
+static int const PiwikGzipWindowBits = 15 + 16;
+static int const PiwikGzipMemoryLevel = 8;
+
+
+@implementation PiwikGzip
+
+
++ (NSData*)gzipData:(NSData*)data {
+  
+  if (data.length == 0 || data.length > UINT_MAX) {
+    return nil;
+  }
+  
+  z_stream stream;
+  bzero(&stream, sizeof(stream));
+  
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, PiwikGzipWindowBits, PiwikGzipMemoryLevel, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return nil;
+  }
+  
+  // The bound is large enough to compress in a single call
+  NSMutableData *compressedData = [NSMutableData dataWithLength:deflateBound(&stream, (uLong)data.length)];
+  
+  stream.next_in = (Bytef*)data.bytes;
+  stream.avail_in = (uInt)data.length;
+  stream.next_out = compressedData.mutableBytes;
+  stream.avail_out = (uInt)compressedData.length;
+  
+  int result = deflate(&stream, Z_FINISH);
+  compressedData.length = stream.total_out;
+  deflateEnd(&stream);
+  
+  return result == Z_STREAM_END ? compressedData : nil;
+}
+
+
+@end
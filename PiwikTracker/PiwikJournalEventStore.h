@@ -0,0 +1,56 @@
+//
+//  PiwikJournalEventStore.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+#import "PiwikEventStore.h"
+
+
+/**
+ An event store backed by an append-only journal of memory mapped segment files.
+
+ Events are appended to the newest segment and read from a persisted read cursor. Deleted events are flagged in place and the cursor is moved past them. Segments behind the cursor are recycled and used for new events.
+
+ The journal is opened the first time the store is used and does not require Core Data. Reading events does not create any intermediate objects besides the decoded parameters.
+
+ Events queued in a PiwikCoreDataEventStore are not moved to the journal.
+ */
+@interface PiwikJournalEventStore : NSObject <PiwikEventStore>
+
+/**
+ Create a journal store in the application documents directory.
+ */
+- (instancetype)init;
+
+/**
+ Create a journal store.
+
+ @param directoryURL The directory holding the journal files. It will be created if it does not exist.
+ */
+- (instancetype)initWithDirectoryURL:(NSURL*)directoryURL;
+
+/**
+ The directory holding the journal files.
+ */
+@property (nonatomic, readonly, strong) NSURL *directoryURL;
+
+/**
+ The size in bytes of each segment file. Default 256 KB.
+
+ Events larger than the segment size are written to a larger segment of their own. Must be set before the store is used.
+ */
+@property (nonatomic) NSUInteger segmentSize;
+
+@property (nonatomic) NSUInteger maximumNumberOfEvents;
+
+@property (nonatomic) PiwikEventOverflowPolicy overflowPolicy;
+
+@property (readonly) NSUInteger numberOfEvents;
+
+@property (readonly) NSUInteger numberOfDroppedEvents;
+
+@end
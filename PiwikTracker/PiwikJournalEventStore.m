@@ -0,0 +1,967 @@
+//
+//  PiwikJournalEventStore.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikJournalEventStore.h"
+#import "PiwikEventEncoder.h"
+#import "PiwikEventParameters.h"
+#import "PiwikEventQueueBudget.h"
+#import "PiwikLogging.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#pragma mark - Constants
+
+static char * const PiwikJournalQueueLabel = "org.piwik.tracker.journal";
+
+static NSString * const PiwikJournalDirectoryName = @"piwiktracker.journal";
+static NSString * const PiwikJournalSegmentExtension = @"segment";
+static NSString * const PiwikJournalSpareSegmentName = @"spare.segment";
+static NSString * const PiwikJournalCursorFileName = @"cursor";
+static NSString * const PiwikJournalParameterSetsFileName = @"parametersets";
+
+static NSUInteger const PiwikJournalDefaultSegmentSize = 256 * 1024;
+static NSUInteger const PiwikJournalMaximumRecordLength = 16 * 1024 * 1024;
+
+// "PTJ1", first four bytes of every segment and of the cursor file
+static uint32_t const PiwikJournalMagic = 0x314A5450;
+static uint32_t const PiwikJournalSegmentHeaderSize = 8;
+
+// Each record: payload length (uint32 little endian), state (uint8), payload
+// The state byte hold the state in the lower four bits and the event priority in the upper four bits, zero in records written by earlier versions
+// A zero length marks the end of the written part of the segment
+static uint32_t const PiwikJournalRecordHeaderSize = 5;
+static uint8_t const PiwikJournalRecordStateMask = 0x0F;
+static uint8_t const PiwikJournalRecordPriorityShift = 4;
+
+typedef NS_ENUM(uint8_t, PiwikJournalRecordState) {
+  PiwikJournalRecordStateLive = 1,
+  PiwikJournalRecordStateDeleted = 2
+};
+
+
+static inline uint32_t PiwikJournalReadUInt32(const uint8_t *bytes) {
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return CFSwapInt32LittleToHost(value);
+}
+
+
+static inline void PiwikJournalWriteUInt32(uint8_t *bytes, uint32_t value) {
+  value = CFSwapInt32HostToLittle(value);
+  memcpy(bytes, &value, sizeof(value));
+}
+
+
+// Event ids encode the position of the record in the journal
+static inline NSNumber* PiwikJournalEventID(uint32_t segmentNumber, uint32_t offset) {
+  return @(((uint64_t)segmentNumber << 32) | offset);
+}
+
+
+#pragma mark - Segment
+
+@interface PiwikJournalSegment : NSObject
+
+@property (nonatomic, readonly) uint32_t number;
+@property (nonatomic, readonly, strong) NSURL *URL;
+@property (nonatomic, readonly) uint32_t size;
+@property (nonatomic, readonly) uint32_t writeOffset;
+// The time of the last append, the file modification time for segments written by an earlier launch
+@property (nonatomic, readonly) CFAbsoluteTime lastAppendTime;
+
+- (instancetype)initWithURL:(NSURL*)URL number:(uint32_t)number size:(uint32_t)size create:(BOOL)create;
+
+- (uint32_t)payloadLengthAtOffset:(uint32_t)offset;
+- (PiwikJournalRecordState)stateAtOffset:(uint32_t)offset;
+- (void)setState:(PiwikJournalRecordState)state atOffset:(uint32_t)offset;
+- (PiwikEventPriority)priorityAtOffset:(uint32_t)offset;
+- (NSData*)payloadAtOffset:(uint32_t)offset;
+- (BOOL)appendRecord:(NSData*)payload priority:(PiwikEventPriority)priority;
+
+- (void)sync;
+- (void)close;
+
+@end
+
+
+@implementation PiwikJournalSegment {
+  int _fileDescriptor;
+  uint8_t *_bytes;
+}
+
+
+- (instancetype)initWithURL:(NSURL*)URL number:(uint32_t)number size:(uint32_t)size create:(BOOL)create {
+
+  if (self = [super init]) {
+
+    _URL = URL;
+    _number = number;
+    _fileDescriptor = open([[URL path] fileSystemRepresentation], create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (_fileDescriptor < 0) {
+      return nil;
+    }
+
+    if (create) {
+      // Truncating first zero fills recycled segments
+      if (ftruncate(_fileDescriptor, 0) != 0 || ftruncate(_fileDescriptor, size) != 0) {
+        [self close];
+        return nil;
+      }
+      _lastAppendTime = CFAbsoluteTimeGetCurrent();
+    } else {
+      struct stat fileStat;
+      if (fstat(_fileDescriptor, &fileStat) != 0 || fileStat.st_size < PiwikJournalSegmentHeaderSize || fileStat.st_size > UINT32_MAX) {
+        [self close];
+        return nil;
+      }
+      size = (uint32_t)fileStat.st_size;
+      // Updated when the mapped pages are synced, at the latest when the next segment is created
+      _lastAppendTime = (CFAbsoluteTime)fileStat.st_mtimespec.tv_sec - kCFAbsoluteTimeIntervalSince1970;
+    }
+    _size = size;
+
+    void *bytes = mmap(NULL, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fileDescriptor, 0);
+    if (bytes == MAP_FAILED) {
+      [self close];
+      return nil;
+    }
+    _bytes = bytes;
+
+    if (create) {
+      PiwikJournalWriteUInt32(_bytes, PiwikJournalMagic);
+    } else if (PiwikJournalReadUInt32(_bytes) != PiwikJournalMagic) {
+      [self close];
+      return nil;
+    }
+
+    // Find the end of the written records, anything after an incomplete record is ignored and will be overwritten
+    _writeOffset = PiwikJournalSegmentHeaderSize;
+    uint32_t length;
+    while ((length = [self payloadLengthAtOffset:_writeOffset]) > 0) {
+      _writeOffset += PiwikJournalRecordHeaderSize + length;
+    }
+
+  }
+
+  return self;
+}
+
+
+- (void)dealloc {
+  [self close];
+}
+
+
+// The length of the record at the offset, 0 if there is no complete record
+- (uint32_t)payloadLengthAtOffset:(uint32_t)offset {
+
+  if (!_bytes || offset > _size - PiwikJournalRecordHeaderSize) {
+    return 0;
+  }
+
+  uint32_t length = PiwikJournalReadUInt32(_bytes + offset);
+  if (length > _size - offset - PiwikJournalRecordHeaderSize) {
+    return 0;
+  }
+
+  uint8_t state = _bytes[offset + 4] & PiwikJournalRecordStateMask;
+  if (state != PiwikJournalRecordStateLive && state != PiwikJournalRecordStateDeleted) {
+    return 0;
+  }
+
+  return length;
+}
+
+
+- (PiwikJournalRecordState)stateAtOffset:(uint32_t)offset {
+  return _bytes[offset + 4] & PiwikJournalRecordStateMask;
+}
+
+
+- (void)setState:(PiwikJournalRecordState)state atOffset:(uint32_t)offset {
+  _bytes[offset + 4] = (_bytes[offset + 4] & ~PiwikJournalRecordStateMask) | state;
+}
+
+
+- (PiwikEventPriority)priorityAtOffset:(uint32_t)offset {
+  return _bytes[offset + 4] >> PiwikJournalRecordPriorityShift;
+}
+
+
+- (NSData*)payloadAtOffset:(uint32_t)offset {
+  // Copy, the segment may be unmapped before the data is used
+  return [NSData dataWithBytes:_bytes + offset + PiwikJournalRecordHeaderSize length:[self payloadLengthAtOffset:offset]];
+}
+
+
+- (BOOL)appendRecord:(NSData*)payload priority:(PiwikEventPriority)priority {
+
+  if (payload.length == 0 || _size - _writeOffset < PiwikJournalRecordHeaderSize || payload.length > _size - _writeOffset - PiwikJournalRecordHeaderSize) {
+    return NO;
+  }
+
+  // Write the length last, an interrupted write will leave the length at zero and the record is ignored
+  memcpy(_bytes + _writeOffset + PiwikJournalRecordHeaderSize, payload.bytes, payload.length);
+  _bytes[_writeOffset + 4] = PiwikJournalRecordStateLive | (uint8_t)(MIN(priority, PiwikJournalRecordStateMask) << PiwikJournalRecordPriorityShift);
+  PiwikJournalWriteUInt32(_bytes + _writeOffset, (uint32_t)payload.length);
+
+  _writeOffset += PiwikJournalRecordHeaderSize + (uint32_t)payload.length;
+  _lastAppendTime = CFAbsoluteTimeGetCurrent();
+
+  return YES;
+}
+
+
+- (void)sync {
+  if (_bytes) {
+    msync(_bytes, _size, MS_ASYNC);
+  }
+}
+
+
+- (void)close {
+
+  if (_bytes) {
+    munmap(_bytes, _size);
+    _bytes = NULL;
+  }
+
+  if (_fileDescriptor >= 0) {
+    close(_fileDescriptor);
+    _fileDescriptor = -1;
+  }
+
+}
+
+
+@end
+
+
+#pragma mark - Journal event store
+
+@interface PiwikJournalEventStore ()
+
+// All journal state is only accessed on the journal queue
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic) BOOL isOpen;
+
+// Segments from the read cursor and forward, oldest first
+@property (nonatomic, strong) NSMutableArray *segments;
+@property (nonatomic) uint32_t nextSegmentNumber;
+
+// The read cursor, the oldest record that may still be live
+@property (nonatomic) uint32_t readSegmentNumber;
+@property (nonatomic) uint32_t readOffset;
+
+// The number of live records in each priority lane, written on the journal queue, may be read from any thread
+@property (nonatomic, readonly, strong) PiwikEventQueueBudget *budget;
+@property (readwrite) NSUInteger numberOfDroppedEvents;
+
+// Decoded parameter sets by identifier
+@property (nonatomic, strong) NSMutableDictionary *parameterSets;
+
+@end
+
+
+@implementation PiwikJournalEventStore
+
+
+- (instancetype)init {
+  NSURL *documentsURL = [[[NSFileManager defaultManager] URLsForDirectory:NSDocumentDirectory inDomains:NSUserDomainMask] lastObject];
+  return [self initWithDirectoryURL:[documentsURL URLByAppendingPathComponent:PiwikJournalDirectoryName]];
+}
+
+
+- (instancetype)initWithDirectoryURL:(NSURL*)directoryURL {
+
+  if (self = [super init]) {
+    _directoryURL = directoryURL;
+    _segmentSize = PiwikJournalDefaultSegmentSize;
+    _queue = dispatch_queue_create(PiwikJournalQueueLabel, DISPATCH_QUEUE_SERIAL);
+    _isOpen = NO;
+    _budget = [[PiwikEventQueueBudget alloc] init];
+  }
+
+  return self;
+}
+
+
+- (void)dealloc {
+  for (PiwikJournalSegment *segment in _segments) {
+    [segment close];
+  }
+}
+
+
+#pragma mark PiwikEventStore
+
+- (NSUInteger)maximumNumberOfEvents {
+  return self.budget.maximumNumberOfEvents;
+}
+
+
+- (void)setMaximumNumberOfEvents:(NSUInteger)maximumNumberOfEvents {
+  self.budget.maximumNumberOfEvents = maximumNumberOfEvents;
+}
+
+
+- (PiwikEventOverflowPolicy)overflowPolicy {
+  return self.budget.overflowPolicy;
+}
+
+
+- (void)setOverflowPolicy:(PiwikEventOverflowPolicy)overflowPolicy {
+  self.budget.overflowPolicy = overflowPolicy;
+}
+
+
+- (void)setMaximumNumberOfEvents:(NSUInteger)maximumNumberOfEvents forPriority:(PiwikEventPriority)priority {
+  [self.budget setMaximumNumberOfEvents:maximumNumberOfEvents forPriority:priority];
+}
+
+
+- (NSUInteger)numberOfEvents {
+  return self.budget.numberOfEvents;
+}
+
+
+- (NSUInteger)numberOfEventsWithPriority:(PiwikEventPriority)priority {
+  return [self.budget numberOfEventsWithPriority:priority];
+}
+
+
+- (void)storeEvents:(NSArray*)events parameterSets:(NSDictionary*)parameterSets completionBlock:(void (^)(void))completionBlock {
+  [self storeEvents:events priority:PiwikEventPriorityNormal parameterSets:parameterSets completionBlock:completionBlock];
+}
+
+
+- (void)storeEvents:(NSArray*)events priority:(PiwikEventPriority)priority parameterSets:(NSDictionary*)parameterSets completionBlock:(void (^)(void))completionBlock {
+
+  dispatch_async(self.queue, ^{
+
+    PiwikSignpostDeclareID(signpostID)
+    PiwikSignpostBegin(signpostID, "Persist", "%lu events", (unsigned long)events.count)
+
+    [self openIfNeeded];
+
+    NSUInteger numberOfEventsToDelete[PiwikNumberOfEventPriorities];
+    NSUInteger numberOfEventsToStore = [self.budget numberOfEventsToStore:events.count withPriority:priority numberOfEventsToDelete:numberOfEventsToDelete];
+
+    NSUInteger numberOfDeletedEvents = 0;
+    for (NSUInteger lane = 0; lane < PiwikNumberOfEventPriorities; lane++) {
+      if (numberOfEventsToDelete[lane] > 0) {
+        numberOfDeletedEvents += [self deleteOldestEvents:numberOfEventsToDelete[lane] withPriority:lane];
+      }
+    }
+
+    if (numberOfEventsToStore > 0) {
+
+      [self storeParameterSets:parameterSets];
+
+      NSUInteger firstEvent = events.count - numberOfEventsToStore;
+      for (NSUInteger i = 0; i < numberOfEventsToStore; i++) {
+        if (![self appendRecord:events[firstEvent + i] priority:priority]) {
+          PiwikLog(@"Failed to write event to the journal");
+          break;
+        }
+      }
+
+      [self.segments.lastObject sync];
+
+    }
+
+    NSUInteger numberOfDroppedEvents = events.count - numberOfEventsToStore + numberOfDeletedEvents;
+    if (numberOfDroppedEvents > 0) {
+      self.numberOfDroppedEvents += numberOfDroppedEvents;
+      PiwikLog(@"Tracker reach maximum number of queued events, %lu events dropped", (unsigned long)numberOfDroppedEvents);
+    }
+
+    PiwikSignpostEnd(signpostID, "Persist")
+
+    if (completionBlock) {
+      completionBlock();
+    }
+
+  });
+
+}
+
+
+- (void)eventsFromStore:(NSUInteger)numberOfEvents excludingEventIDs:(NSSet*)excludedEventIDs completionBlock:(void (^)(NSArray *eventIDs, NSArray *events, BOOL hasMore))completionBlock {
+  [self eventsFromStore:numberOfEvents minimumPriority:PiwikEventPriorityNormal excludingEventIDs:excludedEventIDs completionBlock:completionBlock];
+}
+
+
+- (void)eventsFromStore:(NSUInteger)numberOfEvents minimumPriority:(PiwikEventPriority)minimumPriority excludingEventIDs:(NSSet*)excludedEventIDs completionBlock:(void (^)(NSArray *eventIDs, NSArray *events, BOOL hasMore))completionBlock {
+
+  dispatch_async(self.queue, ^{
+
+    PiwikSignpostDeclareID(signpostID)
+    PiwikSignpostBegin(signpostID, "Fetch")
+
+    [self openIfNeeded];
+
+    NSMutableArray *eventIDs = [NSMutableArray arrayWithCapacity:numberOfEvents];
+    NSMutableArray *events = [NSMutableArray arrayWithCapacity:numberOfEvents];
+    __block BOOL hasMore = NO;
+    __block BOOL hasCorruptEvents = NO;
+
+    [self enumerateLiveRecordsUsingBlock:^(PiwikJournalSegment *segment, uint32_t offset, BOOL *stop) {
+
+      if ([segment priorityAtOffset:offset] < minimumPriority) {
+        return;
+      }
+
+      NSNumber *eventID = PiwikJournalEventID(segment.number, offset);
+      if ([excludedEventIDs containsObject:eventID]) {
+        return;
+      }
+
+      if (events.count == numberOfEvents) {
+        hasMore = YES;
+        *stop = YES;
+        return;
+      }
+
+      NSDictionary *parameters = [self parametersWithData:[segment payloadAtOffset:offset]];
+      if (parameters) {
+        [events addObject:parameters];
+        [eventIDs addObject:eventID];
+      } else {
+        // Can not be decoded, remove it or it will block the queue
+        PiwikLog(@"Remove event that could not be decoded");
+        [segment setState:PiwikJournalRecordStateDeleted atOffset:offset];
+        [self.budget removeNumberOfEvents:1 withPriority:[segment priorityAtOffset:offset]];
+        hasCorruptEvents = YES;
+      }
+
+    }];
+
+    if (hasCorruptEvents) {
+      [self advanceReadCursor];
+    }
+
+    PiwikSignpostEnd(signpostID, "Fetch", "%lu events", (unsigned long)events.count)
+
+    if (events.count > 0) {
+      completionBlock(eventIDs, events, hasMore);
+    } else {
+      // No more pending events
+      completionBlock(nil, nil, NO);
+    }
+
+  });
+
+}
+
+
+- (void)deleteEventsWithIDs:(NSArray*)eventIDs {
+
+  dispatch_async(self.queue, ^{
+
+    [self openIfNeeded];
+
+    for (NSNumber *eventID in eventIDs) {
+
+      uint32_t segmentNumber = (uint32_t)([eventID unsignedLongLongValue] >> 32);
+      uint32_t offset = (uint32_t)([eventID unsignedLongLongValue] & UINT32_MAX);
+
+      for (PiwikJournalSegment *segment in self.segments) {
+        if (segment.number == segmentNumber) {
+          if (offset < segment.writeOffset && [segment payloadLengthAtOffset:offset] > 0 && [segment stateAtOffset:offset] == PiwikJournalRecordStateLive) {
+            [segment setState:PiwikJournalRecordStateDeleted atOffset:offset];
+            [self.budget removeNumberOfEvents:1 withPriority:[segment priorityAtOffset:offset]];
+          }
+          break;
+        }
+      }
+
+    }
+
+    [self advanceReadCursor];
+
+    // Parameter sets are no longer referenced once the journal is empty
+    if (self.numberOfEvents == 0) {
+      [self deleteAllParameterSets];
+    }
+
+  });
+
+}
+
+
+// Segments are written in order, whole segments last written to before the date are deleted without reading the records
+// The segment currently written to is kept until the next segment is created
+- (void)deleteEventsStoredBeforeDate:(NSDate*)date completionBlock:(void (^)(NSUInteger numberOfDeletedEvents))completionBlock {
+
+  dispatch_async(self.queue, ^{
+
+    [self openIfNeeded];
+
+    CFAbsoluteTime time = [date timeIntervalSinceReferenceDate];
+    NSUInteger numberOfDeletedEvents = 0;
+
+    for (PiwikJournalSegment *segment in self.segments) {
+
+      if (segment == self.segments.lastObject || segment.lastAppendTime >= time) {
+        break;
+      }
+
+      uint32_t offset = segment.number == self.readSegmentNumber ? self.readOffset : PiwikJournalSegmentHeaderSize;
+      while (offset < segment.writeOffset) {
+        if ([segment stateAtOffset:offset] == PiwikJournalRecordStateLive) {
+          [segment setState:PiwikJournalRecordStateDeleted atOffset:offset];
+          [self.budget removeNumberOfEvents:1 withPriority:[segment priorityAtOffset:offset]];
+          numberOfDeletedEvents++;
+        }
+        offset += PiwikJournalRecordHeaderSize + [segment payloadLengthAtOffset:offset];
+      }
+
+    }
+
+    if (numberOfDeletedEvents > 0) {
+      [self advanceReadCursor];
+
+      // Parameter sets are no longer referenced once the journal is empty
+      if (self.numberOfEvents == 0) {
+        [self deleteAllParameterSets];
+      }
+    }
+
+    if (completionBlock) {
+      completionBlock(numberOfDeletedEvents);
+    }
+
+  });
+
+}
+
+
+- (void)deleteAllStoredEvents {
+
+  dispatch_async(self.queue, ^{
+
+    [self openIfNeeded];
+
+    for (PiwikJournalSegment *segment in self.segments) {
+      [segment close];
+      [[NSFileManager defaultManager] removeItemAtURL:segment.URL error:nil];
+    }
+    [self.segments removeAllObjects];
+
+    // Keep counting segment numbers, ids of events already read must not match new events
+    PiwikJournalSegment *segment = [self createSegmentWithMinimumRecordLength:0];
+    if (segment) {
+      [self.segments addObject:segment];
+      self.readSegmentNumber = segment.number;
+    }
+    self.readOffset = PiwikJournalSegmentHeaderSize;
+    [self writeReadCursor];
+
+    [self.budget removeAllEvents];
+    [self deleteAllParameterSets];
+
+  });
+
+}
+
+
+- (void)waitUntilAllOperationsAreFinished {
+  dispatch_sync(self.queue, ^{});
+}
+
+
+- (void)openWithCompletionBlock:(void (^)(void))completionBlock {
+  
+  dispatch_async(self.queue, ^{
+    [self openIfNeeded];
+    
+    if (completionBlock) {
+      completionBlock();
+    }
+  });
+  
+}
+
+
+// Event ids are numbers and valid until the event has been deleted
+- (NSArray*)archivableEventIDs:(NSArray*)eventIDs {
+  return eventIDs;
+}
+
+
+- (NSArray*)eventIDsFromArchivableEventIDs:(NSArray*)archivableEventIDs {
+  return archivableEventIDs;
+}
+
+
+#pragma mark Journal
+
+- (NSURL*)URLForSegmentNumber:(uint32_t)number {
+  NSString *fileName = [[NSString stringWithFormat:@"%010u", number] stringByAppendingPathExtension:PiwikJournalSegmentExtension];
+  return [self.directoryURL URLByAppendingPathComponent:fileName];
+}
+
+
+// Load the journal, run before any other journal operation
+- (void)openIfNeeded {
+
+  if (self.isOpen) {
+    return;
+  }
+  self.isOpen = YES;
+
+  NSFileManager *fileManager = [NSFileManager defaultManager];
+  [fileManager createDirectoryAtURL:self.directoryURL withIntermediateDirectories:YES attributes:nil error:nil];
+
+  [self readReadCursor];
+
+  // Find all segments, the file name is the segment number
+  NSMutableArray *segmentNumbers = [NSMutableArray array];
+  for (NSURL *URL in [fileManager contentsOfDirectoryAtURL:self.directoryURL includingPropertiesForKeys:nil options:0 error:nil]) {
+    NSString *name = [[URL lastPathComponent] stringByDeletingPathExtension];
+    if ([[URL pathExtension] isEqualToString:PiwikJournalSegmentExtension] && ![[URL lastPathComponent] isEqualToString:PiwikJournalSpareSegmentName]) {
+      [segmentNumbers addObject:@([name longLongValue])];
+    }
+  }
+  [segmentNumbers sortUsingSelector:@selector(compare:)];
+
+  self.segments = [NSMutableArray arrayWithCapacity:segmentNumbers.count + 1];
+  self.nextSegmentNumber = self.readSegmentNumber;
+
+  for (NSNumber *segmentNumber in segmentNumbers) {
+
+    uint32_t number = [segmentNumber unsignedIntValue];
+    NSURL *URL = [self URLForSegmentNumber:number];
+    self.nextSegmentNumber = MAX(self.nextSegmentNumber, number + 1);
+
+    if (number < self.readSegmentNumber) {
+      // Already read, the app was terminated before the segment was recycled
+      [fileManager removeItemAtURL:URL error:nil];
+      continue;
+    }
+
+    PiwikJournalSegment *segment = [[PiwikJournalSegment alloc] initWithURL:URL number:number size:0 create:NO];
+    if (segment) {
+      [self.segments addObject:segment];
+    } else {
+      PiwikLog(@"Remove journal segment that could not be opened: %@", [URL lastPathComponent]);
+      [fileManager removeItemAtURL:URL error:nil];
+    }
+
+  }
+
+  if (self.segments.count == 0) {
+    PiwikJournalSegment *segment = [self createSegmentWithMinimumRecordLength:0];
+    if (segment) {
+      [self.segments addObject:segment];
+    }
+  }
+
+  PiwikJournalSegment *readSegment = self.segments.firstObject;
+  if (readSegment.number != self.readSegmentNumber || self.readOffset > readSegment.writeOffset) {
+    self.readSegmentNumber = readSegment.number;
+    self.readOffset = PiwikJournalSegmentHeaderSize;
+  }
+
+  [self.budget removeAllEvents];
+  [self enumerateLiveRecordsUsingBlock:^(PiwikJournalSegment *segment, uint32_t offset, BOOL *stop) {
+    [self.budget addNumberOfEvents:1 withPriority:[segment priorityAtOffset:offset]];
+  }];
+
+  [self readParameterSets];
+
+  PiwikLog(@"Journal opened with %lu queued events", (unsigned long)self.numberOfEvents);
+}
+
+
+- (void)enumerateLiveRecordsUsingBlock:(void (^)(PiwikJournalSegment *segment, uint32_t offset, BOOL *stop))block {
+
+  BOOL stop = NO;
+  for (PiwikJournalSegment *segment in self.segments) {
+
+    uint32_t offset = segment.number == self.readSegmentNumber ? self.readOffset : PiwikJournalSegmentHeaderSize;
+    while (offset < segment.writeOffset) {
+
+      if ([segment stateAtOffset:offset] == PiwikJournalRecordStateLive) {
+        block(segment, offset, &stop);
+        if (stop) {
+          return;
+        }
+      }
+
+      offset += PiwikJournalRecordHeaderSize + [segment payloadLengthAtOffset:offset];
+    }
+
+  }
+
+}
+
+
+// Flag the oldest live records in the priority lane as deleted in one pass from the read cursor
+- (NSUInteger)deleteOldestEvents:(NSUInteger)numberOfEvents withPriority:(PiwikEventPriority)priority {
+
+  NSUInteger lane = MIN(priority, PiwikNumberOfEventPriorities - 1);
+
+  __block NSUInteger numberOfDeletedEvents = 0;
+  [self enumerateLiveRecordsUsingBlock:^(PiwikJournalSegment *segment, uint32_t offset, BOOL *stop) {
+    if (MIN([segment priorityAtOffset:offset], PiwikNumberOfEventPriorities - 1) != lane) {
+      return;
+    }
+    [segment setState:PiwikJournalRecordStateDeleted atOffset:offset];
+    numberOfDeletedEvents++;
+    *stop = numberOfDeletedEvents == numberOfEvents;
+  }];
+
+  [self.budget removeNumberOfEvents:numberOfDeletedEvents withPriority:priority];
+
+  [self advanceReadCursor];
+
+  return numberOfDeletedEvents;
+}
+
+
+- (BOOL)appendRecord:(NSData*)record priority:(PiwikEventPriority)priority {
+
+  PiwikJournalSegment *segment = self.segments.lastObject;
+
+  if (!segment || ![segment appendRecord:record priority:priority]) {
+
+    [segment sync];
+
+    segment = [self createSegmentWithMinimumRecordLength:record.length];
+    if (!segment || ![segment appendRecord:record priority:priority]) {
+      return NO;
+    }
+    [self.segments addObject:segment];
+
+  }
+
+  [self.budget addNumberOfEvents:1 withPriority:priority];
+
+  return YES;
+}
+
+
+// Create the next segment, reusing the spare segment if available
+- (PiwikJournalSegment*)createSegmentWithMinimumRecordLength:(NSUInteger)length {
+
+  if (length > PiwikJournalMaximumRecordLength) {
+    return nil;
+  }
+
+  NSUInteger pageSize = (NSUInteger)getpagesize();
+  NSUInteger minimumSize = PiwikJournalSegmentHeaderSize + PiwikJournalRecordHeaderSize + length;
+  NSUInteger size = MAX(self.segmentSize, (minimumSize + pageSize - 1) / pageSize * pageSize);
+
+  NSURL *URL = [self URLForSegmentNumber:self.nextSegmentNumber];
+  NSURL *spareURL = [self.directoryURL URLByAppendingPathComponent:PiwikJournalSpareSegmentName];
+
+  if (size == self.segmentSize) {
+    // Fails if there is no spare segment and a new file is created instead
+    rename([[spareURL path] fileSystemRepresentation], [[URL path] fileSystemRepresentation]);
+  }
+
+  PiwikJournalSegment *segment = [[PiwikJournalSegment alloc] initWithURL:URL number:self.nextSegmentNumber size:(uint32_t)size create:YES];
+  if (segment) {
+    self.nextSegmentNumber++;
+  } else {
+    PiwikLog(@"Failed to create journal segment %@", [URL lastPathComponent]);
+  }
+
+  return segment;
+}
+
+
+// Keep a single spare segment for new events, remove any other segment
+- (void)recycleSegment:(PiwikJournalSegment*)segment {
+
+  [segment close];
+
+  NSURL *spareURL = [self.directoryURL URLByAppendingPathComponent:PiwikJournalSpareSegmentName];
+  NSFileManager *fileManager = [NSFileManager defaultManager];
+
+  if (segment.size != self.segmentSize || [fileManager fileExistsAtPath:[spareURL path]] ||
+      rename([[segment.URL path] fileSystemRepresentation], [[spareURL path] fileSystemRepresentation]) != 0) {
+    [fileManager removeItemAtURL:segment.URL error:nil];
+  }
+
+}
+
+
+// Move the read cursor past deleted records and recycle segments that have been read
+- (void)advanceReadCursor {
+
+  uint32_t readSegmentNumber = self.readSegmentNumber;
+  uint32_t readOffset = self.readOffset;
+
+  while (YES) {
+
+    PiwikJournalSegment *segment = self.segments.firstObject;
+    while (self.readOffset < segment.writeOffset && [segment stateAtOffset:self.readOffset] == PiwikJournalRecordStateDeleted) {
+      self.readOffset += PiwikJournalRecordHeaderSize + [segment payloadLengthAtOffset:self.readOffset];
+    }
+
+    // Stop at the first live record or in the segment currently written to
+    if (self.readOffset < segment.writeOffset || self.segments.count <= 1) {
+      break;
+    }
+
+    [self.segments removeObjectAtIndex:0];
+    [self recycleSegment:segment];
+
+    self.readSegmentNumber = ((PiwikJournalSegment*)self.segments.firstObject).number;
+    self.readOffset = PiwikJournalSegmentHeaderSize;
+
+  }
+
+  if (readSegmentNumber != self.readSegmentNumber || readOffset != self.readOffset) {
+    [self writeReadCursor];
+  }
+
+}
+
+
+- (void)readReadCursor {
+
+  self.readSegmentNumber = 0;
+  self.readOffset = PiwikJournalSegmentHeaderSize;
+
+  NSData *cursor = [NSData dataWithContentsOfURL:[self.directoryURL URLByAppendingPathComponent:PiwikJournalCursorFileName]];
+  if (cursor.length == 12 && PiwikJournalReadUInt32(cursor.bytes) == PiwikJournalMagic) {
+    self.readSegmentNumber = PiwikJournalReadUInt32((const uint8_t*)cursor.bytes + 4);
+    self.readOffset = MAX(PiwikJournalReadUInt32((const uint8_t*)cursor.bytes + 8), PiwikJournalSegmentHeaderSize);
+  }
+
+}
+
+
+- (void)writeReadCursor {
+
+  uint8_t cursor[12];
+  PiwikJournalWriteUInt32(cursor, PiwikJournalMagic);
+  PiwikJournalWriteUInt32(cursor + 4, self.readSegmentNumber);
+  PiwikJournalWriteUInt32(cursor + 8, self.readOffset);
+
+  // Written in place, the cursor is small enough to never be torn
+  NSURL *cursorURL = [self.directoryURL URLByAppendingPathComponent:PiwikJournalCursorFileName];
+  int fileDescriptor = open([[cursorURL path] fileSystemRepresentation], O_WRONLY | O_CREAT, 0644);
+  if (fileDescriptor >= 0) {
+    pwrite(fileDescriptor, cursor, sizeof(cursor), 0);
+    close(fileDescriptor);
+  }
+
+}
+
+
+#pragma mark Parameter sets
+
+- (NSDictionary*)parametersWithData:(NSData*)data {
+
+  NSArray *parameterSetIDs;
+  NSDictionary *eventParameters = [PiwikEventEncoder parametersWithData:data parameterSetIDs:&parameterSetIDs];
+  if (!eventParameters) {
+    return nil;
+  }
+
+  // The parameter sets are merged when the request is created
+  NSMutableArray *parameterSets = [NSMutableArray arrayWithCapacity:parameterSetIDs.count];
+  for (NSNumber *parameterSetID in parameterSetIDs) {
+    NSDictionary *parameterSet = self.parameterSets[parameterSetID];
+    if (!parameterSet) {
+      return nil;
+    }
+    [parameterSets addObject:parameterSet];
+  }
+
+  return [[PiwikEventParameters alloc] initWithParameters:eventParameters parameterSets:parameterSets parameterSetIDs:parameterSetIDs];
+}
+
+
+// Parameter sets file: identifier (uint64 little endian), length (uint32 little endian), encoded parameter set
+- (void)storeParameterSets:(NSDictionary*)parameterSets {
+
+  NSMutableData *data = [NSMutableData data];
+
+  [parameterSets enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+
+    if (self.parameterSets[key]) {
+      return;
+    }
+
+    NSDictionary *parameters = [PiwikEventEncoder parametersWithData:obj parameterSetIDs:NULL];
+    if (!parameters) {
+      return;
+    }
+    self.parameterSets[key] = parameters;
+
+    uint64_t identifier = CFSwapInt64HostToLittle([key unsignedLongLongValue]);
+    uint8_t length[4];
+    PiwikJournalWriteUInt32(length, (uint32_t)[obj length]);
+    [data appendBytes:&identifier length:sizeof(identifier)];
+    [data appendBytes:length length:sizeof(length)];
+    [data appendData:obj];
+
+  }];
+
+  if (data.length > 0) {
+    NSURL *parameterSetsURL = [self.directoryURL URLByAppendingPathComponent:PiwikJournalParameterSetsFileName];
+    int fileDescriptor = open([[parameterSetsURL path] fileSystemRepresentation], O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fileDescriptor >= 0) {
+      write(fileDescriptor, data.bytes, data.length);
+      close(fileDescriptor);
+    }
+  }
+
+}
+
+
+- (void)readParameterSets {
+
+  self.parameterSets = [NSMutableDictionary dictionary];
+
+  NSData *data = [NSData dataWithContentsOfURL:[self.directoryURL URLByAppendingPathComponent:PiwikJournalParameterSetsFileName]];
+  const uint8_t *bytes = data.bytes;
+  NSUInteger offset = 0;
+
+  // A set partially written when the app was terminated is ignored
+  while (data.length - offset >= 12) {
+
+    uint64_t identifier;
+    memcpy(&identifier, bytes + offset, sizeof(identifier));
+    identifier = CFSwapInt64LittleToHost(identifier);
+    uint32_t length = PiwikJournalReadUInt32(bytes + offset + 8);
+    offset += 12;
+
+    if (length > data.length - offset) {
+      break;
+    }
+
+    NSDictionary *parameters = [PiwikEventEncoder parametersWithData:[data subdataWithRange:NSMakeRange(offset, length)] parameterSetIDs:NULL];
+    if (parameters) {
+      self.parameterSets[@((int64_t)identifier)] = parameters;
+    }
+    offset += length;
+
+  }
+
+}
+
+
+// The tracker will pass the parameter sets in use with the next event and they will be stored again
+- (void)deleteAllParameterSets {
+  [[NSFileManager defaultManager] removeItemAtURL:[self.directoryURL URLByAppendingPathComponent:PiwikJournalParameterSetsFileName] error:nil];
+  [self.parameterSets removeAllObjects];
+}
+
+
+@end
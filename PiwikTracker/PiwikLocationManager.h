@@ -10,12 +10,35 @@
 #import <CoreLocation/CoreLocation.h>
 
 
+// Keep the coordinates as reported by Core Location
+static NSUInteger const PiwikCoordinatePrecisionUnrounded = NSUIntegerMax;
+
+
 @interface PiwikLocationManager : NSObject
 
-@property (nonatomic, readonly) CLLocation *location;
+/**
+ The last location update, rounded to the coordinate precision if set. Nil if no update has been received or if the last update is older than the maximum location age.
+
+ The snapshot is replaced atomically when the location changes. Reading it never calls Core Location and is safe from any queue.
+ */
+@property (readonly) CLLocation *location;
+
+/**
+ The number of decimals of the latitude and longitude, e.g. 3 for around 100 meters. The horizontal accuracy of a rounded location is never better than the precision. Default PiwikCoordinatePrecisionUnrounded, the location is not rounded.
+ */
+@property (nonatomic) NSUInteger coordinatePrecision;
+
+/**
+ Location updates older than this are not used. Default 30 minutes.
+ */
+@property (nonatomic) NSTimeInterval maximumLocationAge;
 
 - (void)startMonitoringLocationChanges;
 - (void)stopMonitoringLocationChanges;
 
-@end
+/**
+ Start monitoring if it was postponed until the first location was needed, the user may be asked for permission. Must be called on the main queue.
+ */
+- (void)startPendingMonitoringLocationChanges;
 
+@end
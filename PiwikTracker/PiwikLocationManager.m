@@ -9,9 +9,14 @@
 #import "PiwikLocationManager.h"
 
 
+static NSUInteger const PiwikDefaultCoordinatePrecision = PiwikCoordinatePrecisionUnrounded;
+static NSTimeInterval const PiwikDefaultMaximumLocationAge = 30 * 60;
+
+
 @interface PiwikLocationManager () <CLLocationManagerDelegate>
 
 @property (nonatomic, strong) CLLocationManager *locationManager;
+@property (strong) CLLocation *locationSnapshot;
 @property (nonatomic) BOOL startMonitoringOnNextLocationRequest;
 @property (nonatomic) BOOL isMonitorLocationChanges;
 
@@ -27,6 +32,8 @@
     
     _locationManager = [[CLLocationManager alloc] init];
     _locationManager.delegate = self;
+    _coordinatePrecision = PiwikDefaultCoordinatePrecision;
+    _maximumLocationAge = PiwikDefaultMaximumLocationAge;
     
   }
   return self;
@@ -54,6 +61,9 @@
 
 - (void)_startMonitoringLocationChanges {
   
+  // Use the last known location until the first update
+  [self updateLocationSnapshot:self.locationManager.location];
+  
 #if TARGET_OS_IPHONE
   
   // Workaround
@@ -87,6 +97,7 @@
 
 - (void)stopMonitoringLocationChanges {
   self.isMonitorLocationChanges = NO;
+  self.locationSnapshot = nil;
 
 #if TARGET_OS_IPHONE
   
@@ -103,14 +114,48 @@
 }
 
 
-- (CLLocation*)location {
+- (void)startPendingMonitoringLocationChanges {
   
   if (self.startMonitoringOnNextLocationRequest && !self.isMonitorLocationChanges) {
     [self _startMonitoringLocationChanges];
   }
   
+}
+
+
+- (CLLocation*)location {
+  
   // Will return nil if the location monitoring has not been started
-  return self.locationManager.location;
+  CLLocation *location = self.locationSnapshot;
+  if (!location || -[location.timestamp timeIntervalSinceNow] > self.maximumLocationAge) {
+    return nil;
+  }
+  
+  return location;
+}
+
+
+- (void)updateLocationSnapshot:(CLLocation*)location {
+  
+  if (!location || location.horizontalAccuracy < 0) {
+    // Invalid location
+    return;
+  }
+  
+  if (self.coordinatePrecision == PiwikCoordinatePrecisionUnrounded) {
+    self.locationSnapshot = location;
+    return;
+  }
+  
+  double scale = pow(10, self.coordinatePrecision);
+  CLLocationCoordinate2D coordinate = CLLocationCoordinate2DMake(round(location.coordinate.latitude * scale) / scale,
+                                                                 round(location.coordinate.longitude * scale) / scale);
+  
+  self.locationSnapshot = [[CLLocation alloc] initWithCoordinate:coordinate
+                                                        altitude:0
+                                              horizontalAccuracy:MAX(location.horizontalAccuracy, 111000 / scale)
+                                                verticalAccuracy:-1
+                                                       timestamp:location.timestamp];
   
 }
 
@@ -118,7 +163,7 @@
 #pragma mark - core location delegate methods
 
 - (void)locationManager:(CLLocationManager*)manager didUpdateLocations:(NSArray*)locations {
-  // Do nothing
+  [self updateLocationSnapshot:locations.lastObject];
 }
 
 
@@ -0,0 +1,90 @@
+//
+//  PiwikLogging.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+// Private logging and instrumentation macros shared by the tracker, the event stores and the dispatchers.
+//
+// Define PIWIK_DEBUG_LOG to log the processing of each event, using os_log on iOS 10 and OS X 10.12 or later.
+// Define PIWIK_SIGNPOSTS to record os_signpost intervals of the enqueue, persist, fetch, payload and request stages, shown by the Instruments points of interest and os_signpost instruments from iOS 12 and OS X 10.14.
+// Both can be set in the build settings (GCC_PREPROCESSOR_DEFINITIONS). When not defined the macros expand to nothing and cost nothing.
+
+//#define PIWIK_DEBUG_LOG
+//#define PIWIK_SIGNPOSTS
+
+
+#if defined(PIWIK_DEBUG_LOG) || defined(PIWIK_SIGNPOSTS)
+#import <os/log.h>
+
+static NSString * const PiwikLogSubsystem = @"org.piwik.PiwikTracker";
+
+// One log handle for each translation unit, created once
+#define PiwikDefineLogHandle(function, category) \
+  static inline os_log_t function(void) API_AVAILABLE(ios(10.0), macos(10.12)) { \
+    static os_log_t log; \
+    static dispatch_once_t onceToken; \
+    dispatch_once(&onceToken, ^{ \
+      log = os_log_create([PiwikLogSubsystem UTF8String], category); \
+    }); \
+    return log; \
+  }
+#endif
+
+
+// Debug logging
+#ifdef PIWIK_DEBUG_LOG
+
+PiwikDefineLogHandle(PiwikDebugLogHandle, "Debug")
+
+static inline void PiwikDebugLogMessage(NSString *message) {
+  if (@available(iOS 10.0, macOS 10.12, *)) {
+    os_log_debug(PiwikDebugLogHandle(), "%{public}@", message);
+  } else {
+    NSLog(@"[Piwik] %@", message);
+  }
+}
+
+  #define PiwikDebugLog(fmt,...) PiwikDebugLogMessage([NSString stringWithFormat:(fmt), ##__VA_ARGS__]);
+#else
+  #define PiwikDebugLog(...)
+#endif
+
+
+// Always logging
+#define PiwikLog(fmt,...) NSLog(@"[Piwik] %@",[NSString stringWithFormat:(fmt), ##__VA_ARGS__]);
+
+
+// Signpost intervals
+// Declare an identifier with PiwikSignpostDeclareID(name), then pass it to PiwikSignpostBegin and PiwikSignpostEnd with the same interval name.
+// The identifier is a plain integer and may be captured by blocks running on other queues.
+#ifdef PIWIK_SIGNPOSTS
+#import <os/signpost.h>
+
+PiwikDefineLogHandle(PiwikSignpostLogHandle, "Pipeline")
+
+// Unique within the file, intervals with the same name are only recorded in one file. 0 and UINT64_MAX are reserved by os_signpost
+static inline uint64_t PiwikSignpostNextID(void) {
+  static uint64_t lastID = 0;
+  return __atomic_add_fetch(&lastID, 1, __ATOMIC_RELAXED);
+}
+
+  #define PiwikSignpostDeclareID(name) uint64_t name = PiwikSignpostNextID();
+  #define PiwikSignpostBegin(signpostID, intervalName, ...) \
+    if (@available(iOS 12.0, macOS 10.14, *)) { \
+      os_signpost_interval_begin(PiwikSignpostLogHandle(), (os_signpost_id_t)(signpostID), intervalName, ##__VA_ARGS__); \
+    }
+  #define PiwikSignpostEnd(signpostID, intervalName, ...) \
+    if (@available(iOS 12.0, macOS 10.14, *)) { \
+      os_signpost_interval_end(PiwikSignpostLogHandle(), (os_signpost_id_t)(signpostID), intervalName, ##__VA_ARGS__); \
+    }
+#else
+  #define PiwikSignpostDeclareID(name)
+  #define PiwikSignpostBegin(signpostID, intervalName, ...)
+  #define PiwikSignpostEnd(signpostID, intervalName, ...)
+#endif
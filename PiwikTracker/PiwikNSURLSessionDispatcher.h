@@ -12,11 +12,35 @@
 
 /**
  A dispatcher that will use NSURLSession to send requests to the Piwik server.
+ 
+ The dispatcher use its own session, keeping connections to the Piwik server alive between requests and using HTTP/2 when supported by the server. Requests are sent with background network service type, at most two connections to the server and without URL cache or cookies.
  */
 @interface PiwikNSURLSessionDispatcher : NSObject <PiwikDispatcher>
 
 @property (nonatomic, strong) NSString *userAgent;
 
+/**
+ The timeout in seconds used for requests. Default 5 seconds.
+ */
+@property (nonatomic) NSTimeInterval requestTimeout;
+
+/**
+ Compress bulk request bodies with gzip. Default NO.
+ */
+@property (nonatomic) BOOL compressBulkRequests;
+
+/**
+ Bulk request bodies smaller than the threshold in bytes are not compressed. Default 1024 bytes.
+ */
+@property (nonatomic) NSUInteger compressionThreshold;
+
+/**
+ The identifier of the background session used to upload events while the app is suspended. Default nil, background uploads disabled.
+ 
+ Setting the identifier creates the background session and reconnects to uploads started by a previous launch of the app. The tracker sets the identifier when `backgroundDispatch` is enabled.
+ */
+@property (nonatomic, copy) NSString *backgroundSessionIdentifier;
+
 - (instancetype)initWithPiwikURL:(NSURL*)piwikURL;
 
 @end
@@ -7,17 +7,46 @@
 //
 
 #import "PiwikNSURLSessionDispatcher.h"
+#import "PiwikGzip.h"
+#import "PiwikQuerySerializer.h"
+#import "PiwikBulkRequestResult.h"
+#import "PiwikLogging.h"
 
 
-@interface PiwikNSURLSessionDispatcher ()
+@interface PiwikNSURLSessionDispatcher () <NSURLSessionTaskDelegate>
 
 @property (nonatomic, strong) NSURL *piwikURL;
 
+// Dedicated session, keeping connections to the Piwik server alive between dispatches
+@property (nonatomic, strong) NSURLSession *session;
+
+// Requests are created on the queue calling the dispatcher, the tracker queue
+@property (nonatomic, strong) PiwikQuerySerializer *serializer;
+
+// Background uploads, only accessed on the background delegate queue
+@property (nonatomic, strong) NSOperationQueue *backgroundQueue;
+@property (nonatomic, strong) NSURLSession *backgroundSession;
+@property (nonatomic, copy) void (^backgroundRequestCompletionBlock)(NSString *requestIdentifier, BOOL success);
+@property (nonatomic, strong) NSMutableArray *undeliveredBackgroundRequestResults;
+@property (nonatomic, copy) void (^backgroundEventsCompletionHandler)(void);
+
 @end
 
 
 static NSUInteger const PiwikHTTPRequestTimeout = 5;
 
+// Leave connections for the app's own traffic
+static NSInteger const PiwikHTTPMaximumConnectionsPerHost = 2;
+
+static NSString * const PiwikBulkRequestContentType = @"application/json; charset=utf-8";
+
+static NSTimeInterval const PiwikBackgroundHTTPRequestTimeout = 60;
+
+// Give up on a discretionary upload while the tracker still waits for it, it would otherwise send the events again
+static NSTimeInterval const PiwikBackgroundHTTPResourceTimeout = 12 * 60 * 60;
+
+static NSString * const PiwikBackgroundUploadDirectoryName = @"piwiktracker.uploads";
+
 
 @implementation PiwikNSURLSessionDispatcher
 
@@ -26,36 +55,64 @@ static NSUInteger const PiwikHTTPRequestTimeout = 5;
   self = [super init];
   if (self) {
     _piwikURL = piwikURL;
+    _requestTimeout = PiwikHTTPRequestTimeout;
+    _compressBulkRequests = NO;
+    _compressionThreshold = PiwikDefaultCompressionThreshold;
+    
+    NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration defaultSessionConfiguration];
+    [self configureSessionConfiguration:configuration];
+    _session = [NSURLSession sessionWithConfiguration:configuration];
+    
+    _serializer = [[PiwikQuerySerializer alloc] init];
+    
+    _backgroundQueue = [[NSOperationQueue alloc] init];
+    _backgroundQueue.maxConcurrentOperationCount = 1;
+    _undeliveredBackgroundRequestResults = [NSMutableArray array];
   }
   return self;
 }
 
+
+- (void)dealloc {
+  [_session finishTasksAndInvalidate];
+}
+
+
+// Tracking requests are low priority, never cached and do not need cookies
+- (void)configureSessionConfiguration:(NSURLSessionConfiguration*)configuration {
+  configuration.HTTPMaximumConnectionsPerHost = PiwikHTTPMaximumConnectionsPerHost;
+  configuration.networkServiceType = NSURLNetworkServiceTypeBackground;
+  configuration.requestCachePolicy = NSURLRequestReloadIgnoringCacheData;
+  configuration.URLCache = nil;
+  configuration.HTTPCookieStorage = nil;
+  configuration.HTTPCookieAcceptPolicy = NSHTTPCookieAcceptPolicyNever;
+  configuration.HTTPShouldSetCookies = NO;
+}
+
+
 - (void)sendSingleEventWithParameters:(NSDictionary*)parameters
                               success:(void (^)())successBlock
                               failure:(void (^)(BOOL shouldContinue))failureBlock {
   
   //NSLog(@"Dispatch single event with NSURLSession dispatcher");
     
-  NSMutableArray *parameterPairs = [NSMutableArray arrayWithCapacity:parameters.count];
-  [parameters enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
-    [parameterPairs addObject:[NSString stringWithFormat:@"%@=%@", key, obj]];
-  }];
-  
   // URL encoded query string
-  NSString *queryString = [[parameterPairs componentsJoinedByString:@"&"] stringByAddingPercentEscapesUsingEncoding:NSUTF8StringEncoding];
+  NSString *queryString = [self.serializer queryStringWithParameters:parameters];
   
   NSURL *URL = [NSURL URLWithString:[@"?" stringByAppendingString:queryString] relativeToURL:self.piwikURL];
   NSMutableURLRequest *request = [[NSMutableURLRequest alloc]
                                   initWithURL:URL
                                   cachePolicy:NSURLRequestReloadIgnoringCacheData
-                                  timeoutInterval:PiwikHTTPRequestTimeout];
+                                  timeoutInterval:self.requestTimeout];
   if (self.userAgent) {
     [request setValue:self.userAgent forHTTPHeaderField:@"User-Agent"];
   }
     
   request.HTTPMethod = @"GET";
   
-  [self sendRequest:request success:successBlock failure:failureBlock];
+  [self sendRequest:request success:^(NSData *data) {
+    successBlock();
+  } failure:failureBlock];
   
 }
 
@@ -66,35 +123,84 @@ static NSUInteger const PiwikHTTPRequestTimeout = 5;
   
   //NSLog(@"Dispatch batch events with NSURLSession dispatcher");
   
+  [self sendRequest:[self bulkRequestWithParameters:parameters] success:^(NSData *data) {
+    successBlock();
+  } failure:failureBlock];
+  
+}
+
+
+- (void)sendBulkEventWithRequestBody:(NSData*)requestBody
+                             success:(void (^)(PiwikBulkRequestResult *result))successBlock
+                             failure:(void (^)(BOOL shouldContinue))failureBlock {
+  
+  [self sendRequest:[self bulkRequestWithBody:requestBody] success:^(NSData *data) {
+    successBlock([PiwikBulkRequestResult resultWithResponseData:data]);
+  } failure:failureBlock];
+  
+}
+
+
+- (NSMutableURLRequest*)bulkRequestWithParameters:(NSDictionary*)parameters {
+  
+  NSData *body;
+  NSArray *queryStrings = parameters[@"requests"];
+  if (parameters.count == 1 && [queryStrings isKindOfClass:[NSArray class]]) {
+    body = [self.serializer bulkRequestBodyWithQueryStrings:queryStrings];
+  } else {
+    NSError *error;
+    body = [NSJSONSerialization dataWithJSONObject:parameters options:0 error:&error];
+  }
+  
+  return [self bulkRequestWithBody:body];
+}
+
+
+- (NSMutableURLRequest*)bulkRequestWithBody:(NSData*)body {
+  
   NSMutableURLRequest *request = [[NSMutableURLRequest alloc] initWithURL:self.piwikURL
                                                               cachePolicy:NSURLRequestReloadIgnoringCacheData
-                                                          timeoutInterval:PiwikHTTPRequestTimeout];
+                                                          timeoutInterval:self.requestTimeout];
   if (self.userAgent) {
     [request setValue:self.userAgent forHTTPHeaderField:@"User-Agent"];
   }
     
   request.HTTPMethod = @"POST";
   
-  NSString *charset = (__bridge NSString *)CFStringConvertEncodingToIANACharSetName(CFStringConvertNSStringEncodingToEncoding(NSUTF8StringEncoding));
-  [request setValue:[NSString stringWithFormat:@"application/json; charset=%@", charset] forHTTPHeaderField:@"Content-Type"];
+  [request setValue:PiwikBulkRequestContentType forHTTPHeaderField:@"Content-Type"];
   
-  NSError *error;
-  request.HTTPBody = [NSJSONSerialization dataWithJSONObject:parameters options:0 error:&error];
+  request.HTTPBody = body;
   
-  [self sendRequest:request success:successBlock failure:failureBlock];
+  // The query strings in a bulk request are very similar and compress well
+  if (self.compressBulkRequests && request.HTTPBody.length >= self.compressionThreshold) {
+    NSData *compressedBody = [PiwikGzip gzipData:request.HTTPBody];
+    if (compressedBody) {
+      request.HTTPBody = compressedBody;
+      [request setValue:@"gzip" forHTTPHeaderField:@"Content-Encoding"];
+    }
+  }
   
+  return request;
 }
 
 
-- (void)sendRequest:(NSURLRequest*)request success:(void (^)())successBlock failure:(void (^)(BOOL shouldContinue))failureBlock {
+- (void)sendRequest:(NSURLRequest*)request success:(void (^)(NSData *data))successBlock failure:(void (^)(BOOL shouldContinue))failureBlock {
   
-  NSURLSession *session = [NSURLSession sharedSession];
+  PiwikSignpostDeclareID(signpostID)
+  PiwikSignpostBegin(signpostID, "Request", "%{public}@ %lu bytes", request.HTTPMethod, (unsigned long)request.HTTPBody.length)
   
-  NSURLSessionDataTask *task = [session dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
-    if (!error) {
-      successBlock();
+  NSURLSessionDataTask *task = [self.session dataTaskWithRequest:request completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+    if (!error && [self isSuccessfulResponse:response]) {
+      PiwikSignpostEnd(signpostID, "Request", "success")
+      successBlock(data);
+    } else if (!error) {
+      // A client error is a rejected request and other requests may be accepted, abort on server errors
+      PiwikSignpostEnd(signpostID, "Request", "rejected")
+      failureBlock(![self isServerErrorResponse:response]);
     } else {
-      failureBlock([self shouldAbortdispatchForNetworkError:error]);
+      // The request never reached the server, e.g. no connection or an unknown host, the next request would fail the same way
+      PiwikSignpostEnd(signpostID, "Request", "failure")
+      failureBlock(NO);
     }
   }];
   
@@ -103,19 +209,158 @@ static NSUInteger const PiwikHTTPRequestTimeout = 5;
 }
 
 
-// Should the dispatch be aborted and pending events rescheduled
-- (BOOL)shouldAbortdispatchForNetworkError:(NSError*)error {
+#pragma mark - Background uploads
+
+- (void)setBackgroundSessionIdentifier:(NSString*)backgroundSessionIdentifier {
   
-  if (error.code == NSURLErrorBadURL ||
-      error.code == NSURLErrorUnsupportedURL ||
-      error.code == NSURLErrorCannotFindHost ||
-      error.code == NSURLErrorCannotConnectToHost ||
-      error.code == NSURLErrorDNSLookupFailed) {
-    return YES;
+  if ([_backgroundSessionIdentifier isEqualToString:backgroundSessionIdentifier]) {
+    return;
+  }
+  
+  _backgroundSessionIdentifier = [backgroundSessionIdentifier copy];
+  
+  [self.backgroundSession finishTasksAndInvalidate];
+  self.backgroundSession = nil;
+  
+  if (!backgroundSessionIdentifier) {
+    return;
+  }
+  
+  NSURLSessionConfiguration *configuration;
+  if ([NSURLSessionConfiguration respondsToSelector:@selector(backgroundSessionConfigurationWithIdentifier:)]) {
+    configuration = [NSURLSessionConfiguration backgroundSessionConfigurationWithIdentifier:backgroundSessionIdentifier];
   } else {
+    // iOS 7
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdeprecated-declarations"
+    configuration = [NSURLSessionConfiguration backgroundSessionConfiguration:backgroundSessionIdentifier];
+#pragma clang diagnostic pop
+  }
+  [self configureSessionConfiguration:configuration];
+  
+  // Let the system wait for a good time to upload, e.g. Wi-Fi and power
+  configuration.discretionary = YES;
+  configuration.timeoutIntervalForResource = PiwikBackgroundHTTPResourceTimeout;
+  
+  // Creating the session reconnects to uploads started before the app was suspended or terminated
+  self.backgroundSession = [NSURLSession sessionWithConfiguration:configuration delegate:self delegateQueue:self.backgroundQueue];
+  
+}
+
+
+- (void)setBackgroundRequestCompletionBlock:(void (^)(NSString *requestIdentifier, BOOL success))completionBlock {
+  
+  [self.backgroundQueue addOperationWithBlock:^{
+    
+    _backgroundRequestCompletionBlock = [completionBlock copy];
+    
+    // Results received before the block was set
+    if (completionBlock) {
+      for (NSArray *result in self.undeliveredBackgroundRequestResults) {
+        completionBlock(result[0], [result[1] boolValue]);
+      }
+      [self.undeliveredBackgroundRequestResults removeAllObjects];
+    }
+    
+  }];
+  
+}
+
+
+- (void)sendBackgroundBulkEventWithParameters:(NSDictionary*)parameters requestIdentifier:(NSString*)requestIdentifier {
+  
+  NSMutableURLRequest *request = [self bulkRequestWithParameters:parameters];
+  request.timeoutInterval = PiwikBackgroundHTTPRequestTimeout;
+  
+  // Background sessions only upload from files
+  NSURL *fileURL = [self backgroundUploadFileURLForRequestIdentifier:requestIdentifier];
+  [[NSFileManager defaultManager] createDirectoryAtURL:[fileURL URLByDeletingLastPathComponent] withIntermediateDirectories:YES attributes:nil error:nil];
+  
+  if (!self.backgroundSession || ![request.HTTPBody writeToURL:fileURL atomically:YES]) {
+    [self.backgroundQueue addOperationWithBlock:^{
+      [self backgroundRequestDidCompleteWithIdentifier:requestIdentifier success:NO];
+    }];
+    return;
+  }
+  
+  request.HTTPBody = nil;
+  NSURLSessionUploadTask *task = [self.backgroundSession uploadTaskWithRequest:request fromFile:fileURL];
+  task.taskDescription = requestIdentifier;
+  [task resume];
+  
+}
+
+
+- (BOOL)handleEventsForBackgroundURLSession:(NSString*)identifier completionHandler:(void (^)(void))completionHandler {
+  
+  if (![identifier isEqualToString:self.backgroundSessionIdentifier]) {
     return NO;
   }
   
+  [self.backgroundQueue addOperationWithBlock:^{
+    self.backgroundEventsCompletionHandler = completionHandler;
+  }];
+  
+  return YES;
+}
+
+
+- (NSURL*)backgroundUploadFileURLForRequestIdentifier:(NSString*)requestIdentifier {
+  NSURL *cachesURL = [[[NSFileManager defaultManager] URLsForDirectory:NSCachesDirectory inDomains:NSUserDomainMask] lastObject];
+  return [[cachesURL URLByAppendingPathComponent:PiwikBackgroundUploadDirectoryName] URLByAppendingPathComponent:requestIdentifier];
+}
+
+
+// Must be called on the background delegate queue
+- (void)backgroundRequestDidCompleteWithIdentifier:(NSString*)requestIdentifier success:(BOOL)success {
+  
+  [[NSFileManager defaultManager] removeItemAtURL:[self backgroundUploadFileURLForRequestIdentifier:requestIdentifier] error:nil];
+  
+  if (self.backgroundRequestCompletionBlock) {
+    self.backgroundRequestCompletionBlock(requestIdentifier, success);
+  } else {
+    [self.undeliveredBackgroundRequestResults addObject:@[requestIdentifier, @(success)]];
+  }
+  
+}
+
+
+- (void)URLSession:(NSURLSession*)session task:(NSURLSessionTask*)task didCompleteWithError:(NSError*)error {
+  
+  if (task.taskDescription) {
+    // The server may have answered with an error status
+    BOOL success = !error && [self isSuccessfulResponse:task.response];
+    [self backgroundRequestDidCompleteWithIdentifier:task.taskDescription success:success];
+  }
+  
+}
+
+
+- (void)URLSessionDidFinishEventsForBackgroundURLSession:(NSURLSession*)session {
+  
+  void (^completionHandler)(void) = self.backgroundEventsCompletionHandler;
+  self.backgroundEventsCompletionHandler = nil;
+  
+  if (completionHandler) {
+    dispatch_async(dispatch_get_main_queue(), completionHandler);
+  }
+  
+}
+
+
+- (BOOL)isSuccessfulResponse:(NSURLResponse*)response {
+  
+  if (![response isKindOfClass:[NSHTTPURLResponse class]]) {
+    return YES;
+  }
+  
+  NSInteger statusCode = [(NSHTTPURLResponse*)response statusCode];
+  return statusCode >= 200 && statusCode < 300;
+}
+
+
+- (BOOL)isServerErrorResponse:(NSURLResponse*)response {
+  return [response isKindOfClass:[NSHTTPURLResponse class]] && [(NSHTTPURLResponse*)response statusCode] >= 500;
 }
 
 
@@ -0,0 +1,69 @@
+//
+//  PiwikParameters.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+// Piwik query parameter names
+static NSString * const PiwikParameterSiteID = @"idsite";
+static NSString * const PiwikParameterRecord = @"rec";
+static NSString * const PiwikParameterAPIVersion = @"apiv";
+static NSString * const PiwikParameterScreenReseloution = @"res";
+static NSString * const PiwikParameterHours = @"h";
+static NSString * const PiwikParameterMinutes = @"m";
+static NSString * const PiwikParameterSeconds = @"s";
+static NSString * const PiwikParameterDateAndTime = @"cdt";
+static NSString * const PiwikParameterActionName = @"action_name";
+static NSString * const PiwikParameterURL = @"url";
+static NSString * const PiwikParameterVisitorID = @"_id";
+static NSString * const PiwikParameterUserID = @"uid";
+static NSString * const PiwikParameterVisitScopeCustomVariables = @"_cvar";
+static NSString * const PiwikParameterScreenScopeCustomVariables = @"cvar";
+static NSString * const PiwikParameterRandomNumber = @"r";
+// Not used by the Piwik server, lets a proxy drop events it has already forwarded
+static NSString * const PiwikParameterEventIdentifier = @"pk_eid";
+// Not used by the Piwik server, the sample rate applied to the event, lets reports be weighted back up
+static NSString * const PiwikParameterSampleRate = @"sample_rate";
+// Not used by the Piwik server, the number of identical stale events sent as one event
+static NSString * const PiwikParameterRollupCount = @"rollup_count";
+static NSString * const PiwikParameterFirstVisitTimestamp = @"_idts";
+static NSString * const PiwikParameterPreviousVisitTimestamp = @"_viewts";
+static NSString * const PiwikParameterTotalNumberOfVisits = @"_idvc";
+static NSString * const PiwikParameterGoalID = @"idgoal";
+static NSString * const PiwikParameterRevenue = @"revenue";
+static NSString * const PiwikParameterSessionStart = @"new_visit";
+static NSString * const PiwikParameterLanguage = @"lang";
+static NSString * const PiwikParameterLatitude = @"lat";
+static NSString * const PiwikParameterLongitude = @"long";
+static NSString * const PiwikParameterSearchKeyword = @"search";
+static NSString * const PiwikParameterSearchCategory = @"search_cat";
+static NSString * const PiwikParameterSearchNumberOfHits = @"search_count";
+static NSString * const PiwikParameterLink = @"link";
+static NSString * const PiwikParameterDownload = @"download";
+static NSString * const PiwikParameterSendImage = @"send_image";
+// Ecommerce
+static NSString * const PiwikParameterTransactionIdentifier = @"ec_id";
+static NSString * const PiwikParameterTransactionSubTotal = @"ec_st";
+static NSString * const PiwikParameterTransactionTax = @"ec_tx";
+static NSString * const PiwikParameterTransactionShipping = @"ec_sh";
+static NSString * const PiwikParameterTransactionDiscount = @"ec_dt";
+static NSString * const PiwikParameterTransactionItems = @"ec_items";
+// Campaign
+static NSString * const PiwikParameterReferrer = @"urlref";
+static NSString * const PiwikParameterCampaignName = @"_rcn";
+static NSString * const PiwikParameterCampaignKeyword = @"_rck";
+// Events
+static NSString * const PiwikParameterEventCategory = @"e_c";
+static NSString * const PiwikParameterEventAction = @"e_a";
+static NSString * const PiwikParameterEventName = @"e_n";
+static NSString * const PiwikParameterEventValue = @"e_v";
+// Content impression
+static NSString * const PiwikParameterContentName = @"c_n";
+static NSString * const PiwikParameterContentPiece = @"c_p";
+static NSString * const PiwikParameterContentTarget = @"c_t";
+static NSString * const PiwikParameterContentInteraction = @"c_i";
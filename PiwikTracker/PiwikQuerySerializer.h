@@ -0,0 +1,76 @@
+//
+//  PiwikQuerySerializer.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ Serialize event parameters to URL query strings and bulk request bodies.
+
+ Keys and values are written and percent escaped in a single pass into one UTF-8 buffer. All characters except unreserved characters, "/" and ":" are escaped, including "&", "=", "+" and "#" inside values.
+
+ Escaped parameters shared by many events, e.g. the static and session parameters, can be cached and are copied into the output without escaping them again. The parameter sets referenced by PiwikEventParameters are cached automatically, only the parameters of the event itself are escaped for each event.
+
+ A serializer is not thread safe and must only be used from one queue at the time.
+ */
+@interface PiwikQuerySerializer : NSObject
+
+/**
+ Escape and cache parameters that will be serialized many times. Replace any cached value for the same keys.
+
+ @param parameters The parameters to cache.
+ */
+- (void)cacheParameters:(NSDictionary*)parameters;
+
+/**
+ Remove all cached parameters.
+ */
+- (void)removeAllCachedParameters;
+
+/**
+ Create a query string, e.g. "idsite=1&rec=1", without the leading "?".
+
+ @param parameters The event parameters. Values that are not strings are written using their description.
+ @return The escaped query string.
+ */
+- (NSString*)queryStringWithParameters:(NSDictionary*)parameters;
+
+/**
+ Create a bulk request JSON body, {"requests":["?...","?..."]}.
+
+ Written directly into the buffer without creating intermediate JSON objects.
+
+ @param queryStrings The query strings, including the leading "?", in the order they should be written.
+ @return The UTF-8 encoded JSON body.
+ */
+- (NSData*)bulkRequestBodyWithQueryStrings:(NSArray*)queryStrings;
+
+/**
+ Create a bulk request JSON body directly from the event parameters.
+
+ Each query string is written straight into one buffer, pre-sized from the average query length of the previous body. No intermediate query strings are created.
+
+ @param events The event parameters.
+ @param options NSEnumerationReverse to write the events in reverse order.
+ @return The UTF-8 encoded JSON body, equal to the body created from the query strings of the events.
+ */
+- (NSData*)bulkRequestBodyWithEvents:(NSArray*)events options:(NSEnumerationOptions)options;
+
+/**
+ Create a bulk request JSON body with a batch identifier, {"requests":["?...","?..."],"batch_id":"..."}.
+
+ The Piwik server ignores the batch identifier, a proxy can use it to drop a batch it has already forwarded.
+
+ @param events The event parameters.
+ @param options NSEnumerationReverse to write the events in reverse order.
+ @param batchIdentifier The batch identifier, or nil to leave it out.
+ @return The UTF-8 encoded JSON body.
+ */
+- (NSData*)bulkRequestBodyWithEvents:(NSArray*)events options:(NSEnumerationOptions)options batchIdentifier:(NSString*)batchIdentifier;
+
+@end
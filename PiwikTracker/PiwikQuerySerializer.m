@@ -0,0 +1,369 @@
+//
+//  PiwikQuerySerializer.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikQuerySerializer.h"
+#import "PiwikEventParameters.h"
+
+
+@interface PiwikQuerySerializer ()
+
+// Escaped "key=value" pairs and the values they were created from
+@property (nonatomic, strong) NSMutableDictionary *cachedPairs;
+@property (nonatomic, strong) NSMutableDictionary *cachedValues;
+
+// Escaped "key=value&key=value" parameter sets, keyed by parameter set identifier
+@property (nonatomic, strong) NSMutableDictionary *cachedParameterSets;
+
+// Used to size the buffer of the next bulk request body
+@property (nonatomic) NSUInteger averageQueryLength;
+
+@end
+
+
+// Strings not available as a C string are converted in chunks of this size
+static NSUInteger const PiwikSerializerChunkSize = 256;
+
+// Parameter sets are replaced when a new session start, keep the cache small
+static NSUInteger const PiwikSerializerMaximumCachedParameterSets = 16;
+
+static NSUInteger const PiwikSerializerDefaultQueryLength = 256;
+
+static const char PiwikHexDigits[] = "0123456789ABCDEF";
+
+static const char PiwikBulkRequestPrefix[] = "{\"requests\":[";
+static const char PiwikBulkRequestSuffix[] = "]}";
+static const char PiwikBulkRequestBatchIdentifierPrefix[] = "],\"batch_id\":\"";
+static const char PiwikBulkRequestBatchIdentifierSuffix[] = "\"}";
+
+
+typedef void (*PiwikAppendBytesFunction)(NSMutableData *data, const uint8_t *bytes, NSUInteger length);
+
+
+// Unreserved characters (RFC 3986), plus "/" and ":" to keep urls readable
+static inline BOOL PiwikIsUnescapedQueryCharacter(uint8_t c) {
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') ||
+         c == '-' || c == '.' || c == '_' || c == '~' || c == '/' || c == ':';
+}
+
+
+static void PiwikAppendQueryEscapedBytes(NSMutableData *data, const uint8_t *bytes, NSUInteger length) {
+
+  // Reserve room for the worst case, every byte percent escaped
+  NSUInteger start = data.length;
+  [data setLength:start + length * 3];
+  uint8_t *output = (uint8_t*)data.mutableBytes + start;
+
+  NSUInteger written = 0;
+  for (NSUInteger i = 0; i < length; i++) {
+    uint8_t c = bytes[i];
+    if (PiwikIsUnescapedQueryCharacter(c)) {
+      output[written++] = c;
+    } else {
+      output[written++] = '%';
+      output[written++] = PiwikHexDigits[c >> 4];
+      output[written++] = PiwikHexDigits[c & 0x0F];
+    }
+  }
+
+  [data setLength:start + written];
+}
+
+
+static void PiwikAppendJSONEscapedBytes(NSMutableData *data, const uint8_t *bytes, NSUInteger length) {
+
+  // Reserve room for the worst case, every byte written as \u00XX
+  NSUInteger start = data.length;
+  [data setLength:start + length * 6];
+  uint8_t *output = (uint8_t*)data.mutableBytes + start;
+
+  NSUInteger written = 0;
+  for (NSUInteger i = 0; i < length; i++) {
+    uint8_t c = bytes[i];
+    if (c == '"' || c == '\\') {
+      output[written++] = '\\';
+      output[written++] = c;
+    } else if (c < 0x20) {
+      memcpy(output + written, "\\u00", 4);
+      written += 4;
+      output[written++] = PiwikHexDigits[c >> 4];
+      output[written++] = PiwikHexDigits[c & 0x0F];
+    } else {
+      output[written++] = c;
+    }
+  }
+
+  [data setLength:start + written];
+}
+
+
+// Append the UTF-8 bytes of the string without creating a copy of the whole string
+static void PiwikAppendString(NSMutableData *data, NSString *string, PiwikAppendBytesFunction appendBytes) {
+
+  const char *cString = CFStringGetCStringPtr((__bridge CFStringRef)string, kCFStringEncodingUTF8);
+  if (cString) {
+    appendBytes(data, (const uint8_t*)cString, strlen(cString));
+    return;
+  }
+
+  uint8_t buffer[PiwikSerializerChunkSize];
+  NSRange range = NSMakeRange(0, string.length);
+  while (range.length > 0) {
+    NSUInteger usedLength = 0;
+    if (![string getBytes:buffer maxLength:sizeof(buffer) usedLength:&usedLength encoding:NSUTF8StringEncoding
+                  options:NSStringEncodingConversionAllowLossy range:range remainingRange:&range] || usedLength == 0) {
+      break;
+    }
+    appendBytes(data, buffer, usedLength);
+  }
+
+}
+
+
+static void PiwikAppendParameter(NSMutableData *data, id key, id value) {
+  PiwikAppendString(data, [key description], PiwikAppendQueryEscapedBytes);
+  [data appendBytes:"=" length:1];
+  PiwikAppendString(data, [value isKindOfClass:[NSString class]] ? value : [value description], PiwikAppendQueryEscapedBytes);
+}
+
+
+@implementation PiwikQuerySerializer
+
+
+- (instancetype)init {
+  self = [super init];
+  if (self) {
+    _cachedPairs = [NSMutableDictionary dictionary];
+    _cachedValues = [NSMutableDictionary dictionary];
+    _cachedParameterSets = [NSMutableDictionary dictionary];
+    _averageQueryLength = PiwikSerializerDefaultQueryLength;
+  }
+  return self;
+}
+
+
+- (void)cacheParameters:(NSDictionary*)parameters {
+
+  [parameters enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
+    NSMutableData *pair = [NSMutableData data];
+    PiwikAppendParameter(pair, key, value);
+
+    self.cachedPairs[key] = pair;
+    self.cachedValues[key] = value;
+  }];
+
+}
+
+
+- (void)removeAllCachedParameters {
+  [self.cachedPairs removeAllObjects];
+  [self.cachedValues removeAllObjects];
+  [self.cachedParameterSets removeAllObjects];
+}
+
+
+- (NSString*)queryStringWithParameters:(NSDictionary*)parameters {
+
+  NSMutableData *data = [NSMutableData dataWithCapacity:parameters.count * 16];
+  [self appendQueryWithParameters:parameters toData:data];
+
+  // Escaped output is always ASCII
+  return [[NSString alloc] initWithData:data encoding:NSASCIIStringEncoding];
+}
+
+
+- (NSData*)bulkRequestBodyWithQueryStrings:(NSArray*)queryStrings {
+
+  NSMutableData *data = [NSMutableData dataWithCapacity:queryStrings.count * 256];
+
+  [data appendBytes:PiwikBulkRequestPrefix length:sizeof(PiwikBulkRequestPrefix) - 1];
+
+  [queryStrings enumerateObjectsUsingBlock:^(NSString *queryString, NSUInteger idx, BOOL *stop) {
+    if (idx > 0) {
+      [data appendBytes:"," length:1];
+    }
+    [data appendBytes:"\"" length:1];
+    PiwikAppendString(data, queryString, PiwikAppendJSONEscapedBytes);
+    [data appendBytes:"\"" length:1];
+  }];
+
+  [data appendBytes:PiwikBulkRequestSuffix length:sizeof(PiwikBulkRequestSuffix) - 1];
+
+  return data;
+}
+
+
+// Escaped queries only hold unreserved characters, "/", ":", "%", "&" and "=", none of them are escaped in JSON
+- (NSData*)bulkRequestBodyWithEvents:(NSArray*)events options:(NSEnumerationOptions)options {
+  return [self bulkRequestBodyWithEvents:events options:options batchIdentifier:nil];
+}
+
+
+- (NSData*)bulkRequestBodyWithEvents:(NSArray*)events options:(NSEnumerationOptions)options batchIdentifier:(NSString*)batchIdentifier {
+
+  NSUInteger framingLength = sizeof(PiwikBulkRequestPrefix) + sizeof(PiwikBulkRequestSuffix);
+  // Quotes, "?" and ","
+  NSUInteger separatorLength = 4;
+
+  NSMutableData *data = [NSMutableData dataWithCapacity:framingLength + events.count * (self.averageQueryLength + separatorLength)];
+
+  [data appendBytes:PiwikBulkRequestPrefix length:sizeof(PiwikBulkRequestPrefix) - 1];
+
+  __block BOOL isFirstEvent = YES;
+  [events enumerateObjectsWithOptions:options usingBlock:^(NSDictionary *event, NSUInteger idx, BOOL *stop) {
+    if (!isFirstEvent) {
+      [data appendBytes:"," length:1];
+    }
+    isFirstEvent = NO;
+
+    [data appendBytes:"\"?" length:2];
+    [self appendQueryWithParameters:event toData:data];
+    [data appendBytes:"\"" length:1];
+  }];
+
+  if (batchIdentifier) {
+    [data appendBytes:PiwikBulkRequestBatchIdentifierPrefix length:sizeof(PiwikBulkRequestBatchIdentifierPrefix) - 1];
+    PiwikAppendString(data, batchIdentifier, PiwikAppendJSONEscapedBytes);
+    [data appendBytes:PiwikBulkRequestBatchIdentifierSuffix length:sizeof(PiwikBulkRequestBatchIdentifierSuffix) - 1];
+  } else {
+    [data appendBytes:PiwikBulkRequestSuffix length:sizeof(PiwikBulkRequestSuffix) - 1];
+  }
+
+  if (events.count > 0) {
+    self.averageQueryLength = data.length / events.count;
+  }
+
+  return data;
+}
+
+
+- (void)appendQueryWithParameters:(NSDictionary*)parameters toData:(NSMutableData*)data {
+
+  if ([parameters isKindOfClass:[PiwikEventParameters class]]) {
+    [self appendQueryWithEventParameters:(PiwikEventParameters*)parameters toData:data];
+    return;
+  }
+
+  __block BOOL isFirstParameter = YES;
+  [parameters enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
+
+    if (!isFirstParameter) {
+      [data appendBytes:"&" length:1];
+    }
+    isFirstParameter = NO;
+
+    NSData *cachedPair = self.cachedPairs[key];
+    if (cachedPair && [self.cachedValues[key] isEqual:value]) {
+      [data appendData:cachedPair];
+    } else {
+      PiwikAppendParameter(data, key, value);
+    }
+
+  }];
+
+}
+
+
+// Write the event parameters followed by the parameter sets, without merging them
+- (void)appendQueryWithEventParameters:(PiwikEventParameters*)eventParameters toData:(NSMutableData*)data {
+
+  NSArray *parameterSets = eventParameters.parameterSets;
+
+  __block BOOL isFirstParameter = YES;
+  [eventParameters.parameters enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
+
+    // Replaced by a parameter set
+    for (NSDictionary *parameterSet in parameterSets) {
+      if (parameterSet[key]) {
+        return;
+      }
+    }
+
+    if (!isFirstParameter) {
+      [data appendBytes:"&" length:1];
+    }
+    isFirstParameter = NO;
+
+    PiwikAppendParameter(data, key, value);
+  }];
+
+  [eventParameters.parameterSetIDs enumerateObjectsUsingBlock:^(NSNumber *parameterSetID, NSUInteger idx, BOOL *stop) {
+
+    NSDictionary *parameterSet = parameterSets[idx];
+    NSArray *laterParameterSets = [parameterSets subarrayWithRange:NSMakeRange(idx + 1, parameterSets.count - idx - 1)];
+
+    NSData *escapedParameterSet;
+    if ([self parameterSet:parameterSet sharesKeysWithParameterSets:laterParameterSets]) {
+      // Rare, only some of the values are used and the set can not be cached
+      escapedParameterSet = [self escapedParameterSet:parameterSet excludingKeysInParameterSets:laterParameterSets];
+    } else {
+      escapedParameterSet = self.cachedParameterSets[parameterSetID];
+      if (!escapedParameterSet) {
+        escapedParameterSet = [self escapedParameterSet:parameterSet excludingKeysInParameterSets:nil];
+
+        if (self.cachedParameterSets.count >= PiwikSerializerMaximumCachedParameterSets) {
+          [self.cachedParameterSets removeAllObjects];
+        }
+        self.cachedParameterSets[parameterSetID] = escapedParameterSet;
+      }
+    }
+
+    if (escapedParameterSet.length > 0) {
+      if (!isFirstParameter) {
+        [data appendBytes:"&" length:1];
+      }
+      isFirstParameter = NO;
+
+      [data appendData:escapedParameterSet];
+    }
+
+  }];
+
+}
+
+
+- (BOOL)parameterSet:(NSDictionary*)parameterSet sharesKeysWithParameterSets:(NSArray*)parameterSets {
+
+  for (NSDictionary *otherParameterSet in parameterSets) {
+    for (id key in otherParameterSet) {
+      if (parameterSet[key]) {
+        return YES;
+      }
+    }
+  }
+
+  return NO;
+}
+
+
+// Later parameter sets replace values of earlier sets
+- (NSData*)escapedParameterSet:(NSDictionary*)parameterSet excludingKeysInParameterSets:(NSArray*)laterParameterSets {
+
+  NSMutableData *data = [NSMutableData data];
+
+  __block BOOL isFirstParameter = YES;
+  [parameterSet enumerateKeysAndObjectsUsingBlock:^(id key, id value, BOOL *stop) {
+
+    for (NSDictionary *laterParameterSet in laterParameterSets) {
+      if (laterParameterSet[key]) {
+        return;
+      }
+    }
+
+    if (!isFirstParameter) {
+      [data appendBytes:"&" length:1];
+    }
+    isFirstParameter = NO;
+
+    PiwikAppendParameter(data, key, value);
+  }];
+
+  return data;
+}
+
+
+@end
@@ -0,0 +1,57 @@
+//
+//  PiwikReachability.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ The type of network currently used to reach the Internet.
+ */
+typedef NS_ENUM(NSUInteger, PiwikNetworkClass) {
+  // Not reachable or not known
+  PiwikNetworkClassUnknown = 0,
+  // Wi-Fi, or any wired connection on OSX
+  PiwikNetworkClassWiFi,
+  // Cellular data
+  PiwikNetworkClassCellular
+};
+
+
+/**
+ Determine the type of network used to reach the Internet.
+ 
+ The network class is read from the routing state of the device and does not generate any network traffic.
+ */
+@interface PiwikReachability : NSObject
+
+/**
+ The network class right now.
+ */
+- (PiwikNetworkClass)networkClass;
+
+/**
+ YES if the Internet can be reached right now. Also YES if the routing state can not be read, requests will then find out.
+ */
+- (BOOL)isReachable;
+
+/**
+ Run the block every time the reachability or the network class change.
+ 
+ Only one block is kept, calling this method again replace the block and the queue.
+ 
+ @param queue The queue the block is run on.
+ @param changeBlock Run with the new reachability and network class.
+ */
+- (void)startMonitoringOnQueue:(dispatch_queue_t)queue changeBlock:(void (^)(BOOL isReachable, PiwikNetworkClass networkClass))changeBlock;
+
+/**
+ Stop running the change block.
+ */
+- (void)stopMonitoring;
+
+@end
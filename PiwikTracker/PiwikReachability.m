@@ -0,0 +1,130 @@
+//
+//  PiwikReachability.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikReachability.h"
+#import <SystemConfiguration/SystemConfiguration.h>
+#import <netinet/in.h>
+
+
+@interface PiwikReachability ()
+
+@property (nonatomic, copy) void (^changeBlock)(BOOL isReachable, PiwikNetworkClass networkClass);
+
+@end
+
+
+static PiwikNetworkClass PiwikNetworkClassWithFlags(SCNetworkReachabilityFlags flags) {
+  
+  if (!(flags & kSCNetworkReachabilityFlagsReachable) || (flags & kSCNetworkReachabilityFlagsConnectionRequired)) {
+    return PiwikNetworkClassUnknown;
+  }
+  
+#if TARGET_OS_IPHONE
+  if (flags & kSCNetworkReachabilityFlagsIsWWAN) {
+    return PiwikNetworkClassCellular;
+  }
+#endif
+  
+  return PiwikNetworkClassWiFi;
+}
+
+
+// Run on the monitoring queue, the info pointer is not retained and cleared before the object is deallocated
+static void PiwikReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags flags, void *info) {
+  
+  PiwikReachability *reachability = (__bridge PiwikReachability*)info;
+  void (^changeBlock)(BOOL, PiwikNetworkClass) = reachability.changeBlock;
+  
+  if (changeBlock) {
+    PiwikNetworkClass networkClass = PiwikNetworkClassWithFlags(flags);
+    changeBlock(networkClass != PiwikNetworkClassUnknown, networkClass);
+  }
+  
+}
+
+
+@implementation PiwikReachability {
+  SCNetworkReachabilityRef _reachability;
+}
+
+
+- (instancetype)init {
+  
+  if (self = [super init]) {
+    // The zero address represents the default route
+    struct sockaddr_in zeroAddress;
+    bzero(&zeroAddress, sizeof(zeroAddress));
+    zeroAddress.sin_len = sizeof(zeroAddress);
+    zeroAddress.sin_family = AF_INET;
+    
+    _reachability = SCNetworkReachabilityCreateWithAddress(kCFAllocatorDefault, (const struct sockaddr*)&zeroAddress);
+  }
+  
+  return self;
+}
+
+
+- (void)dealloc {
+  if (_reachability) {
+    [self stopMonitoring];
+    CFRelease(_reachability);
+  }
+}
+
+
+- (PiwikNetworkClass)networkClass {
+  
+  SCNetworkReachabilityFlags flags;
+  if (!_reachability || !SCNetworkReachabilityGetFlags(_reachability, &flags)) {
+    return PiwikNetworkClassUnknown;
+  }
+  
+  return PiwikNetworkClassWithFlags(flags);
+}
+
+
+- (BOOL)isReachable {
+  
+  SCNetworkReachabilityFlags flags;
+  if (!_reachability || !SCNetworkReachabilityGetFlags(_reachability, &flags)) {
+    return YES;
+  }
+  
+  return PiwikNetworkClassWithFlags(flags) != PiwikNetworkClassUnknown;
+}
+
+
+- (void)startMonitoringOnQueue:(dispatch_queue_t)queue changeBlock:(void (^)(BOOL isReachable, PiwikNetworkClass networkClass))changeBlock {
+  
+  if (!_reachability) {
+    return;
+  }
+  
+  self.changeBlock = changeBlock;
+  
+  SCNetworkReachabilityContext context = {0, (__bridge void*)self, NULL, NULL, NULL};
+  if (!SCNetworkReachabilitySetCallback(_reachability, PiwikReachabilityCallback, &context) ||
+      !SCNetworkReachabilitySetDispatchQueue(_reachability, queue)) {
+    [self stopMonitoring];
+  }
+  
+}
+
+
+- (void)stopMonitoring {
+  
+  if (_reachability) {
+    SCNetworkReachabilitySetCallback(_reachability, NULL, NULL);
+    SCNetworkReachabilitySetDispatchQueue(_reachability, NULL);
+  }
+  
+  self.changeBlock = nil;
+}
+
+
+@end
@@ -0,0 +1,180 @@
+//
+//  PiwikTelemetry.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ Why a tracked event was dropped before it was tracked by the Piwik server.
+ */
+typedef NS_ENUM(NSUInteger, PiwikEventDropReason) {
+  // Outsampled by the sample rate
+  PiwikEventDropReasonSampling = 0,
+  // The user opted out from tracking
+  PiwikEventDropReasonOptOut,
+  // The queue was full, see maxNumberOfQueuedEvents and overflowPolicy
+  PiwikEventDropReasonOverflow,
+  // Merged with an identical event, see eventCoalescingInterval and staleEventRollupAge
+  PiwikEventDropReasonCoalesced,
+  // Rejected as invalid by the Piwik server, removed from the queue so it does not block later events
+  PiwikEventDropReasonRejected,
+  // Older than the retention window, see maximumEventAge
+  PiwikEventDropReasonExpired
+};
+
+static NSUInteger const PiwikNumberOfEventDropReasons = 6;
+
+
+/**
+ Why a request to the Piwik server failed.
+ */
+typedef NS_ENUM(NSUInteger, PiwikDispatchErrorClass) {
+  // The Internet was unreachable when the request failed
+  PiwikDispatchErrorClassOffline = 0,
+  // The dispatcher aborted the dispatch, e.g. a timeout or a failed connection
+  PiwikDispatchErrorClassNetwork,
+  // The request failed but the dispatcher continued with the next request, e.g. rejected by the server
+  PiwikDispatchErrorClassRequest
+};
+
+static NSUInteger const PiwikNumberOfDispatchErrorClasses = 3;
+
+
+/**
+ A snapshot of the tracker telemetry since the tracker was created.
+
+ Histograms are arrays of counts (NSNumber), one for each bucket. A value is counted in the first bucket with an upper bound greater or equal to the value, the last bucket has no upper bound.
+ */
+@interface PiwikTrackerStatistics : NSObject <NSCopying>
+
+/**
+ The number of events tracked, including events that were later dropped.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfTrackedEvents;
+
+/**
+ The number of events handed to the event store or the event buffer.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfQueuedEvents;
+
+/**
+ The number of events that are currently stored or buffered.
+ */
+@property (nonatomic, readonly) NSUInteger queueDepth;
+
+/**
+ The number of events dropped for a reason.
+ */
+- (NSUInteger)numberOfDroppedEventsWithReason:(PiwikEventDropReason)reason;
+
+/**
+ The number of successful requests.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfSuccessfulRequests;
+
+/**
+ The number of events received by the Piwik server.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfSentEvents;
+
+/**
+ The approximate number of bytes sent in successful requests, before compression.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfSentBytes;
+
+/**
+ The number of failed requests of an error class.
+ */
+- (NSUInteger)numberOfFailedRequestsWithErrorClass:(PiwikDispatchErrorClass)errorClass;
+
+/**
+ The upper bounds of the latency buckets in seconds.
+ */
++ (NSArray*)latencyBucketBounds;
+
+/**
+ The time from sending a successful request until the response was received.
+ */
+@property (nonatomic, readonly, strong) NSArray *latencyHistogram;
+
+/**
+ The upper bounds of the payload size buckets in bytes.
+ */
++ (NSArray*)payloadSizeBucketBounds;
+
+/**
+ The approximate size of successful requests.
+ */
+@property (nonatomic, readonly, strong) NSArray *payloadSizeHistogram;
+
+/**
+ The upper bounds of the time in queue buckets in seconds.
+ */
++ (NSArray*)timeInQueueBucketBounds;
+
+/**
+ The time from tracking an event until it was received by the Piwik server.
+ */
+@property (nonatomic, readonly, strong) NSArray *timeInQueueHistogram;
+
+/**
+ A percentile of the time in queue, e.g. 0.5 for the median or 0.95.
+
+ @return The upper bound of the bucket holding the percentile, DBL_MAX if in the last bucket and 0 if no events have been sent.
+ */
+- (NSTimeInterval)timeInQueuePercentile:(double)percentile;
+
+@end
+
+
+/**
+ Record the tracker telemetry.
+
+ Counters are updated with relaxed atomic operations and may be recorded from any thread without locks. A snapshot is not taken atomically, counters updated while the snapshot is taken may be off by the events in progress.
+ */
+@interface PiwikTelemetry : NSObject
+
+- (void)recordTrackedEvent;
+
+- (void)recordQueuedEvent;
+
+- (void)recordDroppedEvents:(NSUInteger)numberOfEvents reason:(PiwikEventDropReason)reason;
+
+/**
+ Record the total number of events dropped by the event store.
+
+ @param numberOfDroppedEvents The number of dropped events reported by the store since it was created.
+ @return The number of events dropped since the last call, recorded as overflow drops.
+ */
+- (NSUInteger)recordNumberOfEventsDroppedByStore:(NSUInteger)numberOfDroppedEvents;
+
+/**
+ Reset the number of events dropped by the store, e.g. when a new store is set.
+ */
+- (void)resetNumberOfEventsDroppedByStore:(NSUInteger)numberOfDroppedEvents;
+
+- (void)recordRequestDidSucceedWithNumberOfEvents:(NSUInteger)numberOfEvents payloadSize:(NSUInteger)payloadSize latency:(NSTimeInterval)latency;
+
+- (void)recordRequestDidFailWithErrorClass:(PiwikDispatchErrorClass)errorClass;
+
+/**
+ Record the time in queue of events received by the Piwik server.
+
+ @param events The sent event parameters.
+ @param time The time the events were received.
+ */
+- (void)recordTimeInQueueOfEvents:(NSArray*)events absoluteTime:(CFAbsoluteTime)time;
+
+/**
+ A snapshot of the telemetry.
+
+ @param queueDepth The number of events currently stored or buffered.
+ */
+- (PiwikTrackerStatistics*)statisticsWithQueueDepth:(NSUInteger)queueDepth;
+
+@end
@@ -0,0 +1,264 @@
+//
+//  PiwikTelemetry.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikTelemetry.h"
+#import <stdatomic.h>
+#import "PiwikParameters.h"
+#import "PiwikTimeContext.h"
+
+
+// Upper bounds of the histogram buckets, the last bucket has no upper bound
+static double const PiwikLatencyBucketBounds[] = {0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30};
+static double const PiwikPayloadSizeBucketBounds[] = {512, 1024, 4096, 16384, 65536, 262144};
+static double const PiwikTimeInQueueBucketBounds[] = {1, 10, 60, 5 * 60, 30 * 60, 2 * 3600, 24 * 3600, 7 * 24 * 3600};
+
+#define PiwikNumberOfBuckets(bounds) (sizeof(bounds) / sizeof(bounds[0]) + 1)
+
+
+static NSUInteger PiwikBucketIndex(const double *bounds, NSUInteger numberOfBounds, double value) {
+  NSUInteger index = 0;
+  while (index < numberOfBounds && value > bounds[index]) {
+    index++;
+  }
+  return index;
+}
+
+
+static NSArray* PiwikBucketBoundsArray(const double *bounds, NSUInteger numberOfBounds) {
+  NSMutableArray *array = [NSMutableArray arrayWithCapacity:numberOfBounds];
+  for (NSUInteger i = 0; i < numberOfBounds; i++) {
+    [array addObject:@(bounds[i])];
+  }
+  return array;
+}
+
+
+static NSArray* PiwikHistogramArray(atomic_uint_fast64_t *counts, NSUInteger numberOfBuckets) {
+  NSMutableArray *array = [NSMutableArray arrayWithCapacity:numberOfBuckets];
+  for (NSUInteger i = 0; i < numberOfBuckets; i++) {
+    [array addObject:@(atomic_load_explicit(&counts[i], memory_order_relaxed))];
+  }
+  return array;
+}
+
+
+@interface PiwikTrackerStatistics ()
+
+@property (nonatomic) NSUInteger numberOfTrackedEvents;
+@property (nonatomic) NSUInteger numberOfQueuedEvents;
+@property (nonatomic) NSUInteger queueDepth;
+@property (nonatomic, strong) NSArray *numberOfDroppedEvents;
+@property (nonatomic) NSUInteger numberOfSuccessfulRequests;
+@property (nonatomic) NSUInteger numberOfSentEvents;
+@property (nonatomic) NSUInteger numberOfSentBytes;
+@property (nonatomic, strong) NSArray *numberOfFailedRequests;
+@property (nonatomic, strong) NSArray *latencyHistogram;
+@property (nonatomic, strong) NSArray *payloadSizeHistogram;
+@property (nonatomic, strong) NSArray *timeInQueueHistogram;
+
+@end
+
+
+@implementation PiwikTrackerStatistics
+
+
+- (id)copyWithZone:(NSZone*)zone {
+  
+  PiwikTrackerStatistics *statistics = [[[self class] allocWithZone:zone] init];
+  statistics.numberOfTrackedEvents = self.numberOfTrackedEvents;
+  statistics.numberOfQueuedEvents = self.numberOfQueuedEvents;
+  statistics.queueDepth = self.queueDepth;
+  statistics.numberOfDroppedEvents = self.numberOfDroppedEvents;
+  statistics.numberOfSuccessfulRequests = self.numberOfSuccessfulRequests;
+  statistics.numberOfSentEvents = self.numberOfSentEvents;
+  statistics.numberOfSentBytes = self.numberOfSentBytes;
+  statistics.numberOfFailedRequests = self.numberOfFailedRequests;
+  statistics.latencyHistogram = self.latencyHistogram;
+  statistics.payloadSizeHistogram = self.payloadSizeHistogram;
+  statistics.timeInQueueHistogram = self.timeInQueueHistogram;
+  
+  return statistics;
+}
+
+
+- (NSUInteger)numberOfDroppedEventsWithReason:(PiwikEventDropReason)reason {
+  return reason < self.numberOfDroppedEvents.count ? [self.numberOfDroppedEvents[reason] unsignedIntegerValue] : 0;
+}
+
+
+- (NSUInteger)numberOfFailedRequestsWithErrorClass:(PiwikDispatchErrorClass)errorClass {
+  return errorClass < self.numberOfFailedRequests.count ? [self.numberOfFailedRequests[errorClass] unsignedIntegerValue] : 0;
+}
+
+
++ (NSArray*)latencyBucketBounds {
+  return PiwikBucketBoundsArray(PiwikLatencyBucketBounds, PiwikNumberOfBuckets(PiwikLatencyBucketBounds) - 1);
+}
+
+
++ (NSArray*)payloadSizeBucketBounds {
+  return PiwikBucketBoundsArray(PiwikPayloadSizeBucketBounds, PiwikNumberOfBuckets(PiwikPayloadSizeBucketBounds) - 1);
+}
+
+
++ (NSArray*)timeInQueueBucketBounds {
+  return PiwikBucketBoundsArray(PiwikTimeInQueueBucketBounds, PiwikNumberOfBuckets(PiwikTimeInQueueBucketBounds) - 1);
+}
+
+
+- (NSTimeInterval)timeInQueuePercentile:(double)percentile {
+  
+  uint64_t total = 0;
+  for (NSNumber *count in self.timeInQueueHistogram) {
+    total += [count unsignedLongLongValue];
+  }
+  if (total == 0) {
+    return 0;
+  }
+  
+  // The rank of the percentile, at least the first event
+  uint64_t rank = MAX((uint64_t)ceil(MIN(MAX(percentile, 0), 1) * total), 1);
+  uint64_t cumulative = 0;
+  NSUInteger numberOfBounds = PiwikNumberOfBuckets(PiwikTimeInQueueBucketBounds) - 1;
+  for (NSUInteger i = 0; i < self.timeInQueueHistogram.count; i++) {
+    cumulative += [self.timeInQueueHistogram[i] unsignedLongLongValue];
+    if (cumulative >= rank) {
+      return i < numberOfBounds ? PiwikTimeInQueueBucketBounds[i] : DBL_MAX;
+    }
+  }
+  
+  return DBL_MAX;
+}
+
+
+- (NSString*)description {
+  return [NSString stringWithFormat:@"<%@: tracked=%lu queued=%lu queueDepth=%lu dropped=%@ requests=%lu sentEvents=%lu sentBytes=%lu failed=%@ timeInQueueMedian=%.0fs>",
+          NSStringFromClass([self class]), (unsigned long)self.numberOfTrackedEvents, (unsigned long)self.numberOfQueuedEvents,
+          (unsigned long)self.queueDepth, [self.numberOfDroppedEvents componentsJoinedByString:@"/"], (unsigned long)self.numberOfSuccessfulRequests,
+          (unsigned long)self.numberOfSentEvents, (unsigned long)self.numberOfSentBytes, [self.numberOfFailedRequests componentsJoinedByString:@"/"],
+          [self timeInQueuePercentile:0.5]];
+}
+
+
+@end
+
+
+@implementation PiwikTelemetry {
+  atomic_uint_fast64_t _numberOfTrackedEvents;
+  atomic_uint_fast64_t _numberOfQueuedEvents;
+  atomic_uint_fast64_t _numberOfDroppedEvents[PiwikNumberOfEventDropReasons];
+  atomic_uint_fast64_t _numberOfEventsDroppedByStore;
+  atomic_uint_fast64_t _numberOfSuccessfulRequests;
+  atomic_uint_fast64_t _numberOfSentEvents;
+  atomic_uint_fast64_t _numberOfSentBytes;
+  atomic_uint_fast64_t _numberOfFailedRequests[PiwikNumberOfDispatchErrorClasses];
+  atomic_uint_fast64_t _latencyHistogram[PiwikNumberOfBuckets(PiwikLatencyBucketBounds)];
+  atomic_uint_fast64_t _payloadSizeHistogram[PiwikNumberOfBuckets(PiwikPayloadSizeBucketBounds)];
+  atomic_uint_fast64_t _timeInQueueHistogram[PiwikNumberOfBuckets(PiwikTimeInQueueBucketBounds)];
+}
+
+
+// Instance variables are zero initialized, a valid state for atomic counters
+
+
+- (void)recordTrackedEvent {
+  atomic_fetch_add_explicit(&_numberOfTrackedEvents, 1, memory_order_relaxed);
+}
+
+
+- (void)recordQueuedEvent {
+  atomic_fetch_add_explicit(&_numberOfQueuedEvents, 1, memory_order_relaxed);
+}
+
+
+- (void)recordDroppedEvents:(NSUInteger)numberOfEvents reason:(PiwikEventDropReason)reason {
+  if (reason < PiwikNumberOfEventDropReasons) {
+    atomic_fetch_add_explicit(&_numberOfDroppedEvents[reason], numberOfEvents, memory_order_relaxed);
+  }
+}
+
+
+- (NSUInteger)recordNumberOfEventsDroppedByStore:(NSUInteger)numberOfDroppedEvents {
+  
+  // Only the caller seeing a new total will record the difference
+  uint_fast64_t previous = atomic_load_explicit(&_numberOfEventsDroppedByStore, memory_order_relaxed);
+  while (numberOfDroppedEvents > previous) {
+    if (atomic_compare_exchange_weak_explicit(&_numberOfEventsDroppedByStore, &previous, numberOfDroppedEvents, memory_order_relaxed, memory_order_relaxed)) {
+      NSUInteger difference = (NSUInteger)(numberOfDroppedEvents - previous);
+      [self recordDroppedEvents:difference reason:PiwikEventDropReasonOverflow];
+      return difference;
+    }
+  }
+  
+  return 0;
+}
+
+
+- (void)resetNumberOfEventsDroppedByStore:(NSUInteger)numberOfDroppedEvents {
+  atomic_store_explicit(&_numberOfEventsDroppedByStore, numberOfDroppedEvents, memory_order_relaxed);
+}
+
+
+- (void)recordRequestDidSucceedWithNumberOfEvents:(NSUInteger)numberOfEvents payloadSize:(NSUInteger)payloadSize latency:(NSTimeInterval)latency {
+  
+  atomic_fetch_add_explicit(&_numberOfSuccessfulRequests, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&_numberOfSentEvents, numberOfEvents, memory_order_relaxed);
+  atomic_fetch_add_explicit(&_numberOfSentBytes, payloadSize, memory_order_relaxed);
+  
+  NSUInteger latencyIndex = PiwikBucketIndex(PiwikLatencyBucketBounds, PiwikNumberOfBuckets(PiwikLatencyBucketBounds) - 1, latency);
+  atomic_fetch_add_explicit(&_latencyHistogram[latencyIndex], 1, memory_order_relaxed);
+  
+  NSUInteger payloadSizeIndex = PiwikBucketIndex(PiwikPayloadSizeBucketBounds, PiwikNumberOfBuckets(PiwikPayloadSizeBucketBounds) - 1, payloadSize);
+  atomic_fetch_add_explicit(&_payloadSizeHistogram[payloadSizeIndex], 1, memory_order_relaxed);
+  
+}
+
+
+- (void)recordRequestDidFailWithErrorClass:(PiwikDispatchErrorClass)errorClass {
+  if (errorClass < PiwikNumberOfDispatchErrorClasses) {
+    atomic_fetch_add_explicit(&_numberOfFailedRequests[errorClass], 1, memory_order_relaxed);
+  }
+}
+
+
+- (void)recordTimeInQueueOfEvents:(NSArray*)events absoluteTime:(CFAbsoluteTime)time {
+  
+  NSUInteger numberOfBounds = PiwikNumberOfBuckets(PiwikTimeInQueueBucketBounds) - 1;
+  for (NSDictionary *event in events) {
+    // The UTC time the event was tracked, with a resolution of one second
+    CFAbsoluteTime trackedTime = [PiwikTimeContext absoluteTimeWithUTCDateAndTime:event[PiwikParameterDateAndTime]];
+    if (isnan(trackedTime)) {
+      continue;
+    }
+    NSUInteger index = PiwikBucketIndex(PiwikTimeInQueueBucketBounds, numberOfBounds, MAX(time - trackedTime, 0));
+    atomic_fetch_add_explicit(&_timeInQueueHistogram[index], 1, memory_order_relaxed);
+  }
+  
+}
+
+
+- (PiwikTrackerStatistics*)statisticsWithQueueDepth:(NSUInteger)queueDepth {
+  
+  PiwikTrackerStatistics *statistics = [[PiwikTrackerStatistics alloc] init];
+  statistics.numberOfTrackedEvents = (NSUInteger)atomic_load_explicit(&_numberOfTrackedEvents, memory_order_relaxed);
+  statistics.numberOfQueuedEvents = (NSUInteger)atomic_load_explicit(&_numberOfQueuedEvents, memory_order_relaxed);
+  statistics.queueDepth = queueDepth;
+  statistics.numberOfDroppedEvents = PiwikHistogramArray(_numberOfDroppedEvents, PiwikNumberOfEventDropReasons);
+  statistics.numberOfSuccessfulRequests = (NSUInteger)atomic_load_explicit(&_numberOfSuccessfulRequests, memory_order_relaxed);
+  statistics.numberOfSentEvents = (NSUInteger)atomic_load_explicit(&_numberOfSentEvents, memory_order_relaxed);
+  statistics.numberOfSentBytes = (NSUInteger)atomic_load_explicit(&_numberOfSentBytes, memory_order_relaxed);
+  statistics.numberOfFailedRequests = PiwikHistogramArray(_numberOfFailedRequests, PiwikNumberOfDispatchErrorClasses);
+  statistics.latencyHistogram = PiwikHistogramArray(_latencyHistogram, PiwikNumberOfBuckets(PiwikLatencyBucketBounds));
+  statistics.payloadSizeHistogram = PiwikHistogramArray(_payloadSizeHistogram, PiwikNumberOfBuckets(PiwikPayloadSizeBucketBounds));
+  statistics.timeInQueueHistogram = PiwikHistogramArray(_timeInQueueHistogram, PiwikNumberOfBuckets(PiwikTimeInQueueBucketBounds));
+  
+  return statistics;
+}
+
+
+@end
@@ -0,0 +1,58 @@
+//
+//  PiwikTimeContext.h
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <Foundation/Foundation.h>
+
+
+/**
+ Compute the local time of day and the UTC date and time sent with each event.
+ 
+ The time zone offset is cached until the next daylight saving time transition or until the system time zone change. The time is computed with integer math, without a calendar or a date formatter.
+ 
+ The context is not thread safe and must only be accessed from the tracker queue.
+ */
+@interface PiwikTimeContext : NSObject
+
+/**
+ Create a context following the system time zone.
+ */
+- (instancetype)init;
+
+/**
+ Create a context using a fixed time zone.
+ 
+ @param timeZone The time zone of the local time. The context will not follow changes of the system time zone.
+ */
+- (instancetype)initWithTimeZone:(NSTimeZone*)timeZone;
+
+/**
+ Add the local hours, minutes and seconds and the UTC date and time to the parameters.
+ 
+ @param parameters The event parameters.
+ @param time The time the event was tracked.
+ */
+- (void)addTimeParameters:(NSMutableDictionary*)parameters absoluteTime:(CFAbsoluteTime)time;
+
+/**
+ The local hours, minutes and seconds.
+ */
+- (void)getLocalHours:(NSInteger*)hours minutes:(NSInteger*)minutes seconds:(NSInteger*)seconds absoluteTime:(CFAbsoluteTime)time;
+
+/**
+ The UTC date and time formatted as yyyy-MM-dd HH:mm:ss.
+ */
+- (NSString*)UTCDateAndTimeWithAbsoluteTime:(CFAbsoluteTime)time;
+
+/**
+ Parse a UTC date and time formatted as yyyy-MM-dd HH:mm:ss.
+ 
+ @return The time, or NAN if the string could not be parsed.
+ */
++ (CFAbsoluteTime)absoluteTimeWithUTCDateAndTime:(NSString*)dateAndTime;
+
+@end
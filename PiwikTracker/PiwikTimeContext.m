@@ -0,0 +1,246 @@
+//
+//  PiwikTimeContext.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import "PiwikTimeContext.h"
+#import "PiwikParameters.h"
+
+
+static int64_t const PiwikSecondsPerDay = 86400;
+
+// Seconds between 1970-01-01 and 2001-01-01, the reference date of CFAbsoluteTime
+static int64_t const PiwikUnixEpochOffset = 978307200;
+
+// yyyy-MM-dd HH:mm:ss
+static NSUInteger const PiwikDateAndTimeLength = 19;
+
+
+// Integer math, no calendar or formatter needed
+
+static inline int64_t PiwikFloorDivide(int64_t value, int64_t divisor) {
+  return (value >= 0 ? value : value - divisor + 1) / divisor;
+}
+
+
+static inline int64_t PiwikFloorModulo(int64_t value, int64_t divisor) {
+  return value - PiwikFloorDivide(value, divisor) * divisor;
+}
+
+
+// The proleptic Gregorian date of a number of days since 1970-01-01, see http://howardhinnant.github.io/date_algorithms.html
+static void PiwikCivilFromDays(int64_t days, int64_t *year, unsigned *month, unsigned *day) {
+  days += 719468;
+  int64_t era = PiwikFloorDivide(days, 146097);
+  unsigned dayOfEra = (unsigned)(days - era * 146097);
+  unsigned yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  unsigned dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  unsigned monthFromMarch = (5 * dayOfYear + 2) / 153;
+  *day = dayOfYear - (153 * monthFromMarch + 2) / 5 + 1;
+  *month = monthFromMarch < 10 ? monthFromMarch + 3 : monthFromMarch - 9;
+  *year = (int64_t)yearOfEra + era * 400 + (*month <= 2 ? 1 : 0);
+}
+
+
+// The number of days since 1970-01-01 of a proleptic Gregorian date, the inverse of PiwikCivilFromDays
+static int64_t PiwikDaysFromCivil(int64_t year, unsigned month, unsigned day) {
+  year -= month <= 2 ? 1 : 0;
+  int64_t era = PiwikFloorDivide(year, 400);
+  unsigned yearOfEra = (unsigned)(year - era * 400);
+  unsigned dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  unsigned dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return era * 146097 + (int64_t)dayOfEra - 719468;
+}
+
+
+// Zero padded decimal digits
+static inline void PiwikWriteDigits(char *buffer, unsigned value, NSUInteger width) {
+  for (NSUInteger i = width; i > 0; i--) {
+    buffer[i - 1] = '0' + value % 10;
+    value /= 10;
+  }
+}
+
+
+// Returns NO if not all characters are digits
+static inline BOOL PiwikReadDigits(const char *buffer, NSUInteger width, unsigned *value) {
+  *value = 0;
+  for (NSUInteger i = 0; i < width; i++) {
+    if (buffer[i] < '0' || buffer[i] > '9') {
+      return NO;
+    }
+    *value = *value * 10 + (unsigned)(buffer[i] - '0');
+  }
+  return YES;
+}
+
+
+// The strings 0 to 59, shared by hours, minutes and seconds
+static NSArray* PiwikSexagesimalNumberStrings(void) {
+  static NSArray *numbers;
+  static dispatch_once_t onceToken;
+  dispatch_once(&onceToken, ^{
+    NSMutableArray *strings = [NSMutableArray arrayWithCapacity:60];
+    for (NSUInteger i = 0; i < 60; i++) {
+      [strings addObject:[NSString stringWithFormat:@"%lu", (unsigned long)i]];
+    }
+    numbers = [strings copy];
+  });
+  return numbers;
+}
+
+
+@interface PiwikTimeContext ()
+
+@property (nonatomic, strong) NSTimeZone *timeZone;
+@property (nonatomic, strong) id timeZoneObserver;
+
+// Set from the notification thread
+@property (atomic) BOOL needsRefresh;
+
+// The cached offset is valid within this range
+@property (nonatomic) NSInteger secondsFromGMT;
+@property (nonatomic) CFAbsoluteTime offsetValidFrom;
+@property (nonatomic) CFAbsoluteTime offsetValidUntil;
+
+@end
+
+
+@implementation PiwikTimeContext
+
+
+- (instancetype)init {
+  self = [super init];
+  if (self) {
+    _needsRefresh = YES;
+    
+    __weak typeof(self)weakSelf = self;
+    _timeZoneObserver = [[NSNotificationCenter defaultCenter] addObserverForName:NSSystemTimeZoneDidChangeNotification
+                                                                          object:nil
+                                                                           queue:nil
+                                                                      usingBlock:^(NSNotification *notification) {
+                                                                        weakSelf.needsRefresh = YES;
+                                                                      }];
+  }
+  return self;
+}
+
+
+- (instancetype)initWithTimeZone:(NSTimeZone*)timeZone {
+  self = [super init];
+  if (self) {
+    _timeZone = timeZone;
+    _needsRefresh = YES;
+  }
+  return self;
+}
+
+
+- (void)dealloc {
+  if (_timeZoneObserver) {
+    [[NSNotificationCenter defaultCenter] removeObserver:_timeZoneObserver];
+  }
+}
+
+
+- (void)addTimeParameters:(NSMutableDictionary*)parameters absoluteTime:(CFAbsoluteTime)time {
+  
+  NSInteger hours, minutes, seconds;
+  [self getLocalHours:&hours minutes:&minutes seconds:&seconds absoluteTime:time];
+  
+  NSArray *numbers = PiwikSexagesimalNumberStrings();
+  parameters[PiwikParameterHours] = numbers[hours];
+  parameters[PiwikParameterMinutes] = numbers[minutes];
+  parameters[PiwikParameterSeconds] = numbers[seconds];
+  
+  parameters[PiwikParameterDateAndTime] = [self UTCDateAndTimeWithAbsoluteTime:time];
+}
+
+
+- (void)getLocalHours:(NSInteger*)hours minutes:(NSInteger*)minutes seconds:(NSInteger*)seconds absoluteTime:(CFAbsoluteTime)time {
+  
+  if (self.needsRefresh || time < self.offsetValidFrom || time >= self.offsetValidUntil) {
+    [self refreshOffsetWithAbsoluteTime:time];
+  }
+  
+  int64_t secondOfDay = PiwikFloorModulo((int64_t)floor(time) + self.secondsFromGMT, PiwikSecondsPerDay);
+  *hours = (NSInteger)(secondOfDay / 3600);
+  *minutes = (NSInteger)(secondOfDay / 60 % 60);
+  *seconds = (NSInteger)(secondOfDay % 60);
+}
+
+
+- (NSString*)UTCDateAndTimeWithAbsoluteTime:(CFAbsoluteTime)time {
+  
+  int64_t unixTime = (int64_t)floor(time) + PiwikUnixEpochOffset;
+  int64_t days = PiwikFloorDivide(unixTime, PiwikSecondsPerDay);
+  int64_t secondOfDay = unixTime - days * PiwikSecondsPerDay;
+  
+  int64_t year;
+  unsigned month, day;
+  PiwikCivilFromDays(days, &year, &month, &day);
+  
+  char buffer[PiwikDateAndTimeLength];
+  PiwikWriteDigits(buffer, (unsigned)MAX(0, MIN(year, 9999)), 4);
+  buffer[4] = '-';
+  PiwikWriteDigits(buffer + 5, month, 2);
+  buffer[7] = '-';
+  PiwikWriteDigits(buffer + 8, day, 2);
+  buffer[10] = ' ';
+  PiwikWriteDigits(buffer + 11, (unsigned)(secondOfDay / 3600), 2);
+  buffer[13] = ':';
+  PiwikWriteDigits(buffer + 14, (unsigned)(secondOfDay / 60 % 60), 2);
+  buffer[16] = ':';
+  PiwikWriteDigits(buffer + 17, (unsigned)(secondOfDay % 60), 2);
+  
+  return [[NSString alloc] initWithBytes:buffer length:PiwikDateAndTimeLength encoding:NSASCIIStringEncoding];
+}
+
+
++ (CFAbsoluteTime)absoluteTimeWithUTCDateAndTime:(NSString*)dateAndTime {
+  
+  char buffer[PiwikDateAndTimeLength + 1];
+  if (![dateAndTime isKindOfClass:[NSString class]] || dateAndTime.length != PiwikDateAndTimeLength ||
+      ![dateAndTime getCString:buffer maxLength:sizeof(buffer) encoding:NSASCIIStringEncoding]) {
+    return NAN;
+  }
+  
+  unsigned year, month, day, hours, minutes, seconds;
+  if (!PiwikReadDigits(buffer, 4, &year) || !PiwikReadDigits(buffer + 5, 2, &month) || !PiwikReadDigits(buffer + 8, 2, &day) ||
+      !PiwikReadDigits(buffer + 11, 2, &hours) || !PiwikReadDigits(buffer + 14, 2, &minutes) || !PiwikReadDigits(buffer + 17, 2, &seconds) ||
+      month < 1 || month > 12 || day < 1 || day > 31) {
+    return NAN;
+  }
+  
+  int64_t unixTime = PiwikDaysFromCivil(year, month, day) * PiwikSecondsPerDay + hours * 3600 + minutes * 60 + seconds;
+  return (CFAbsoluteTime)(unixTime - PiwikUnixEpochOffset);
+}
+
+
+- (void)refreshOffsetWithAbsoluteTime:(CFAbsoluteTime)time {
+  
+  NSTimeZone *timeZone = self.timeZone;
+  if (!timeZone) {
+    if (self.needsRefresh) {
+      // The system time zone is cached by Foundation
+      [NSTimeZone resetSystemTimeZone];
+    }
+    timeZone = [NSTimeZone systemTimeZone];
+  }
+  self.needsRefresh = NO;
+  
+  NSDate *date = [NSDate dateWithTimeIntervalSinceReferenceDate:time];
+  self.secondsFromGMT = [timeZone secondsFromGMTForDate:date];
+  
+  // The offset will not change until the next daylight saving time transition
+  NSDate *nextTransition = [timeZone nextDaylightSavingTimeTransitionAfterDate:date];
+  self.offsetValidFrom = time;
+  self.offsetValidUntil = nextTransition ? [nextTransition timeIntervalSinceReferenceDate] : DBL_MAX;
+  
+}
+
+
+@end
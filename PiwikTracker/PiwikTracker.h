@@ -8,8 +8,60 @@
 
 #import <Foundation/Foundation.h>
 #import "PiwikDebugDispatcher.h"
+#import "PiwikEventStore.h"
+#import "PiwikDispatchController.h"
+#import "PiwikTelemetry.h"
 
 @class PiwikTransaction;
+@class PiwikEvent;
+
+
+/**
+ The type of a tracked event, used to sample each type at its own rate.
+ */
+typedef NS_ENUM(NSUInteger, PiwikEventType) {
+  // Screen views, sendView: and send:
+  PiwikEventTypeScreenView = 0,
+  // Events, exceptions and social interactions
+  PiwikEventTypeEvent,
+  // Goals
+  PiwikEventTypeGoal,
+  // Transactions
+  PiwikEventTypeEcommerce,
+  // Outlinks, downloads, searches, campaigns and content
+  PiwikEventTypeOther
+};
+@class PiwikTracker;
+
+
+/**
+ Receive telemetry from the tracker as it happens, e.g. to log or report the health of the tracking.
+ 
+ All methods are optional and called on the main queue.
+ */
+@protocol PiwikTrackerTelemetryDelegate <NSObject>
+
+@optional
+
+/**
+ Tracked events were dropped, before they reached the event store or when rejected by the Piwik server.
+ */
+- (void)piwikTracker:(PiwikTracker*)tracker didDropEvents:(NSUInteger)numberOfEvents reason:(PiwikEventDropReason)reason;
+
+/**
+ A request was received by the Piwik server.
+ 
+ @param payloadSize The approximate size of the request in bytes, before compression.
+ @param latency The time from sending the request until the response was received, in seconds.
+ */
+- (void)piwikTracker:(PiwikTracker*)tracker didSendEvents:(NSUInteger)numberOfEvents payloadSize:(NSUInteger)payloadSize latency:(NSTimeInterval)latency;
+
+/**
+ A request failed, the events stay queued and are sent again by a later dispatch.
+ */
+- (void)piwikTracker:(PiwikTracker*)tracker didFailToSendEvents:(NSUInteger)numberOfEvents errorClass:(PiwikDispatchErrorClass)errorClass;
+
+@end
 
 
 /**
@@ -25,7 +77,7 @@
  2. Track screen views, events, errors, social interaction, search, goals and more
  3. Let the SDK dispatch events to the Piwik server automatically, or dispatch events manually
 
- All events are persisted locally in Core Data until they are dispatched and successfully received by the Piwik server.
+ All events are persisted locally, by default in Core Data, until they are dispatched and successfully received by the Piwik server.
  
  All methods are asynchronous and will return immediately.
  */
@@ -41,6 +93,12 @@ typedef NS_ENUM(NSUInteger, CustomVariableScope) {
 };
 
 
+typedef NS_ENUM(NSUInteger, PiwikEventDurability) {
+  PiwikEventDurabilityEveryEvent,
+  PiwikEventDurabilityBuffered
+};
+
+
 /**
  @name Creating a Piwik tracker
  */
@@ -80,6 +138,17 @@ typedef NS_ENUM(NSUInteger, CustomVariableScope) {
  */
 + (instancetype)sharedInstance;
 
+/**
+ Return a tracker reporting to another site of the same Piwik server, created the first time it is requested.
+ 
+ Each site has its own visitor, session and custom variables, but all trackers share this tracker's event store, its limits and storage budget, its dispatcher and its dispatch timer. Events of all sites are sent by this tracker, several sites can share one bulk request.
+ Dispatch and event store settings, e.g. dispatchInterval and maxNumberOfQueuedEvents, are set on this tracker. A dispatch started by a site tracker sends the events of all sites, and deleteQueuedEvents deletes them.
+ 
+ @param siteID The site id of the other site
+ @return The tracker for the site, or this tracker if the site id is the same
+ */
+- (PiwikTracker*)trackerForSiteID:(NSString*)siteID;
+
 /**
  Piwik site id.
  
@@ -142,12 +211,56 @@ typedef NS_ENUM(NSUInteger, CustomVariableScope) {
 @property(nonatomic) BOOL optOut;
 
 /**
- The probability of an event actually being sampled and sent to the Piwik server. Value 1-100, default 100.
+ Enrich and store events on a private serial queue instead of the calling thread. Default NO.
+ 
+ When set to YES the tracking methods will only capture the event parameters and the current time before returning. Adding session, static and per request parameters and handing the event over to the store is done in the background.
+ Events as well as changes to the session and custom variables are processed in the order they are made, an event is always sent with the custom variables and session state set before it was tracked.
+ 
+ Please note that `PiwikSessionStartNotification` will be posted on the tracker queue when this option is enabled. Custom variables set by an observer of the notification will be included in the event starting the session.
+ */
+@property (nonatomic) BOOL processEventsInBackground;
+
+/**
+ Defer the tracker startup until the app has shown its first frame. Default NO.
+
+ Set to YES directly after the tracker has been created, e.g. in `application:didFinishLaunchingWithOptions:`. Opening the event store, which may include a Core Data migration, reading or creating the client ID and reading the device model is then done on a background queue when the main run loop is idle after launch, instead of when the first event is tracked.
+ Events tracked before the startup has finished are kept in memory and are processed in the order they were tracked as soon as it has finished, as if processEventsInBackground was enabled. They are not included in the queue depth of statistics until then. Reading statistics or dispatchStatistics never waits for the startup.
+
+ Setting the property back to NO has no effect once the startup has been deferred.
+ */
+@property (nonatomic) BOOL lazyStartup;
+
+/**
+ The probability of an event actually being sampled and sent to the Piwik server. Value 0-100, default 100.
  
  Use the sample rate to only send a sample of all events generated by the app. This can be useful for applications that generate a lot of events.
+ 
+ Sampling is decided for each visitor from the client ID, not for each event. A visitor is either sampled for all events of a type or for none, so visits and funnels stay complete. Sampled events carry the applied rate in the sample_rate parameter, so reports can be weighted back up.
+ 
+ The rate applies to event types without a rate of their own. Goals and transactions are not sampled unless their rate is set explicitly.
+ @see setSampleRate:forEventType:
  */
 @property (nonatomic) NSUInteger sampleRate;
 
+/**
+ Set the sample rate of an event type. Value 0-100.
+ 
+ Replaces the default sample rate for the type, e.g. to send all goals but only a sample of the screen views.
+ 
+ @param sampleRate The sample rate of the event type.
+ @param eventType The event type.
+ @see sampleRate
+ */
+- (void)setSampleRate:(NSUInteger)sampleRate forEventType:(PiwikEventType)eventType;
+
+/**
+ The sample rate applied to an event type.
+ 
+ @param eventType The event type.
+ @return The rate set for the type, otherwise 100 for goals and transactions and sampleRate for other types.
+ */
+- (NSUInteger)sampleRateForEventType:(PiwikEventType)eventType;
+
 
 // Removed for now. This feature still depends on the auth_token being sent to the Piwik server.
 // The auth_token should not be used any longer in the clients due to security reasons.
@@ -252,6 +365,18 @@ typedef NS_ENUM(NSUInteger, CustomVariableScope) {
  */
 - (BOOL)sendEventWithCategory:(NSString*)category action:(NSString*)action name:(NSString*)name value:(NSNumber*)value;
 
+/**
+ Track an event from a reusable event.
+ 
+ Same as `sendEventWithCategory:action:name:value:` but for call sites tracking many events. The caller creates no collections, the event can be changed and sent again as soon as the method returns.
+ With `processEventsInBackground` enabled only the field values are captured on the calling thread and the event parameters are built on the tracker queue. Otherwise they are built on the calling thread before the method returns.
+ 
+ @param event The event, the field values are captured when the method is called.
+ @return YES if the event was queued for dispatching.
+ @see PiwikEvent
+ */
+- (BOOL)sendEvent:(PiwikEvent*)event;
+
 /**
  Track a caught exception or error.
  
@@ -280,6 +405,8 @@ typedef NS_ENUM(NSUInteger, CustomVariableScope) {
 /**
  Track a goal conversion.
  
+ Goals are queued as high priority events and dispatched according to `highPriorityDispatchInterval`.
+ 
  @param goalID The unique goal ID as configured in the Piwik server.
  @param revenue The monetary value of the conversion.
  @return YES if the event was queued for dispatching.
@@ -303,6 +430,8 @@ typedef NS_ENUM(NSUInteger, CustomVariableScope) {
  
  A transaction contains transaction information as well as an optional list of items included in the transaction.
  
+ Transactions are queued as high priority events and dispatched according to `highPriorityDispatchInterval`.
+ 
  Use the transaction builder to create the transaction object.
  
  @param transaction The transaction.
@@ -411,10 +540,23 @@ typedef NS_ENUM(NSUInteger, CustomVariableScope) {
  
  If a negative value is set the dispatch timer will never run and manual dispatch must be used. If 0 is set the event is dispatched as as quick as possible after it has been queued.
  
+ The timer is not run while the Internet is unreachable, the events are dispatched shortly after the network is back. After a failed dispatch the interval is doubled for each failure in a row, up to 30 minutes.
+ 
  @see dispatch
  */
 @property(nonatomic) NSTimeInterval dispatchInterval;
 
+/**
+ How long high priority events, goals and transactions, may wait before they are dispatched. Default 0 seconds.
+ 
+ If 0 is set high priority events are dispatched as a small batch directly after they have been queued, without waiting for the dispatch timer. If a positive value is set the high priority events tracked during the interval are dispatched together. If a negative value is set high priority events are queued and dispatched as any other event.
+ 
+ High priority events bypass the event buffer. If the event starting a new visit has not been sent yet, the high priority dispatch send all queued events to make sure goals are not counted in the previous visit.
+ 
+ Requires an event store implementing `storeEvents:priority:parameterSets:completionBlock:` and `eventsFromStore:minimumPriority:excludingEventIDs:completionBlock:`, otherwise all events are dispatched on the dispatch timer.
+ */
+@property (nonatomic) NSTimeInterval highPriorityDispatchInterval;
+
 /**
  Specifies the maximum number of events queued in core date. Default 500.
  
@@ -422,6 +564,99 @@ typedef NS_ENUM(NSUInteger, CustomVariableScope) {
  */
 @property (nonatomic) NSUInteger maxNumberOfQueuedEvents;
 
+/**
+ The maximum number of high priority events queued. Default 100.
+ 
+ High priority events share `maxNumberOfQueuedEvents` with all other events, the quota make sure a burst of goals can not push out all other events. Requires an event store implementing `setMaximumNumberOfEvents:forPriority:`.
+ */
+@property (nonatomic) NSUInteger maxNumberOfQueuedHighPriorityEvents;
+
+/**
+ What to do with new events when `maxNumberOfQueuedEvents` events are queued. Default PiwikEventOverflowPolicyDropNewest.
+ 
+ PiwikEventOverflowPolicyDropNewest - new events are dropped.
+ PiwikEventOverflowPolicyDropOldest - the oldest queued events with the same priority are deleted to make room for new events.
+ PiwikEventOverflowPolicyDropLowestPriority - the oldest queued events with a lower priority are deleted to make room for new events, e.g. screen views are deleted to make room for goals.
+ 
+ Requires an event store implementing `overflowPolicy`.
+ */
+@property (nonatomic) PiwikEventOverflowPolicy overflowPolicy;
+
+/**
+ The number of events currently in the event store, not including buffered events. Returns 0 if the event store does not implement `numberOfEvents`.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfQueuedEvents;
+
+/**
+ The number of events dropped because the queue was full since the event store was created. Returns 0 if the event store does not implement `numberOfDroppedEvents`.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfDroppedEvents;
+
+/**
+ The store used to persist events until they are dispatched. Default PiwikCoreDataEventStore.
+ 
+ Use a PiwikJournalEventStore to avoid setting up Core Data, or provide a custom store implementing the PiwikEventStore protocol. The store must be set directly after the tracker is created, events already queued in the previous store will not be moved.
+ 
+ @see PiwikEventStore
+ */
+@property (nonatomic, strong) id<PiwikEventStore> eventStore;
+
+/**
+ Control how often tracked events are written to the persistent store. Default PiwikEventDurabilityEveryEvent.
+ 
+ PiwikEventDurabilityEveryEvent - each event is written to disk directly when it is tracked. No events will be lost if the app crashes.
+ PiwikEventDurabilityBuffered - events are kept in an in-memory buffer and written to disk in batches when the buffer reach `eventBufferFlushThreshold` events, after `eventBufferFlushInterval` seconds, before each dispatch and when the app is sent to the background or terminated. Up to `eventBufferFlushThreshold` events may be lost if the app crashes, in return for far less disk I/O.
+ 
+ The number of buffered and stored events will never exceed `maxNumberOfQueuedEvents`.
+ */
+@property (nonatomic) PiwikEventDurability eventDurability;
+
+/**
+ The number of buffered events that will trigger a write to the persistent store. Default 20 events.
+ 
+ Only used when eventDurability is set to PiwikEventDurabilityBuffered.
+ */
+@property (nonatomic) NSUInteger eventBufferFlushThreshold;
+
+/**
+ The maximum time in seconds an event is kept in the in-memory buffer before it is written to the persistent store. Default 10 seconds.
+ 
+ Only used when eventDurability is set to PiwikEventDurabilityBuffered.
+ */
+@property (nonatomic) NSTimeInterval eventBufferFlushInterval;
+
+/**
+ Merge identical screen views and content impressions tracked within this interval into one event. Default 0 seconds, disabled.
+ 
+ Useful when a view controller is shown repeatedly or a content impression is tracked each time a cell is reused. The first event is queued and identical events tracked within the interval are dropped, an event starting a new session or carrying screen custom variables or campaign parameters is never dropped.
+ 
+ Screen views are identical if they have the same action name and url, content impressions if they have the same name, piece and target.
+ */
+@property (nonatomic) NSTimeInterval eventCoalescingInterval;
+
+/**
+ The number of identical events dropped since the tracker was created.
+ 
+ @see eventCoalescingInterval
+ */
+@property (nonatomic, readonly) NSUInteger numberOfCoalescedEvents;
+
+/**
+ The retention window in seconds. Events queued longer are deleted instead of being sent, e.g. after a long time offline. Default 0 seconds, events are kept until they are sent.
+ 
+ Expired events are deleted from the store in a single range delete when the property is set and before each dispatch. They are reported as PiwikEventDropReasonExpired.
+ 
+ Requires an event store implementing `deleteEventsStoredBeforeDate:completionBlock:`. The journal store deletes whole segments of events, events may be kept slightly longer than the window.
+ */
+@property (nonatomic) NSTimeInterval maximumEventAge;
+
+/**
+ Roll up identical screen views and content impressions older than this number of seconds. Default 0 seconds, disabled.
+ 
+ Useful after a long time offline, when the same screens were viewed repeatedly. Only the first of the identical old events in a request is sent, with the number of events it stands for in the rollup_count parameter. The others are deleted and reported as PiwikEventDropReasonCoalesced once the server has accepted that event, they are sent again if the request fails. Events are identical when all their parameters except the time, the random number and the event identifier are equal, events of different sites or visitors are never rolled up. An event starting a new session is never rolled up.
+ */
+@property (nonatomic) NSTimeInterval staleEventRollupAge;
+
 /**
  Specifies how many events should be sent to the Piwik server in each request. Default 20 events per request.
  
@@ -429,6 +664,87 @@ typedef NS_ENUM(NSUInteger, CustomVariableScope) {
  */
 @property (nonatomic) NSUInteger eventsPerRequest;
 
+/**
+ The maximum number of requests sent to the Piwik server at the same time during a dispatch. Default 1.
+ 
+ Each request contain a separate range of queued events and the events are deleted as soon as their request is successful. Sending several requests in parallel will empty a large queue faster on high latency networks.
+ 
+ A request containing the first event of a new visit is always sent on its own, after any earlier request has finished and before any later event is sent.
+ */
+@property (nonatomic) NSUInteger maxConcurrentDispatches;
+
+/**
+ Adapt the number of events per request and the request timeout to the measured network performance. Default NO.
+ 
+ When enabled `eventsPerRequest` is the maximum number of events sent in each request. The batch size grow while requests succeed and is halved after a failure. The request timeout follow the measured round trip time and is kept between 5 seconds and `maxRequestTimeout`. Wi-Fi and cellular networks are tracked separately.
+ 
+ The request timeout is only adjusted if the dispatcher implement `setRequestTimeout:`.
+ 
+ @see dispatchStatistics
+ */
+@property (nonatomic) BOOL adaptiveDispatch;
+
+/**
+ Postpone timed dispatches when sending is expensive for the device. Default NO.
+ 
+ When enabled the dispatch interval is four times longer in Low Power Mode and twice as long on cellular networks. High priority events and manual dispatches are not postponed.
+ 
+ Regardless of this setting timed dispatches are paused while the Internet is unreachable, and the interval is backed off exponentially after failed dispatches.
+ */
+@property (nonatomic) BOOL powerAwareDispatch;
+
+/**
+ The maximum request timeout in seconds used by adaptive dispatch. Default 30 seconds.
+ */
+@property (nonatomic) NSTimeInterval maxRequestTimeout;
+
+/**
+ Compress bulk request bodies with gzip to reduce mobile data usage. Default NO.
+ 
+ Only enable if the Piwik server, or a proxy in front of it, accept `Content-Encoding: gzip` request bodies. Small requests are sent uncompressed. Requires a dispatcher implementing `setCompressBulkRequests:`.
+ */
+@property (nonatomic) BOOL compressBulkRequests;
+
+/**
+ Hand queued events over to the system when the app resigns active. Default NO.
+ 
+ The events are written to a single bulk request and uploaded by a background `NSURLSession`, even if the app is suspended or terminated. The events stay in the queue and are excluded from normal dispatches until the upload has finished. Successfully uploaded events are deleted, if needed the next time the app is launched. Uploads that have not finished within 24 hours are given up on and their events are sent again by a normal dispatch.
+ 
+ Requires a dispatcher implementing the background upload methods of the `PiwikDispatcher` protocol, e.g. `PiwikNSURLSessionDispatcher`, and an event store implementing `archivableEventIDs:` and `eventIDsFromArchivableEventIDs:`.
+ 
+ Set this property as early as possible after the app has been launched, and forward `application:handleEventsForBackgroundURLSession:completionHandler:` from the app delegate to `handleEventsForBackgroundURLSession:completionHandler:`.
+ */
+@property (nonatomic) BOOL backgroundDispatch;
+
+/**
+ Pass on the events of a background upload session to the tracker.
+ 
+ Call from the app delegate `application:handleEventsForBackgroundURLSession:completionHandler:` method.
+ 
+ @param identifier The background session identifier.
+ @param completionHandler The completion handler passed to the app delegate.
+ @return YES if the session belongs to the tracker. If NO the app is responsible for calling the completion handler.
+ @see backgroundDispatch
+ */
+- (BOOL)handleEventsForBackgroundURLSession:(NSString*)identifier completionHandler:(void (^)(void))completionHandler;
+
+/**
+ The measured network performance and the dispatch settings currently used for the network the device is connected to.
+ */
+@property (nonatomic, readonly) PiwikDispatchStatistics *dispatchStatistics;
+
+/**
+ A snapshot of the tracker telemetry since the tracker was created.
+ 
+ Tell if events were sampled out, dropped by opt out, a full queue or coalescing, how many events are queued, and how long requests and events take to reach the Piwik server. The counters are updated without locks and cost next to nothing when not read.
+ */
+@property (nonatomic, readonly) PiwikTrackerStatistics *statistics;
+
+/**
+ Receive telemetry as it happens. Default nil.
+ */
+@property (nonatomic, weak) id<PiwikTrackerTelemetryDelegate> telemetryDelegate;
+
 /**
  Manually start a dispatch of all pending events.
  
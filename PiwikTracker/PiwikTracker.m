@@ -8,19 +8,30 @@
 
 #import "PiwikTracker.h"
 #import <CommonCrypto/CommonDigest.h>
-#import <CoreData/CoreData.h>
 #import <CoreLocation/CoreLocation.h>
 
 #import "PiwikTransaction.h"
 #import "PiwikTransactionItem.h"
-#import "PTEventEntity.h"
+#import "PiwikEvent.h"
 #import "PiwikLocationManager.h"
+#import "PiwikEventBuffer.h"
+#import "PiwikEventCoalescer.h"
+#import "PiwikTimeContext.h"
+#import "PiwikTelemetry.h"
+#import "PiwikLogging.h"
+#import "PiwikEventEncoder.h"
+#import "PiwikQuerySerializer.h"
+#import "PiwikParameters.h"
+#import "PiwikCoreDataEventStore.h"
+#import "PiwikReachability.h"
+#import "PiwikDispatchScheduler.h"
+#import "PiwikDeviceModel.h"
+#import "PiwikBulkRequestResult.h"
 
 #import "PiwikDispatcher.h"
 #import "PiwikNSURLSessionDispatcher.h"
 
 #include <sys/types.h>
-#include <sys/sysctl.h>
 #if TARGET_OS_IPHONE
 #import <UIKit/UIKit.h>
 #else
@@ -28,19 +39,6 @@
 #endif
 
 
-//#define PIWIK_DEBUG_LOG
-
-// Debug logging
-#ifdef PIWIK_DEBUG_LOG
-  #define PiwikDebugLog(fmt,...) NSLog(@"[Piwik] %@",[NSString stringWithFormat:(fmt), ##__VA_ARGS__]);
-#else
-  #define PiwikDebugLog(...)
-#endif
-
-// Always logging
-#define PiwikLog(fmt,...) NSLog(@"[Piwik] %@",[NSString stringWithFormat:(fmt), ##__VA_ARGS__]);
-
-
 #pragma mark - Constants
 
 // Notifications
@@ -55,59 +53,6 @@ static NSString * const PiwikUserDefaultFirstVistsTimestampKey = @"PiwikFirstVis
 static NSString * const PiwikUserDefaultVisitorIDKey = @"PiwikVisitorIDKey";
 static NSString * const PiwikUserDefaultOptOutKey = @"PiwikOptOutKey";
 
-// Piwik query parameter names
-static NSString * const PiwikParameterSiteID = @"idsite";
-static NSString * const PiwikParameterRecord = @"rec";
-static NSString * const PiwikParameterAPIVersion = @"apiv";
-static NSString * const PiwikParameterScreenReseloution = @"res";
-static NSString * const PiwikParameterHours = @"h";
-static NSString * const PiwikParameterMinutes = @"m";
-static NSString * const PiwikParameterSeconds = @"s";
-static NSString * const PiwikParameterDateAndTime = @"cdt";
-static NSString * const PiwikParameterActionName = @"action_name";
-static NSString * const PiwikParameterURL = @"url";
-static NSString * const PiwikParameterVisitorID = @"_id";
-static NSString * const PiwikParameterUserID = @"uid";
-static NSString * const PiwikParameterVisitScopeCustomVariables = @"_cvar";
-static NSString * const PiwikParameterScreenScopeCustomVariables = @"cvar";
-static NSString * const PiwikParameterRandomNumber = @"r";
-static NSString * const PiwikParameterFirstVisitTimestamp = @"_idts";
-static NSString * const PiwikParameterPreviousVisitTimestamp = @"_viewts";
-static NSString * const PiwikParameterTotalNumberOfVisits = @"_idvc";
-static NSString * const PiwikParameterGoalID = @"idgoal";
-static NSString * const PiwikParameterRevenue = @"revenue";
-static NSString * const PiwikParameterSessionStart = @"new_visit";
-static NSString * const PiwikParameterLanguage = @"lang";
-static NSString * const PiwikParameterLatitude = @"lat";
-static NSString * const PiwikParameterLongitude = @"long";
-static NSString * const PiwikParameterSearchKeyword = @"search";
-static NSString * const PiwikParameterSearchCategory = @"search_cat";
-static NSString * const PiwikParameterSearchNumberOfHits = @"search_count";
-static NSString * const PiwikParameterLink = @"link";
-static NSString * const PiwikParameterDownload = @"download";
-static NSString * const PiwikParameterSendImage = @"send_image";
-// Ecommerce
-static NSString * const PiwikParameterTransactionIdentifier = @"ec_id";
-static NSString * const PiwikParameterTransactionSubTotal = @"ec_st";
-static NSString * const PiwikParameterTransactionTax = @"ec_tx";
-static NSString * const PiwikParameterTransactionShipping = @"ec_sh";
-static NSString * const PiwikParameterTransactionDiscount = @"ec_dt";
-static NSString * const PiwikParameterTransactionItems = @"ec_items";
-// Campaign
-static NSString * const PiwikParameterReferrer = @"urlref";
-static NSString * const PiwikParameterCampaignName = @"_rcn";
-static NSString * const PiwikParameterCampaignKeyword = @"_rck";
-// Events
-static NSString * const PiwikParameterEventCategory = @"e_c";
-static NSString * const PiwikParameterEventAction = @"e_a";
-static NSString * const PiwikParameterEventName = @"e_n";
-static NSString * const PiwikParameterEventValue = @"e_v";
-// Content impression
-static NSString * const PiwikParameterContentName = @"c_n";
-static NSString * const PiwikParameterContentPiece = @"c_p";
-static NSString * const PiwikParameterContentTarget = @"c_t";
-static NSString * const PiwikParameterContentInteraction = @"c_i";
-
 // Piwik default parmeter values
 static NSString * const PiwikDefaultRecordValue = @"1";
 static NSString * const PiwikDefaultAPIVersionValue = @"1";
@@ -117,11 +62,40 @@ static NSString * const PiwikDefaultContentInteractionName = @"tap";
 static NSUInteger const PiwikDefaultSessionTimeout = 120;
 static NSUInteger const PiwikDefaultDispatchTimer = 120;
 static NSUInteger const PiwikDefaultMaxNumberOfStoredEvents = 500;
+static NSUInteger const PiwikDefaultMaxNumberOfStoredHighPriorityEvents = 100;
+static NSTimeInterval const PiwikDefaultHighPriorityDispatchInterval = 0;
 static NSUInteger const PiwikDefaultSampleRate = 100;
 static NSUInteger const PiwikDefaultNumberOfEventsPerRequest = 20;
+static NSUInteger const PiwikDefaultMaxConcurrentDispatches = 1;
+static NSTimeInterval const PiwikDefaultMinRequestTimeout = 5;
+static NSTimeInterval const PiwikDefaultMaxRequestTimeout = 30;
+static NSUInteger const PiwikDefaultEventBufferFlushThreshold = 20;
+static NSTimeInterval const PiwikDefaultEventBufferFlushInterval = 10;
+static NSTimeInterval const PiwikDefaultEventCoalescingInterval = 0;
 
 static NSUInteger const PiwikExceptionDescriptionMaximumLength = 50;
 
+// An event sent on its own and rejected this many times while the server accepts other events is dropped
+static NSUInteger const PiwikMaximumNumberOfEventRejections = 3;
+
+// Background dispatch
+static NSString * const PiwikBackgroundSessionIdentifierPrefix = @"org.piwik.tracker.background.";
+static NSString * const PiwikBackgroundRequestsFileName = @"piwiktracker.backgroundrequests.plist";
+static NSString * const PiwikBackgroundRequestDateKey = @"date";
+static NSString * const PiwikBackgroundRequestEventIDsKey = @"eventIDs";
+// Longer than the dispatcher lets the system retry a discretionary upload
+static NSTimeInterval const PiwikBackgroundRequestMaximumAge = 24 * 60 * 60;
+
+// Bulk request body key, not used by the Piwik server
+static NSString * const PiwikBulkRequestBatchIdentifierKey = @"batch_id";
+
+// Tracker queue
+static char * const PiwikTrackerQueueLabel = "org.piwik.tracker";
+static char PiwikTrackerQueueKey;
+
+// Lazy startup runs after the Core Animation commit observer when the main run loop is about to wait
+static CFIndex const PiwikStartupRunLoopObserverOrder = INT_MAX;
+
 // Page view prefix values
 static NSString * const PiwikPrefixView = @"screen";
 static NSString * const PiwikPrefixEvent = @"event";
@@ -169,7 +143,8 @@ static NSString * const PiwikURLCampaignKeyword = @"pk_kwd";
 
 @property (nonatomic, readonly) NSString *clientID;
 
-@property (nonatomic, strong) NSString *lastGeneratedPageURL;
+// Set from the calling thread when the page URL is generated
+@property (atomic, strong) NSString *lastGeneratedPageURL;
 
 @property (nonatomic) NSUInteger totalNumberOfVisits;
 
@@ -184,16 +159,81 @@ static NSString * const PiwikURLCampaignKeyword = @"pk_kwd";
 @property (nonatomic, strong) NSDictionary *staticParameters;
 @property (nonatomic, strong) NSDictionary *campaignParameters;
 
+// Encoded parameter sets referenced by stored events
+@property (nonatomic, strong) NSNumber *sessionParameterSetID;
+@property (nonatomic, strong) NSNumber *staticParameterSetID;
+@property (nonatomic, strong) NSMutableDictionary *parameterSets;
+
+// Cached time zone offset for the local time, only accessed on the tracker queue
+@property (nonatomic, strong) PiwikTimeContext *timeContext;
+
+// Query serializer caching the escaped static and session parameters, only accessed on the tracker queue
+@property (nonatomic, strong) PiwikQuerySerializer *querySerializer;
+
+// Serial queue owning the session, custom variable and campaign state
+@property (nonatomic, strong) dispatch_queue_t trackerQueue;
+
+// Set while the tracker queue is suspended waiting for the lazy startup, read from any thread
+@property (atomic) BOOL isStartupPending;
+
+// Read once on the main thread, nil until then, read by the tracker queue
+@property (atomic, strong) NSString *screenResolution;
+
+// Write-behind buffer, only accessed on the tracker queue
+@property (nonatomic, strong) PiwikEventBuffer *eventBuffer;
+@property (nonatomic) BOOL isEventBufferFlushScheduled;
+
+// Drop identical views and impressions, only accessed on the tracker queue
+@property (nonatomic, strong) PiwikEventCoalescer *eventCoalescer;
+
 @property (nonatomic, strong) id<PiwikDispatcher> dispatcher;
-@property (nonatomic, strong) NSTimer *dispatchTimer;
+@property (nonatomic, strong) PiwikDispatchScheduler *dispatchScheduler;
+
+// Trackers of other sites sharing the event store and the dispatch of this tracker, keyed by site id
+@property (nonatomic, strong) NSMutableDictionary *siteTrackers;
+// Set for a site tracker, the tracker that dispatches its events
+@property (nonatomic, weak) PiwikTracker *dispatchingTracker;
+// Only accessed on the tracker queue
 @property (nonatomic) BOOL isDispatchRunning;
 
+// High priority lane dispatch state, only accessed on the tracker queue
+@property (nonatomic) BOOL isHighPriorityDispatchRunning;
+@property (nonatomic) BOOL isHighPriorityDispatchScheduled;
+@property (nonatomic) BOOL isNewVisitPending;
+
+// In-flight dispatch state, only accessed on the tracker queue
+@property (nonatomic, strong) NSMutableSet *inFlightEventIDs;
+@property (nonatomic, strong) NSMutableSet *failedEventIDs;
+@property (nonatomic) NSUInteger numberOfDispatchesInFlight;
+@property (nonatomic) BOOL isFetchingEvents;
+@property (nonatomic) BOOL isNewVisitDispatchInFlight;
+@property (nonatomic) BOOL isDispatchAborted;
+
+// Events in rejected requests and the number of rejections, only accessed on the tracker queue
+// While not empty events are sent one by one to isolate the events the server will not accept
+@property (nonatomic, strong) NSMutableDictionary *eventRejectionCounts;
+@property (nonatomic) BOOL didAcceptRequestInDispatch;
+
+// Adaptive batch size and timeout, only accessed on the tracker queue
+@property (nonatomic, strong) PiwikDispatchController *dispatchController;
+@property (nonatomic, strong) PiwikReachability *reachability;
+
+// Lock-free counters, updated from any queue
+@property (nonatomic, strong) PiwikTelemetry *telemetry;
+
+// Events handed over to the background session, only accessed on the tracker queue
+@property (nonatomic, strong) NSMutableDictionary *backgroundRequests;
+@property (nonatomic, strong) NSMutableSet *backgroundEventIDs;
+
 @property (nonatomic) BOOL includeLocationInformation; // Disabled, see comments in .h file
 @property (nonatomic, strong) PiwikLocationManager *locationManager;
+// The location snapshot in the session parameters, only accessed on the tracker queue
+@property (nonatomic, strong) CLLocation *sessionLocation;
 
-@property (nonatomic, readonly, strong) NSManagedObjectContext *managedObjectContext;
-@property (nonatomic, readonly, strong) NSManagedObjectModel *managedObjectModel;
-@property (nonatomic, readonly, strong) NSPersistentStoreCoordinator *persistentStoreCoordinator;
+// Sample rates keyed by event type, replaced and never mutated
+@property (strong) NSDictionary *eventTypeSampleRates;
+// The visitor sample bucket 0-99 derived from the client ID, -1 until calculated on the tracker queue
+@property (nonatomic) NSInteger visitorSampleBucket;
 
 @end
 
@@ -208,10 +248,8 @@ NSString* UserDefaultKeyWithSiteID(NSString* siteID, NSString *key);
 @synthesize previousVisitTimestamp = _previousVisitTimestamp;
 @synthesize currentVisitTimestamp = _currentVisitTimestamp;
 @synthesize clientID = _clientID;
-
-@synthesize managedObjectContext = _managedObjectContext;
-@synthesize managedObjectModel = _managedObjectModel;
-@synthesize persistentStoreCoordinator = _persistentStoreCoordinator;
+@synthesize sessionStart = _sessionStart;
+@synthesize userID = _userID;
 
 
 static PiwikTracker *_sharedInstance;
@@ -271,19 +309,55 @@ static PiwikTracker *_sharedInstance;
 }
 
 
+- (PiwikTracker*)trackerForSiteID:(NSString*)siteID {
+  
+  if (self.dispatchingTracker) {
+    return [self.dispatchingTracker trackerForSiteID:siteID];
+  }
+  
+  if ([siteID isEqualToString:self.siteID]) {
+    return self;
+  }
+  
+  @synchronized(self.siteTrackers) {
+    PiwikTracker *tracker = self.siteTrackers[siteID];
+    if (!tracker) {
+      tracker = [[PiwikTracker alloc] initWithSiteID:siteID dispatcher:self.dispatcher dispatchingTracker:self];
+      self.siteTrackers[siteID] = tracker;
+    }
+    return tracker;
+  }
+  
+}
+
+
 - (id)initWithSiteID:(NSString*)siteID dispatcher:(id<PiwikDispatcher>)dispatcher {
+  return [self initWithSiteID:siteID dispatcher:dispatcher dispatchingTracker:nil];
+}
+
+
+// A site tracker shares the event store, the dispatcher and the dispatch timer of the dispatching tracker
+- (id)initWithSiteID:(NSString*)siteID dispatcher:(id<PiwikDispatcher>)dispatcher dispatchingTracker:(PiwikTracker*)dispatchingTracker {
   
   if (self = [super init]) {
     
     // Initialize instance variables
     _siteID = siteID;
     _dispatcher = dispatcher;
-    
+    _dispatchingTracker = dispatchingTracker;
+    _siteTrackers = [NSMutableDictionary dictionary];
+
+    _trackerQueue = dispatch_queue_create(PiwikTrackerQueueLabel, DISPATCH_QUEUE_SERIAL);
+    dispatch_queue_set_specific(_trackerQueue, &PiwikTrackerQueueKey, (__bridge void*)self, NULL);
+    _processEventsInBackground = NO;
+
     _isPrefixingEnabled = YES;
     
     _sessionTimeout = PiwikDefaultSessionTimeout;
     
     _sampleRate = PiwikDefaultSampleRate;
+    _eventTypeSampleRates = @{};
+    _visitorSampleBucket = -1;
     
     // By default a new session will be started when the tracker is created
     _sessionStart = YES;
@@ -292,13 +366,66 @@ static PiwikTracker *_sharedInstance;
     
     _dispatchInterval = PiwikDefaultDispatchTimer;
     _maxNumberOfQueuedEvents = PiwikDefaultMaxNumberOfStoredEvents;
+    
+    _maxNumberOfQueuedHighPriorityEvents = PiwikDefaultMaxNumberOfStoredHighPriorityEvents;
+    _highPriorityDispatchInterval = PiwikDefaultHighPriorityDispatchInterval;
+    
+    if (dispatchingTracker) {
+      // One store and one storage budget for all sites
+      _eventStore = dispatchingTracker.eventStore;
+    } else {
+      _eventStore = [[PiwikCoreDataEventStore alloc] init];
+      _eventStore.maximumNumberOfEvents = _maxNumberOfQueuedEvents;
+      [_eventStore setMaximumNumberOfEvents:_maxNumberOfQueuedHighPriorityEvents forPriority:PiwikEventPriorityHigh];
+    }
+    _overflowPolicy = PiwikEventOverflowPolicyDropNewest;
     _isDispatchRunning = NO;
+    _isHighPriorityDispatchRunning = NO;
     
     _eventsPerRequest = PiwikDefaultNumberOfEventsPerRequest;
+    _maxConcurrentDispatches = PiwikDefaultMaxConcurrentDispatches;
+    _inFlightEventIDs = [NSMutableSet set];
+    _failedEventIDs = [NSMutableSet set];
+    _eventRejectionCounts = [NSMutableDictionary dictionary];
+    
+    _adaptiveDispatch = NO;
+    _maxRequestTimeout = PiwikDefaultMaxRequestTimeout;
+    _telemetry = [[PiwikTelemetry alloc] init];
+    
+    // Timed dispatches run on the tracker queue, site trackers have no timer of their own
+    if (!dispatchingTracker) {
+      _reachability = [[PiwikReachability alloc] init];
+      __weak typeof(self)weakSelf = self;
+      _dispatchScheduler = [[PiwikDispatchScheduler alloc] initWithQueue:_trackerQueue reachability:_reachability dispatchBlock:^{
+        [weakSelf dispatch];
+      }];
+    }
+    _powerAwareDispatch = NO;
+    _dispatchController = [[PiwikDispatchController alloc] initWithMaximumEventsPerRequest:_eventsPerRequest
+                                                                     minimumRequestTimeout:PiwikDefaultMinRequestTimeout
+                                                                     maximumRequestTimeout:_maxRequestTimeout];
+    
+    _parameterSets = [NSMutableDictionary dictionary];
+    _querySerializer = [[PiwikQuerySerializer alloc] init];
+    _timeContext = [[PiwikTimeContext alloc] init];
+    
+    _eventDurability = PiwikEventDurabilityEveryEvent;
+    _eventBufferFlushThreshold = PiwikDefaultEventBufferFlushThreshold;
+    _eventBufferFlushInterval = PiwikDefaultEventBufferFlushInterval;
+    
+    _eventCoalescer = [[PiwikEventCoalescer alloc] init];
+    _eventCoalescingInterval = PiwikDefaultEventCoalescingInterval;
+    _eventCoalescer.interval = _eventCoalescingInterval;
     
     _locationManager = [[PiwikLocationManager alloc] init];
     _includeLocationInformation = NO;
     
+    // The screen must be read on the main thread, never wait for it here, the main thread may be waiting for the tracker queue
+    __weak typeof(self)weakSelf = self;
+    dispatch_async(dispatch_get_main_queue(), ^{
+      [weakSelf readScreenResolution];
+    });
+    
     // Set default user defatult values
     NSDictionary *defaultValues = @{PiwikUserDefaultOptOutKey : @NO};
     [[NSUserDefaults standardUserDefaults] registerDefaults:defaultValues];
@@ -325,6 +452,15 @@ static PiwikTracker *_sharedInstance;
                                              selector:@selector(appDidEnterBackground:)
                                                  name:UIApplicationWillResignActiveNotification
                                                object:nil];
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(appWillTerminate:)
+                                                 name:UIApplicationWillTerminateNotification
+                                               object:nil];
+#else
+    [[NSNotificationCenter defaultCenter] addObserver:self
+                                             selector:@selector(appWillTerminate:)
+                                                 name:NSApplicationWillTerminateNotification
+                                               object:nil];
 #endif
     
     return self;
@@ -337,41 +473,26 @@ static PiwikTracker *_sharedInstance;
 
 - (void)startDispatchTimer {
   
-  // Run on main thread run loop
-  __weak typeof(self)weakSelf = self;
-  dispatch_async(dispatch_get_main_queue(), ^{
+  // If dispatch interval is < 0, manual dispatch must be used
+  // If dispatch internal is = 0, the event is dispatched automatically directly after the event is tracked
+  if (self.dispatchInterval > 0) {
     
-    [weakSelf stopDispatchTimer];
+    // Run on a timer source, paused while the network is unreachable
+    [self.dispatchScheduler scheduleDispatchWithInterval:self.dispatchInterval];
     
-    // If dispatch interval is < 0, manual dispatch must be used
-    // If dispatch internal is = 0, the event is dispatched automatically directly after the event is tracked
-    if (weakSelf.dispatchInterval > 0) {
-      
-      // Run on timer
-      weakSelf.dispatchTimer = [NSTimer scheduledTimerWithTimeInterval:weakSelf.dispatchInterval
-                                                                target:weakSelf
-                                                              selector:@selector(dispatch:)
-                                                              userInfo:nil
-                                                               repeats:NO];
-      
-      PiwikDebugLog(@"Dispatch timer started with interval %f", weakSelf.dispatchInterval);
-      
-    }
+    PiwikDebugLog(@"Dispatch timer started with interval %f", self.dispatchInterval);
     
-  });
+  } else {
+    [self.dispatchScheduler cancel];
+  }
   
 }
 
 
 - (void)stopDispatchTimer {
+  [self.dispatchScheduler cancel];
   
-  if (self.dispatchTimer) {
-    [self.dispatchTimer invalidate];
-    self.dispatchTimer = nil;
-    
-    PiwikDebugLog(@"Dispatch timer stopped");
-  }
-  
+  PiwikDebugLog(@"Dispatch timer stopped");
 }
 
 
@@ -403,6 +524,69 @@ static PiwikTracker *_sharedInstance;
   }
   
   [self stopDispatchTimer];
+  
+  // Do not keep buffered events in memory while in the background
+  [self flushEventBufferAndWait];
+  
+#if TARGET_OS_IPHONE
+  if (self.backgroundDispatch && !self.dispatchingTracker) {
+    [self sendEventsInBackground];
+  }
+#endif
+}
+
+
+- (void)appWillTerminate:(NSNotification*)notification {
+  [self flushEventBufferAndWait];
+}
+
+
+#pragma mark Lazy startup
+
+// Suspend the tracker queue until the event store, the client ID and the device information are ready
+- (void)deferStartup {
+  
+  self.isStartupPending = YES;
+  dispatch_suspend(self.trackerQueue);
+  
+  // A one-shot observer is released by the run loop after it has fired
+  CFRunLoopObserverRef observer = CFRunLoopObserverCreateWithHandler(kCFAllocatorDefault, kCFRunLoopBeforeWaiting, false, PiwikStartupRunLoopObserverOrder, ^(CFRunLoopObserverRef observer, CFRunLoopActivity activity) {
+    [self startUpInBackground];
+  });
+  CFRunLoopAddObserver(CFRunLoopGetMain(), observer, kCFRunLoopCommonModes);
+  CFRelease(observer);
+  
+  PiwikDebugLog(@"Tracker startup deferred");
+}
+
+
+// Must be called on the main thread
+- (void)startUpInBackground {
+  
+  [self readScreenResolution];
+  
+  id<PiwikEventStore> eventStore = self.eventStore;
+  dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0), ^{
+    
+    // Nothing else reads the client ID while the tracker queue is suspended
+    [self clientID];
+    [PiwikDeviceModel currentModelName];
+    
+    void (^resumeTrackerQueue)(void) = ^{
+      self.isStartupPending = NO;
+      dispatch_resume(self.trackerQueue);
+      
+      PiwikDebugLog(@"Tracker startup finished");
+    };
+    
+    if ([eventStore respondsToSelector:@selector(openWithCompletionBlock:)]) {
+      [eventStore openWithCompletionBlock:resumeTrackerQueue];
+    } else {
+      resumeTrackerQueue();
+    }
+    
+  });
+  
 }
 
 
@@ -479,6 +663,42 @@ static PiwikTracker *_sharedInstance;
 }
 
 
+- (BOOL)sendEvent:(PiwikEvent*)event {
+  
+  if (![self shouldQueueEvent]) {
+    return YES;
+  }
+  
+  // Capture the immutable field values, the parameters are built on the tracker queue
+  NSString *category = event.category;
+  NSString *action = event.action;
+  NSString *name = event.name;
+  BOOL hasValue = event.hasValue;
+  double value = event.value;
+  NSString *pageURL = [self generatePageURL:nil];
+  CFAbsoluteTime time = CFAbsoluteTimeGetCurrent();
+  
+  [self performBlockOnTrackerQueue:^{
+    
+    NSMutableDictionary *params = [[NSMutableDictionary alloc] initWithCapacity:5];
+    params[PiwikParameterEventCategory] = category;
+    params[PiwikParameterEventAction] = action;
+    if (name) {
+      params[PiwikParameterEventName] = name;
+    }
+    if (hasValue) {
+      params[PiwikParameterEventValue] = @(value);
+    }
+    params[PiwikParameterURL] = pageURL;
+    
+    [self processEvent:params timestamp:[NSDate dateWithTimeIntervalSinceReferenceDate:time] priority:PiwikEventPriorityNormal];
+    
+  }];
+  
+  return YES;
+}
+
+
 // Each Piwik request must contain a page URL
 // For screen views the page URL is generated based on the screen hierarchy
 // For other types of events (e.g. goals, custom events etc) the page URL is set to the value generated by the last page view
@@ -565,7 +785,7 @@ static PiwikTracker *_sharedInstance;
   // Setting the url is mandatory
   params[PiwikParameterURL] = [self generatePageURL:nil];
 
-  return [self queueEvent:params];
+  return [self queueEvent:params priority:PiwikEventPriorityHigh];
 }
 
 
@@ -618,7 +838,7 @@ static PiwikTracker *_sharedInstance;
   // Setting the url is mandatory
   params[PiwikParameterURL] = [self generatePageURL:nil];
   
-  return [self queueEvent:params];
+  return [self queueEvent:params priority:PiwikEventPriorityHigh];
 }
 
 
@@ -680,7 +900,10 @@ static PiwikTracker *_sharedInstance;
   
   if (isCampaignURL) {
     parameters[PiwikParameterReferrer] = campaignURLString;
-    self.campaignParameters = [NSDictionary dictionaryWithDictionary:parameters];
+    NSDictionary *campaignParameters = [NSDictionary dictionaryWithDictionary:parameters];
+    [self performBlockOnTrackerQueue:^{
+      self.campaignParameters = campaignParameters;
+    }];
     return YES;
   } else {
     return NO;
@@ -746,169 +969,471 @@ static PiwikTracker *_sharedInstance;
   }
   
   CustomVariable *customVariable = [[CustomVariable alloc] initWithIndex:index name:name value:value];
-  
-  if (scope == VisitCustomVariableScope) {
-    
-    if (!self.visitCustomVariables) {
-      self.visitCustomVariables = [NSMutableDictionary dictionary];
-    }
-    self.visitCustomVariables[@(index)] = customVariable;
-    
-    // Force generation of session parameters
-    self.sessionParameters = nil;
-    
-  } else if (scope == ScreenCustomVariableScope) {
-    
-    if (!self.screenCustomVariables) {
-      self.screenCustomVariables = [NSMutableDictionary dictionary];
+
+  // Custom variables are applied in order with the events using them
+  [self performBlockOnTrackerQueue:^{
+
+    if (scope == VisitCustomVariableScope) {
+
+      if (!self.visitCustomVariables) {
+        self.visitCustomVariables = [NSMutableDictionary dictionary];
+      }
+      self.visitCustomVariables[@(index)] = customVariable;
+
+      // Force generation of session parameters
+      self.sessionParameters = nil;
+
+    } else if (scope == ScreenCustomVariableScope) {
+
+      if (!self.screenCustomVariables) {
+        self.screenCustomVariables = [NSMutableDictionary dictionary];
+      }
+      self.screenCustomVariables[@(index)] = customVariable;
+
     }
-    self.screenCustomVariables[@(index)] = customVariable;
-    
-  }
-  
+
+  }];
+
   return YES;
 }
 
 
 - (BOOL)queueEvent:(NSDictionary*)parameters {
+  return [self queueEvent:parameters priority:PiwikEventPriorityNormal];
+}
+
+
+- (BOOL)queueEvent:(NSDictionary*)parameters priority:(PiwikEventPriority)priority {
   
-  // OptOut check
-  if (self.optOut) {
-    // User opted out from tracking, to nothing
+  if (![self shouldQueueEvent]) {
     // Still return YES, since returning NO is considered an error
     return YES;
   }
+
+  // Only capture an immutable snapshot of the event and the time it was tracked
+  // Enrichment is done on the tracker queue
+  NSMutableDictionary *event = [parameters mutableCopy];
+  NSDate *timestamp = [NSDate date];
+
+  [self performBlockOnTrackerQueue:^{
+    [self processEvent:event timestamp:timestamp priority:priority];
+  }];
+
+  return YES;
+}
+
+
+// Record a tracked event and check if it should be queued, dropped events are reported
+- (BOOL)shouldQueueEvent {
   
-  // Use the sampling rate to decide if the event should be queued or not
-  if (self.sampleRate != 100 && self.sampleRate < (arc4random_uniform(101))) {
-    // Outsampled, do not queue
-    return YES;
+  [self.telemetry recordTrackedEvent];
+  
+  // OptOut check
+  if (self.optOut) {
+    // User opted out from tracking, to nothing
+    [self didDropEvents:1 reason:PiwikEventDropReasonOptOut];
+    return NO;
   }
   
-  parameters = [self addPerRequestParameters:parameters];
-  parameters = [self addSessionParameters:parameters];
-  parameters = [self addStaticParameters:parameters];
+  // The first event may be tracked before the screen was read after the tracker was created
+  if (!self.screenResolution && !self.isStartupPending && [NSThread isMainThread]) {
+    [self readScreenResolution];
+  }
   
-  PiwikDebugLog(@"Store event with parameters %@", parameters);
+  return YES;
+}
+
+
+- (void)setSampleRate:(NSUInteger)sampleRate forEventType:(PiwikEventType)eventType {
   
-  [self storeEventWithParameters:parameters completionBlock:^{
-    
-    if (self.dispatchInterval == 0) {
-      // Trigger dispatch
-      __weak typeof(self)weakSelf = self;
-      dispatch_async(dispatch_get_main_queue(), ^{
-        [weakSelf dispatch];
-      });
-    }
-    
-  }];
+  @synchronized(self) {
+    NSMutableDictionary *sampleRates = [self.eventTypeSampleRates mutableCopy];
+    sampleRates[@(eventType)] = @(MIN(sampleRate, 100));
+    self.eventTypeSampleRates = sampleRates;
+  }
   
-  return YES;
 }
 
 
-- (NSDictionary*)addPerRequestParameters:(NSDictionary*)parameters {
+- (NSUInteger)sampleRateForEventType:(PiwikEventType)eventType {
+  
+  NSNumber *sampleRate = self.eventTypeSampleRates[@(eventType)];
+  if (sampleRate) {
+    return [sampleRate unsignedIntegerValue];
+  } else if (eventType == PiwikEventTypeGoal || eventType == PiwikEventTypeEcommerce) {
+    // Never sampled unless explicitly configured, they are too important to be reported as estimates
+    return 100;
+  } else {
+    return MIN(self.sampleRate, 100);
+  }
   
-  NSMutableDictionary *joinedParameters = [NSMutableDictionary dictionaryWithDictionary:parameters];
+}
+
+
++ (PiwikEventType)eventTypeOfParameters:(NSDictionary*)parameters {
   
-  // User id
-  if (self.userID && self.userID.length > 0) {
-    joinedParameters[PiwikParameterUserID] = self.userID;
+  // Transactions are also sent as goal 0
+  if (parameters[PiwikParameterTransactionIdentifier] || parameters[PiwikParameterTransactionItems]) {
+    return PiwikEventTypeEcommerce;
+  } else if (parameters[PiwikParameterGoalID]) {
+    return PiwikEventTypeGoal;
+  } else if (parameters[PiwikParameterEventCategory]) {
+    return PiwikEventTypeEvent;
+  } else if (parameters[PiwikParameterActionName]) {
+    return PiwikEventTypeScreenView;
+  } else {
+    return PiwikEventTypeOther;
   }
   
-  // Custom parameters
-  if (self.screenCustomVariables) {
-    joinedParameters[PiwikParameterScreenScopeCustomVariables] = [PiwikTracker JSONEncodeCustomVariables:self.screenCustomVariables];
-    self.screenCustomVariables = nil;
+}
+
+
+// Must be called on the tracker queue
+// Sample visitors rather than events, the same visitor is always in or out of the sample for a rate
+- (BOOL)isVisitorSampledAtRate:(NSUInteger)sampleRate {
+  
+  if (sampleRate >= 100) {
+    return YES;
   }
   
-  // Add campaign parameters if they are set
-  if (self.campaignParameters.count > 0) {
-    [joinedParameters addEntriesFromDictionary:self.campaignParameters];
-    self.campaignParameters = nil;
+  if (self.visitorSampleBucket < 0) {
+    NSString *hash = [PiwikTracker md5:self.clientID];
+    self.visitorSampleBucket = (NSInteger)(strtoul([[hash substringToIndex:8] UTF8String], NULL, 16) % 100);
   }
   
-  // Add random number (cache buster)
-  int randomNumber = arc4random_uniform(50000);
-  joinedParameters[PiwikParameterRandomNumber] = [NSString stringWithFormat:@"%ld", (long)randomNumber];
+  return self.visitorSampleBucket < (NSInteger)sampleRate;
+}
+
+
+// Must be called on the tracker queue
+- (void)processEvent:(NSMutableDictionary*)parameters timestamp:(NSDate*)timestamp priority:(PiwikEventPriority)priority {
+
+  PiwikSignpostDeclareID(signpostID)
+  PiwikSignpostBegin(signpostID, "Enqueue")
   
-  // Location
-  if (self.includeLocationInformation) {
-    // The first request for location will ask the user for permission
-    CLLocation *location = self.locationManager.location;
-    if (location) {
-      joinedParameters[PiwikParameterLatitude] = @(location.coordinate.latitude);
-      joinedParameters[PiwikParameterLongitude] = @(location.coordinate.longitude);
-    }
+  NSUInteger sampleRate = [self sampleRateForEventType:[PiwikTracker eventTypeOfParameters:parameters]];
+  if (![self isVisitorSampledAtRate:sampleRate]) {
+    // Outsampled, do not queue
+    [self didDropEvents:1 reason:PiwikEventDropReasonSampling];
+    PiwikSignpostEnd(signpostID, "Enqueue", "outsampled")
+    return;
   }
   
-  // Add local time
-  NSDate *now = [NSDate date];
-  NSCalendar *calendar = [NSCalendar currentCalendar];
-  unsigned unitFlags = NSHourCalendarUnit | NSMinuteCalendarUnit |  NSSecondCalendarUnit;
-  NSDateComponents *dateComponents = [calendar components:unitFlags fromDate:now];
-  joinedParameters[PiwikParameterHours] = [NSString stringWithFormat:@"%ld", (long)[dateComponents hour]];
-  joinedParameters[PiwikParameterMinutes] = [NSString stringWithFormat:@"%ld", (long)[dateComponents minute]];
-  joinedParameters[PiwikParameterSeconds] = [NSString stringWithFormat:@"%ld", (long)[dateComponents second]];
+  if ([self shouldCoalesceEvent:parameters timestamp:timestamp]) {
+    PiwikDebugLog(@"Coalesce identical event with parameters %@", parameters);
+    [self didDropEvents:1 reason:PiwikEventDropReasonCoalesced];
+    PiwikSignpostEnd(signpostID, "Enqueue", "coalesced")
+    return;
+  }
   
-  // Add UTC time
-  static NSDateFormatter *UTCDateFormatter = nil;
-  if (!UTCDateFormatter) {
-    UTCDateFormatter = [[NSDateFormatter alloc] init];
-    UTCDateFormatter.dateFormat = @"yyyy-MM-dd HH:mm:ss";
-    UTCDateFormatter.timeZone = [NSTimeZone timeZoneWithName:@"UTC"];
+  if (sampleRate < 100) {
+    parameters[PiwikParameterSampleRate] = [NSString stringWithFormat:@"%lu", (unsigned long)sampleRate];
   }
-  joinedParameters[PiwikParameterDateAndTime] = [UTCDateFormatter stringFromDate:now];
   
-  return joinedParameters;
-}
+  // The enrichment steps add to the same dictionary
+  [self addPerRequestParametersToParameters:parameters timestamp:timestamp];
+  [self addSessionParametersToParameters:parameters];
+  [self addStaticParameters];
 
+  PiwikDebugLog(@"Store event with parameters %@", parameters);
+  
+  // Session and static parameters are stored once as parameter sets and only referenced by the event
+  NSData *event = [PiwikEventEncoder dataWithParameters:parameters
+                                        parameterSetIDs:@[self.sessionParameterSetID, self.staticParameterSetID]];
 
-- (NSDictionary*)addSessionParameters:(NSDictionary*)parameters {
+  if ([parameters[PiwikParameterSessionStart] isEqual:@"1"]) {
+    // High priority dispatches must send the new visit first
+    self.isNewVisitPending = YES;
+  }
   
-  if (self.sessionStart) {
-    
-    self.totalNumberOfVisits = self.totalNumberOfVisits + 1;
-    self.currentVisitTimestamp = [[NSDate date] timeIntervalSince1970];
+  if (priority > PiwikEventPriorityNormal && [self isHighPriorityLaneEnabled]) {
     
-    // Reset session params and visit custom variables to force a rebuild
-    self.sessionParameters = nil;
-    self.visitCustomVariables = nil;
+    // Bypass the buffer, buffered events were tracked before this event and are stored first
+    [self flushEventBuffer];
+    [self.telemetry recordQueuedEvent];
+    [self.eventStore storeEvents:@[event] priority:priority parameterSets:[self parameterSetsForStore] completionBlock:^{
+      [self recordEventsDroppedByStore];
+      [self didQueueHighPriorityEvent];
+    }];
     
-    // Send notifications to allow observers to set new visit custom variables
-    [[NSNotificationCenter defaultCenter] postNotificationName:PiwikSessionStartNotification object:self];
-  }
-  
-  if (!self.sessionParameters) {
-    NSMutableDictionary *sessionParameters = [NSMutableDictionary dictionary];
+  } else if (self.eventDurability == PiwikEventDurabilityEveryEvent) {
     
-    sessionParameters[PiwikParameterTotalNumberOfVisits] = [NSString stringWithFormat:@"%ld", (unsigned long)self.totalNumberOfVisits];
+    [self.telemetry recordQueuedEvent];
+    [self.eventStore storeEvents:@[event] parameterSets:[self parameterSetsForStore] completionBlock:^{
+      [self recordEventsDroppedByStore];
+      [self didQueueEvent];
+    }];
     
-    sessionParameters[PiwikParameterPreviousVisitTimestamp] = [NSString stringWithFormat:@"%.0f", self.previousVisitTimestamp];
+  } else {
     
-    if (self.visitCustomVariables) {
-      sessionParameters[PiwikParameterVisitScopeCustomVariables] = [PiwikTracker JSONEncodeCustomVariables:self.visitCustomVariables];
-    }
+    [self bufferEvent:event];
+    [self didQueueEvent];
     
-    self.sessionParameters = sessionParameters;
   }
+
+  PiwikSignpostEnd(signpostID, "Enqueue")
+}
+
+
+- (void)didQueueEvent {
   
-  // Join event parameters with session parameters
-  NSMutableDictionary *joinedParameters = [NSMutableDictionary dictionaryWithDictionary:parameters];
-  [joinedParameters addEntriesFromDictionary:self.sessionParameters];
-  
-  if (self.sessionStart) {
-    joinedParameters[PiwikParameterSessionStart] = @"1";
-    self.sessionStart = NO;
+  // Site trackers follow the dispatch interval of the dispatching tracker
+  PiwikTracker *dispatchingTracker = self.dispatchingTracker ?: self;
+  if (dispatchingTracker.dispatchInterval == 0) {
+    // Trigger dispatch
+    __weak typeof(self)weakSelf = self;
+    dispatch_async(dispatch_get_main_queue(), ^{
+      [weakSelf dispatch];
+    });
   }
   
-  return joinedParameters;
 }
 
 
-- (NSMutableDictionary*)visitCustomVariables {
+- (BOOL)isHighPriorityLaneEnabled {
+  return self.highPriorityDispatchInterval >= 0 &&
+         [self.eventStore respondsToSelector:@selector(storeEvents:priority:parameterSets:completionBlock:)] &&
+         [self.eventStore respondsToSelector:@selector(eventsFromStore:minimumPriority:excludingEventIDs:completionBlock:)];
+}
+
+
+// Run on any queue by the event store
+- (void)didQueueHighPriorityEvent {
   
-  if (self.includeDefaultCustomVariable) {
+  if (self.dispatchingTracker) {
+    [self.dispatchingTracker didQueueHighPriorityEvent];
+    return;
+  }
+  
+  dispatch_async(self.trackerQueue, ^{
+    
+    if (self.highPriorityDispatchInterval <= 0) {
+      [self dispatchHighPriorityEvents];
+    } else if (!self.isHighPriorityDispatchScheduled) {
+      // Collect the high priority events tracked during the interval into one request
+      self.isHighPriorityDispatchScheduled = YES;
+      __weak typeof(self)weakSelf = self;
+      dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.highPriorityDispatchInterval * NSEC_PER_SEC)), self.trackerQueue, ^{
+        weakSelf.isHighPriorityDispatchScheduled = NO;
+        [weakSelf dispatchHighPriorityEvents];
+      });
+    }
+    
+  });
+  
+}
+
+
+// Must be called on the tracker queue
+- (BOOL)shouldCoalesceEvent:(NSDictionary*)parameters timestamp:(NSDate*)timestamp {
+  
+  if (self.sessionStart) {
+    // The first event of a new session is always sent
+    [self.eventCoalescer removeAllEvents];
+    return NO;
+  }
+  
+  if (self.screenCustomVariables || self.campaignParameters.count > 0) {
+    // Would be lost with the dropped event
+    return NO;
+  }
+  
+  return [self.eventCoalescer shouldCoalesceEventWithParameters:parameters timestamp:timestamp];
+}
+
+
+// Must be called on the tracker queue
+- (void)bufferEvent:(NSData*)event {
+  
+  // The buffer is bounded by the same limit as the store
+  if (!self.eventBuffer || self.eventBuffer.capacity != self.maxNumberOfQueuedEvents) {
+    [self flushEventBuffer];
+    self.eventBuffer = [[PiwikEventBuffer alloc] initWithCapacity:self.maxNumberOfQueuedEvents];
+  }
+  
+  if (![self.eventBuffer addEvent:event]) {
+    PiwikLog(@"Tracker reach maximum number of queued events");
+    [self didDropEvents:1 reason:PiwikEventDropReasonOverflow];
+    return;
+  }
+  
+  [self.telemetry recordQueuedEvent];
+  
+  if (self.eventBuffer.count >= self.eventBufferFlushThreshold) {
+    
+    [self flushEventBuffer];
+    
+  } else if (!self.isEventBufferFlushScheduled) {
+    
+    // Make sure the event does not stay in memory longer then the flush interval
+    self.isEventBufferFlushScheduled = YES;
+    __weak typeof(self)weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.eventBufferFlushInterval * NSEC_PER_SEC)), self.trackerQueue, ^{
+      weakSelf.isEventBufferFlushScheduled = NO;
+      [weakSelf flushEventBuffer];
+    });
+    
+  }
+  
+}
+
+
+// Must be called on the tracker queue
+- (void)flushEventBuffer {
+  
+  if (self.eventBuffer.count == 0) {
+    return;
+  }
+  
+  NSArray *events = [self.eventBuffer drainEvents:self.eventBuffer.count];
+  
+  PiwikDebugLog(@"Flush %ld buffered events", (unsigned long)events.count);
+  
+  [self.eventStore storeEvents:events parameterSets:[self parameterSetsForStore] completionBlock:^{
+    [self recordEventsDroppedByStore];
+  }];
+}
+
+
+// Write buffered events and block until they are saved by the store
+- (void)flushEventBufferAndWait {
+  
+  if (self.isStartupPending) {
+    // Nothing has been buffered yet, do not block until the startup has finished
+    return;
+  }
+  
+  __block BOOL didFlush = NO;
+  [self performBlockOnTrackerQueueAndWait:^{
+    didFlush = self.eventBuffer.count > 0;
+    [self flushEventBuffer];
+  }];
+  
+  if (didFlush) {
+    // Wait for the pending save to finish
+    [self.eventStore waitUntilAllOperationsAreFinished];
+  }
+  
+}
+
+
+// Run the block on the tracker queue
+// The block is run directly if already on the tracker queue, e.g. when called from a session start notification observer
+- (void)performBlockOnTrackerQueue:(void (^)(void))block {
+
+  if ((self.processEventsInBackground || self.isStartupPending) && dispatch_get_specific(&PiwikTrackerQueueKey) != (__bridge void*)self) {
+    dispatch_async(self.trackerQueue, block);
+  } else {
+    [self performBlockOnTrackerQueueAndWait:block];
+  }
+
+}
+
+
+- (void)performBlockOnTrackerQueueAndWait:(void (^)(void))block {
+  
+  if (dispatch_get_specific(&PiwikTrackerQueueKey) == (__bridge void*)self) {
+    block();
+  } else {
+    dispatch_sync(self.trackerQueue, block);
+  }
+  
+}
+
+
+- (void)addPerRequestParametersToParameters:(NSMutableDictionary*)joinedParameters timestamp:(NSDate*)now {
+  
+  // User id
+  // Custom parameters
+  if (self.screenCustomVariables) {
+    joinedParameters[PiwikParameterScreenScopeCustomVariables] = [PiwikTracker JSONEncodeCustomVariables:self.screenCustomVariables];
+    self.screenCustomVariables = nil;
+  }
+  
+  // Add campaign parameters if they are set
+  if (self.campaignParameters.count > 0) {
+    [joinedParameters addEntriesFromDictionary:self.campaignParameters];
+    self.campaignParameters = nil;
+  }
+  
+  // Add random number (cache buster)
+  int randomNumber = arc4random_uniform(50000);
+  joinedParameters[PiwikParameterRandomNumber] = [NSString stringWithFormat:@"%ld", (long)randomNumber];
+  
+  // Stored with the event and sent unchanged with every retry
+  joinedParameters[PiwikParameterEventIdentifier] = [PiwikTracker eventIdentifier];
+  
+  // Add local time and UTC time
+  [self.timeContext addTimeParameters:joinedParameters absoluteTime:[now timeIntervalSinceReferenceDate]];
+  
+}
+
+
+- (void)addSessionParametersToParameters:(NSMutableDictionary*)joinedParameters {
+  
+  if (self.sessionStart) {
+    
+    self.totalNumberOfVisits = self.totalNumberOfVisits + 1;
+    self.currentVisitTimestamp = [[NSDate date] timeIntervalSince1970];
+    
+    // Reset session params and visit custom variables to force a rebuild
+    self.sessionParameters = nil;
+    self.visitCustomVariables = nil;
+    
+    // Send notifications to allow observers to set new visit custom variables
+    [[NSNotificationCenter defaultCenter] postNotificationName:PiwikSessionStartNotification object:self];
+    
+    if (self.includeLocationInformation) {
+      // The first session will ask the user for permission
+      dispatch_async(dispatch_get_main_queue(), ^{
+        [self.locationManager startPendingMonitoringLocationChanges];
+      });
+    }
+  }
+  
+  // Only read the snapshot, the session parameters are rebuilt when the location changes significantly
+  CLLocation *location = self.includeLocationInformation ? self.locationManager.location : nil;
+  if (location != self.sessionLocation) {
+    self.sessionLocation = location;
+    self.sessionParameters = nil;
+  }
+  
+  if (!self.sessionParameters) {
+    NSMutableDictionary *sessionParameters = [NSMutableDictionary dictionary];
+    
+    sessionParameters[PiwikParameterTotalNumberOfVisits] = [NSString stringWithFormat:@"%ld", (unsigned long)self.totalNumberOfVisits];
+    
+    sessionParameters[PiwikParameterPreviousVisitTimestamp] = [NSString stringWithFormat:@"%.0f", self.previousVisitTimestamp];
+    
+    if (self.visitCustomVariables) {
+      sessionParameters[PiwikParameterVisitScopeCustomVariables] = [PiwikTracker JSONEncodeCustomVariables:self.visitCustomVariables];
+    }
+    
+    if (self.userID && self.userID.length > 0) {
+      sessionParameters[PiwikParameterUserID] = self.userID;
+    }
+    
+    if (self.sessionLocation) {
+      sessionParameters[PiwikParameterLatitude] = @(self.sessionLocation.coordinate.latitude);
+      sessionParameters[PiwikParameterLongitude] = @(self.sessionLocation.coordinate.longitude);
+    }
+    
+    self.sessionParameters = sessionParameters;
+    self.sessionParameterSetID = [self addParameterSet:sessionParameters];
+  }
+  
+  // The session parameters are referenced by the event, see processEvent:timestamp:
+  if (self.sessionStart) {
+    joinedParameters[PiwikParameterSessionStart] = @"1";
+    self.sessionStart = NO;
+  }
+  
+}
+
+
+- (NSMutableDictionary*)visitCustomVariables {
+  
+  if (self.includeDefaultCustomVariable) {
     
     if (!_visitCustomVariables) {
       _visitCustomVariables = [NSMutableDictionary dictionary];
@@ -916,7 +1441,7 @@ static PiwikTracker *_sharedInstance;
     
     // Set custom variables - platform, OS version and application version
     
-    _visitCustomVariables[@(0)] = [[CustomVariable alloc] initWithIndex:1 name:@"Platform" value:self.platformName];
+    _visitCustomVariables[@(0)] = [[CustomVariable alloc] initWithIndex:1 name:@"Platform" value:[PiwikDeviceModel currentModelName];
     
 #if TARGET_OS_IPHONE
     _visitCustomVariables[@(1)] = [[CustomVariable alloc] initWithIndex:2 name:@"OS version" value:[UIDevice currentDevice].systemVersion];
@@ -931,9 +1456,11 @@ static PiwikTracker *_sharedInstance;
 }
 
    
-- (NSDictionary*)addStaticParameters:(NSDictionary*)parameters {
+- (void)addStaticParameters {
   
-  if (!self.staticParameters) {
+  // Built again once the screen has been read on the main thread
+  NSString *screenResolution = self.screenResolution;
+  if (!self.staticParameters || (screenResolution && !self.staticParameters[PiwikParameterScreenReseloution])) {
     NSMutableDictionary *staticParameters = [NSMutableDictionary dictionary];
     
     staticParameters[PiwikParameterSiteID] = self.siteID;
@@ -943,15 +1470,7 @@ static PiwikTracker *_sharedInstance;
     staticParameters[PiwikParameterAPIVersion] = PiwikDefaultAPIVersionValue;
     
     // Set resolution
-#if TARGET_OS_IPHONE
-    CGRect screenBounds = [[UIScreen mainScreen] bounds];
-    CGFloat screenScale = [[UIScreen mainScreen] scale];
-#else
-    CGRect screenBounds = [[NSScreen mainScreen] frame];
-    CGFloat screenScale = [[NSScreen mainScreen] backingScaleFactor];
-#endif
-    CGSize screenSize = CGSizeMake(CGRectGetWidth(screenBounds) * screenScale, CGRectGetHeight(screenBounds) * screenScale);
-    staticParameters[PiwikParameterScreenReseloution] = [NSString stringWithFormat:@"%.0fx%.0f", screenSize.width, screenSize.height];
+    staticParameters[PiwikParameterScreenReseloution] = screenResolution;
     
     staticParameters[PiwikParameterVisitorID] = self.clientID;
     
@@ -963,155 +1482,1025 @@ static PiwikTracker *_sharedInstance;
     staticParameters[PiwikParameterSendImage] = @(0);
     
     self.staticParameters = staticParameters;
+    self.staticParameterSetID = [self addParameterSet:staticParameters];
+  }
+  
+}
+
+
+// Encode a new parameter set and keep it until it has been handed over to the store
+- (NSNumber*)addParameterSet:(NSDictionary*)parameters {
+  
+  NSData *parameterSet = [PiwikEventEncoder dataWithParameterSet:parameters];
+  NSNumber *identifier = [PiwikEventEncoder identifierForParameterSet:parameterSet];
+  
+  // Shared by most events sent during the session
+  [self.querySerializer cacheParameters:parameters];
+  self.parameterSets[identifier] = parameterSet;
+  
+  return identifier;
+}
+
+
+// The parameter sets to pass along with events written to the store
+// Replaced sets are only passed once, the sets currently in use are always passed since the store remove sets no longer referenced
+- (NSDictionary*)parameterSetsForStore {
+  
+  NSDictionary *parameterSets = [self.parameterSets copy];
+  
+  [self.parameterSets removeAllObjects];
+  for (NSNumber *identifier in @[self.sessionParameterSetID, self.staticParameterSetID]) {
+    self.parameterSets[identifier] = parameterSets[identifier];
+  }
+  
+  return parameterSets;
+}
+
+
++ (NSString*)JSONEncodeCustomVariables:(NSDictionary*)variables {
+  
+  // Travers all custom variables and create a JSON object that be be serialized
+  NSMutableDictionary *JSONObject = [NSMutableDictionary dictionaryWithCapacity:variables.count];
+  for (CustomVariable *customVariable in [variables objectEnumerator]) {
+        JSONObject[[NSString stringWithFormat:@"%ld", (long)customVariable.index]] = [NSArray arrayWithObjects:customVariable.name, customVariable.value, nil];
+  }
+  
+  NSError *error;
+  NSData *JSONData = [NSJSONSerialization dataWithJSONObject:JSONObject options:0 error:&error];
+  
+  return [[NSString alloc] initWithData:JSONData encoding:NSUTF8StringEncoding];
+}
+
+
+- (BOOL)dispatch {
+
+  PiwikTracker *dispatchingTracker = self.dispatchingTracker;
+  if (dispatchingTracker) {
+    // Buffered events reach the store before the dispatching tracker fetch them, store operations run in order
+    dispatch_async(self.trackerQueue, ^{
+      [self flushEventBuffer];
+      [dispatchingTracker dispatch];
+    });
+    return YES;
+  }
+
+  // The dispatch state is only read and changed on the tracker queue
+  // Let events still waiting on the tracker queue or in the buffer reach the store before they are fetched
+  // Store operations run in order, expired events are deleted before the first fetch
+  dispatch_async(self.trackerQueue, ^{
+    if (self.isDispatchRunning) {
+      return;
+    }
+    self.isDispatchRunning = YES;
+    
+    [self flushEventBuffer];
+    [self deleteExpiredEvents];
+    [self sendNextEvents];
+  });
+  
+  return YES;
+
+}
+
+
+// Must be called on the tracker queue
+// Send the high priority events without waiting for the dispatch timer, a running dispatch is already sending all events
+- (void)dispatchHighPriorityEvents {
+  
+  if (self.isHighPriorityDispatchRunning || self.isDispatchRunning) {
+    return;
+  }
+  
+  if (!self.dispatchScheduler.isNetworkReachable) {
+    // Sent by the timed dispatch when the network is back
+    return;
+  }
+  
+  self.isHighPriorityDispatchRunning = YES;
+  [self sendNextEvents];
+}
+
+
+// Must be called on the tracker queue
+// Fetch and send the next range of events not already in flight, until maxConcurrentDispatches requests are running
+// A high priority dispatch only fetch high priority events, unless a new visit must reach the server first
+- (void)sendNextEvents {
+  
+  if (self.isFetchingEvents || self.isDispatchAborted || self.isNewVisitDispatchInFlight ||
+      self.numberOfDispatchesInFlight >= MAX(self.maxConcurrentDispatches, 1)) {
+    return;
+  }
+  
+  // Only one fetch at the time, or two fetches could return the same events
+  self.isFetchingEvents = YES;
+  
+  NSMutableSet *excludedEventIDs = [self.inFlightEventIDs mutableCopy];
+  [excludedEventIDs unionSet:self.failedEventIDs];
+  [excludedEventIDs unionSet:self.backgroundEventIDs];
+  
+  PiwikNetworkClass networkClass = [self.reachability networkClass];
+  
+  NSUInteger numberOfEventsToSend = self.eventsPerRequest;
+  if (self.adaptiveDispatch) {
+    self.dispatchController.maximumEventsPerRequest = self.eventsPerRequest;
+    self.dispatchController.maximumRequestTimeout = self.maxRequestTimeout;
+    numberOfEventsToSend = [self.dispatchController eventsPerRequestForNetworkClass:networkClass];
+  }
+  
+  if (self.eventRejectionCounts.count > 0) {
+    // Isolate the events in rejected requests, the other events in the request can then be delivered
+    numberOfEventsToSend = 1;
+  }
+  
+  BOOL isHighPriorityFetch = self.isHighPriorityDispatchRunning && !self.isDispatchRunning && !self.isNewVisitPending;
+  
+  void (^completionBlock)(NSArray*, NSArray*, BOOL) = ^ (NSArray *eventIDs, NSArray *events, BOOL hasMore) {
+    
+    dispatch_async(self.trackerQueue, ^{
+      
+      self.isFetchingEvents = NO;
+      
+      if (!events || events.count == 0) {
+        if (isHighPriorityFetch && self.isDispatchRunning) {
+          // A dispatch of all events was started during the fetch
+          self.isHighPriorityDispatchRunning = NO;
+          [self sendNextEvents];
+        } else {
+          // No pending events that are not already in flight
+          [self sendEventDidFinish];
+        }
+        return;
+      }
+      
+      NSDictionary *mergedEventIDs;
+      if (self.staleEventRollupAge > 0) {
+        NSArray *remainingEventIDs;
+        events = [self rollUpStaleEvents:events eventIDs:eventIDs remainingEventIDs:&remainingEventIDs mergedEventIDs:&mergedEventIDs];
+        eventIDs = remainingEventIDs;
+      }
+      
+      // The server must see the start of a new visit before any later event, send it on its own
+      BOOL isNewVisit = [self eventsStartNewVisit:events];
+      if (isNewVisit && self.numberOfDispatchesInFlight > 0) {
+        // Fetched again when the requests in flight have finished
+        return;
+      }
+      
+      [self sendEvents:events eventIDs:eventIDs mergedEventIDs:mergedEventIDs isNewVisit:isNewVisit networkClass:networkClass];
+      
+      if (hasMore) {
+        [self sendNextEvents];
+      }
+      
+    });
+    
+  };
+  
+  if (isHighPriorityFetch) {
+    [self.eventStore eventsFromStore:numberOfEventsToSend minimumPriority:PiwikEventPriorityHigh excludingEventIDs:excludedEventIDs completionBlock:completionBlock];
+  } else {
+    [self.eventStore eventsFromStore:numberOfEventsToSend excludingEventIDs:excludedEventIDs completionBlock:completionBlock];
+  }
+  
+}
+
+
+// Must be called on the tracker queue
+- (void)deleteExpiredEvents {
+  
+  if (self.maximumEventAge <= 0 || ![self.eventStore respondsToSelector:@selector(deleteEventsStoredBeforeDate:completionBlock:)]) {
+    return;
+  }
+  
+  NSTimeInterval maximumEventAge = self.maximumEventAge;
+  [self.eventStore deleteEventsStoredBeforeDate:[NSDate dateWithTimeIntervalSinceNow:-maximumEventAge] completionBlock:^(NSUInteger numberOfDeletedEvents) {
+    if (numberOfDeletedEvents > 0) {
+      PiwikLog(@"Deleted %lu events queued longer than %.0f seconds", (unsigned long)numberOfDeletedEvents, maximumEventAge);
+      [self didDropEvents:numberOfDeletedEvents reason:PiwikEventDropReasonExpired];
+    }
+  }];
+  
+}
+
+
+// Must be called on the tracker queue
+// Identical stale events in the fetched range are sent once, the other events are kept in the store until it was accepted
+// The merged event IDs are keyed by the ID of the event sent for them
+- (NSArray*)rollUpStaleEvents:(NSArray*)events eventIDs:(NSArray*)eventIDs remainingEventIDs:(NSArray**)remainingEventIDs mergedEventIDs:(NSDictionary**)mergedEventIDs {
+  
+  CFAbsoluteTime staleTime = CFAbsoluteTimeGetCurrent() - self.staleEventRollupAge;
+  
+  NSMutableArray *rolledUpEvents = [NSMutableArray arrayWithCapacity:events.count];
+  NSMutableArray *rolledUpEventIDs = [NSMutableArray arrayWithCapacity:events.count];
+  NSMutableArray *numberOfRolledUpEvents = [NSMutableArray arrayWithCapacity:events.count];
+  NSMutableDictionary *rolledUpEventIDsByID = [NSMutableDictionary dictionary];
+  NSMutableDictionary *indexesByKey = [NSMutableDictionary dictionary];
+  
+  [events enumerateObjectsUsingBlock:^(NSDictionary *event, NSUInteger idx, BOOL *stop) {
+    
+    NSString *key;
+    if (![event[PiwikParameterSessionStart] isEqual:@"1"] &&
+        [PiwikTimeContext absoluteTimeWithUTCDateAndTime:event[PiwikParameterDateAndTime]] < staleTime) {
+      key = [PiwikEventCoalescer rollupKeyForStoredEvent:event];
+    }
+    
+    NSNumber *index = key ? indexesByKey[key] : nil;
+    if (index) {
+      NSUInteger i = [index unsignedIntegerValue];
+      numberOfRolledUpEvents[i] = @([numberOfRolledUpEvents[i] unsignedIntegerValue] + 1);
+      id carrierEventID = rolledUpEventIDs[i];
+      rolledUpEventIDsByID[carrierEventID] = [rolledUpEventIDsByID[carrierEventID] ?: @[] arrayByAddingObject:eventIDs[idx]];
+      return;
+    }
+    
+    if (key) {
+      indexesByKey[key] = @(rolledUpEvents.count);
+    }
+    [rolledUpEvents addObject:event];
+    [rolledUpEventIDs addObject:eventIDs[idx]];
+    [numberOfRolledUpEvents addObject:@1];
+    
+  }];
+  
+  if (rolledUpEventIDsByID.count == 0) {
+    *remainingEventIDs = eventIDs;
+    *mergedEventIDs = nil;
+    return events;
+  }
+  
+  [numberOfRolledUpEvents enumerateObjectsUsingBlock:^(NSNumber *count, NSUInteger idx, BOOL *stop) {
+    if ([count unsignedIntegerValue] > 1) {
+      NSMutableDictionary *event = [NSMutableDictionary dictionaryWithDictionary:rolledUpEvents[idx]];
+      event[PiwikParameterRollupCount] = [count stringValue];
+      rolledUpEvents[idx] = event;
+    }
+  }];
+  
+  *remainingEventIDs = rolledUpEventIDs;
+  *mergedEventIDs = rolledUpEventIDsByID;
+  return rolledUpEvents;
+}
+
+
+// The event IDs followed by the IDs of the events merged into them
+- (NSArray*)eventIDs:(NSArray*)eventIDs withMergedEventIDs:(NSDictionary*)mergedEventIDs {
+  
+  if (mergedEventIDs.count == 0) {
+    return eventIDs;
+  }
+  
+  NSMutableArray *allEventIDs = [NSMutableArray arrayWithArray:eventIDs];
+  for (id eventID in eventIDs) {
+    [allEventIDs addObjectsFromArray:mergedEventIDs[eventID] ?: @[]];
+  }
+  return allEventIDs;
+}
+
+
+// Must be called on the tracker queue
+// Merged events stay in the store until the event sent for them is accepted
+- (void)sendEvents:(NSArray*)events eventIDs:(NSArray*)eventIDs mergedEventIDs:(NSDictionary*)mergedEventIDs isNewVisit:(BOOL)isNewVisit networkClass:(PiwikNetworkClass)networkClass {
+  
+  NSArray *allEventIDs = [self eventIDs:eventIDs withMergedEventIDs:mergedEventIDs];
+  [self.inFlightEventIDs addObjectsFromArray:allEventIDs];
+  self.numberOfDispatchesInFlight++;
+  self.isNewVisitDispatchInFlight = isNewVisit;
+  
+  PiwikSignpostDeclareID(signpostID)
+  PiwikSignpostBegin(signpostID, "Payload", "%lu events", (unsigned long)events.count)
+  
+  // Write bulk requests straight into the body if the dispatcher accepts it, in the same reverse order as bulkRequestParametersForEvents:
+  NSDictionary *requestParameters;
+  NSData *requestBody;
+  NSUInteger payloadSize;
+  if (events.count > 1 && [self.dispatcher respondsToSelector:@selector(sendBulkEventWithRequestBody:success:failure:)]) {
+    requestBody = [self.querySerializer bulkRequestBodyWithEvents:events options:NSEnumerationReverse batchIdentifier:[self batchIdentifierForEvents:events]];
+    payloadSize = requestBody.length;
+  } else {
+    requestParameters = [self requestParametersForEvents:events];
+    payloadSize = [self payloadSizeForRequestParameters:requestParameters];
+  }
+  
+  PiwikSignpostEnd(signpostID, "Payload", "%lu bytes", (unsigned long)payloadSize)
+  
+  if (self.adaptiveDispatch && [self.dispatcher respondsToSelector:@selector(setRequestTimeout:)]) {
+    [self.dispatcher setRequestTimeout:[self.dispatchController requestTimeoutForNetworkClass:networkClass]];
+  }
+  
+  CFAbsoluteTime startTime = CFAbsoluteTimeGetCurrent();
+  
+  void (^failureBlock)(BOOL shouldContinue) = ^ (BOOL shouldContinue) {
+    PiwikDebugLog(@"Failed to send stats to Piwik server");
+    
+    dispatch_async(self.trackerQueue, ^{
+      
+      PiwikDispatchErrorClass errorClass = PiwikDispatchErrorClassRequest;
+      if (![self.reachability isReachable]) {
+        errorClass = PiwikDispatchErrorClassOffline;
+      } else if (!shouldContinue) {
+        errorClass = PiwikDispatchErrorClassNetwork;
+      }
+      [self.telemetry recordRequestDidFailWithErrorClass:errorClass];
+      [self notifyTelemetryDelegate:^(id<PiwikTrackerTelemetryDelegate> delegate) {
+        if ([delegate respondsToSelector:@selector(piwikTracker:didFailToSendEvents:errorClass:)]) {
+          [delegate piwikTracker:self didFailToSendEvents:events.count errorClass:errorClass];
+        }
+      }];
+      
+      [self.dispatchController requestDidFailWithNumberOfEvents:events.count networkClass:networkClass];
+      
+      if (errorClass == PiwikDispatchErrorClassRequest) {
+        [self eventsWereRejectedWithIDs:eventIDs];
+      }
+      
+      if (shouldContinue && !isNewVisit) {
+        // Do not retry the same events during this dispatch
+        [self.failedEventIDs addObjectsFromArray:allEventIDs];
+      } else {
+        // Later events must not reach the server before a new visit
+        self.isDispatchAborted = YES;
+      }
+      
+      [self sendEventsDidFinishWithIDs:allEventIDs];
+    });
+    
+  };
+  
+  // The result is only parsed from bulk requests with a body written by the tracker
+  void (^successBlock)(PiwikBulkRequestResult *result) = ^ (PiwikBulkRequestResult *result) {
+    CFAbsoluteTime endTime = CFAbsoluteTimeGetCurrent();
+    NSTimeInterval roundTripTime = endTime - startTime;
+    dispatch_async(self.trackerQueue, ^{
+      
+      // The requests in the body are in reverse order and processed in body order, the server may stop before the end
+      // The processed requests are the last events, the unprocessed events are sent again by the next dispatch
+      NSUInteger numberOfProcessedEvents = events.count;
+      if (result && ![result isCompleteForNumberOfEvents:events.count]) {
+        PiwikLog(@"Bulk request partially processed %@, %lu events sent", result, (unsigned long)events.count);
+        numberOfProcessedEvents = result.numberOfTrackedEvents + result.numberOfInvalidEvents;
+      }
+      NSRange processedRange = NSMakeRange(events.count - numberOfProcessedEvents, numberOfProcessedEvents);
+      NSArray *unprocessedEventIDs = [eventIDs subarrayWithRange:NSMakeRange(0, processedRange.location)];
+      BOOL isNewVisitProcessed = !isNewVisit || ![self eventsStartNewVisit:[events subarrayWithRange:NSMakeRange(0, processedRange.location)]];
+      
+      NSMutableIndexSet *invalidEventIndexes = [NSMutableIndexSet indexSet];
+      [result.invalidIndexes enumerateIndexesUsingBlock:^(NSUInteger idx, BOOL *stop) {
+        if (idx < numberOfProcessedEvents) {
+          [invalidEventIndexes addIndex:events.count - 1 - idx];
+        }
+      }];
+      
+      NSMutableIndexSet *acceptedEventIndexes = [NSMutableIndexSet indexSetWithIndexesInRange:processedRange];
+      [acceptedEventIndexes removeIndexes:invalidEventIndexes];
+      NSArray *acceptedEventIDs = [eventIDs objectsAtIndexes:acceptedEventIndexes];
+      NSArray *acceptedEvents = [events objectsAtIndexes:acceptedEventIndexes];
+      NSUInteger numberOfAcceptedEvents = acceptedEventIDs.count;
+      
+      if (invalidEventIndexes.count > 0) {
+        // Merged events would be rejected the same way
+        [self quarantineEventsWithIDs:[self eventIDs:[eventIDs objectsAtIndexes:invalidEventIndexes] withMergedEventIDs:mergedEventIDs]];
+      } else if (result.numberOfInvalidEvents > 0) {
+        // Older servers only report the number of invalid events, they will never be tracked and are deleted with the batch
+        PiwikLog(@"Piwik server rejected %lu events as invalid", (unsigned long)result.numberOfInvalidEvents);
+        NSUInteger numberOfInvalidEvents = MIN(result.numberOfInvalidEvents, numberOfAcceptedEvents);
+        [self didDropEvents:numberOfInvalidEvents reason:PiwikEventDropReasonRejected];
+        numberOfAcceptedEvents -= numberOfInvalidEvents;
+      }
+      
+      [self.telemetry recordRequestDidSucceedWithNumberOfEvents:numberOfAcceptedEvents payloadSize:payloadSize latency:roundTripTime];
+      [self.telemetry recordTimeInQueueOfEvents:acceptedEvents absoluteTime:endTime];
+      [self notifyTelemetryDelegate:^(id<PiwikTrackerTelemetryDelegate> delegate) {
+        if ([delegate respondsToSelector:@selector(piwikTracker:didSendEvents:payloadSize:latency:)]) {
+          [delegate piwikTracker:self didSendEvents:numberOfAcceptedEvents payloadSize:payloadSize latency:roundTripTime];
+        }
+      }];
+      
+      [self.dispatchController requestDidSucceedWithNumberOfEvents:events.count
+                                                       payloadSize:payloadSize
+                                                     roundTripTime:roundTripTime
+                                                      networkClass:networkClass];
+      
+      if (isNewVisitProcessed) {
+        self.isNewVisitPending = NO;
+      } else {
+        // Later events must not reach the server before a new visit
+        self.isDispatchAborted = YES;
+      }
+      
+      if (unprocessedEventIDs.count > 0) {
+        // Not rejected, do not retry the same events during this dispatch
+        [self.failedEventIDs addObjectsFromArray:[self eventIDs:unprocessedEventIDs withMergedEventIDs:mergedEventIDs]];
+      }
+      
+      self.didAcceptRequestInDispatch = YES;
+      [self.eventRejectionCounts removeObjectsForKeys:acceptedEventIDs];
+      
+      // The events merged into an accepted event are only dropped now, they are sent again if the request fails
+      NSArray *acceptedAndMergedEventIDs = [self eventIDs:acceptedEventIDs withMergedEventIDs:mergedEventIDs];
+      NSUInteger numberOfMergedEvents = acceptedAndMergedEventIDs.count - acceptedEventIDs.count;
+      if (numberOfMergedEvents > 0) {
+        [self didDropEvents:numberOfMergedEvents reason:PiwikEventDropReasonCoalesced];
+      }
+      
+      // Each batch is deleted as soon as it is acknowledged
+      [self.eventStore deleteEventsWithIDs:acceptedAndMergedEventIDs];
+      [self sendEventsDidFinishWithIDs:allEventIDs];
+    });
+  };
+  
+  if (requestBody) {
+    [self.dispatcher sendBulkEventWithRequestBody:requestBody success:successBlock failure:failureBlock];
+  } else if (events.count == 1) {
+    [self.dispatcher sendSingleEventWithParameters:requestParameters success:^{
+      successBlock(nil);
+    } failure:failureBlock];
+  } else {
+    [self.dispatcher sendBulkEventWithParameters:requestParameters success:^{
+      successBlock(nil);
+    } failure:failureBlock];
+  }
+  
+}
+
+
+// Must be called on the tracker queue
+// Only drop an event on its own, a rejected batch may be caused by one event, and only if the server accepts other events
+- (void)eventsWereRejectedWithIDs:(NSArray*)eventIDs {
+  
+  for (id eventID in eventIDs) {
+    self.eventRejectionCounts[eventID] = @([self.eventRejectionCounts[eventID] unsignedIntegerValue] + 1);
+  }
+  
+  if (eventIDs.count == 1 && self.didAcceptRequestInDispatch &&
+      [self.eventRejectionCounts[eventIDs.firstObject] unsignedIntegerValue] >= PiwikMaximumNumberOfEventRejections) {
+    [self quarantineEventsWithIDs:eventIDs];
+  }
+  
+}
+
+
+// Must be called on the tracker queue
+// Events the server will never accept are dropped, or they would be sent again in every dispatch
+- (void)quarantineEventsWithIDs:(NSArray*)eventIDs {
+  
+  PiwikLog(@"Piwik server rejected %lu events, dropping them", (unsigned long)eventIDs.count);
+  
+  [self.eventRejectionCounts removeObjectsForKeys:eventIDs];
+  [self.eventStore deleteEventsWithIDs:eventIDs];
+  [self didDropEvents:eventIDs.count reason:PiwikEventDropReasonRejected];
+  
+}
+
+
+// Approximate size of the request, used to measure the throughput
+- (NSUInteger)payloadSizeForRequestParameters:(NSDictionary*)requestParameters {
+  
+  __block NSUInteger payloadSize = 0;
+  [requestParameters enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+    if ([obj isKindOfClass:[NSArray class]]) {
+      // Bulk request query strings
+      for (NSString *queryString in obj) {
+        payloadSize += queryString.length + 3;
+      }
+    } else {
+      payloadSize += [key length] + [[obj description] length] + 2;
+    }
+  }];
+  
+  return payloadSize;
+}
+
+
+- (BOOL)eventsStartNewVisit:(NSArray*)events {
+  
+  for (NSDictionary *event in events) {
+    if ([event[PiwikParameterSessionStart] isEqual:@"1"]) {
+      return YES;
+    }
+  }
+  
+  return NO;
+}
+
+
+- (NSDictionary*)requestParametersForEvents:(NSArray*)events {
+  
+  if (events.count == 1) {
+    
+    // Send events as query parameters
+    return [events objectAtIndex:0];
+    
+  } else {
+    
+    // Send events as JSON encoded post body
+    return [self bulkRequestParametersForEvents:events];
+    
+  }
+  
+}
+
+
+- (NSDictionary*)bulkRequestParametersForEvents:(NSArray*)events {
+  
+  NSMutableDictionary *JSONParams = [NSMutableDictionary dictionaryWithCapacity:2];
+  
+  // Piwik server will process each record in the batch request in reverse order, not sure if this is a bug
+  // Build the request in revers order
+  NSEnumerationOptions enumerationOption = NSEnumerationReverse;
+  
+  NSMutableArray *queryStrings = [NSMutableArray arrayWithCapacity:events.count];
+  [events enumerateObjectsWithOptions:enumerationOption usingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
+    
+    // Values are escaped once, the server decode each query string in the request body
+    NSString *queryString = [@"?" stringByAppendingString:[self.querySerializer queryStringWithParameters:obj]];
+    
+    [queryStrings addObject:queryString];
+    
+  }];
+  
+  JSONParams[@"requests"] = queryStrings;
+  
+  NSString *batchIdentifier = [self batchIdentifierForEvents:events];
+  if (batchIdentifier) {
+    JSONParams[PiwikBulkRequestBatchIdentifierKey] = batchIdentifier;
+  }
+//  DLog(@"Bulk request:\n%@", JSONParams);
+  
+  return JSONParams;
+}
+
+
+// The same events always give the same batch identifier, a retried batch can be recognized by a proxy
+// Events stored by older versions have no identifier and are left out
+- (NSString*)batchIdentifierForEvents:(NSArray*)events {
+  
+  NSMutableArray *eventIdentifiers = [NSMutableArray arrayWithCapacity:events.count];
+  for (NSDictionary *event in events) {
+    NSString *eventIdentifier = event[PiwikParameterEventIdentifier];
+    if (eventIdentifier) {
+      [eventIdentifiers addObject:eventIdentifier];
+    }
+  }
+  
+  if (eventIdentifiers.count == 0) {
+    return nil;
+  }
+  
+  return [[PiwikTracker md5:[eventIdentifiers componentsJoinedByString:@","]] substringToIndex:16];
+}
+
+
+// Must be called on the tracker queue
+- (void)sendEventsDidFinishWithIDs:(NSArray*)eventIDs {
+  
+  [self.inFlightEventIDs minusSet:[NSSet setWithArray:eventIDs]];
+  self.numberOfDispatchesInFlight--;
+  self.isNewVisitDispatchInFlight = NO;
+  
+  if (self.isDispatchAborted) {
+    [self sendEventDidFinish];
+  } else {
+    [self sendNextEvents];
+  }
+  
+}
+
+
+// Must be called on the tracker queue
+- (void)sendEventDidFinish {
+  
+  if (self.isFetchingEvents || self.numberOfDispatchesInFlight > 0) {
+    // Wait for the requests in flight
+    return;
+  }
+  
+  BOOL didFail = self.isDispatchAborted || self.failedEventIDs.count > 0;
+  
+  [self.failedEventIDs removeAllObjects];
+  self.isDispatchAborted = NO;
+  
+  if (!didFail) {
+    // Every event was delivered or dropped, stop sending them one by one
+    [self.eventRejectionCounts removeAllObjects];
+  }
+  self.didAcceptRequestInDispatch = NO;
+  
+  self.isHighPriorityDispatchRunning = NO;
+  
+  // The timer keep running during a high priority dispatch
+  if (self.isDispatchRunning) {
+    self.isDispatchRunning = NO;
+    // Back off the next timed dispatch after a failure
+    [self.dispatchScheduler dispatchDidFinishWithSuccess:!didFail];
+    [self startDispatchTimer];
+  }
+}
+
+
+#if TARGET_OS_IPHONE
+
+// Hand the queued events over to the background session, they will be sent even if the app is suspended
+- (void)sendEventsInBackground {
+  
+  if (![self.dispatcher respondsToSelector:@selector(sendBackgroundBulkEventWithParameters:requestIdentifier:)] ||
+      ![self.eventStore respondsToSelector:@selector(archivableEventIDs:)]) {
+    return;
+  }
+  
+  // Keep the app running until the request has been handed over
+  UIApplication *application = [UIApplication sharedApplication];
+  __block UIBackgroundTaskIdentifier backgroundTask = UIBackgroundTaskInvalid;
+  void (^endBackgroundTask)(void) = ^ () {
+    dispatch_async(dispatch_get_main_queue(), ^{
+      if (backgroundTask != UIBackgroundTaskInvalid) {
+        [application endBackgroundTask:backgroundTask];
+        backgroundTask = UIBackgroundTaskInvalid;
+      }
+    });
+  };
+  backgroundTask = [application beginBackgroundTaskWithExpirationHandler:^{
+    [application endBackgroundTask:backgroundTask];
+    backgroundTask = UIBackgroundTaskInvalid;
+  }];
+  
+  dispatch_async(self.trackerQueue, ^{
+    
+    if (self.isFetchingEvents) {
+      // A running dispatch is fetching events, handing over the same events would send them twice
+      endBackgroundTask();
+      return;
+    }
+    
+    self.isFetchingEvents = YES;
+    
+    NSMutableSet *excludedEventIDs = [self.inFlightEventIDs mutableCopy];
+    [excludedEventIDs unionSet:self.backgroundEventIDs];
+    
+    [self.eventStore eventsFromStore:self.maxNumberOfQueuedEvents excludingEventIDs:excludedEventIDs completionBlock:^(NSArray *eventIDs, NSArray *events, BOOL hasMore) {
+      
+      dispatch_async(self.trackerQueue, ^{
+        
+        self.isFetchingEvents = NO;
+        
+        if (events.count > 0) {
+          
+          NSString *requestIdentifier = [[NSUUID UUID] UUIDString];
+          
+          // Record the request before handing it over, the app may be terminated before it has finished
+          [self addBackgroundRequestWithIdentifier:requestIdentifier eventIDs:eventIDs];
+          [self.dispatcher sendBackgroundBulkEventWithParameters:[self bulkRequestParametersForEvents:events] requestIdentifier:requestIdentifier];
+          
+          PiwikDebugLog(@"Handed %ld events over to the background session", (unsigned long)events.count);
+        }
+        
+        // A dispatch blocked by the fetch continue with the remaining events
+        if (self.isDispatchRunning || self.isHighPriorityDispatchRunning) {
+          [self sendNextEvents];
+        }
+        
+        endBackgroundTask();
+      });
+      
+    }];
+    
+  });
+  
+}
+
+#endif
+
+
+// Must be called on the tracker queue
+- (void)addBackgroundRequestWithIdentifier:(NSString*)requestIdentifier eventIDs:(NSArray*)eventIDs {
+  
+  self.backgroundRequests[requestIdentifier] = @{PiwikBackgroundRequestDateKey : [NSDate date],
+                                                 PiwikBackgroundRequestEventIDsKey : [self.eventStore archivableEventIDs:eventIDs]};
+  [self.backgroundEventIDs addObjectsFromArray:eventIDs];
+  
+  [self saveBackgroundRequests];
+}
+
+
+// Must be called on the tracker queue
+- (void)backgroundRequestDidFinishWithIdentifier:(NSString*)requestIdentifier success:(BOOL)success {
+  
+  NSDictionary *request = self.backgroundRequests[requestIdentifier];
+  if (!request) {
+    // Expired or sent by another tracker
+    return;
+  }
+  
+  NSArray *eventIDs = [self.eventStore eventIDsFromArchivableEventIDs:request[PiwikBackgroundRequestEventIDsKey]];
+  
+  if (success) {
+    [self.eventStore deleteEventsWithIDs:eventIDs];
+  }
+  
+  // Failed events are sent again by the next dispatch
+  [self.backgroundRequests removeObjectForKey:requestIdentifier];
+  [self.backgroundEventIDs minusSet:[NSSet setWithArray:eventIDs]];
+  
+  [self saveBackgroundRequests];
+  
+  PiwikDebugLog(@"Background request finished %@", success ? @"successfully" : @"with error");
+}
+
+
+// Must be called on the tracker queue
+- (NSMutableDictionary*)backgroundRequests {
+  
+  if (!_backgroundRequests) {
+    
+    NSMutableDictionary *backgroundRequests = [NSMutableDictionary dictionary];
+    
+    NSDictionary *storedRequests = [NSDictionary dictionaryWithContentsOfURL:[self backgroundRequestsURL]];
+    [storedRequests enumerateKeysAndObjectsUsingBlock:^(NSString *requestIdentifier, NSDictionary *request, BOOL *stop) {
+      // The system may give up on an upload without reporting it, send the events again
+      if (fabs([request[PiwikBackgroundRequestDateKey] timeIntervalSinceNow]) < PiwikBackgroundRequestMaximumAge) {
+        backgroundRequests[requestIdentifier] = request;
+      }
+    }];
+    
+    _backgroundRequests = backgroundRequests;
+  }
+  
+  return _backgroundRequests;
+}
+
+
+// Must be called on the tracker queue
+- (NSMutableSet*)backgroundEventIDs {
+  
+  if (!_backgroundEventIDs) {
+    
+    _backgroundEventIDs = [NSMutableSet set];
+    
+    if (self.backgroundRequests.count > 0 && [self.eventStore respondsToSelector:@selector(eventIDsFromArchivableEventIDs:)]) {
+      for (NSDictionary *request in [self.backgroundRequests allValues]) {
+        [_backgroundEventIDs addObjectsFromArray:[self.eventStore eventIDsFromArchivableEventIDs:request[PiwikBackgroundRequestEventIDsKey]]];
+      }
+    }
+    
+  }
+  
+  return _backgroundEventIDs;
+}
+
+
+- (void)saveBackgroundRequests {
+  
+  if (self.backgroundRequests.count > 0) {
+    [self.backgroundRequests writeToURL:[self backgroundRequestsURL] atomically:YES];
+  } else {
+    [[NSFileManager defaultManager] removeItemAtURL:[self backgroundRequestsURL] error:nil];
+  }
+  
+}
+
+
+- (NSURL*)backgroundRequestsURL {
+  NSURL *documentsURL = [[[NSFileManager defaultManager] URLsForDirectory:NSDocumentDirectory inDomains:NSUserDomainMask] lastObject];
+  return [documentsURL URLByAppendingPathComponent:PiwikBackgroundRequestsFileName];
+}
+
+
+- (BOOL)handleEventsForBackgroundURLSession:(NSString*)identifier completionHandler:(void (^)(void))completionHandler {
+  
+  if ([self.dispatcher respondsToSelector:@selector(handleEventsForBackgroundURLSession:completionHandler:)]) {
+    return [self.dispatcher handleEventsForBackgroundURLSession:identifier completionHandler:completionHandler];
+  } else {
+    return NO;
+  }
+  
+}
+
+
+- (void)deleteQueuedEvents {
+  // Include events tracked before this call but not yet stored
+  [self performBlockOnTrackerQueue:^{
+    [self.eventBuffer removeAllEvents];
+    [self.eventStore deleteAllStoredEvents];
+    self.isNewVisitPending = NO;
+  }];
+}
+
+
+#pragma mark - Properties
+
+
+- (void)setMaxNumberOfQueuedEvents:(NSUInteger)maxNumberOfQueuedEvents {
+  _maxNumberOfQueuedEvents = maxNumberOfQueuedEvents;
+  self.eventStore.maximumNumberOfEvents = maxNumberOfQueuedEvents;
+}
+
+
+- (void)setPowerAwareDispatch:(BOOL)powerAwareDispatch {
+  _powerAwareDispatch = powerAwareDispatch;
+  self.dispatchScheduler.postponeDispatchOnExpensiveNetworks = powerAwareDispatch;
+}
+
+
+- (void)setCompressBulkRequests:(BOOL)compressBulkRequests {
+  _compressBulkRequests = compressBulkRequests;
+  
+  if ([self.dispatcher respondsToSelector:@selector(setCompressBulkRequests:)]) {
+    [self.dispatcher setCompressBulkRequests:compressBulkRequests];
   }
   
-  // Join event parameters with static parameters
-  NSMutableDictionary *joinedParameters = [NSMutableDictionary dictionaryWithDictionary:parameters];
-  [joinedParameters addEntriesFromDictionary:self.staticParameters];
-    
-  return joinedParameters;
 }
 
 
-+ (NSString*)JSONEncodeCustomVariables:(NSDictionary*)variables {
+- (void)setBackgroundDispatch:(BOOL)backgroundDispatch {
+  _backgroundDispatch = backgroundDispatch;
   
-  // Travers all custom variables and create a JSON object that be be serialized
-  NSMutableDictionary *JSONObject = [NSMutableDictionary dictionaryWithCapacity:variables.count];
-  for (CustomVariable *customVariable in [variables objectEnumerator]) {
-        JSONObject[[NSString stringWithFormat:@"%ld", (long)customVariable.index]] = [NSArray arrayWithObjects:customVariable.name, customVariable.value, nil];
+  if (!backgroundDispatch || ![self.dispatcher respondsToSelector:@selector(sendBackgroundBulkEventWithParameters:requestIdentifier:)]) {
+    return;
   }
   
-  NSError *error;
-  NSData *JSONData = [NSJSONSerialization dataWithJSONObject:JSONObject options:0 error:&error];
+  // Set the completion block first, uploads finished while the app was not running are reported when the session is created
+  __weak typeof(self)weakSelf = self;
+  [self.dispatcher setBackgroundRequestCompletionBlock:^(NSString *requestIdentifier, BOOL success) {
+    typeof(self)strongSelf = weakSelf;
+    if (strongSelf) {
+      dispatch_async(strongSelf.trackerQueue, ^{
+        [strongSelf backgroundRequestDidFinishWithIdentifier:requestIdentifier success:success];
+      });
+    }
+  }];
   
-  return [[NSString alloc] initWithData:JSONData encoding:NSUTF8StringEncoding];
+  [self.dispatcher setBackgroundSessionIdentifier:[PiwikBackgroundSessionIdentifierPrefix stringByAppendingString:self.siteID]];
 }
 
 
-- (void)dispatch:(NSNotification*)notification {
-  [self dispatch];
+- (PiwikTrackerStatistics*)statistics {
+  
+  // Nothing has been buffered yet while the startup is pending, do not block until it has finished
+  // The startup waits for the main run loop, blocking on the main thread would never return
+  __block NSUInteger numberOfBufferedEvents = 0;
+  if (!self.isStartupPending) {
+    [self performBlockOnTrackerQueueAndWait:^{
+      numberOfBufferedEvents = self.eventBuffer.count;
+    }];
+  }
+  
+  return [self.telemetry statisticsWithQueueDepth:self.numberOfQueuedEvents + numberOfBufferedEvents];
 }
 
 
-- (BOOL)dispatch {
+// Run on any queue
+- (void)didDropEvents:(NSUInteger)numberOfEvents reason:(PiwikEventDropReason)reason {
   
-  if (self.isDispatchRunning) {
-    return YES;
-  } else {
-    self.isDispatchRunning = YES;
-    [self sendEvent];
-    return YES;
+  [self.telemetry recordDroppedEvents:numberOfEvents reason:reason];
+  
+  [self notifyTelemetryDelegate:^(id<PiwikTrackerTelemetryDelegate> delegate) {
+    if ([delegate respondsToSelector:@selector(piwikTracker:didDropEvents:reason:)]) {
+      [delegate piwikTracker:self didDropEvents:numberOfEvents reason:reason];
+    }
+  }];
+  
+}
+
+
+// Run on any queue, the store only report the total number of dropped events
+- (void)recordEventsDroppedByStore {
+  
+  if (![self.eventStore respondsToSelector:@selector(numberOfDroppedEvents)]) {
+    return;
+  }
+  
+  NSUInteger numberOfEvents = [self.telemetry recordNumberOfEventsDroppedByStore:self.eventStore.numberOfDroppedEvents];
+  if (numberOfEvents > 0) {
+    [self notifyTelemetryDelegate:^(id<PiwikTrackerTelemetryDelegate> delegate) {
+      if ([delegate respondsToSelector:@selector(piwikTracker:didDropEvents:reason:)]) {
+        [delegate piwikTracker:self didDropEvents:numberOfEvents reason:PiwikEventDropReasonOverflow];
+      }
+    }];
   }
   
 }
 
 
-- (void)sendEvent {
+// Delegate methods are called on the main queue
+- (void)notifyTelemetryDelegate:(void (^)(id<PiwikTrackerTelemetryDelegate> delegate))block {
+  
+  id<PiwikTrackerTelemetryDelegate> delegate = self.telemetryDelegate;
+  if (!delegate) {
+    return;
+  }
+  
+  dispatch_async(dispatch_get_main_queue(), ^{
+    block(delegate);
+  });
+  
+}
+
 
-  NSUInteger numberOfEventsToSend = self.eventsPerRequest;
-  [self eventsFromStore:numberOfEventsToSend completionBlock:^(NSArray *entityIDs, NSArray *events, BOOL hasMore) {
-    
-    if (!events || events.count == 0) {
-      
-      // No pending events
-      [self sendEventDidFinishHasMorePending:NO];
-      
-    } else {
-      
-      NSDictionary *requestParameters = [self requestParametersForEvents:events];
+- (PiwikDispatchStatistics*)dispatchStatistics {
   
-      __weak typeof(self)weakSelf = self;
-      void (^successBlock)(void) = ^ () {
-        [weakSelf deleteEventsWithIDs:entityIDs];
-        [weakSelf sendEventDidFinishHasMorePending:hasMore];
-      };
-      
-      void (^failureBlock)(BOOL shouldContinue) = ^ (BOOL shouldContinue) {
-        PiwikDebugLog(@"Failed to send stats to Piwik server");
-        
-        if (shouldContinue) {
-          [weakSelf sendEventDidFinishHasMorePending:hasMore];
-        } else {
-          [weakSelf sendEventDidFinishHasMorePending:NO];
-        }
-        
-      };
-      
-      if (events.count == 1) {
-        [self.dispatcher sendSingleEventWithParameters:requestParameters success:successBlock failure:failureBlock];
-      } else {
-        [self.dispatcher sendBulkEventWithParameters:requestParameters success:successBlock failure:failureBlock];
-      }
-      
-    }
-    
+  if (self.dispatchingTracker) {
+    return self.dispatchingTracker.dispatchStatistics;
+  }
+  
+  PiwikNetworkClass networkClass = [self.reachability networkClass];
+  
+  if (self.isStartupPending) {
+    // Nothing has been dispatched before the startup, the dispatch controller is only changed once the tracker queue runs
+    return [self.dispatchController statisticsForNetworkClass:networkClass];
+  }
+  
+  __block PiwikDispatchStatistics *statistics;
+  [self performBlockOnTrackerQueueAndWait:^{
+    statistics = [self.dispatchController statisticsForNetworkClass:networkClass];
   }];
   
+  return statistics;
 }
 
 
-- (NSDictionary*)requestParametersForEvents:(NSArray*)events {
+- (void)setMaxNumberOfQueuedHighPriorityEvents:(NSUInteger)maxNumberOfQueuedHighPriorityEvents {
+  _maxNumberOfQueuedHighPriorityEvents = maxNumberOfQueuedHighPriorityEvents;
   
-  if (events.count == 1) {
-    
-    // Send events as query parameters
-    return [events objectAtIndex:0];
-    
-  } else {
-    
-    // Send events as JSON encoded post body    
-    NSMutableDictionary *JSONParams = [NSMutableDictionary dictionaryWithCapacity:2];
-    
-    // Piwik server will process each record in the batch request in reverse order, not sure if this is a bug
-    // Build the request in revers order
-    NSEnumerationOptions enumerationOption = NSEnumerationReverse;
+  if ([self.eventStore respondsToSelector:@selector(setMaximumNumberOfEvents:forPriority:)]) {
+    [self.eventStore setMaximumNumberOfEvents:maxNumberOfQueuedHighPriorityEvents forPriority:PiwikEventPriorityHigh];
+  }
+}
+
+
+- (void)setEventStore:(id<PiwikEventStore>)eventStore {
+  _eventStore = eventStore;
+  _eventStore.maximumNumberOfEvents = self.maxNumberOfQueuedEvents;
   
-    NSMutableArray *queryStrings = [NSMutableArray arrayWithCapacity:events.count];
-    [events enumerateObjectsWithOptions:enumerationOption usingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
-      
-      NSDictionary *params = (NSDictionary*)obj;
-            
-      // As of Piwik 2.0 the query string should not be url encoded in the request body
-      // Unfortenatly the AFNetworking methods for create parameter pairs are not external
-      NSMutableArray *parameterPair = [NSMutableArray arrayWithCapacity:params.count];
-      [params enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
-        [parameterPair addObject:[NSString stringWithFormat:@"%@=%@", key, obj]];
-      }];
-      
-      NSString *queryString = [NSString stringWithFormat:@"?%@", [parameterPair componentsJoinedByString:@"&"]];
+  if ([_eventStore respondsToSelector:@selector(numberOfDroppedEvents)]) {
+    [self.telemetry resetNumberOfEventsDroppedByStore:_eventStore.numberOfDroppedEvents];
+  }
   
-      [queryStrings addObject:queryString];
-      
-    }];
-        
-    JSONParams[@"requests"] = queryStrings;
-//    DLog(@"Bulk request:\n%@", JSONParams);
-    
-    return JSONParams;
-    
+  if ([_eventStore respondsToSelector:@selector(setMaximumNumberOfEvents:forPriority:)]) {
+    [_eventStore setMaximumNumberOfEvents:self.maxNumberOfQueuedHighPriorityEvents forPriority:PiwikEventPriorityHigh];
+  }
+  
+  if ([_eventStore respondsToSelector:@selector(setOverflowPolicy:)]) {
+    _eventStore.overflowPolicy = self.overflowPolicy;
   }
   
+  // Site trackers share the store but leave its configuration to this tracker
+  @synchronized(self.siteTrackers) {
+    for (PiwikTracker *tracker in self.siteTrackers.allValues) {
+      [tracker shareEventStore:eventStore];
+    }
+  }
 }
 
 
-- (void)sendEventDidFinishHasMorePending:(BOOL)hasMore {
- 
-  if (hasMore) {
-    [self sendEvent];
-  } else {
-    self.isDispatchRunning = NO;
-    [self startDispatchTimer];
+- (void)shareEventStore:(id<PiwikEventStore>)eventStore {
+  _eventStore = eventStore;
+  
+  if ([_eventStore respondsToSelector:@selector(numberOfDroppedEvents)]) {
+    [self.telemetry resetNumberOfEventsDroppedByStore:_eventStore.numberOfDroppedEvents];
   }
+}
 
+
+- (void)setOverflowPolicy:(PiwikEventOverflowPolicy)overflowPolicy {
+  _overflowPolicy = overflowPolicy;
+  
+  if ([self.eventStore respondsToSelector:@selector(setOverflowPolicy:)]) {
+    self.eventStore.overflowPolicy = overflowPolicy;
+  }
 }
 
 
-- (void)deleteQueuedEvents {
-  [self deleteAllStoredEvents];
+- (NSUInteger)numberOfQueuedEvents {
+  return [self.eventStore respondsToSelector:@selector(numberOfEvents)] ? self.eventStore.numberOfEvents : 0;
 }
 
 
-#pragma mark - Properties
+- (NSUInteger)numberOfDroppedEvents {
+  return [self.eventStore respondsToSelector:@selector(numberOfDroppedEvents)] ? self.eventStore.numberOfDroppedEvents : 0;
+}
+
+
+- (void)setEventCoalescingInterval:(NSTimeInterval)eventCoalescingInterval {
+  _eventCoalescingInterval = eventCoalescingInterval;
+  
+  [self performBlockOnTrackerQueue:^{
+    self.eventCoalescer.interval = eventCoalescingInterval;
+  }];
+}
+
+
+- (NSUInteger)numberOfCoalescedEvents {
+  return self.eventCoalescer.numberOfCoalescedEvents;
+}
+
+
+- (void)setMaximumEventAge:(NSTimeInterval)maximumEventAge {
+  _maximumEventAge = maximumEventAge;
+  
+  [self performBlockOnTrackerQueue:^{
+    [self deleteExpiredEvents];
+  }];
+  
+}
 
 
 - (void)setIncludeLocationInformation:(BOOL)includeLocationInformation {
@@ -1140,6 +2529,48 @@ static PiwikTracker *_sharedInstance;
 }
 
 
+- (void)setLazyStartup:(BOOL)lazyStartup {
+  
+  // Can only be deferred once
+  if (lazyStartup && !_lazyStartup) {
+    _lazyStartup = YES;
+    [self deferStartup];
+  }
+  
+}
+
+
+- (void)setSessionStart:(BOOL)sessionStart {
+  // Apply in order with queued events, the session will start with the next event tracked
+  [self performBlockOnTrackerQueue:^{
+    _sessionStart = sessionStart;
+  }];
+}
+
+
+- (BOOL)sessionStart {
+  return _sessionStart;
+}
+
+
+- (void)setUserID:(NSString*)userID {
+  NSString *copiedUserID = [userID copy];
+  [self performBlockOnTrackerQueue:^{
+    if (copiedUserID != _userID && ![copiedUserID isEqualToString:_userID]) {
+      _userID = copiedUserID;
+      
+      // Force generation of session parameters
+      self.sessionParameters = nil;
+    }
+  }];
+}
+
+
+- (NSString*)userID {
+  return _userID;
+}
+
+
 - (void)setOptOut:(BOOL)optOut {
   NSUserDefaults *userDefaults = [NSUserDefaults standardUserDefaults];
   [userDefaults setBool:optOut forKey:PiwikUserDefaultOptOutKey];
@@ -1335,308 +2766,48 @@ inline NSString* UserDefaultKeyWithSiteID(NSString *siteID, NSString *key) {
 }
 
 
-+ (NSString*)UUIDString {
-  CFUUIDRef UUID = CFUUIDCreate(kCFAllocatorDefault);
-  NSString *UUIDString = (__bridge_transfer NSString*)CFUUIDCreateString(kCFAllocatorDefault, UUID);
-  CFRelease(UUID); // Need to release the UUID, the UUIDString ownership is transfered
-  
-  return UUIDString;
-}
-
-
-- (NSString*)platform {
-  
-  size_t size;
-  sysctlbyname("hw.machine", NULL, &size, NULL, 0);
-  char *machine = malloc(size * sizeof(char));
-  sysctlbyname("hw.machine", machine, &size, NULL, 0);
-  NSString *platform = [NSString stringWithUTF8String:machine];
-  free(machine);
-  
-  return platform;
-}
-
-
-- (NSString*)platformName  {
-  
-  NSString *platform = [self platform];
-
-    // https://gist.github.com/Jaybles/1323251
-    // https://www.theiphonewiki.com/wiki/Models
-    
-    // iPhone
-    if ([platform isEqualToString:@"iPhone1,1"])    return @"iPhone 1G";
-    if ([platform isEqualToString:@"iPhone1,2"])    return @"iPhone 3G";
-    if ([platform isEqualToString:@"iPhone2,1"])    return @"iPhone 3GS";
-    if ([platform isEqualToString:@"iPhone3,1"])    return @"iPhone 4";
-    if ([platform isEqualToString:@"iPhone3,3"])    return @"Verizon iPhone 4";
-    if ([platform isEqualToString:@"iPhone4,1"])    return @"iPhone 4S";
-    if ([platform isEqualToString:@"iPhone5,1"])    return @"iPhone 5 (GSM)";
-    if ([platform isEqualToString:@"iPhone5,2"])    return @"iPhone 5 (GSM+CDMA)";
-    if ([platform isEqualToString:@"iPhone5,3"])    return @"iPhone 5c (GSM)";
-    if ([platform isEqualToString:@"iPhone5,4"])    return @"iPhone 5c (Global)";
-    if ([platform isEqualToString:@"iPhone6,1"])    return @"iPhone 5s (GSM)";
-    if ([platform isEqualToString:@"iPhone6,2"])    return @"iPhone 5s (Global)";
-    if ([platform isEqualToString:@"iPhone7,1"])    return @"iPhone 6 Plus";
-    if ([platform isEqualToString:@"iPhone7,2"])    return @"iPhone 6";
-    if ([platform isEqualToString:@"iPhone8,1"])    return @"iPhone 6s";
-    if ([platform isEqualToString:@"iPhone8,2"])    return @"iPhone 6s Plus";
-    
-    // iPod
-    if ([platform isEqualToString:@"iPod1,1"])      return @"iPod Touch 1G";
-    if ([platform isEqualToString:@"iPod2,1"])      return @"iPod Touch 2G";
-    if ([platform isEqualToString:@"iPod3,1"])      return @"iPod Touch 3G";
-    if ([platform isEqualToString:@"iPod4,1"])      return @"iPod Touch 4G";
-    if ([platform isEqualToString:@"iPod5,1"])      return @"iPod Touch 5G";
-    if ([platform isEqualToString:@"iPod7,1"])      return @"iPod Touch 6G";
-    
-    // iPad
-    if ([platform isEqualToString:@"iPad1,1"])      return @"iPad";
-    if ([platform isEqualToString:@"iPad2,1"])      return @"iPad 2 (WiFi)";
-    if ([platform isEqualToString:@"iPad2,2"])      return @"iPad 2 (GSM)";
-    if ([platform isEqualToString:@"iPad2,3"])      return @"iPad 2 (CDMA)";
-    if ([platform isEqualToString:@"iPad2,4"])      return @"iPad 2 (WiFi)";
-    if ([platform isEqualToString:@"iPad2,5"])      return @"iPad Mini (WiFi)";
-    if ([platform isEqualToString:@"iPad2,6"])      return @"iPad Mini (GSM)";
-    if ([platform isEqualToString:@"iPad2,7"])      return @"iPad Mini (GSM+CDMA)";
-    if ([platform isEqualToString:@"iPad3,1"])      return @"iPad 3 (WiFi)";
-    if ([platform isEqualToString:@"iPad3,2"])      return @"iPad 3 (GSM+CDMA)";
-    if ([platform isEqualToString:@"iPad3,3"])      return @"iPad 3 (GSM)";
-    if ([platform isEqualToString:@"iPad3,4"])      return @"iPad 4 (WiFi)";
-    if ([platform isEqualToString:@"iPad3,5"])      return @"iPad 4 (GSM)";
-    if ([platform isEqualToString:@"iPad3,6"])      return @"iPad 4 (GSM+CDMA)";
-    if ([platform isEqualToString:@"iPad4,1"])      return @"iPad Air (WiFi)";
-    if ([platform isEqualToString:@"iPad4,2"])      return @"iPad Air (Cellular)";
-    if ([platform isEqualToString:@"iPad4,3"])      return @"iPad Air";
-    if ([platform isEqualToString:@"iPad4,4"])      return @"iPad Mini 2 (WiFi)";
-    if ([platform isEqualToString:@"iPad4,5"])      return @"iPad Mini 2 (Cellular)";
-    if ([platform isEqualToString:@"iPad4,6"])      return @"iPad Mini 2 (Rev)";
-    if ([platform isEqualToString:@"iPad4,7"])      return @"iPad Mini 3 (WiFi)";
-    if ([platform isEqualToString:@"iPad4,8"])      return @"iPad Mini 3 (A1600)";
-    if ([platform isEqualToString:@"iPad4,9"])      return @"iPad Mini 3 (A1601)";
-    if ([platform isEqualToString:@"iPad5,1"])      return @"iPad Mini 4 (WiFi)";
-    if ([platform isEqualToString:@"iPad5,2"])      return @"iPad Mini 4 (LTE)";
-    if ([platform isEqualToString:@"iPad5,3"])      return @"iPad Air 2 (WiFi)";
-    if ([platform isEqualToString:@"iPad5,4"])      return @"iPad Air 2 (Cellular)";
-    if ([platform isEqualToString:@"iPad6,8"])      return @"iPad Pro";
-    
-    if ([platform isEqualToString:@"i386"])         return @"Simulator";
-    if ([platform isEqualToString:@"x86_64"])       return @"Simulator";
-    
-  return platform;
-  
-}
-
-
-#pragma mark - Core data methods
-
-- (BOOL)storeEventWithParameters:(NSDictionary*)parameters completionBlock:(void (^)(void))completionBlock {
-  
-  [self.managedObjectContext performBlock:^{
-    
-    NSError *error;
-    
-    // Check if we reached the limit of the number of queued events
-    NSFetchRequest *fetchRequest = [NSFetchRequest fetchRequestWithEntityName:@"PTEventEntity"];
-    NSUInteger count = [self.managedObjectContext countForFetchRequest:fetchRequest error:&error];
-    
-    if (count < self.maxNumberOfQueuedEvents) {
-      
-      // Create new event entity
-      PTEventEntity *eventEntity = [NSEntityDescription insertNewObjectForEntityForName:@"PTEventEntity" inManagedObjectContext:self.managedObjectContext];
-      eventEntity.piwikRequestParameters = [NSKeyedArchiver archivedDataWithRootObject:parameters];
-      
-      [self.managedObjectContext save:&error];
-      
-    } else {
-      PiwikLog(@"Tracker reach maximum number of queued events");
-    }
-    
-    completionBlock();
-    
-  }];
-  
-  return YES;
-}
-
-
-- (void)eventsFromStore:(NSUInteger)numberOfEvents completionBlock:(void (^)(NSArray *entityIDs, NSArray *events, BOOL hasMore))completionBlock {
-  
-  [self.managedObjectContext performBlock:^{
-    
-    NSFetchRequest *fetchRequest = [NSFetchRequest fetchRequestWithEntityName:@"PTEventEntity"];
-    
-    // Oldest first
-    NSSortDescriptor *sortDescriptor = [NSSortDescriptor sortDescriptorWithKey:@"date" ascending:YES];
-    fetchRequest.sortDescriptors = @[sortDescriptor];
-
-    fetchRequest.fetchLimit = numberOfEvents + 1;
-    
-    NSError *error;
-    NSArray *eventEntities = [self.managedObjectContext executeFetchRequest:fetchRequest error:&error];
-    
-    NSUInteger returnCount = eventEntities.count == fetchRequest.fetchLimit ? numberOfEvents : eventEntities.count;
-    
-    NSMutableArray *events = [NSMutableArray arrayWithCapacity:returnCount];
-    NSMutableArray *entityIDs = [NSMutableArray arrayWithCapacity:returnCount];
-    
-    if (eventEntities && eventEntities.count > 0) {
-      
-      [eventEntities enumerateObjectsAtIndexes:[NSIndexSet indexSetWithIndexesInRange:NSMakeRange(0, returnCount)] options:0
-        usingBlock:^(id obj, NSUInteger idx, BOOL *stop) {
-          
-          PTEventEntity *eventEntity = (PTEventEntity*)obj;
-          NSDictionary *parameters = (NSDictionary*)[NSKeyedUnarchiver unarchiveObjectWithData:eventEntity.piwikRequestParameters];
-
-          [events addObject:parameters];
-          [entityIDs addObject:eventEntity.objectID];
-          
-      }];
-      
-      completionBlock(entityIDs, events, eventEntities.count == fetchRequest.fetchLimit ? YES : NO);
-      
-    } else {
-      // No more pending events
-      completionBlock(nil, nil, NO);
-    }
-    
-  }];
-    
-}
-
-
-- (void)deleteEventsWithIDs:(NSArray*)entityIDs {
-
-  [self.managedObjectContext performBlock:^{
-    
-    NSError *error;
-    
-    for (NSManagedObjectID *entityID in entityIDs) {
-      
-      PTEventEntity *event = (PTEventEntity*)[self.managedObjectContext existingObjectWithID:entityID error:&error];
-      if (event) {
-        [self.managedObjectContext deleteObject:event];
-      }
-
-    }
-    
-    [self.managedObjectContext save:&error];
-    
-  }];
-  
-}
-
-
-- (void)deleteAllStoredEvents {
-  
-  [self.managedObjectContext performBlock:^{
-    
-    NSError *error;
-    
-    NSFetchRequest *fetchRequest = [NSFetchRequest fetchRequestWithEntityName:@"PTEventEntity"];
-
-    NSArray *events = [self.managedObjectContext executeFetchRequest:fetchRequest error:&error];    
-    for (NSManagedObject *event in events) {
-      [self.managedObjectContext deleteObject:event];
-    }
-    
-    [self.managedObjectContext save:&error];
-    
-  }];
-  
-}
-
-
-#pragma mark - Core Data stack
-
-- (NSManagedObjectContext*)managedObjectContext {
+// 16 hex digits from a random UUID, the two halves are folded to keep the random bits of both
++ (NSString*)eventIdentifier {
   
-  if (_managedObjectContext) {
-    return _managedObjectContext;
-  }
+  uuid_t UUIDBytes;
+  [[NSUUID UUID] getUUIDBytes:UUIDBytes];
   
-  NSPersistentStoreCoordinator *coordinator = [self persistentStoreCoordinator];
-  if (coordinator) {
-    _managedObjectContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
-    [_managedObjectContext setPersistentStoreCoordinator:coordinator];
+  static const char hexDigits[] = "0123456789abcdef";
+  char identifier[16];
+  for (NSUInteger i = 0; i < 8; i++) {
+    uint8_t byte = UUIDBytes[i] ^ UUIDBytes[i + 8];
+    identifier[i * 2] = hexDigits[byte >> 4];
+    identifier[i * 2 + 1] = hexDigits[byte & 0x0F];
   }
   
-  return _managedObjectContext;
+  return [[NSString alloc] initWithBytes:identifier length:sizeof(identifier) encoding:NSASCIIStringEncoding];
 }
 
 
-- (NSManagedObjectModel*)managedObjectModel {
-  
-  if (_managedObjectModel) {
-    return _managedObjectModel;
-  }
-  
-  NSURL *modelURL = [[NSBundle bundleForClass:[self class]] URLForResource:@"piwiktracker" withExtension:@"momd"];
-  _managedObjectModel = [[NSManagedObjectModel alloc] initWithContentsOfURL:modelURL];
++ (NSString*)UUIDString {
+  CFUUIDRef UUID = CFUUIDCreate(kCFAllocatorDefault);
+  NSString *UUIDString = (__bridge_transfer NSString*)CFUUIDCreateString(kCFAllocatorDefault, UUID);
+  CFRelease(UUID); // Need to release the UUID, the UUIDString ownership is transfered
   
-  return _managedObjectModel;
+  return UUIDString;
 }
 
 
-- (NSPersistentStoreCoordinator*)persistentStoreCoordinator {
-  
-  if (_persistentStoreCoordinator) {
-    return _persistentStoreCoordinator;
-  }
-  
-  NSURL *storeURL = [[self applicationDocumentsDirectory] URLByAppendingPathComponent:@"piwiktracker"];
+// Must be called on the main thread
+- (void)readScreenResolution {
   
-  // Support lightweigt data migration
-  NSDictionary *options = @{
-                            NSMigratePersistentStoresAutomaticallyOption: @(YES),
-                            NSInferMappingModelAutomaticallyOption: @(YES)
-                           };
-  
-  NSError *error = nil;
-  _persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:[self managedObjectModel]];
-  if (![_persistentStoreCoordinator addPersistentStoreWithType:NSSQLiteStoreType
-                                                 configuration:nil
-                                                           URL:storeURL
-                                                       options:options
-                                                         error:&error]) {
-    
-    BOOL isMigrationError = [error code] == NSPersistentStoreIncompatibleVersionHashError || [error code] == NSMigrationMissingSourceModelError;
-    
-    if ([[error domain] isEqualToString:NSCocoaErrorDomain] && isMigrationError) {
-      
-      PiwikLog(@"Remove incompatible model version: %@", [storeURL lastPathComponent]);
-      
-      // Could not open the database, remove it and try again
-      [[NSFileManager defaultManager] removeItemAtURL:storeURL error:nil];
-      
-      
-      // Try one more time to create the store
-      [_persistentStoreCoordinator addPersistentStoreWithType:NSSQLiteStoreType
-                                                configuration:nil
-                                                          URL:storeURL
-                                                      options:nil
-                                                        error:&error];
-      
-      if (_persistentStoreCoordinator) {
-        // If we successfully added a store, remove the error that was initially created
-        PiwikLog(@"Recovered from migration error");
-        error = nil;
-      } else {
-        // Not possible to recover of workaround
-        PiwikLog(@"Unresolved error when setting up code data stack %@, %@", error, [error userInfo]);
-        abort();
-      }
-      
-    }
-    
+  if (!self.screenResolution) {
+#if TARGET_OS_IPHONE
+    CGRect screenBounds = [[UIScreen mainScreen] bounds];
+    CGFloat screenScale = [[UIScreen mainScreen] scale];
+#else
+    CGRect screenBounds = [[NSScreen mainScreen] frame];
+    CGFloat screenScale = [[NSScreen mainScreen] backingScaleFactor];
+#endif
+    CGSize screenSize = CGSizeMake(CGRectGetWidth(screenBounds) * screenScale, CGRectGetHeight(screenBounds) * screenScale);
+    self.screenResolution = [NSString stringWithFormat:@"%.0fx%.0f", screenSize.width, screenSize.height];
   }
   
-  return _persistentStoreCoordinator;
-}
-
-
-- (NSURL*)applicationDocumentsDirectory {
-  return [[[NSFileManager defaultManager] URLsForDirectory:NSDocumentDirectory inDomains:NSUserDomainMask] lastObject];
 }
 
 
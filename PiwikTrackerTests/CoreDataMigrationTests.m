@@ -34,6 +34,14 @@
   
   XCTAssertNotNil(storeURL, @"Cannot find %@.sqlite", name);
   
+  [self migrateDataFromStoreWithURL:storeURL];
+  
+}
+
+
+- (NSManagedObjectContext*)migrateDataFromStoreWithURL:(NSURL*)storeURL {
+  
+  NSBundle *bundle = [NSBundle bundleForClass:[self class]];
   NSURL *modelURL = [bundle URLForResource:@"piwiktracker" withExtension:@"momd"];
   NSManagedObjectModel *managedObjectModel = [[NSManagedObjectModel alloc] initWithContentsOfURL:modelURL];
   
@@ -56,6 +64,10 @@
   
   XCTAssertNotNil(persistentStore, @"Cannot load persistentStore: %@", [error localizedDescription]);
   
+  NSManagedObjectContext *managedObjectContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSMainQueueConcurrencyType];
+  managedObjectContext.persistentStoreCoordinator = persistentStoreCoordinator;
+  
+  return managedObjectContext;
 }
 
 
@@ -64,5 +76,47 @@
 }
 
 
+- (void)testDataMigrationFromV2 {
+  
+  NSBundle *bundle = [NSBundle bundleForClass:[self class]];
+  NSURL *modelURL = [bundle URLForResource:@"piwiktracker v2" withExtension:@"mom" subdirectory:@"piwiktracker.momd"];
+  NSManagedObjectModel *managedObjectModel = [[NSManagedObjectModel alloc] initWithContentsOfURL:modelURL];
+  
+  XCTAssertNotNil(managedObjectModel, @"Cannot load v2 model");
+  
+  // Create a v2 store containing one event
+  NSURL *storeURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:
+                     [NSString stringWithFormat:@"piwiktracker_v2_%@.sqlite", [[NSUUID UUID] UUIDString]]];
+  
+  NSPersistentStoreCoordinator *persistentStoreCoordinator = [[NSPersistentStoreCoordinator alloc]
+                                                              initWithManagedObjectModel:managedObjectModel];
+  NSError *error;
+  [persistentStoreCoordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:storeURL options:nil error:&error];
+  
+  NSManagedObjectContext *managedObjectContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSMainQueueConcurrencyType];
+  managedObjectContext.persistentStoreCoordinator = persistentStoreCoordinator;
+  
+  NSManagedObject *event = [NSEntityDescription insertNewObjectForEntityForName:@"PTEventEntity" inManagedObjectContext:managedObjectContext];
+  [event setValue:[NSDate date] forKey:@"date"];
+  [event setValue:[NSKeyedArchiver archivedDataWithRootObject:@{@"action_name": @"v2"}] forKey:@"piwikRequestParameters"];
+  
+  XCTAssertTrue([managedObjectContext save:&error], @"Cannot save v2 store: %@", [error localizedDescription]);
+  
+  managedObjectContext = nil;
+  persistentStoreCoordinator = nil;
+  
+  // Migrate to the current model, the event must be kept and read as a keyed archive
+  managedObjectContext = [self migrateDataFromStoreWithURL:storeURL];
+  
+  NSFetchRequest *fetchRequest = [NSFetchRequest fetchRequestWithEntityName:@"PTEventEntity"];
+  NSArray *events = [managedObjectContext executeFetchRequest:fetchRequest error:&error];
+  
+  XCTAssertEqual(events.count, 1, @"Event lost during migration");
+  XCTAssertEqualObjects([events.firstObject valueForKey:@"encoding"], @(0), @"Migrated event must use the keyed archive encoding");
+  
+  [[NSFileManager defaultManager] removeItemAtURL:storeURL error:nil];
+  
+}
+
 
 @end
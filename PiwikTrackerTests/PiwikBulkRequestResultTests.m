@@ -0,0 +1,60 @@
+//
+//  PiwikBulkRequestResultTests.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "PiwikBulkRequestResult.h"
+
+@interface PiwikBulkRequestResultTests : XCTestCase
+@end
+
+@implementation PiwikBulkRequestResultTests
+
+
+- (NSData*)dataWithString:(NSString*)string {
+  return [string dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+
+- (void)testResultWithCounts {
+  
+  PiwikBulkRequestResult *result = [PiwikBulkRequestResult resultWithResponseData:[self dataWithString:@"{\"status\":\"success\",\"tracked\":19,\"invalid\":1}"]];
+  
+  XCTAssertNotNil(result);
+  XCTAssertEqual(result.numberOfTrackedEvents, 19);
+  XCTAssertEqual(result.numberOfInvalidEvents, 1);
+  XCTAssertNil(result.invalidIndexes);
+  XCTAssertTrue([result isCompleteForNumberOfEvents:20]);
+  XCTAssertFalse([result isCompleteForNumberOfEvents:21]);
+  
+}
+
+
+- (void)testResultWithInvalidIndices {
+  
+  PiwikBulkRequestResult *result = [PiwikBulkRequestResult resultWithResponseData:[self dataWithString:@"{\"status\":\"success\",\"tracked\":3,\"invalid\":2,\"invalid_indices\":[1,4]}"]];
+  
+  XCTAssertEqual(result.numberOfInvalidEvents, 2);
+  XCTAssertEqual(result.invalidIndexes.count, 2);
+  XCTAssertTrue([result.invalidIndexes containsIndex:1]);
+  XCTAssertTrue([result.invalidIndexes containsIndex:4]);
+  
+}
+
+
+- (void)testNotABulkResponse {
+  
+  XCTAssertNil([PiwikBulkRequestResult resultWithResponseData:nil]);
+  XCTAssertNil([PiwikBulkRequestResult resultWithResponseData:[NSData data]]);
+  XCTAssertNil([PiwikBulkRequestResult resultWithResponseData:[self dataWithString:@"GIF89a"]]);
+  XCTAssertNil([PiwikBulkRequestResult resultWithResponseData:[self dataWithString:@"{\"status\":\"success\"}"]]);
+  
+}
+
+
+@end
@@ -0,0 +1,59 @@
+//
+//  PiwikDeviceModelTests.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "PiwikDeviceModel.h"
+
+@interface PiwikDeviceModelTests : XCTestCase
+@end
+
+@implementation PiwikDeviceModelTests
+
+
+- (void)testKnownModelsAreNamed {
+  
+  // First, last and a few in between, a table out of order will miss some of them
+  XCTAssertEqualObjects([PiwikDeviceModel nameForMachineIdentifier:@"i386" modelNames:nil], @"Simulator");
+  XCTAssertEqualObjects([PiwikDeviceModel nameForMachineIdentifier:@"iPad2,5" modelNames:nil], @"iPad Mini (WiFi)");
+  XCTAssertEqualObjects([PiwikDeviceModel nameForMachineIdentifier:@"iPhone1,1" modelNames:nil], @"iPhone 1G");
+  XCTAssertEqualObjects([PiwikDeviceModel nameForMachineIdentifier:@"iPhone8,1" modelNames:nil], @"iPhone 6s");
+  XCTAssertEqualObjects([PiwikDeviceModel nameForMachineIdentifier:@"iPod7,1" modelNames:nil], @"iPod Touch 6G");
+  XCTAssertEqualObjects([PiwikDeviceModel nameForMachineIdentifier:@"x86_64" modelNames:nil], @"Simulator");
+  
+}
+
+
+- (void)testUnknownModelsAreNamedByIdentifier {
+  XCTAssertEqualObjects([PiwikDeviceModel nameForMachineIdentifier:@"iPhone99,1" modelNames:nil], @"iPhone99,1");
+  XCTAssertEqualObjects([PiwikDeviceModel nameForMachineIdentifier:@"" modelNames:nil], @"");
+}
+
+
+- (void)testModelNamesReplaceTable {
+  
+  NSDictionary *modelNames = @{@"iPhone99,1" : @"iPhone Future", @"iPhone8,1" : @"iPhone 6s (Renamed)"};
+  
+  XCTAssertEqualObjects([PiwikDeviceModel nameForMachineIdentifier:@"iPhone99,1" modelNames:modelNames], @"iPhone Future");
+  XCTAssertEqualObjects([PiwikDeviceModel nameForMachineIdentifier:@"iPhone8,1" modelNames:modelNames], @"iPhone 6s (Renamed)");
+  XCTAssertEqualObjects([PiwikDeviceModel nameForMachineIdentifier:@"iPhone7,2" modelNames:modelNames], @"iPhone 6");
+  
+}
+
+
+- (void)testCurrentModelIsCached {
+  
+  NSString *modelName = [PiwikDeviceModel currentModelName];
+  
+  XCTAssertTrue(modelName.length > 0);
+  XCTAssertTrue([PiwikDeviceModel currentModelName] == modelName);
+  
+}
+
+
+@end
@@ -0,0 +1,66 @@
+//
+//  PiwikDispatchControllerTests.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "PiwikDispatchController.h"
+
+@interface PiwikDispatchControllerTests : XCTestCase
+@end
+
+@implementation PiwikDispatchControllerTests
+
+
+- (void)testFailureHalvesBatchAndSuccessGrowsIt {
+  
+  PiwikDispatchController *controller = [[PiwikDispatchController alloc] initWithMaximumEventsPerRequest:20
+                                                                                    minimumRequestTimeout:5
+                                                                                    maximumRequestTimeout:30];
+  
+  XCTAssertEqual([controller eventsPerRequestForNetworkClass:PiwikNetworkClassCellular], 20);
+  
+  [controller requestDidFailWithNumberOfEvents:20 networkClass:PiwikNetworkClassCellular];
+  XCTAssertEqual([controller eventsPerRequestForNetworkClass:PiwikNetworkClassCellular], 10);
+  XCTAssertEqual([controller requestTimeoutForNetworkClass:PiwikNetworkClassCellular], 10);
+  
+  [controller requestDidSucceedWithNumberOfEvents:10 payloadSize:4000 roundTripTime:0.5 networkClass:PiwikNetworkClassCellular];
+  XCTAssertEqual([controller eventsPerRequestForNetworkClass:PiwikNetworkClassCellular], 11);
+  XCTAssertEqual([controller requestTimeoutForNetworkClass:PiwikNetworkClassCellular], 5);
+  
+  // Network classes are independent
+  XCTAssertEqual([controller eventsPerRequestForNetworkClass:PiwikNetworkClassWiFi], 20);
+  
+  PiwikDispatchStatistics *statistics = [controller statisticsForNetworkClass:PiwikNetworkClassCellular];
+  XCTAssertEqual(statistics.numberOfRequests, 2);
+  XCTAssertEqual(statistics.numberOfFailures, 1);
+  XCTAssertEqualWithAccuracy(statistics.throughput, 8000, 0.1);
+  
+}
+
+
+- (void)testBounds {
+  
+  PiwikDispatchController *controller = [[PiwikDispatchController alloc] initWithMaximumEventsPerRequest:2
+                                                                                    minimumRequestTimeout:5
+                                                                                    maximumRequestTimeout:8];
+  
+  for (NSUInteger i = 0; i < 5; i++) {
+    [controller requestDidFailWithNumberOfEvents:1 networkClass:PiwikNetworkClassWiFi];
+  }
+  XCTAssertEqual([controller eventsPerRequestForNetworkClass:PiwikNetworkClassWiFi], 1);
+  XCTAssertEqual([controller requestTimeoutForNetworkClass:PiwikNetworkClassWiFi], 8);
+  
+  for (NSUInteger i = 0; i < 5; i++) {
+    [controller requestDidSucceedWithNumberOfEvents:2 payloadSize:100 roundTripTime:0.1 networkClass:PiwikNetworkClassWiFi];
+  }
+  XCTAssertEqual([controller eventsPerRequestForNetworkClass:PiwikNetworkClassWiFi], 2);
+  
+}
+
+
+@end
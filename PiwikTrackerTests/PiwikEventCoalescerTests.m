@@ -0,0 +1,90 @@
+//
+//  PiwikEventCoalescerTests.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "PiwikEventCoalescer.h"
+
+@interface PiwikEventCoalescerTests : XCTestCase
+@end
+
+@implementation PiwikEventCoalescerTests
+
+
+- (void)testIdenticalViewsWithinIntervalAreCoalesced {
+  
+  PiwikEventCoalescer *coalescer = [[PiwikEventCoalescer alloc] init];
+  coalescer.interval = 2;
+  
+  NSDictionary *view = @{@"action_name" : @"screen/home", @"url" : @"http://example.com/screen/home"};
+  NSDictionary *otherView = @{@"action_name" : @"screen/settings", @"url" : @"http://example.com/screen/settings"};
+  NSDate *now = [NSDate date];
+  
+  XCTAssertFalse([coalescer shouldCoalesceEventWithParameters:view timestamp:now]);
+  XCTAssertTrue([coalescer shouldCoalesceEventWithParameters:view timestamp:[now dateByAddingTimeInterval:1]]);
+  XCTAssertFalse([coalescer shouldCoalesceEventWithParameters:otherView timestamp:[now dateByAddingTimeInterval:1]]);
+  
+  // The interval is measured from the queued event
+  XCTAssertFalse([coalescer shouldCoalesceEventWithParameters:view timestamp:[now dateByAddingTimeInterval:2]]);
+  
+  XCTAssertEqual(coalescer.numberOfCoalescedEvents, 1);
+  
+}
+
+
+- (void)testOnlyViewsAndImpressionsAreCoalesced {
+  
+  PiwikEventCoalescer *coalescer = [[PiwikEventCoalescer alloc] init];
+  coalescer.interval = 10;
+  
+  NSDictionary *impression = @{@"c_n" : @"banner", @"c_p" : @"image.png", @"c_t" : @"http://example.com"};
+  NSDictionary *interaction = @{@"c_n" : @"banner", @"c_p" : @"image.png", @"c_i" : @"tap"};
+  NSDictionary *event = @{@"e_c" : @"category", @"e_a" : @"action"};
+  NSDate *now = [NSDate date];
+  
+  XCTAssertNotNil([PiwikEventCoalescer coalescingKeyForParameters:impression]);
+  XCTAssertNil([PiwikEventCoalescer coalescingKeyForParameters:interaction]);
+  XCTAssertNil([PiwikEventCoalescer coalescingKeyForParameters:event]);
+  
+  XCTAssertFalse([coalescer shouldCoalesceEventWithParameters:impression timestamp:now]);
+  XCTAssertTrue([coalescer shouldCoalesceEventWithParameters:impression timestamp:now]);
+  XCTAssertFalse([coalescer shouldCoalesceEventWithParameters:interaction timestamp:now]);
+  XCTAssertFalse([coalescer shouldCoalesceEventWithParameters:interaction timestamp:now]);
+  
+  // Disabled
+  coalescer.interval = 0;
+  XCTAssertFalse([coalescer shouldCoalesceEventWithParameters:impression timestamp:now]);
+  
+}
+
+
+- (void)testRollupKeyIgnoresTimeAndIdentifiersOfStoredEvents {
+  
+  NSDictionary *view = @{@"action_name" : @"screen/home", @"url" : @"http://example.com/screen/home", @"idsite" : @"1", @"_id" : @"0123456789abcdef",
+                         @"r" : @"123", @"pk_eid" : @"a", @"cdt" : @"2016-10-14 10:00:00", @"h" : @"12", @"m" : @"0", @"s" : @"0", @"send_image" : @0};
+  NSMutableDictionary *laterView = [view mutableCopy];
+  [laterView addEntriesFromDictionary:@{@"r" : @"456", @"pk_eid" : @"b", @"cdt" : @"2016-10-14 10:05:00", @"m" : @"5"}];
+  NSMutableDictionary *otherSite = [view mutableCopy];
+  otherSite[@"idsite"] = @"2";
+  NSMutableDictionary *otherVisitor = [view mutableCopy];
+  otherVisitor[@"_id"] = @"fedcba9876543210";
+  
+  NSString *key = [PiwikEventCoalescer rollupKeyForStoredEvent:view];
+  XCTAssertNotNil(key);
+  XCTAssertEqualObjects([PiwikEventCoalescer rollupKeyForStoredEvent:laterView], key);
+  XCTAssertNotEqualObjects([PiwikEventCoalescer rollupKeyForStoredEvent:otherSite], key);
+  XCTAssertNotEqualObjects([PiwikEventCoalescer rollupKeyForStoredEvent:otherVisitor], key);
+  
+  XCTAssertNotNil([PiwikEventCoalescer rollupKeyForStoredEvent:@{@"c_n" : @"banner", @"idsite" : @"1"}]);
+  XCTAssertNil([PiwikEventCoalescer rollupKeyForStoredEvent:@{@"c_n" : @"banner", @"c_i" : @"tap", @"idsite" : @"1"}]);
+  XCTAssertNil([PiwikEventCoalescer rollupKeyForStoredEvent:@{@"idgoal" : @"1", @"url" : @"http://example.com", @"idsite" : @"1"}]);
+  
+}
+
+
+@end
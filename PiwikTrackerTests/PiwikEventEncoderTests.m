@@ -0,0 +1,81 @@
+//
+//  PiwikEventEncoderTests.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "PiwikEventEncoder.h"
+
+@interface PiwikEventEncoderTests : XCTestCase
+@end
+
+@implementation PiwikEventEncoderTests
+
+
+- (void)testEventRoundTrip {
+  
+  NSDictionary *parameters = @{@"action_name": @"Menu/Settings",
+                               @"url": @"http://example.com/Menu/Settings",
+                               @"h": @"9",
+                               @"m": @"05",
+                               @"r": @"-123456",
+                               @"cvar": @"{\"1\":[\"Platform\",\"iOS\"]}",
+                               @"custom_parameter": @"Menu/Settings",
+                               @"gt_ms": @(42),
+                               @"revenue": @(9.99)};
+  NSArray *parameterSetIDs = @[@(1), @(2)];
+  
+  NSData *data = [PiwikEventEncoder dataWithParameters:parameters parameterSetIDs:parameterSetIDs];
+  
+  NSArray *decodedParameterSetIDs;
+  NSDictionary *decodedParameters = [PiwikEventEncoder parametersWithData:data parameterSetIDs:&decodedParameterSetIDs];
+  
+  XCTAssertEqualObjects(decodedParameters, parameters);
+  XCTAssertEqualObjects(decodedParameterSetIDs, parameterSetIDs);
+  XCTAssertTrue(data.length < [NSKeyedArchiver archivedDataWithRootObject:parameters].length);
+  
+}
+
+
+- (void)testParameterSetIdentifierIsStable {
+  
+  NSDictionary *parameters = @{@"idsite": @"1", @"_id": @"0123456789abcdef", @"res": @"320x568"};
+  NSDictionary *sameParameters = [NSDictionary dictionaryWithDictionary:parameters];
+  
+  NSNumber *identifier = [PiwikEventEncoder identifierForParameterSet:[PiwikEventEncoder dataWithParameterSet:parameters]];
+  XCTAssertEqualObjects(identifier, [PiwikEventEncoder identifierForParameterSet:[PiwikEventEncoder dataWithParameterSet:sameParameters]]);
+  
+  NSDictionary *decodedParameters = [PiwikEventEncoder parametersWithData:[PiwikEventEncoder dataWithParameterSet:parameters] parameterSetIDs:NULL];
+  XCTAssertEqualObjects(decodedParameters, parameters);
+  
+}
+
+
+// The event identifier is sent with every event, the key must be written as a key id and not inline
+- (void)testEventIdentifierKeyIsEncodedById {
+  
+  NSData *data = [PiwikEventEncoder dataWithParameters:@{@"pk_eid": @"0123456789abcdef"} parameterSetIDs:@[]];
+  
+  // Version, parameter set count, parameter count, key id, value type, length and the 16 characters
+  XCTAssertEqual(data.length, 22);
+  XCTAssertEqualObjects([PiwikEventEncoder parametersWithData:data parameterSetIDs:NULL], @{@"pk_eid": @"0123456789abcdef"});
+  
+}
+
+
+- (void)testMalformedData {
+  
+  NSData *data = [PiwikEventEncoder dataWithParameters:@{@"action_name": @"Menu"} parameterSetIDs:@[]];
+  NSData *truncatedData = [data subdataWithRange:NSMakeRange(0, data.length - 2)];
+  
+  XCTAssertNil([PiwikEventEncoder parametersWithData:truncatedData parameterSetIDs:NULL]);
+  XCTAssertNil([PiwikEventEncoder parametersWithData:[NSData data] parameterSetIDs:NULL]);
+  
+}
+
+
+@end
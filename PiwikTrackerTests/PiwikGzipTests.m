@@ -0,0 +1,40 @@
+//
+//  PiwikGzipTests.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "PiwikGzip.h"
+
+@interface PiwikGzipTests : XCTestCase
+@end
+
+@implementation PiwikGzipTests
+
+
+- (void)testBulkRequestCompress {
+  
+  NSMutableArray *queryStrings = [NSMutableArray array];
+  for (NSUInteger i = 0; i < 20; i++) {
+    [queryStrings addObject:[NSString stringWithFormat:@"?idsite=1&rec=1&url=http://example.com/screen/%lu&action_name=screen/%lu&_id=0123456789abcdef", (unsigned long)i, (unsigned long)i]];
+  }
+  NSData *body = [NSJSONSerialization dataWithJSONObject:@{@"requests": queryStrings} options:0 error:nil];
+  
+  NSData *compressedBody = [PiwikGzip gzipData:body];
+  
+  XCTAssertNotNil(compressedBody);
+  XCTAssertTrue(compressedBody.length < body.length / 3, @"Bulk request should compress well");
+  
+  // gzip magic number
+  const uint8_t *bytes = compressedBody.bytes;
+  XCTAssertEqual(bytes[0], 0x1f);
+  XCTAssertEqual(bytes[1], 0x8b);
+  
+}
+
+
+@end
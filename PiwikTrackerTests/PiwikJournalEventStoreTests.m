@@ -0,0 +1,210 @@
+//
+//  PiwikJournalEventStoreTests.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "PiwikJournalEventStore.h"
+#import "PiwikEventEncoder.h"
+
+@interface PiwikJournalEventStoreTests : XCTestCase
+@property (nonatomic, strong) NSURL *directoryURL;
+@end
+
+@implementation PiwikJournalEventStoreTests
+
+
+- (void)setUp {
+  [super setUp];
+  self.directoryURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+}
+
+
+- (void)tearDown {
+  [[NSFileManager defaultManager] removeItemAtURL:self.directoryURL error:nil];
+  [super tearDown];
+}
+
+
+- (PiwikJournalEventStore*)createStore {
+  PiwikJournalEventStore *store = [[PiwikJournalEventStore alloc] initWithDirectoryURL:self.directoryURL];
+  store.maximumNumberOfEvents = 500;
+  // Small segments to exercise segment rollover and recycling
+  store.segmentSize = 4096;
+  return store;
+}
+
+
+- (void)storeNumberOfEvents:(NSUInteger)numberOfEvents inStore:(PiwikJournalEventStore*)store {
+  [self storeNumberOfEvents:numberOfEvents priority:PiwikEventPriorityNormal inStore:store];
+}
+
+
+- (void)storeNumberOfEvents:(NSUInteger)numberOfEvents priority:(PiwikEventPriority)priority inStore:(PiwikJournalEventStore*)store {
+  
+  NSData *parameterSet = [PiwikEventEncoder dataWithParameterSet:@{@"idsite": @"1"}];
+  NSNumber *parameterSetID = [PiwikEventEncoder identifierForParameterSet:parameterSet];
+  
+  NSMutableArray *events = [NSMutableArray arrayWithCapacity:numberOfEvents];
+  for (NSUInteger i = 0; i < numberOfEvents; i++) {
+    NSDictionary *parameters = @{@"action_name": [NSString stringWithFormat:@"Screen %lu", (unsigned long)i]};
+    [events addObject:[PiwikEventEncoder dataWithParameters:parameters parameterSetIDs:@[parameterSetID]]];
+  }
+  
+  [store storeEvents:events priority:priority parameterSets:@{parameterSetID: parameterSet} completionBlock:nil];
+  [store waitUntilAllOperationsAreFinished];
+}
+
+
+- (NSArray*)eventsFromStore:(PiwikJournalEventStore*)store numberOfEvents:(NSUInteger)numberOfEvents eventIDs:(NSArray**)eventIDs {
+  
+  __block NSArray *readEventIDs;
+  __block NSArray *readEvents;
+  [store eventsFromStore:numberOfEvents excludingEventIDs:nil completionBlock:^(NSArray *IDs, NSArray *events, BOOL hasMore) {
+    readEventIDs = IDs;
+    readEvents = events;
+  }];
+  [store waitUntilAllOperationsAreFinished];
+  
+  if (eventIDs) {
+    *eventIDs = readEventIDs;
+  }
+  return readEvents;
+}
+
+
+- (void)testEventsAreReadInOrderAndSurviveReopen {
+  
+  PiwikJournalEventStore *store = [self createStore];
+  [self storeNumberOfEvents:200 inStore:store];
+  
+  NSArray *eventIDs;
+  NSArray *events = [self eventsFromStore:store numberOfEvents:150 eventIDs:&eventIDs];
+  XCTAssertEqual(events.count, 150);
+  XCTAssertEqualObjects(events[0][@"action_name"], @"Screen 0");
+  XCTAssertEqualObjects(events[0][@"idsite"], @"1");
+  
+  [store deleteEventsWithIDs:eventIDs];
+  [store waitUntilAllOperationsAreFinished];
+  
+  // A new store reads the persisted cursor
+  store = [self createStore];
+  events = [self eventsFromStore:store numberOfEvents:100 eventIDs:&eventIDs];
+  XCTAssertEqual(events.count, 50);
+  XCTAssertEqualObjects(events[0][@"action_name"], @"Screen 150");
+  XCTAssertEqualObjects(events[0][@"idsite"], @"1");
+  
+  [store deleteEventsWithIDs:eventIDs];
+  [store waitUntilAllOperationsAreFinished];
+  
+  XCTAssertNil([self eventsFromStore:store numberOfEvents:100 eventIDs:NULL]);
+  
+}
+
+
+- (void)testMaximumNumberOfEvents {
+  
+  PiwikJournalEventStore *store = [self createStore];
+  store.maximumNumberOfEvents = 10;
+  [self storeNumberOfEvents:20 inStore:store];
+  
+  XCTAssertEqual([self eventsFromStore:store numberOfEvents:100 eventIDs:NULL].count, 10);
+  
+  [store deleteAllStoredEvents];
+  [store waitUntilAllOperationsAreFinished];
+  
+  XCTAssertNil([self eventsFromStore:store numberOfEvents:100 eventIDs:NULL]);
+  
+}
+
+
+- (void)testDeleteEventsStoredBeforeDate {
+  
+  PiwikJournalEventStore *store = [self createStore];
+  [self storeNumberOfEvents:200 inStore:store];
+  
+  __block NSUInteger numberOfDeletedEvents = NSNotFound;
+  [store deleteEventsStoredBeforeDate:[NSDate dateWithTimeIntervalSinceNow:-60] completionBlock:^(NSUInteger numberOfEvents) {
+    numberOfDeletedEvents = numberOfEvents;
+  }];
+  [store waitUntilAllOperationsAreFinished];
+  XCTAssertEqual(numberOfDeletedEvents, 0);
+  
+  // Whole segments are deleted, the segment currently written to is kept
+  [store deleteEventsStoredBeforeDate:[NSDate dateWithTimeIntervalSinceNow:60] completionBlock:^(NSUInteger numberOfEvents) {
+    numberOfDeletedEvents = numberOfEvents;
+  }];
+  [store waitUntilAllOperationsAreFinished];
+  XCTAssertGreaterThan(numberOfDeletedEvents, 0);
+  XCTAssertEqual(numberOfDeletedEvents + store.numberOfEvents, 200);
+  
+  NSArray *events = [self eventsFromStore:store numberOfEvents:200 eventIDs:NULL];
+  XCTAssertEqual(events.count, store.numberOfEvents);
+  XCTAssertEqualObjects([events.lastObject objectForKey:@"action_name"], @"Screen 199");
+  
+}
+
+
+- (void)testDropOldestOverflowPolicy {
+  
+  PiwikJournalEventStore *store = [self createStore];
+  store.maximumNumberOfEvents = 10;
+  store.overflowPolicy = PiwikEventOverflowPolicyDropOldest;
+  [self storeNumberOfEvents:8 inStore:store];
+  [self storeNumberOfEvents:5 inStore:store];
+  
+  XCTAssertEqual(store.numberOfEvents, 10);
+  XCTAssertEqual(store.numberOfDroppedEvents, 3);
+  
+  // The three oldest events of the first batch were dropped
+  NSArray *events = [self eventsFromStore:store numberOfEvents:100 eventIDs:NULL];
+  XCTAssertEqual(events.count, 10);
+  XCTAssertEqualObjects(events[0][@"action_name"], @"Screen 3");
+  XCTAssertEqualObjects(events[9][@"action_name"], @"Screen 4");
+  
+}
+
+
+- (void)testPriorityLanes {
+  
+  PiwikJournalEventStore *store = [self createStore];
+  store.maximumNumberOfEvents = 10;
+  [store setMaximumNumberOfEvents:3 forPriority:PiwikEventPriorityHigh];
+  [self storeNumberOfEvents:6 inStore:store];
+  [self storeNumberOfEvents:2 priority:PiwikEventPriorityHigh inStore:store];
+  [self storeNumberOfEvents:2 priority:PiwikEventPriorityHigh inStore:store];
+  
+  // The lane quota is reached before the shared limit
+  XCTAssertEqual([store numberOfEventsWithPriority:PiwikEventPriorityHigh], 3);
+  XCTAssertEqual(store.numberOfEvents, 9);
+  XCTAssertEqual(store.numberOfDroppedEvents, 1);
+  
+  __block NSArray *highPriorityEvents;
+  [store eventsFromStore:100 minimumPriority:PiwikEventPriorityHigh excludingEventIDs:nil completionBlock:^(NSArray *eventIDs, NSArray *events, BOOL hasMore) {
+    highPriorityEvents = events;
+  }];
+  [store waitUntilAllOperationsAreFinished];
+  XCTAssertEqual(highPriorityEvents.count, 3);
+  XCTAssertEqualObjects(highPriorityEvents[0][@"action_name"], @"Screen 0");
+  XCTAssertEqualObjects(highPriorityEvents[2][@"action_name"], @"Screen 1", @"The newest event of the batch is kept");
+  
+  // Make room for high priority events by dropping the oldest normal events
+  store.overflowPolicy = PiwikEventOverflowPolicyDropLowestPriority;
+  [store setMaximumNumberOfEvents:5 forPriority:PiwikEventPriorityHigh];
+  [self storeNumberOfEvents:2 priority:PiwikEventPriorityHigh inStore:store];
+  XCTAssertEqual([store numberOfEventsWithPriority:PiwikEventPriorityNormal], 5);
+  XCTAssertEqual([store numberOfEventsWithPriority:PiwikEventPriorityHigh], 5);
+  
+  // The priority is kept in the journal
+  store = [self createStore];
+  XCTAssertEqual([self eventsFromStore:store numberOfEvents:100 eventIDs:NULL].count, 10);
+  XCTAssertEqual([store numberOfEventsWithPriority:PiwikEventPriorityHigh], 5);
+  
+}
+
+
+@end
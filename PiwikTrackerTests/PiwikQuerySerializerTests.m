@@ -0,0 +1,185 @@
+//
+//  PiwikQuerySerializerTests.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "PiwikQuerySerializer.h"
+#import "PiwikEventParameters.h"
+
+@interface PiwikQuerySerializerTests : XCTestCase
+@end
+
+@implementation PiwikQuerySerializerTests
+
+
+// Query string created by joining formatted parameter pairs, as done before the serializer was introduced
+- (NSString*)joinedQueryStringWithParameters:(NSDictionary*)parameters {
+
+  NSMutableArray *parameterPairs = [NSMutableArray arrayWithCapacity:parameters.count];
+  [parameters enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+    [parameterPairs addObject:[NSString stringWithFormat:@"%@=%@", key, obj]];
+  }];
+
+  return [parameterPairs componentsJoinedByString:@"&"];
+}
+
+
+- (NSDictionary*)parametersFromQueryString:(NSString*)queryString {
+
+  NSMutableDictionary *parameters = [NSMutableDictionary dictionary];
+  for (NSString *parameterPair in [queryString componentsSeparatedByString:@"&"]) {
+    NSArray *components = [parameterPair componentsSeparatedByString:@"="];
+    XCTAssertEqual(components.count, 2, @"Key and value must not contain unescaped & or =");
+    parameters[[components[0] stringByRemovingPercentEncoding]] = [components[1] stringByRemovingPercentEncoding];
+  }
+
+  return parameters;
+}
+
+
+- (void)testPlainParametersAreEqualToJoinedQueryString {
+
+  NSDictionary *parameters = @{@"idsite" : @"1",
+                               @"rec" : @"1",
+                               @"send_image" : @(0),
+                               @"url" : @"http://example.com/screen/start",
+                               @"_id" : @"0123456789abcdef",
+                               @"res" : @"750x1334"};
+
+  PiwikQuerySerializer *serializer = [[PiwikQuerySerializer alloc] init];
+
+  XCTAssertEqualObjects([serializer queryStringWithParameters:parameters], [self joinedQueryStringWithParameters:parameters]);
+
+}
+
+
+- (void)testEscapedValues {
+
+  NSDictionary *parameters = @{@"action_name" : @"screen/search & filter",
+                               @"e_n" : @"a=b+c#d",
+                               @"_cvar" : @"{\"1\":[\"Platform\",\"iPhone\"]}",
+                               @"search" : @"kött på böreks"};
+
+  PiwikQuerySerializer *serializer = [[PiwikQuerySerializer alloc] init];
+  NSString *queryString = [serializer queryStringWithParameters:parameters];
+
+  XCTAssertTrue([queryString canBeConvertedToEncoding:NSASCIIStringEncoding]);
+  XCTAssertEqualObjects([self parametersFromQueryString:queryString], parameters);
+
+}
+
+
+- (void)testCachedParameters {
+
+  NSDictionary *sessionParameters = @{@"_idvc" : @"3", @"_cvar" : @"{\"1\":[\"App version\",\"1.0\"]}"};
+
+  PiwikQuerySerializer *serializer = [[PiwikQuerySerializer alloc] init];
+  NSMutableDictionary *parameters = [NSMutableDictionary dictionaryWithDictionary:sessionParameters];
+  parameters[@"action_name"] = @"screen";
+  NSString *uncachedQueryString = [serializer queryStringWithParameters:parameters];
+
+  [serializer cacheParameters:sessionParameters];
+  XCTAssertEqualObjects([serializer queryStringWithParameters:parameters], uncachedQueryString);
+
+  // A changed value must not use the cached pair
+  parameters[@"_idvc"] = @"4";
+  XCTAssertEqualObjects([self parametersFromQueryString:[serializer queryStringWithParameters:parameters]], parameters);
+
+}
+
+
+- (void)testEventParametersAreMergedWithParameterSets {
+
+  NSDictionary *staticParameters = @{@"idsite" : @"1", @"rec" : @"1", @"_id" : @"0123456789abcdef"};
+  NSDictionary *sessionParameters = @{@"_idvc" : @"3", @"uid" : @"user@example.com", @"rec" : @"0"};
+  NSDictionary *parameters = @{@"action_name" : @"screen/start", @"r" : @"4711"};
+
+  PiwikEventParameters *eventParameters = [[PiwikEventParameters alloc] initWithParameters:parameters
+                                                                              parameterSets:@[staticParameters, sessionParameters]
+                                                                            parameterSetIDs:@[@1, @2]];
+
+  NSMutableDictionary *mergedParameters = [NSMutableDictionary dictionaryWithDictionary:parameters];
+  [mergedParameters addEntriesFromDictionary:staticParameters];
+  [mergedParameters addEntriesFromDictionary:sessionParameters];
+
+  XCTAssertEqualObjects(eventParameters, mergedParameters);
+  XCTAssertEqualObjects(eventParameters[@"rec"], @"0", @"Later parameter sets replace values of earlier sets");
+
+  PiwikQuerySerializer *serializer = [[PiwikQuerySerializer alloc] init];
+  for (NSUInteger i = 0; i < 2; i++) {
+    // Second time using the cached parameter sets
+    XCTAssertEqualObjects([self parametersFromQueryString:[serializer queryStringWithParameters:eventParameters]], mergedParameters);
+  }
+
+}
+
+
+- (void)testBulkRequestBodyIsEqualToJSONSerialization {
+
+  PiwikQuerySerializer *serializer = [[PiwikQuerySerializer alloc] init];
+
+  NSMutableArray *queryStrings = [NSMutableArray array];
+  for (NSUInteger i = 0; i < 5; i++) {
+    NSDictionary *parameters = @{@"idsite" : @"1", @"action_name" : [NSString stringWithFormat:@"screen/%lu & more", (unsigned long)i]};
+    [queryStrings addObject:[@"?" stringByAppendingString:[serializer queryStringWithParameters:parameters]]];
+  }
+  [queryStrings addObject:@"?quote=\"back\\slash\"\n"];
+
+  NSData *body = [serializer bulkRequestBodyWithQueryStrings:queryStrings];
+
+  NSError *error;
+  id JSONObject = [NSJSONSerialization JSONObjectWithData:body options:0 error:&error];
+  XCTAssertNil(error);
+  XCTAssertEqualObjects(JSONObject, @{@"requests" : queryStrings});
+
+}
+
+
+- (void)testBulkRequestBodyWithEventsIsEqualToBodyWithQueryStrings {
+
+  PiwikQuerySerializer *serializer = [[PiwikQuerySerializer alloc] init];
+
+  NSDictionary *staticParameters = @{@"idsite" : @"1", @"rec" : @"1", @"_id" : @"0123456789abcdef"};
+  NSMutableArray *events = [NSMutableArray array];
+  for (NSUInteger i = 0; i < 5; i++) {
+    NSDictionary *parameters = @{@"action_name" : [NSString stringWithFormat:@"screen/%lu & \"more\"", (unsigned long)i]};
+    [events addObject:[[PiwikEventParameters alloc] initWithParameters:parameters parameterSets:@[staticParameters] parameterSetIDs:@[@1]]];
+  }
+  [events addObject:@{@"idsite" : @"2", @"action_name" : @"screen/other"}];
+
+  NSMutableArray *queryStrings = [NSMutableArray array];
+  for (NSDictionary *event in [events reverseObjectEnumerator]) {
+    [queryStrings addObject:[@"?" stringByAppendingString:[serializer queryStringWithParameters:event]]];
+  }
+
+  // Twice, the second body is written into a buffer sized from the first
+  for (NSUInteger i = 0; i < 2; i++) {
+    NSData *body = [serializer bulkRequestBodyWithEvents:events options:NSEnumerationReverse];
+    XCTAssertEqualObjects(body, [serializer bulkRequestBodyWithQueryStrings:queryStrings]);
+  }
+
+}
+
+
+- (void)testBulkRequestBodyWithBatchIdentifier {
+
+  PiwikQuerySerializer *serializer = [[PiwikQuerySerializer alloc] init];
+
+  NSArray *events = @[@{@"idsite" : @"1", @"pk_eid" : @"a1"}, @{@"idsite" : @"1", @"pk_eid" : @"b2"}];
+  NSData *body = [serializer bulkRequestBodyWithEvents:events options:0 batchIdentifier:@"0123456789abcdef"];
+
+  NSError *error;
+  id JSONObject = [NSJSONSerialization JSONObjectWithData:body options:0 error:&error];
+  XCTAssertNil(error);
+  XCTAssertEqualObjects(JSONObject[@"batch_id"], @"0123456789abcdef");
+  XCTAssertEqual([JSONObject[@"requests"] count], 2);
+
+}
+
+
+@end
@@ -0,0 +1,127 @@
+//
+//  PiwikSiteTrackerTests.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "PiwikTracker.h"
+#import "PiwikJournalEventStore.h"
+
+
+@interface PiwikTracker (SiteTrackerTests)
+- (id)initWithSiteID:(NSString*)siteID dispatcher:(id<PiwikDispatcher>)dispatcher;
+- (BOOL)queueEvent:(NSDictionary*)parameters;
+@end
+
+
+// Record the request parameters and report success
+@interface PiwikRecordingDispatcher : NSObject <PiwikDispatcher>
+@property (nonatomic, strong) NSMutableArray *requests;
+@property (nonatomic, copy) void (^requestBlock)(void);
+@end
+
+@implementation PiwikRecordingDispatcher
+
+- (instancetype)init {
+  if (self = [super init]) {
+    _requests = [NSMutableArray array];
+  }
+  return self;
+}
+
+- (void)sendSingleEventWithParameters:(NSDictionary*)parameters success:(void (^)())successBlock failure:(void (^)(BOOL shouldContinue))failureBlock {
+  [self.requests addObject:parameters];
+  successBlock();
+  if (self.requestBlock) self.requestBlock();
+}
+
+- (void)sendBulkEventWithParameters:(NSDictionary*)parameters success:(void (^)())successBlock failure:(void (^)(BOOL shouldContinue))failureBlock {
+  [self.requests addObject:parameters];
+  successBlock();
+  if (self.requestBlock) self.requestBlock();
+}
+
+@end
+
+
+@interface PiwikSiteTrackerTests : XCTestCase
+@property (nonatomic, strong) NSURL *directoryURL;
+@end
+
+@implementation PiwikSiteTrackerTests
+
+
+- (void)setUp {
+  [super setUp];
+  self.directoryURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+}
+
+
+- (void)tearDown {
+  [[NSFileManager defaultManager] removeItemAtURL:self.directoryURL error:nil];
+  [super tearDown];
+}
+
+
+- (void)testSiteTrackersAreKeyedBySiteID {
+  
+  PiwikTracker *tracker = [[PiwikTracker alloc] initWithSiteID:@"1" dispatcher:[[PiwikRecordingDispatcher alloc] init]];
+  tracker.dispatchInterval = -1;
+  
+  PiwikTracker *siteTracker = [tracker trackerForSiteID:@"2"];
+  
+  XCTAssertEqualObjects(siteTracker.siteID, @"2");
+  XCTAssertEqual([tracker trackerForSiteID:@"1"], tracker);
+  XCTAssertEqual([tracker trackerForSiteID:@"2"], siteTracker);
+  XCTAssertEqual([siteTracker trackerForSiteID:@"2"], siteTracker);
+  XCTAssertEqual(siteTracker.dispatcher, tracker.dispatcher);
+  
+}
+
+
+- (void)testEventsOfAllSitesShareOneStoreAndOneBulkRequest {
+  
+  PiwikRecordingDispatcher *dispatcher = [[PiwikRecordingDispatcher alloc] init];
+  PiwikTracker *tracker = [[PiwikTracker alloc] initWithSiteID:@"1" dispatcher:dispatcher];
+  tracker.dispatchInterval = -1;
+  PiwikTracker *siteTracker = [tracker trackerForSiteID:@"2"];
+  
+  // The store is shared with site trackers created before it was set
+  PiwikJournalEventStore *store = [[PiwikJournalEventStore alloc] initWithDirectoryURL:self.directoryURL];
+  tracker.eventStore = store;
+  XCTAssertEqual(siteTracker.eventStore, store);
+  
+  // A new visit is sent on its own
+  tracker.sessionStart = NO;
+  siteTracker.sessionStart = NO;
+  
+  [tracker queueEvent:@{@"action_name" : @"screen/home", @"url" : @"http://example.com/screen/home"}];
+  [siteTracker queueEvent:@{@"action_name" : @"screen/home", @"url" : @"http://example.com/screen/home"}];
+  [store waitUntilAllOperationsAreFinished];
+  XCTAssertEqual(store.numberOfEvents, 2);
+  
+  XCTestExpectation *expectation = [self expectationWithDescription:@"Request sent"];
+  dispatcher.requestBlock = ^{
+    [expectation fulfill];
+  };
+  
+  // A dispatch started by a site tracker sends the events of all sites
+  [siteTracker dispatch];
+  [self waitForExpectationsWithTimeout:5 handler:nil];
+  
+  XCTAssertEqual(dispatcher.requests.count, 1);
+  NSArray *queryStrings = dispatcher.requests.firstObject[@"requests"];
+  XCTAssertEqual(queryStrings.count, 2);
+  
+  NSString *body = [queryStrings componentsJoinedByString:@"\n"];
+  XCTAssertTrue([body rangeOfString:@"idsite=1"].location != NSNotFound);
+  XCTAssertTrue([body rangeOfString:@"idsite=2"].location != NSNotFound);
+  
+}
+
+
+@end
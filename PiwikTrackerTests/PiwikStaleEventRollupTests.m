@@ -0,0 +1,212 @@
+//
+//  PiwikStaleEventRollupTests.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "PiwikTracker.h"
+#import "PiwikJournalEventStore.h"
+
+
+@interface PiwikTracker (StaleEventRollupTests)
+- (id)initWithSiteID:(NSString*)siteID dispatcher:(id<PiwikDispatcher>)dispatcher;
+- (BOOL)queueEvent:(NSDictionary*)parameters;
+@end
+
+
+// Record the request parameters and report success, or a network failure
+@interface PiwikRollupRecordingDispatcher : NSObject <PiwikDispatcher>
+@property (nonatomic, strong) NSMutableArray *requests;
+@property (nonatomic) BOOL shouldFail;
+@property (nonatomic, copy) void (^requestBlock)(void);
+@end
+
+@implementation PiwikRollupRecordingDispatcher
+
+- (instancetype)init {
+  if (self = [super init]) {
+    _requests = [NSMutableArray array];
+  }
+  return self;
+}
+
+- (void)sendSingleEventWithParameters:(NSDictionary*)parameters success:(void (^)())successBlock failure:(void (^)(BOOL shouldContinue))failureBlock {
+  [self sendRequestWithParameters:parameters success:successBlock failure:failureBlock];
+}
+
+- (void)sendBulkEventWithParameters:(NSDictionary*)parameters success:(void (^)())successBlock failure:(void (^)(BOOL shouldContinue))failureBlock {
+  [self sendRequestWithParameters:parameters success:successBlock failure:failureBlock];
+}
+
+- (void)sendRequestWithParameters:(NSDictionary*)parameters success:(void (^)())successBlock failure:(void (^)(BOOL shouldContinue))failureBlock {
+  [self.requests addObject:parameters];
+  if (self.shouldFail) {
+    failureBlock(NO);
+  } else {
+    successBlock();
+  }
+  if (self.requestBlock) self.requestBlock();
+}
+
+@end
+
+
+@interface PiwikStaleEventRollupTests : XCTestCase
+@property (nonatomic, strong) NSURL *directoryURL;
+@property (nonatomic, strong) PiwikJournalEventStore *store;
+@property (nonatomic, strong) PiwikRollupRecordingDispatcher *dispatcher;
+@end
+
+@implementation PiwikStaleEventRollupTests
+
+
+- (void)setUp {
+  [super setUp];
+  self.directoryURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+  self.store = [[PiwikJournalEventStore alloc] initWithDirectoryURL:self.directoryURL];
+  self.dispatcher = [[PiwikRollupRecordingDispatcher alloc] init];
+}
+
+
+- (void)tearDown {
+  [[NSFileManager defaultManager] removeItemAtURL:self.directoryURL error:nil];
+  [super tearDown];
+}
+
+
+// Every stored event is stale, a new visit is sent on its own and never rolled up
+- (PiwikTracker*)trackerWithSiteID:(NSString*)siteID clientID:(NSString*)clientID {
+  PiwikTracker *tracker = [[PiwikTracker alloc] initWithSiteID:siteID dispatcher:self.dispatcher];
+  tracker.dispatchInterval = -1;
+  tracker.eventStore = self.store;
+  tracker.staleEventRollupAge = 0.001;
+  tracker.sessionStart = NO;
+  [tracker setValue:clientID forKey:@"clientID"];
+  return tracker;
+}
+
+
+- (void)queueView:(NSString*)name tracker:(PiwikTracker*)tracker {
+  NSString *actionName = [@"screen/" stringByAppendingString:name];
+  [tracker queueEvent:@{@"action_name" : actionName, @"url" : [@"http://example.com/" stringByAppendingString:actionName]}];
+}
+
+
+// The query strings of the requests sent by the dispatch
+- (NSArray*)dispatchTracker:(PiwikTracker*)tracker {
+
+  NSUInteger numberOfRequests = self.dispatcher.requests.count;
+
+  XCTestExpectation *expectation = [self expectationWithDescription:@"Request sent"];
+  self.dispatcher.requestBlock = ^{
+    [expectation fulfill];
+  };
+  [tracker dispatch];
+  [self waitForExpectationsWithTimeout:5 handler:nil];
+  self.dispatcher.requestBlock = nil;
+
+  // The response is handled and the accepted events deleted on the tracker queue
+  XCTAssertNotNil(tracker.statistics);
+  [self.store waitUntilAllOperationsAreFinished];
+
+  NSDictionary *request = self.dispatcher.requests[numberOfRequests];
+  if (request[@"requests"]) {
+    return request[@"requests"];
+  }
+
+  // A single event is sent as parameters
+  NSMutableArray *parameters = [NSMutableArray array];
+  [request enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL *stop) {
+    [parameters addObject:[NSString stringWithFormat:@"%@=%@", key, obj]];
+  }];
+  return @[[parameters componentsJoinedByString:@"&"]];
+}
+
+
+- (NSUInteger)numberOfQueryStrings:(NSArray*)queryStrings containing:(NSString*)string {
+  NSUInteger count = 0;
+  for (NSString *queryString in queryStrings) {
+    if ([queryString rangeOfString:string].location != NSNotFound) {
+      count++;
+    }
+  }
+  return count;
+}
+
+
+- (void)testStoredViewsAreRolledUp {
+
+  PiwikTracker *tracker = [self trackerWithSiteID:@"1" clientID:@"5bb8a7c2e4c1e1f5"];
+  [self queueView:@"home" tracker:tracker];
+  [self queueView:@"home" tracker:tracker];
+  [self queueView:@"settings" tracker:tracker];
+  [self queueView:@"home" tracker:tracker];
+  [self.store waitUntilAllOperationsAreFinished];
+  XCTAssertEqual(self.store.numberOfEvents, 4);
+
+  NSArray *queryStrings = [self dispatchTracker:tracker];
+
+  XCTAssertEqual(self.dispatcher.requests.count, 1);
+  XCTAssertEqual(queryStrings.count, 2);
+  XCTAssertEqual([self numberOfQueryStrings:queryStrings containing:@"rollup_count=3"], 1);
+  XCTAssertEqual([self numberOfQueryStrings:queryStrings containing:@"rollup_count"], 1);
+
+  XCTAssertEqual([tracker.statistics numberOfDroppedEventsWithReason:PiwikEventDropReasonCoalesced], 2);
+  XCTAssertEqual(self.store.numberOfEvents, 0);
+
+}
+
+
+- (void)testViewsOfDifferentSitesAndVisitorsAreNotRolledUp {
+
+  PiwikTracker *tracker = [self trackerWithSiteID:@"1" clientID:@"5bb8a7c2e4c1e1f5"];
+  PiwikTracker *siteTracker = [tracker trackerForSiteID:@"2"];
+  siteTracker.sessionStart = NO;
+  PiwikTracker *otherVisitorTracker = [self trackerWithSiteID:@"1" clientID:@"0c6a8b1e6f0e3d21"];
+
+  [self queueView:@"home" tracker:tracker];
+  [self queueView:@"home" tracker:siteTracker];
+  [self queueView:@"home" tracker:otherVisitorTracker];
+  [self.store waitUntilAllOperationsAreFinished];
+  XCTAssertEqual(self.store.numberOfEvents, 3);
+
+  NSArray *queryStrings = [self dispatchTracker:tracker];
+
+  XCTAssertEqual(queryStrings.count, 3);
+  XCTAssertEqual([self numberOfQueryStrings:queryStrings containing:@"rollup_count"], 0);
+  XCTAssertEqual([self numberOfQueryStrings:queryStrings containing:@"idsite=2"], 1);
+  XCTAssertEqual([self numberOfQueryStrings:queryStrings containing:@"0c6a8b1e6f0e3d21"], 1);
+  XCTAssertEqual([tracker.statistics numberOfDroppedEventsWithReason:PiwikEventDropReasonCoalesced], 0);
+
+}
+
+
+- (void)testRolledUpViewsSurviveFailedRequest {
+
+  PiwikTracker *tracker = [self trackerWithSiteID:@"1" clientID:@"5bb8a7c2e4c1e1f5"];
+  [self queueView:@"home" tracker:tracker];
+  [self queueView:@"home" tracker:tracker];
+  [self queueView:@"home" tracker:tracker];
+  [self.store waitUntilAllOperationsAreFinished];
+
+  // The merged events are kept until the event sent for them is accepted
+  self.dispatcher.shouldFail = YES;
+  NSArray *queryStrings = [self dispatchTracker:tracker];
+  XCTAssertEqual([self numberOfQueryStrings:queryStrings containing:@"rollup_count=3"], 1);
+  XCTAssertEqual(self.store.numberOfEvents, 3);
+  XCTAssertEqual([tracker.statistics numberOfDroppedEventsWithReason:PiwikEventDropReasonCoalesced], 0);
+
+  self.dispatcher.shouldFail = NO;
+  queryStrings = [self dispatchTracker:tracker];
+  XCTAssertEqual([self numberOfQueryStrings:queryStrings containing:@"rollup_count=3"], 1);
+  XCTAssertEqual(self.store.numberOfEvents, 0);
+  XCTAssertEqual([tracker.statistics numberOfDroppedEventsWithReason:PiwikEventDropReasonCoalesced], 2);
+
+}
+
+
+@end
@@ -0,0 +1,74 @@
+//
+//  PiwikTelemetryTests.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "PiwikTelemetry.h"
+
+@interface PiwikTelemetryTests : XCTestCase
+@end
+
+@implementation PiwikTelemetryTests
+
+
+- (void)testCountersAndHistograms {
+  
+  PiwikTelemetry *telemetry = [[PiwikTelemetry alloc] init];
+  
+  [telemetry recordTrackedEvent];
+  [telemetry recordTrackedEvent];
+  [telemetry recordQueuedEvent];
+  [telemetry recordDroppedEvents:1 reason:PiwikEventDropReasonSampling];
+  
+  // Only the difference since the last total is recorded
+  XCTAssertEqual([telemetry recordNumberOfEventsDroppedByStore:3], 3);
+  XCTAssertEqual([telemetry recordNumberOfEventsDroppedByStore:3], 0);
+  XCTAssertEqual([telemetry recordNumberOfEventsDroppedByStore:5], 2);
+  
+  [telemetry recordRequestDidSucceedWithNumberOfEvents:20 payloadSize:2000 latency:0.3];
+  [telemetry recordRequestDidFailWithErrorClass:PiwikDispatchErrorClassOffline];
+  
+  PiwikTrackerStatistics *statistics = [telemetry statisticsWithQueueDepth:7];
+  XCTAssertEqual(statistics.numberOfTrackedEvents, 2);
+  XCTAssertEqual(statistics.numberOfQueuedEvents, 1);
+  XCTAssertEqual(statistics.queueDepth, 7);
+  XCTAssertEqual([statistics numberOfDroppedEventsWithReason:PiwikEventDropReasonSampling], 1);
+  XCTAssertEqual([statistics numberOfDroppedEventsWithReason:PiwikEventDropReasonOverflow], 5);
+  XCTAssertEqual(statistics.numberOfSentEvents, 20);
+  XCTAssertEqual(statistics.numberOfSentBytes, 2000);
+  XCTAssertEqual([statistics numberOfFailedRequestsWithErrorClass:PiwikDispatchErrorClassOffline], 1);
+  
+  // 0.3 s in the 0.5 s bucket, 2000 bytes in the 4096 bytes bucket
+  XCTAssertEqualObjects(statistics.latencyHistogram[2], @1);
+  XCTAssertEqualObjects(statistics.payloadSizeHistogram[2], @1);
+  
+}
+
+
+- (void)testTimeInQueuePercentiles {
+  
+  PiwikTelemetry *telemetry = [[PiwikTelemetry alloc] init];
+  
+  // 2016-10-14 07:05:09 UTC
+  CFAbsoluteTime now = 498121509;
+  NSMutableArray *events = [NSMutableArray array];
+  for (NSUInteger i = 0; i < 9; i++) {
+    [events addObject:@{@"cdt" : @"2016-10-14 07:05:04"}];
+  }
+  [events addObject:@{@"cdt" : @"2016-10-14 06:05:09"}];
+  [events addObject:@{@"action_name" : @"No time"}];
+  [telemetry recordTimeInQueueOfEvents:events absoluteTime:now];
+  
+  PiwikTrackerStatistics *statistics = [telemetry statisticsWithQueueDepth:0];
+  XCTAssertEqual([statistics timeInQueuePercentile:0.5], 10);
+  XCTAssertEqual([statistics timeInQueuePercentile:0.95], 2 * 3600);
+  
+}
+
+
+@end
@@ -0,0 +1,114 @@
+//
+//  PiwikTimeContextTests.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import "PiwikTimeContext.h"
+
+static NSUInteger const PiwikNumberOfBenchmarkEvents = 10000;
+
+@interface PiwikTimeContextTests : XCTestCase
+@end
+
+@implementation PiwikTimeContextTests
+
+
+- (void)testMatchesCalendarAndDateFormatter {
+  
+  NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
+  formatter.dateFormat = @"yyyy-MM-dd HH:mm:ss";
+  formatter.timeZone = [NSTimeZone timeZoneWithName:@"UTC"];
+  formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+  
+  for (NSString *name in @[@"UTC", @"Europe/Stockholm", @"America/St_Johns", @"Asia/Kathmandu"]) {
+    
+    NSTimeZone *timeZone = [NSTimeZone timeZoneWithName:name];
+    PiwikTimeContext *context = [[PiwikTimeContext alloc] initWithTimeZone:timeZone];
+    
+    NSCalendar *calendar = [[NSCalendar alloc] initWithCalendarIdentifier:NSGregorianCalendar];
+    calendar.timeZone = timeZone;
+    
+    // Around leap days, year ends and daylight saving time transitions
+    CFAbsoluteTime time = -86400 * 365;
+    for (NSUInteger i = 0; i < 2000; i++) {
+      time += 86400 * 7 + 3607.5;
+      NSDate *date = [NSDate dateWithTimeIntervalSinceReferenceDate:time];
+      
+      XCTAssertEqualObjects([context UTCDateAndTimeWithAbsoluteTime:time], [formatter stringFromDate:date]);
+      
+      NSInteger hours, minutes, seconds;
+      [context getLocalHours:&hours minutes:&minutes seconds:&seconds absoluteTime:time];
+      NSDateComponents *components = [calendar components:NSHourCalendarUnit | NSMinuteCalendarUnit | NSSecondCalendarUnit fromDate:date];
+      XCTAssertEqual(hours, components.hour, @"%@ %@", name, date);
+      XCTAssertEqual(minutes, components.minute, @"%@ %@", name, date);
+      XCTAssertEqual(seconds, components.second, @"%@ %@", name, date);
+    }
+    
+  }
+  
+}
+
+
+- (void)testAddTimeParameters {
+  
+  PiwikTimeContext *context = [[PiwikTimeContext alloc] initWithTimeZone:[NSTimeZone timeZoneWithName:@"Europe/Stockholm"]];
+  
+  // 2016-10-14 07:05:09 UTC
+  NSMutableDictionary *parameters = [NSMutableDictionary dictionary];
+  [context addTimeParameters:parameters absoluteTime:498121509];
+  
+  XCTAssertEqualObjects(parameters[@"h"], @"9");
+  XCTAssertEqualObjects(parameters[@"m"], @"5");
+  XCTAssertEqualObjects(parameters[@"s"], @"9");
+  XCTAssertEqualObjects(parameters[@"cdt"], @"2016-10-14 07:05:09");
+  
+}
+
+
+#pragma mark Benchmarks
+
+
+// The per event cost of the calendar and date formatter used before
+- (void)testPerformanceCalendarAndDateFormatter {
+  
+  NSDateFormatter *formatter = [[NSDateFormatter alloc] init];
+  formatter.dateFormat = @"yyyy-MM-dd HH:mm:ss";
+  formatter.timeZone = [NSTimeZone timeZoneWithName:@"UTC"];
+  
+  [self measureBlock:^{
+    NSDate *now = [NSDate date];
+    for (NSUInteger i = 0; i < PiwikNumberOfBenchmarkEvents; i++) {
+      NSMutableDictionary *parameters = [NSMutableDictionary dictionary];
+      NSDate *date = [now dateByAddingTimeInterval:i];
+      NSDateComponents *components = [[NSCalendar currentCalendar] components:NSHourCalendarUnit | NSMinuteCalendarUnit | NSSecondCalendarUnit fromDate:date];
+      parameters[@"h"] = [NSString stringWithFormat:@"%ld", (long)components.hour];
+      parameters[@"m"] = [NSString stringWithFormat:@"%ld", (long)components.minute];
+      parameters[@"s"] = [NSString stringWithFormat:@"%ld", (long)components.second];
+      parameters[@"cdt"] = [formatter stringFromDate:date];
+    }
+  }];
+  
+}
+
+
+- (void)testPerformanceTimeContext {
+  
+  PiwikTimeContext *context = [[PiwikTimeContext alloc] init];
+  
+  [self measureBlock:^{
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    for (NSUInteger i = 0; i < PiwikNumberOfBenchmarkEvents; i++) {
+      NSMutableDictionary *parameters = [NSMutableDictionary dictionary];
+      [context addTimeParameters:parameters absoluteTime:now + i];
+    }
+  }];
+  
+}
+
+
+@end
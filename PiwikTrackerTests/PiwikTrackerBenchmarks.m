@@ -0,0 +1,506 @@
+//
+//  PiwikTrackerBenchmarks.m
+//  PiwikTracker
+//
+//  Created by Mattias Levin on 14/10/16.
+//  Copyright (c) 2016 Mattias Levin. All rights reserved.
+//
+
+#import <UIKit/UIKit.h>
+#import <XCTest/XCTest.h>
+#import <stdatomic.h>
+#import "PiwikTracker.h"
+#import "PiwikTransactionItem.h"
+#import "PiwikEvent.h"
+#import "PiwikJournalEventStore.h"
+#import "PiwikEventEncoder.h"
+#import "PiwikQuerySerializer.h"
+
+
+static NSUInteger const PiwikBenchmarkNumberOfEvents = 1000;
+
+
+// The malloc stack logging hook, exported by libmalloc and called for every allocation and free
+typedef void (PiwikMallocLogger)(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t numberOfFramesToSkip);
+extern PiwikMallocLogger *malloc_logger;
+
+// MALLOC_LOG_TYPE_ALLOCATE, also set for reallocations
+static uint32_t const PiwikMallocLogTypeAllocate = 2;
+
+static PiwikMallocLogger *PiwikPreviousMallocLogger;
+static atomic_uint_fast64_t PiwikNumberOfAllocations;
+
+
+static void PiwikCountAllocation(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t numberOfFramesToSkip) {
+
+  if (type & PiwikMallocLogTypeAllocate) {
+    atomic_fetch_add_explicit(&PiwikNumberOfAllocations, 1, memory_order_relaxed);
+  }
+
+  // Keep malloc stack logging working if it is enabled
+  if (PiwikPreviousMallocLogger) {
+    PiwikPreviousMallocLogger(type, arg1, arg2, arg3, result, numberOfFramesToSkip + 1);
+  }
+
+}
+
+
+// Every allocation made while the block runs, on any thread, including objects freed before it returns
+static uint64_t PiwikNumberOfAllocationsDuringBlock(void (^block)(void)) {
+
+  PiwikPreviousMallocLogger = malloc_logger;
+  uint64_t numberOfAllocationsBefore = atomic_load(&PiwikNumberOfAllocations);
+  malloc_logger = PiwikCountAllocation;
+
+  block();
+
+  malloc_logger = PiwikPreviousMallocLogger;
+  return atomic_load(&PiwikNumberOfAllocations) - numberOfAllocationsBefore;
+}
+
+
+// Private tracker methods exercised by the benchmarks
+@interface PiwikTracker (Benchmarks)
+- (id)initWithSiteID:(NSString*)siteID dispatcher:(id<PiwikDispatcher>)dispatcher;
+- (BOOL)queueEvent:(NSDictionary*)parameters;
+- (NSDictionary*)requestParametersForEvents:(NSArray*)events;
+- (NSString*)JSONEncodeTransactionItems:(NSArray*)items;
++ (NSString*)JSONEncodeCustomVariables:(NSDictionary*)variables;
+@end
+
+
+// Never send anything, only measure the size of the request bodies
+@interface PiwikBenchmarkDispatcher : NSObject <PiwikDispatcher>
+@property (nonatomic, strong) PiwikQuerySerializer *serializer;
+@property (nonatomic) NSUInteger numberOfBytes;
+@end
+
+@implementation PiwikBenchmarkDispatcher
+
+- (instancetype)init {
+  self = [super init];
+  if (self) {
+    _serializer = [[PiwikQuerySerializer alloc] init];
+  }
+  return self;
+}
+
+- (void)sendSingleEventWithParameters:(NSDictionary*)parameters success:(void (^)())successBlock failure:(void (^)(BOOL shouldContinue))failureBlock {
+  self.numberOfBytes += [self.serializer queryStringWithParameters:parameters].length;
+  successBlock();
+}
+
+- (void)sendBulkEventWithParameters:(NSDictionary*)parameters success:(void (^)())successBlock failure:(void (^)(BOOL shouldContinue))failureBlock {
+  self.numberOfBytes += [self.serializer bulkRequestBodyWithQueryStrings:parameters[@"requests"]].length;
+  successBlock();
+}
+
+@end
+
+
+// Keep the encoded events in memory, measure the enrichment without any I/O
+@interface PiwikBenchmarkEventStore : NSObject <PiwikEventStore>
+@property (nonatomic) NSUInteger numberOfStoredEvents;
+@property (nonatomic) NSUInteger numberOfBytes;
+@end
+
+@implementation PiwikBenchmarkEventStore
+
+@synthesize maximumNumberOfEvents = _maximumNumberOfEvents;
+
+- (void)storeEvents:(NSArray*)events parameterSets:(NSDictionary*)parameterSets completionBlock:(void (^)(void))completionBlock {
+  @synchronized(self) {
+    for (NSData *event in events) {
+      self.numberOfBytes += event.length;
+    }
+    self.numberOfStoredEvents += events.count;
+  }
+  if (completionBlock) {
+    completionBlock();
+  }
+}
+
+- (void)eventsFromStore:(NSUInteger)numberOfEvents excludingEventIDs:(NSSet*)excludedEventIDs completionBlock:(void (^)(NSArray *eventIDs, NSArray *events, BOOL hasMore))completionBlock {
+  completionBlock(nil, nil, NO);
+}
+
+- (void)deleteEventsWithIDs:(NSArray*)eventIDs {
+}
+
+- (void)deleteAllStoredEvents {
+}
+
+- (void)waitUntilAllOperationsAreFinished {
+}
+
+@end
+
+
+/**
+ Benchmarks of the code run for every tracked and dispatched event.
+
+ Each benchmark report events per second, bytes per event and allocations per event and compare them to the baselines in PiwikBenchmarkBaselines.plist. Throughput depends on the device and is only reported, sizes and allocations fail the benchmark if they regress beyond the tolerance of the baseline. Metrics without a baseline are only logged, record them from a run on the reference device.
+ */
+@interface PiwikTrackerBenchmarks : XCTestCase
+@property (nonatomic, strong) NSURL *directoryURL;
+@property (nonatomic, strong) NSDictionary *baselines;
+@end
+
+@implementation PiwikTrackerBenchmarks
+
+
+- (void)setUp {
+  [super setUp];
+  self.directoryURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+
+  NSString *path = [[NSBundle bundleForClass:[self class]] pathForResource:@"PiwikBenchmarkBaselines" ofType:@"plist"];
+  self.baselines = path ? [NSDictionary dictionaryWithContentsOfFile:path] : @{};
+}
+
+
+- (void)tearDown {
+  [[NSFileManager defaultManager] removeItemAtURL:self.directoryURL error:nil];
+  [super tearDown];
+}
+
+
+#pragma mark Benchmarks
+
+
+- (void)testQueueEventEnrichment {
+
+  PiwikBenchmarkEventStore *store = [[PiwikBenchmarkEventStore alloc] init];
+  PiwikTracker *tracker = [self createTrackerWithEventStore:store];
+
+  __block NSUInteger numberOfEvents = 0;
+  [self measureMetric:@"queueEvent" numberOfEvents:PiwikBenchmarkNumberOfEvents block:^{
+    for (NSUInteger i = 0; i < PiwikBenchmarkNumberOfEvents; i++) {
+      [tracker queueEvent:@{@"action_name" : @"screen/benchmark", @"url" : @"http://example.com/screen/benchmark"}];
+    }
+    numberOfEvents += PiwikBenchmarkNumberOfEvents;
+  }];
+
+  // Processed synchronously by default
+  XCTAssertEqual(store.numberOfStoredEvents, numberOfEvents);
+  [self reportBytes:store.numberOfBytes numberOfEvents:numberOfEvents metric:@"queueEvent"];
+
+}
+
+
+- (void)testSendTypedEvent {
+
+  PiwikBenchmarkEventStore *store = [[PiwikBenchmarkEventStore alloc] init];
+  PiwikTracker *tracker = [self createTrackerWithEventStore:store];
+
+  // One event reused for every call, as in a game loop
+  PiwikEvent *event = [[PiwikEvent alloc] initWithCategory:@"Player" action:@"Progress"];
+  event.name = @"benchmark";
+
+  __block NSUInteger numberOfEvents = 0;
+  [self measureMetric:@"sendEvent" numberOfEvents:PiwikBenchmarkNumberOfEvents block:^{
+    for (NSUInteger i = 0; i < PiwikBenchmarkNumberOfEvents; i++) {
+      event.value = i;
+      [tracker sendEvent:event];
+    }
+    numberOfEvents += PiwikBenchmarkNumberOfEvents;
+  }];
+
+  XCTAssertEqual(store.numberOfStoredEvents, numberOfEvents);
+
+}
+
+
+- (void)testStoreEventsThroughput {
+
+  NSDictionary *parameterSets;
+  NSArray *events = [self encodedEvents:PiwikBenchmarkNumberOfEvents parameterSets:&parameterSets];
+
+  [self measureMetric:@"storeEvents" numberOfEvents:PiwikBenchmarkNumberOfEvents block:^{
+    PiwikJournalEventStore *store = [self createJournalStore];
+    // One write per event, as with PiwikEventDurabilityEveryEvent
+    for (NSData *event in events) {
+      [store storeEvents:@[event] parameterSets:parameterSets completionBlock:nil];
+    }
+    [store waitUntilAllOperationsAreFinished];
+    [store deleteAllStoredEvents];
+    [store waitUntilAllOperationsAreFinished];
+  }];
+
+}
+
+
+// Only one measurement is allowed per test, one test per queue depth
+- (void)testEventsFromStoreAtQueueDepth100 {
+  [self measureEventsFromStoreAtQueueDepth:100];
+}
+
+
+- (void)testEventsFromStoreAtQueueDepth1000 {
+  [self measureEventsFromStoreAtQueueDepth:1000];
+}
+
+
+- (void)testEventsFromStoreAtQueueDepth10000 {
+  [self measureEventsFromStoreAtQueueDepth:10000];
+}
+
+
+- (void)measureEventsFromStoreAtQueueDepth:(NSUInteger)depth {
+
+  PiwikJournalEventStore *store = [self createJournalStore];
+
+  NSDictionary *parameterSets;
+  [store storeEvents:[self encodedEvents:depth parameterSets:&parameterSets] parameterSets:parameterSets completionBlock:nil];
+  [store waitUntilAllOperationsAreFinished];
+
+  // Read a batch from the head of the queue, as each dispatch request does
+  NSUInteger batchSize = 20;
+  [self measureMetric:[NSString stringWithFormat:@"eventsFromStore.%lu", (unsigned long)depth] numberOfEvents:batchSize block:^{
+    [store eventsFromStore:batchSize excludingEventIDs:nil completionBlock:^(NSArray *eventIDs, NSArray *events, BOOL hasMore) {
+      XCTAssertEqual(events.count, batchSize);
+    }];
+    [store waitUntilAllOperationsAreFinished];
+  }];
+
+}
+
+
+- (void)testRequestParametersSerialization {
+
+  PiwikJournalEventStore *store = [self createJournalStore];
+
+  NSUInteger batchSize = 20;
+  NSDictionary *parameterSets;
+  [store storeEvents:[self encodedEvents:batchSize parameterSets:&parameterSets] parameterSets:parameterSets completionBlock:nil];
+
+  __block NSArray *storedEvents;
+  [store eventsFromStore:batchSize excludingEventIDs:nil completionBlock:^(NSArray *eventIDs, NSArray *events, BOOL hasMore) {
+    storedEvents = events;
+  }];
+  [store waitUntilAllOperationsAreFinished];
+
+  PiwikBenchmarkDispatcher *dispatcher = [[PiwikBenchmarkDispatcher alloc] init];
+  PiwikTracker *tracker = [[PiwikTracker alloc] initWithSiteID:@"1" dispatcher:dispatcher];
+
+  __block NSUInteger numberOfEvents = 0;
+  [self measureMetric:@"requestParameters" numberOfEvents:batchSize block:^{
+    NSDictionary *requestParameters = [tracker requestParametersForEvents:storedEvents];
+    [dispatcher sendBulkEventWithParameters:requestParameters success:^{} failure:^(BOOL shouldContinue) {}];
+    numberOfEvents += storedEvents.count;
+  }];
+
+  [self reportBytes:dispatcher.numberOfBytes numberOfEvents:numberOfEvents metric:@"requestParameters"];
+
+}
+
+
+// The same batch written straight into the request body, compare with testRequestParametersSerialization
+- (void)testBulkRequestBodySerialization {
+
+  PiwikJournalEventStore *store = [self createJournalStore];
+
+  NSUInteger batchSize = 20;
+  NSDictionary *parameterSets;
+  [store storeEvents:[self encodedEvents:batchSize parameterSets:&parameterSets] parameterSets:parameterSets completionBlock:nil];
+
+  __block NSArray *storedEvents;
+  [store eventsFromStore:batchSize excludingEventIDs:nil completionBlock:^(NSArray *eventIDs, NSArray *events, BOOL hasMore) {
+    storedEvents = events;
+  }];
+  [store waitUntilAllOperationsAreFinished];
+
+  PiwikQuerySerializer *serializer = [[PiwikQuerySerializer alloc] init];
+
+  __block NSUInteger numberOfBytes = 0;
+  __block NSUInteger numberOfEvents = 0;
+  [self measureMetric:@"bulkRequestBody" numberOfEvents:batchSize block:^{
+    numberOfBytes += [serializer bulkRequestBodyWithEvents:storedEvents options:NSEnumerationReverse].length;
+    numberOfEvents += storedEvents.count;
+  }];
+
+  [self reportBytes:numberOfBytes numberOfEvents:numberOfEvents metric:@"bulkRequestBody"];
+
+  // Writing the body straight from the events must allocate less than building the query strings first
+  PiwikTracker *tracker = [[PiwikTracker alloc] initWithSiteID:@"1" dispatcher:[[PiwikBenchmarkDispatcher alloc] init]];
+  uint64_t bodyAllocations = PiwikNumberOfAllocationsDuringBlock(^{
+    @autoreleasepool {
+      [serializer bulkRequestBodyWithEvents:storedEvents options:NSEnumerationReverse];
+    }
+  });
+  uint64_t queryStringAllocations = PiwikNumberOfAllocationsDuringBlock(^{
+    @autoreleasepool {
+      [serializer bulkRequestBodyWithQueryStrings:[tracker requestParametersForEvents:storedEvents][@"requests"]];
+    }
+  });
+  XCTAssertLessThan(bodyAllocations, queryStringAllocations);
+
+}
+
+
+- (void)testJSONEncodeTransactionItems {
+
+  PiwikTracker *tracker = [[PiwikTracker alloc] initWithSiteID:@"1" dispatcher:[[PiwikBenchmarkDispatcher alloc] init]];
+
+  NSMutableArray *items = [NSMutableArray array];
+  for (NSUInteger i = 0; i < 10; i++) {
+    [items addObject:[PiwikTransactionItem itemWithSku:[NSString stringWithFormat:@"SKU%lu", (unsigned long)i]
+                                                  name:@"Product"
+                                              category:@"Category"
+                                                 price:9.99
+                                              quantity:i + 1]];
+  }
+
+  [self measureMetric:@"JSONEncodeTransactionItems" numberOfEvents:PiwikBenchmarkNumberOfEvents block:^{
+    for (NSUInteger i = 0; i < PiwikBenchmarkNumberOfEvents; i++) {
+      [tracker JSONEncodeTransactionItems:items];
+    }
+  }];
+
+}
+
+
+- (void)testJSONEncodeCustomVariables {
+
+  NSMutableDictionary *variables = [NSMutableDictionary dictionary];
+  for (NSUInteger i = 1; i <= 5; i++) {
+    variables[@(i)] = @[[NSString stringWithFormat:@"name%lu", (unsigned long)i], [NSString stringWithFormat:@"value%lu", (unsigned long)i]];
+  }
+
+  [self measureMetric:@"JSONEncodeCustomVariables" numberOfEvents:PiwikBenchmarkNumberOfEvents block:^{
+    for (NSUInteger i = 0; i < PiwikBenchmarkNumberOfEvents; i++) {
+      [PiwikTracker JSONEncodeCustomVariables:variables];
+    }
+  }];
+
+}
+
+
+// Time spent on the calling thread creating the tracker and tracking the first event, with the default Core Data store
+// The first run includes the one time costs, e.g. loading the model and the platform lookup
+- (void)testLaunchPathEagerStartup {
+  [self measureLaunchPathWithLazyStartup:NO];
+}
+
+
+- (void)testLaunchPathLazyStartup {
+  [self measureLaunchPathWithLazyStartup:YES];
+}
+
+
+- (void)measureLaunchPathWithLazyStartup:(BOOL)lazyStartup {
+
+  NSMutableArray *trackers = [NSMutableArray array];
+  [self measureMetric:(lazyStartup ? @"launch.lazy" : @"launch.eager") numberOfEvents:1 block:^{
+    PiwikTracker *tracker = [[PiwikTracker alloc] initWithSiteID:@"1" dispatcher:[[PiwikBenchmarkDispatcher alloc] init]];
+    tracker.lazyStartup = lazyStartup;
+    tracker.dispatchInterval = -1;
+    [tracker queueEvent:@{@"action_name" : @"screen/launch", @"url" : @"http://example.com/screen/launch"}];
+    [trackers addObject:tracker];
+  }];
+
+  // Let the deferred startups run when the main run loop is idle
+  [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.1]];
+
+  for (PiwikTracker *tracker in trackers) {
+    XCTAssertEqual(tracker.statistics.numberOfQueuedEvents, 1);
+    [tracker deleteQueuedEvents];
+  }
+
+}
+
+
+#pragma mark Helpers
+
+
+- (PiwikTracker*)createTrackerWithEventStore:(id<PiwikEventStore>)eventStore {
+  PiwikTracker *tracker = [[PiwikTracker alloc] initWithSiteID:@"1" dispatcher:[[PiwikBenchmarkDispatcher alloc] init]];
+  tracker.eventStore = eventStore;
+  // Manual dispatch, only measure queueing
+  tracker.dispatchInterval = -1;
+  return tracker;
+}
+
+
+- (PiwikJournalEventStore*)createJournalStore {
+  PiwikJournalEventStore *store = [[PiwikJournalEventStore alloc] initWithDirectoryURL:self.directoryURL];
+  store.maximumNumberOfEvents = NSUIntegerMax;
+  return store;
+}
+
+
+// Events with the size of a typical screen view referencing a session and a static parameter set
+- (NSArray*)encodedEvents:(NSUInteger)numberOfEvents parameterSets:(NSDictionary**)parameterSets {
+
+  NSData *sessionParameterSet = [PiwikEventEncoder dataWithParameterSet:@{@"_idvc" : @"3", @"_viewts" : @"1476428400", @"_idts" : @"1476000000"}];
+  NSData *staticParameterSet = [PiwikEventEncoder dataWithParameterSet:@{@"idsite" : @"1", @"rec" : @"1", @"apiv" : @"1", @"_id" : @"0123456789abcdef", @"res" : @"750x1334"}];
+  NSArray *parameterSetIDs = @[[PiwikEventEncoder identifierForParameterSet:sessionParameterSet], [PiwikEventEncoder identifierForParameterSet:staticParameterSet]];
+  *parameterSets = @{parameterSetIDs[0] : sessionParameterSet, parameterSetIDs[1] : staticParameterSet};
+
+  NSMutableArray *events = [NSMutableArray arrayWithCapacity:numberOfEvents];
+  for (NSUInteger i = 0; i < numberOfEvents; i++) {
+    NSDictionary *parameters = @{@"action_name" : [NSString stringWithFormat:@"screen/benchmark/%lu", (unsigned long)i],
+                                 @"url" : [NSString stringWithFormat:@"http://example.com/screen/benchmark/%lu", (unsigned long)i],
+                                 @"h" : @"9", @"m" : @"5", @"s" : @"9", @"cdt" : @"2016-10-14 07:05:09", @"r" : @"12345"};
+    [events addObject:[PiwikEventEncoder dataWithParameters:parameters parameterSetIDs:parameterSetIDs]];
+  }
+
+  return events;
+}
+
+
+// Measure the time with measureBlock: and the events per second and allocations per event of the first run
+- (void)measureMetric:(NSString*)metric numberOfEvents:(NSUInteger)numberOfEvents block:(void (^)(void))block {
+
+  __block BOOL isFirstRun = YES;
+  [self measureBlock:^{
+
+    if (!isFirstRun) {
+      block();
+      return;
+    }
+    isFirstRun = NO;
+
+    __block CFAbsoluteTime duration = 0;
+    uint64_t numberOfAllocations = PiwikNumberOfAllocationsDuringBlock(^{
+      // Including the autoreleased objects
+      @autoreleasepool {
+        CFAbsoluteTime start = CFAbsoluteTimeGetCurrent();
+        block();
+        duration = CFAbsoluteTimeGetCurrent() - start;
+      }
+    });
+
+    [self reportValue:numberOfEvents / MAX(duration, DBL_EPSILON) metric:[metric stringByAppendingString:@".eventsPerSecond"] unit:@"events/s"];
+    [self reportValue:numberOfAllocations / (double)numberOfEvents metric:[metric stringByAppendingString:@".allocationsPerEvent"] unit:@"allocations"];
+
+  }];
+
+}
+
+
+- (void)reportBytes:(NSUInteger)numberOfBytes numberOfEvents:(NSUInteger)numberOfEvents metric:(NSString*)metric {
+  [self reportValue:numberOfBytes / (double)MAX(numberOfEvents, 1) metric:[metric stringByAppendingString:@".bytesPerEvent"] unit:@"bytes"];
+}
+
+
+// Compare with the stored baseline, throughput is only reported
+- (void)reportValue:(double)value metric:(NSString*)metric unit:(NSString*)unit {
+
+  NSDictionary *baseline = self.baselines[metric];
+  if (!baseline) {
+    NSLog(@"[Piwik] Benchmark %@: %.2f %@, no baseline", metric, value, unit);
+    return;
+  }
+
+  double baselineValue = [baseline[@"value"] doubleValue];
+  double tolerance = [baseline[@"tolerance"] doubleValue];
+  NSLog(@"[Piwik] Benchmark %@: %.2f %@, baseline %.2f", metric, value, unit, baselineValue);
+
+  if (![metric hasSuffix:@".eventsPerSecond"]) {
+    XCTAssertLessThanOrEqual(value, baselineValue * (1 + tolerance), @"%@ regressed from the baseline", metric);
+  }
+
+}
+
+
+@end
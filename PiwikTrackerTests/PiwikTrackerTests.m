@@ -8,6 +8,18 @@
 
 #import <UIKit/UIKit.h>
 #import <XCTest/XCTest.h>
+#import "PiwikTracker.h"
+#import "PiwikDebugDispatcher.h"
+#import "PiwikJournalEventStore.h"
+
+
+@interface PiwikTracker (Tests)
+- (id)initWithSiteID:(NSString*)siteID dispatcher:(id<PiwikDispatcher>)dispatcher;
++ (PiwikEventType)eventTypeOfParameters:(NSDictionary*)parameters;
+- (BOOL)isVisitorSampledAtRate:(NSUInteger)sampleRate;
+- (void)performBlockOnTrackerQueueAndWait:(void (^)(void))block;
+@end
+
 
 @interface PiwikTrackerTests : XCTestCase
 
@@ -33,4 +45,122 @@
 }
 
 
+- (void)testSampleRateForEventType {
+  
+  PiwikTracker *tracker = [[PiwikTracker alloc] initWithSiteID:@"1" dispatcher:[[PiwikDebugDispatcher alloc] init]];
+  tracker.dispatchInterval = -1;
+  tracker.sampleRate = 20;
+  
+  // Goals and transactions are only sampled when set explicitly
+  XCTAssertEqual([tracker sampleRateForEventType:PiwikEventTypeScreenView], 20);
+  XCTAssertEqual([tracker sampleRateForEventType:PiwikEventTypeGoal], 100);
+  XCTAssertEqual([tracker sampleRateForEventType:PiwikEventTypeEcommerce], 100);
+  
+  [tracker setSampleRate:50 forEventType:PiwikEventTypeGoal];
+  [tracker setSampleRate:150 forEventType:PiwikEventTypeEvent];
+  XCTAssertEqual([tracker sampleRateForEventType:PiwikEventTypeGoal], 50);
+  XCTAssertEqual([tracker sampleRateForEventType:PiwikEventTypeEvent], 100);
+  
+}
+
+
+// The client ID is normally read from the user defaults, set it directly to get a known sample bucket
+- (PiwikTracker*)trackerWithClientID:(NSString*)clientID {
+  PiwikTracker *tracker = [[PiwikTracker alloc] initWithSiteID:@"1" dispatcher:[[PiwikDebugDispatcher alloc] init]];
+  tracker.dispatchInterval = -1;
+  [tracker setValue:clientID forKey:@"clientID"];
+  return tracker;
+}
+
+
+- (BOOL)tracker:(PiwikTracker*)tracker isVisitorSampledAtRate:(NSUInteger)sampleRate {
+  __block BOOL isSampled;
+  [tracker performBlockOnTrackerQueueAndWait:^{
+    isSampled = [tracker isVisitorSampledAtRate:sampleRate];
+  }];
+  return isSampled;
+}
+
+
+- (void)testVisitorSamplingIsDeterministic {
+  
+  // md5("5bb8a7c2e4c1e1f5") starts with ef71a45b, sample bucket 67
+  PiwikTracker *tracker = [self trackerWithClientID:@"5bb8a7c2e4c1e1f5"];
+  PiwikTracker *otherTracker = [self trackerWithClientID:@"5bb8a7c2e4c1e1f5"];
+  
+  XCTAssertFalse([self tracker:tracker isVisitorSampledAtRate:67]);
+  XCTAssertTrue([self tracker:tracker isVisitorSampledAtRate:68]);
+  
+  // The same visitor is always in or out of the sample for a rate
+  for (NSUInteger sampleRate = 1; sampleRate < 100; sampleRate++) {
+    BOOL isSampled = [self tracker:tracker isVisitorSampledAtRate:sampleRate];
+    XCTAssertEqual([self tracker:tracker isVisitorSampledAtRate:sampleRate], isSampled);
+    XCTAssertEqual([self tracker:otherTracker isVisitorSampledAtRate:sampleRate], isSampled);
+    XCTAssertEqual(isSampled, sampleRate > 67);
+  }
+  
+}
+
+
+- (void)testVisitorSamplingAtZeroAndHundred {
+  
+  // Sample buckets 67 and 30
+  for (NSString *clientID in @[@"5bb8a7c2e4c1e1f5", @"0c6a8b1e6f0e3d21"]) {
+    PiwikTracker *tracker = [self trackerWithClientID:clientID];
+    XCTAssertFalse([self tracker:tracker isVisitorSampledAtRate:0]);
+    XCTAssertTrue([self tracker:tracker isVisitorSampledAtRate:100]);
+  }
+  
+}
+
+
+- (void)testGoalsAndTransactionsBypassSampling {
+  
+  PiwikTracker *tracker = [self trackerWithClientID:@"0c6a8b1e6f0e3d21"];
+  tracker.sampleRate = 0;
+  
+  NSUInteger (^sampleRate)(NSDictionary*) = ^NSUInteger(NSDictionary *parameters) {
+    return [tracker sampleRateForEventType:[PiwikTracker eventTypeOfParameters:parameters]];
+  };
+  
+  XCTAssertFalse([self tracker:tracker isVisitorSampledAtRate:sampleRate(@{@"action_name" : @"view"})]);
+  XCTAssertFalse([self tracker:tracker isVisitorSampledAtRate:sampleRate(@{@"e_c" : @"category"})]);
+  XCTAssertTrue([self tracker:tracker isVisitorSampledAtRate:sampleRate(@{@"idgoal" : @"1"})]);
+  XCTAssertTrue([self tracker:tracker isVisitorSampledAtRate:sampleRate(@{@"ec_id" : @"order"})]);
+  
+  // Only an outsampled view is dropped
+  [tracker sendView:@"outsampled"];
+  [tracker sendGoalWithID:1 revenue:10];
+  XCTAssertEqual([tracker.statistics numberOfDroppedEventsWithReason:PiwikEventDropReasonSampling], 1);
+  
+}
+
+
+- (void)testStatisticsWhileStartupIsPending {
+  
+  NSURL *directoryURL = [[NSURL fileURLWithPath:NSTemporaryDirectory()] URLByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+  
+  PiwikTracker *tracker = [[PiwikTracker alloc] initWithSiteID:@"1" dispatcher:[[PiwikDebugDispatcher alloc] init]];
+  tracker.eventStore = [[PiwikJournalEventStore alloc] initWithDirectoryURL:directoryURL];
+  tracker.dispatchInterval = -1;
+  tracker.lazyStartup = YES;
+  [tracker sendView:@"pending"];
+  
+  // The startup runs from the main run loop, reading the statistics on the main thread must not wait for it
+  XCTAssertTrue([NSThread isMainThread]);
+  XCTAssertNotNil(tracker.statistics);
+  XCTAssertNotNil(tracker.dispatchStatistics);
+  
+  // The event is stored once the startup has finished
+  NSDate *timeout = [NSDate dateWithTimeIntervalSinceNow:5];
+  while (tracker.statistics.numberOfQueuedEvents == 0 && [timeout timeIntervalSinceNow] > 0) {
+    [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:0.05]];
+  }
+  XCTAssertEqual(tracker.statistics.numberOfQueuedEvents, 1);
+  
+  [[NSFileManager defaultManager] removeItemAtURL:directoryURL error:nil];
+  
+}
+
+
 @end
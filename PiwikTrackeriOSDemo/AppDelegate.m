@@ -44,6 +44,7 @@ static NSString * const PiwikProductionSiteID = @"23";
 //  }
   
 //  [PiwikTracker sharedInstance].sampleRate = 50;
+//  [[PiwikTracker sharedInstance] setSampleRate:100 forEventType:PiwikEventTypeEvent];
 //  [PiwikTracker sharedInstance].eventsPerRequest = 2;
   
   // Do not track anything until the user give consent